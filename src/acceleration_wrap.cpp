@@ -2,6 +2,11 @@
 #include "acceleration_wrap.h"
 #include "vkapp.h"
 #include <numeric>
+#include <cfloat>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include "thread_pool.h"
 
 //--------------------------------------------------------------------------------------------------
 // Initializing the allocator and querying the raytracing properties
@@ -13,6 +18,12 @@ void RaytracingBuilderKHR::setup(VkApp* _VK, const VkDevice& device, uint32_t qu
     //printf("RaytracingBuilderKHR::setup (3)\n");
     m_device     = device;
     m_queueIndex = queueIndex;
+
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR};
+    VkPhysicalDeviceProperties2 properties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, &asProperties};
+    vkGetPhysicalDeviceProperties2(VK->m_physicalDevice, &properties);
+    m_scratchAlignment = std::max<VkDeviceSize>(1, asProperties.minAccelerationStructureScratchOffsetAlignment);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -27,6 +38,13 @@ void RaytracingBuilderKHR::destroy()
     
     m_tlas.bw.destroy(VK->m_device);
     vkDestroyAccelerationStructureKHR(VK->m_device, m_tlas.accel, nullptr);
+    if (m_instanceBuffer.buffer)
+        m_instanceBuffer.destroy(VK->m_device);
+    if (m_tlasScratch.buffer)
+        m_tlasScratch.destroy(VK->m_device);
+    if (m_blasScratch.buffer)
+        m_blasScratch.destroy(VK->m_device);
+    m_deforming.clear();
 
     m_blas.clear();
 }
@@ -58,16 +76,19 @@ VkDeviceAddress RaytracingBuilderKHR::getBlasDeviceAddress(uint32_t blasId)
 // - There will be as many BLAS as input.size()
 // - The resulting BLAS (along with the inputs used to build) are stored in m_blas,
 //   and can be referenced by index.
-// - if flag has the 'Compact' flag, the BLAS will be compacted
+// - if flag (or the input's flags) has the 'Compact' flag, the BLAS will be compacted
+// - BLAS with a non-zero cacheKey (a hash of its geometry) are loaded
+//   from VK->m_asCache if there, and stored there once built
+// - inputs with onHost set are built on the CPU (see buildBlasOnHost)
 //
 void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
-                                     VkBuildAccelerationStructureFlagsKHR flags)
+                                     VkBuildAccelerationStructureFlagsKHR flags,
+                                     const std::vector<uint64_t>& cacheKeys)
 {
     //printf("RaytracingBuilderKHR::buildBlas (110)\n");
     auto         nbBlas = static_cast<uint32_t>(input.size());
     VkDeviceSize asTotalSize{0};     // Memory size of all allocated BLAS
     uint32_t     nbCompactions{0};   // Nb of BLAS requesting compaction
-    VkDeviceSize maxScratchSize{0};  // Largest scratch size
 
     // Preparing the information for the acceleration build commands.
     std::vector<BuildAccelerationStructure> buildAs(nbBlas);
@@ -89,68 +110,172 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
             for(auto tt = 0; tt < input[idx].asBuildOffsetInfo.size(); tt++)
                 maxPrimCount[tt] = input[idx].asBuildOffsetInfo[tt].primitiveCount; //# of triangles
             vkGetAccelerationStructureBuildSizesKHR(m_device,
-                                                    VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+                                                    input[idx].onHost
+                                                    ? VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR
+                                                    : VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
                                                     &buildAs[idx].buildInfo, maxPrimCount.data(),
                                                     &buildAs[idx].sizeInfo);
 
             // Extra info
             asTotalSize += buildAs[idx].sizeInfo.accelerationStructureSize;
-            maxScratchSize = max(maxScratchSize, buildAs[idx].sizeInfo.buildScratchSize);
             nbCompactions += hasFlag(buildAs[idx].buildInfo.flags,
                                      VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
         }
 
+    // Cached BLAS need no build.  The key covers the build flags too.
+    std::vector<uint64_t> keys(nbBlas, 0);
+    std::vector<bool>     loaded(nbBlas, false);
+    for(uint32_t idx = 0; idx < nbBlas && !cacheKeys.empty(); idx++)
+        {
+            if(cacheKeys[idx] == 0)
+                continue;
+            keys[idx]   = hashBytes(&buildAs[idx].buildInfo.flags, sizeof(buildAs[idx].buildInfo.flags),
+                                    cacheKeys[idx]);
+            loaded[idx] = VK->m_asCache.load(keys[idx], buildAs[idx].as);
+        }
+
+    // Host geometry is built right away, on the CPU.
+    std::vector<uint32_t> hostIndices;
+    for(uint32_t idx = 0; idx < nbBlas; idx++)
+        if(input[idx].onHost && !loaded[idx])
+            hostIndices.push_back(idx);
+    buildBlasOnHost(hostIndices, buildAs);
+
+    // Batching creation/compaction of BLAS to allow staying in
+    // restricted amount of memory.  A batch is built by a single
+    // command, each BLAS with its own aligned range of the scratch
+    // buffer, so the builds can run in parallel; the limit caps both
+    // the batch's acceleration structures and its scratch.
+    std::vector<std::vector<uint32_t>> batches;
+    std::vector<VkDeviceSize>          scratchOffsets(nbBlas);
+    VkDeviceSize          batchScratch{0};  // Largest batch's scratch
+    VkDeviceSize          batchLimit{256'000'000};  // 256 MB
+    {
+        std::vector<uint32_t> indices;  // Indices of the BLAS to create
+        VkDeviceSize          batchSize{0}, scratchSize{0};
+        for(uint32_t idx = 0; idx < nbBlas; idx++)
+            {
+                if(loaded[idx] || input[idx].onHost)
+                    continue;
+                VkDeviceSize scratch = (buildAs[idx].sizeInfo.buildScratchSize + m_scratchAlignment - 1)
+                    / m_scratchAlignment * m_scratchAlignment;
+                if(!indices.empty() && scratchSize + scratch > batchLimit)
+                    {
+                        batches.push_back(indices);
+                        batchSize = scratchSize = 0;
+                        indices.clear();
+                    }
+                indices.push_back(idx);
+                scratchOffsets[idx] = scratchSize;
+                scratchSize  += scratch;
+                batchSize    += buildAs[idx].sizeInfo.accelerationStructureSize;
+                batchScratch  = std::max(batchScratch, scratchSize);
+                // Over the limit
+                if(batchSize >= batchLimit)
+                    {
+                        batches.push_back(indices);
+                        batchSize = scratchSize = 0;
+                        indices.clear();
+                    }
+            }
+        if(!indices.empty())  // The last BLAS elements
+            batches.push_back(indices);
+    }
+
     // Allocate the scratch buffers holding the temporary data of the acceleration structure builder
-    VK->m_scratch1 = VK->createBufferWrap(maxScratchSize,
+    VK->m_scratch1 = VK->createBufferWrap(batchScratch + m_scratchAlignment,
                                     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
                                     | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
     NAME(VK->m_scratch1.buffer, VK_OBJECT_TYPE_BUFFER, "buildBlas scratch buffer");
   
     VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
         nullptr, VK->m_scratch1.buffer};
     VkDeviceAddress           scratchAddress = vkGetBufferDeviceAddress(m_device, &bufferInfo);
+    scratchAddress = (scratchAddress + m_scratchAlignment - 1) / m_scratchAlignment * m_scratchAlignment;
+    for(uint32_t idx = 0; idx < nbBlas; idx++)
+        buildAs[idx].buildInfo.scratchData.deviceAddress = scratchAddress + scratchOffsets[idx];
 
     // Allocate a query pool for storing the needed size for every BLAS compaction.
     VkQueryPool queryPool{VK_NULL_HANDLE};
     if(nbCompactions > 0)  // Is compaction requested?
         {
-            assert(nbCompactions == nbBlas);  // Don't allow mix of on/off compaction
             VkQueryPoolCreateInfo qpci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
             qpci.queryCount = nbBlas;
             qpci.queryType  = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
             vkCreateQueryPool(m_device, &qpci, nullptr, &queryPool);
         }
 
-    // Batching creation/compaction of BLAS to allow staying in restricted amount of memory
-    std::vector<uint32_t> indices;  // Indices of the BLAS to create
-    VkDeviceSize          batchSize{0};
-    VkDeviceSize          batchLimit{256'000'000};  // 256 MB
-    for(uint32_t idx = 0; idx < nbBlas; idx++)
+    // Two timestamps (begin, end) per batch, read once the batch has run.
+    VkQueryPool timestampPool{VK_NULL_HANDLE};
+    VkQueryPoolCreateInfo tqci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    tqci.queryCount = 2 * static_cast<uint32_t>(batches.size());
+    tqci.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    if(!batches.empty())
+        vkCreateQueryPool(m_device, &tqci, nullptr, &timestampPool);
+
+    std::vector<uint64_t>                   storeKeys;
+    std::vector<VkAccelerationStructureKHR> storeAccels;
+    for(auto idx : hostIndices)
+        if(keys[idx])
+            {
+                storeKeys.push_back(keys[idx]);
+                storeAccels.push_back(buildAs[idx].as.accel);
+            }
+    for(uint32_t b = 0; b < batches.size(); b++)
         {
-            indices.push_back(idx);
-            batchSize += buildAs[idx].sizeInfo.accelerationStructureSize;
-            // Over the limit or last BLAS element
-            if(batchSize >= batchLimit || idx == nbBlas - 1)
+            const std::vector<uint32_t>& indices = batches[b];
+            std::vector<uint32_t>        compacting;
+            for(auto idx : indices)
+                if(hasFlag(buildAs[idx].buildInfo.flags, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR))
+                    compacting.push_back(idx);
+            VkCommandBuffer cmdBuf = VK->createTempCmdBuffer();
+            vkCmdResetQueryPool(cmdBuf, timestampPool, 2 * b, 2);
+            vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, 2 * b);
+            cmdCreateBlas(cmdBuf, indices, buildAs, queryPool);
+            vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                timestampPool, 2 * b + 1);
+            VK->submitTempCmdBuffer(cmdBuf);
+
+            if (!compacting.empty())
                 {
+                    // The compacted sizes are read on the CPU.
+                    VK->m_batch.flush();
                     VkCommandBuffer cmdBuf = VK->createTempCmdBuffer();
-                    cmdCreateBlas(cmdBuf, indices, buildAs, scratchAddress, queryPool);
+                    cmdCompactBlas(cmdBuf, compacting, buildAs, queryPool);
                     VK->submitTempCmdBuffer(cmdBuf);
 
-                    if (queryPool)
-                        {
-                            VkCommandBuffer cmdBuf = VK->createTempCmdBuffer();
-                            cmdCompactBlas(cmdBuf, indices, buildAs, queryPool);
-                            VK->submitTempCmdBuffer(cmdBuf);
+                    // Destroy the non-compacted version, once copied
+                    VK->m_batch.flush();
+                    destroyNonCompacted(compacting, buildAs);
+                }
 
-                            // Destroy the non-compacted version
-                            destroyNonCompacted(indices, buildAs);
-                        }
-                    // Reset
+            for(auto idx : indices)
+                if(keys[idx])
+                    {
+                        storeKeys.push_back(keys[idx]);
+                        storeAccels.push_back(buildAs[idx].as.accel);
+                    }
+        }
+    VK->m_asCache.store(storeKeys, storeAccels);
 
-                    batchSize = 0;
-                    indices.clear();
-                }
+    // Report each batch's GPU time once it has run.
+    if(timestampPool)
+        {
+            std::vector<uint32_t> batchCounts;
+            for(const auto& indices : batches)
+                batchCounts.push_back(static_cast<uint32_t>(indices.size()));
+            VkDevice device = m_device;
+            float    msPerTick = VK->m_timestampPeriod * 1e-6f;
+            VK->m_batch.destroyAfterFlush([device, timestampPool, batchCounts, msPerTick]() {
+                std::vector<uint64_t> ticks(2 * batchCounts.size());
+                if (vkGetQueryPoolResults(device, timestampPool, 0, (uint32_t)ticks.size(),
+                                          ticks.size() * sizeof(uint64_t), ticks.data(), sizeof(uint64_t),
+                                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS)
+                    for (size_t b = 0;  b < batchCounts.size();  b++)
+                        printf("BLAS batch %zd: %u builds in %.2f ms\n", b, batchCounts[b],
+                               (ticks[2*b+1] - ticks[2*b]) * msPerTick);
+                vkDestroyQueryPool(device, timestampPool, nullptr); });
         }
 
     // Logging reduction
@@ -159,6 +284,8 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
             VkDeviceSize compactSize = std::accumulate(buildAs.begin(), buildAs.end(), 0ULL, [](const auto& a, const auto& b) {
                 return a + b.sizeInfo.accelerationStructureSize;
             });
+            printf("BLAS compaction: %.1f MB -> %.1f MB\n",
+                   asTotalSize / (1024.0 * 1024.0), compactSize / (1024.0 * 1024.0));
         }
 
     // Keeping all the created acceleration structures
@@ -173,15 +300,19 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
 }
 
 WrapAccelerationStructure createAcceleration(VkApp* VK,
-                                              VkAccelerationStructureCreateInfoKHR& accel_)
+                                              VkAccelerationStructureCreateInfoKHR& accel_,
+                                              bool hostVisible)
 {
     //printf("createAcceleration (6)\n");
     WrapAccelerationStructure result;
-    // Allocating the buffer to hold the acceleration structure
+    // Allocating the buffer to hold the acceleration structure.  Host
+    // commands need it in host visible memory.
     result.bw = VK->createBufferWrap(accel_.size,
                                      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR
                                      | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                                     hostVisible
+                                     ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                                     : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     // Create the acceleration structure
     accel_.buffer = result.bw.buffer;
@@ -193,18 +324,17 @@ WrapAccelerationStructure createAcceleration(VkApp* VK,
 // Creating the bottom level acceleration structure for all indices of `buildAs` vector.
 // The array of BuildAccelerationStructure was created in buildBlas and the vector of
 // indices limits the number of BLAS to create at once. This limits the amount of
-// memory needed when compacting the BLAS.
+// memory needed when compacting the BLAS.  Each build has its own range of
+// scratch (set in buildBlas), so all are recorded into one build command.
 void RaytracingBuilderKHR::cmdCreateBlas(VkCommandBuffer                          cmdBuf,
                                          std::vector<uint32_t>                    indices,
                                          std::vector<BuildAccelerationStructure>& buildAs,
-                                         VkDeviceAddress                          scratchAddress,
                                          VkQueryPool                              queryPool)
 {
     //printf("RaytracingBuilderKHR::cmdCreateBlas (40)\n");
-    if(queryPool)  // For querying the compaction size
-        vkResetQueryPool(m_device, queryPool, 0, static_cast<uint32_t>(indices.size()));
-    uint32_t queryCnt{0};
-
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR>     buildInfos;
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos;
+    std::vector<VkAccelerationStructureKHR>                      compacting;
     for(const auto& idx : indices)
         {
             // Actual allocation of buffer and acceleration structure.
@@ -217,16 +347,21 @@ void RaytracingBuilderKHR::cmdCreateBlas(VkCommandBuffer
             // BuildInfo #2 part
             // Setting where the build lands
             buildAs[idx].buildInfo.dstAccelerationStructure  = buildAs[idx].as.accel;
-            // All build use the same scratch buffer
-            buildAs[idx].buildInfo.scratchData.deviceAddress = scratchAddress;
+            buildInfos.push_back(buildAs[idx].buildInfo);
+            rangeInfos.push_back(buildAs[idx].rangeInfo);
+            if(hasFlag(buildAs[idx].buildInfo.flags, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR))
+                compacting.push_back(buildAs[idx].as.accel);
+        }
 
-            // Building the bottom-level-acceleration-structure
-            vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildAs[idx].buildInfo,
-                                                &buildAs[idx].rangeInfo);
+    // Building the bottom-level-acceleration-structures
+    vkCmdBuildAccelerationStructuresKHR(cmdBuf, static_cast<uint32_t>(buildInfos.size()),
+                                        buildInfos.data(), rangeInfos.data());
 
-            // Since the scratch buffer is reused across builds, we
-            // need a barrier to ensure one build is finished before
-            // starting the next one.
+    if(!compacting.empty())  // For querying the compaction size
+        {
+            vkResetQueryPool(m_device, queryPool, 0, static_cast<uint32_t>(compacting.size()));
+
+            // The builds must be finished before their sizes are queried.
             VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
             barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
             barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
@@ -234,14 +369,10 @@ void RaytracingBuilderKHR::cmdCreateBlas(VkCommandBuffer
                                  VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
                                  0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-            if(queryPool)
-                {
-                    // Add a query to find the 'real' amount of memory needed, use for compaction
-                    vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuf, 1,
-                               &buildAs[idx].buildInfo.dstAccelerationStructure,
-                               VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
-                               queryPool, queryCnt++);
-                }
+            // Add a query to find the 'real' amount of memory needed, use for compaction
+            vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuf, static_cast<uint32_t>(compacting.size()),
+                       compacting.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                       queryPool, 0);
         }
 }
 
@@ -264,6 +395,7 @@ void RaytracingBuilderKHR::cmdCompactBlas(VkCommandBuffer
     for(auto idx : indices)
         {
             buildAs[idx].cleanupAS                          = buildAs[idx].as.accel;           // previous AS to destroy
+            buildAs[idx].cleanupBw                          = buildAs[idx].as.bw;              //   and its buffer
             buildAs[idx].sizeInfo.accelerationStructureSize = compactSizes[queryCtn++];  // new reduced size
 
             // Creating a compact version of the AS
@@ -281,6 +413,118 @@ void RaytracingBuilderKHR::cmdCompactBlas(VkCommandBuffer
         }
 }
 
+//--------------------------------------------------------------------------------------------------
+// Run a host command as a deferred operation, joined by as many
+// threads as the operation can use (at most one per core).
+//
+static VkResult runDeferred(VkDevice device, const std::function<VkResult(VkDeferredOperationKHR)>& command)
+{
+    VkDeferredOperationKHR operation;
+    if(vkCreateDeferredOperationKHR(device, nullptr, &operation) != VK_SUCCESS)
+        return command(VK_NULL_HANDLE);
+
+    VkResult result = command(operation);
+    if(result == VK_OPERATION_DEFERRED_KHR)
+        {
+            uint32_t concurrency = vkGetDeferredOperationMaxConcurrencyKHR(device, operation);
+            uint32_t threads = std::max(1u, std::min(concurrency, std::thread::hardware_concurrency()));
+            ThreadPool            pool(threads);
+            ThreadPool::TaskGroup group;
+            for(uint32_t t = 0; t < threads; t++)
+                pool.run(group, [device, operation]() {
+                    // IDLE: no work for now, but more may come.
+                    while(vkDeferredOperationJoinKHR(device, operation) == VK_THREAD_IDLE_KHR)
+                        std::this_thread::yield();
+                });
+            pool.wait(group);
+            // DONE only means no more work for that thread.
+            while((result = vkGetDeferredOperationResultKHR(device, operation)) == VK_NOT_READY)
+                std::this_thread::yield();
+        }
+    else if(result == VK_OPERATION_NOT_DEFERRED_KHR)
+        result = VK_SUCCESS;
+    vkDestroyDeferredOperationKHR(device, operation, nullptr);
+    return result;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Build the BLAS of host geometry (VK->m_hostAsBuilds) on the CPU with
+// vkBuildAccelerationStructuresKHR, spread over worker threads by a
+// deferred operation, then compact them on the host too.  They live in
+// host visible memory, and are used by the device like any other.
+//
+void RaytracingBuilderKHR::buildBlasOnHost(const std::vector<uint32_t>&             indices,
+                                           std::vector<BuildAccelerationStructure>& buildAs)
+{
+    if(indices.empty())
+        return;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::vector<char>>                               scratch(indices.size());
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR>     buildInfos;
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos;
+    for(size_t i = 0; i < indices.size(); i++)
+        {
+            BuildAccelerationStructure& build = buildAs[indices[i]];
+            VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+            createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+            createInfo.size = build.sizeInfo.accelerationStructureSize;
+            build.as = createAcceleration(VK, createInfo, true);
+
+            scratch[i].resize(build.sizeInfo.buildScratchSize);
+            build.buildInfo.scratchData.hostAddress = scratch[i].data();
+            build.buildInfo.dstAccelerationStructure = build.as.accel;
+            buildInfos.push_back(build.buildInfo);
+            rangeInfos.push_back(build.rangeInfo);
+        }
+
+    VkResult result = runDeferred(m_device, [&](VkDeferredOperationKHR operation) {
+        return vkBuildAccelerationStructuresKHR(m_device, operation, static_cast<uint32_t>(buildInfos.size()),
+                                                buildInfos.data(), rangeInfos.data());
+    });
+    if(result != VK_SUCCESS)
+        throw std::runtime_error("host acceleration structure build failed!");
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    // Compaction: the sizes are written straight to host memory.
+    std::vector<uint32_t>                   compacting;
+    std::vector<VkAccelerationStructureKHR> accels;
+    for(auto idx : indices)
+        if(hasFlag(buildAs[idx].buildInfo.flags, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR))
+            {
+                compacting.push_back(idx);
+                accels.push_back(buildAs[idx].as.accel);
+            }
+    std::vector<VkDeviceSize> compactSizes(compacting.size());
+    if(!compacting.empty())
+        vkWriteAccelerationStructuresPropertiesKHR(m_device, static_cast<uint32_t>(accels.size()), accels.data(),
+                                                   VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                                                   compactSizes.size() * sizeof(VkDeviceSize), compactSizes.data(),
+                                                   sizeof(VkDeviceSize));
+    for(size_t i = 0; i < compacting.size(); i++)
+        {
+            BuildAccelerationStructure& build = buildAs[compacting[i]];
+            WrapAccelerationStructure   built = build.as;
+            build.sizeInfo.accelerationStructureSize = compactSizes[i];
+
+            VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+            createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+            createInfo.size = compactSizes[i];
+            build.as = createAcceleration(VK, createInfo, true);
+
+            VkCopyAccelerationStructureInfoKHR copyInfo{VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR};
+            copyInfo.src  = built.accel;
+            copyInfo.dst  = build.as.accel;
+            copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+            vkCopyAccelerationStructureKHR(m_device, VK_NULL_HANDLE, &copyInfo);
+            vkDestroyAccelerationStructureKHR(m_device, built.accel, nullptr);
+            built.bw.destroy(m_device);
+        }
+
+    printf("BLAS host builds: %zd in %.2f ms (%.2f ms with compaction)\n", indices.size(), buildMs,
+           std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+}
+
 //--------------------------------------------------------------------------------------------------
 // Destroy all the non-compacted acceleration structures
 //
@@ -290,6 +534,7 @@ void RaytracingBuilderKHR::destroyNonCompacted(std::vector<uint32_t> indices, st
     for(auto& i : indices)
         {
             vkDestroyAccelerationStructureKHR(VK->m_device, buildAs[i].cleanupAS, nullptr);
+            buildAs[i].cleanupBw.destroy(VK->m_device);
         }
 }
 
@@ -316,6 +561,8 @@ void RaytracingBuilderKHR::cmdCreateTlas(VkCommandBuffer                      cm
     // Find sizes
     VkAccelerationStructureBuildGeometryInfoKHR buildInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
     buildInfo.flags         = flags;
+    if (motion)
+        buildInfo.flags |= VK_BUILD_ACCELERATION_STRUCTURE_MOTION_BIT_NV;
     buildInfo.geometryCount = 1;
     buildInfo.pGeometries   = &topASGeometry;
     buildInfo.mode = update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
@@ -326,31 +573,31 @@ void RaytracingBuilderKHR::cmdCreateTlas(VkCommandBuffer                      cm
     vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo,
                                             &countInstance, &sizeInfo);
 
-    // Create TLAS
-    if(update == false)
+    // Create the TLAS once.  Later full builds (of no more instances,
+    // so no larger) go into the same memory, and keep the handle that
+    // the descriptor set holds.
+    if(m_tlas.accel == VK_NULL_HANDLE)
         {
+            assert(!update);
+            VkAccelerationStructureMotionInfoNV motionInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MOTION_INFO_NV};
+            motionInfo.maxInstances = countInstance;
 
             VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
             createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
             createInfo.size = sizeInfo.accelerationStructureSize;
+            if (motion) {
+                createInfo.createFlags = VK_ACCELERATION_STRUCTURE_CREATE_MOTION_BIT_NV;
+                createInfo.pNext = &motionInfo; }
             m_tlas = createAcceleration(VK, createInfo);
         }
 
-    // Allocate the scratch memory
-    VK->m_scratch2 = VK->createBufferWrap(sizeInfo.buildScratchSize,
-                                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-                                              | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    NAME(VK->m_scratch2.buffer, VK_OBJECT_TYPE_BUFFER, "cmdCreateTlas scratch buffer");
-
-    VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-        nullptr, VK->m_scratch2.buffer};
-    VkDeviceAddress scratchAddress = vkGetBufferDeviceAddress(m_device, &bufferInfo);
+    // Scratch for both full builds and refits, kept from call to call
+    VkDeviceSize scratchSize = std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize);
 
     // Update build information
     buildInfo.srcAccelerationStructure  = update ? m_tlas.accel : VK_NULL_HANDLE;
     buildInfo.dstAccelerationStructure  = m_tlas.accel;
-    buildInfo.scratchData.deviceAddress = scratchAddress;
+    buildInfo.scratchData.deviceAddress = scratchAddress(scratchSize);
 
     // Build Offsets info: n instances
     VkAccelerationStructureBuildRangeInfoKHR        buildOffsetInfo{countInstance, 0, 0, 0};
@@ -358,129 +605,308 @@ void RaytracingBuilderKHR::cmdCreateTlas(VkCommandBuffer                      cm
 
     // Build the TLAS
     vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildInfo, &pBuildOffsetInfo);
-    //scratch.destroy(VK->m_device);
+}
+
+// The persistent TLAS scratch buffer's (aligned) device address,
+// (re)allocating it if it is smaller than size.  Only grows during
+// buildTlas, whose submit is waited on before any frame's refit.
+VkDeviceAddress RaytracingBuilderKHR::scratchAddress(VkDeviceSize size)
+{
+    if (size > m_tlasScratchSize)
+        {
+            if (m_tlasScratch.buffer)
+                {
+                    VkDevice device = VK->m_device;
+                    VK->m_batch.destroyAfterFlush([device, old = m_tlasScratch]() mutable {
+                        old.destroy(device); });
+                }
+            m_tlasScratchSize = size;
+            m_tlasScratch = VK->createBufferWrap(size + m_scratchAlignment,
+                                                 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                                 | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            NAME(m_tlasScratch.buffer, VK_OBJECT_TYPE_BUFFER, "TLAS scratch buffer");
+        }
+
+    VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        nullptr, m_tlasScratch.buffer};
+    VkDeviceAddress address = vkGetBufferDeviceAddress(m_device, &bufferInfo);
+    return (address + m_scratchAlignment - 1) / m_scratchAlignment * m_scratchAlignment;
 }
 
 //--------------------------------------------------------------------------------------------------
-// Refit BLAS number blasIdx from updated buffer contents.
+// Deforming BLASes: one scratch buffer, sized for the larger of a
+// build and a refit of each, split into aligned ranges so that all
+// of them update in a single command.
 //
-void RaytracingBuilderKHR::updateBlas(uint32_t blasIdx, BlasInput& blas, VkBuildAccelerationStructureFlagsKHR flags)
+void RaytracingBuilderKHR::setupBlasUpdates(const std::vector<uint32_t>& blasIds,
+                                            const std::vector<BlasInput>& inputs)
 {
-    assert (false && "Not used; Not maintained;  Probably leaks a VkDeviceMemory");
-    //printf("RaytracingBuilderKHR::updateBlas\n");
-    assert(size_t(blasIdx) < m_blas.size());
-
-    // Preparing all build information, acceleration is filled later
-    VkAccelerationStructureBuildGeometryInfoKHR buildInfos{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
-    buildInfos.flags                    = flags;
-    buildInfos.geometryCount            = (uint32_t)blas.asGeometry.size();
-    buildInfos.pGeometries              = blas.asGeometry.data();
-    buildInfos.mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;  // UPDATE
-    buildInfos.type                     = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-    buildInfos.srcAccelerationStructure = m_blas[blasIdx].accel;  // UPDATE
-    buildInfos.dstAccelerationStructure = m_blas[blasIdx].accel;
-
-    // Find size to build on the device
-    std::vector<uint32_t> maxPrimCount(blas.asBuildOffsetInfo.size());
-    for(auto tt = 0; tt < blas.asBuildOffsetInfo.size(); tt++)
-        maxPrimCount[tt] = blas.asBuildOffsetInfo[tt].primitiveCount;  // Number of primitives/triangles
-    VkAccelerationStructureBuildSizesInfoKHR sizeInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
-    vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfos,
-                                            maxPrimCount.data(), &sizeInfo);
-
-    // Allocate the scratch buffer and setting the scratch info
-    BufferWrap scratch = VK->createBufferWrap(sizeInfo.buildScratchSize,
-                                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-                                              | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
-    bufferInfo.buffer = scratch.buffer;
-    buildInfos.scratchData.deviceAddress = vkGetBufferDeviceAddress(m_device, &bufferInfo);
-
-    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> pBuildOffset(blas.asBuildOffsetInfo.size());
-    for(size_t i = 0; i < blas.asBuildOffsetInfo.size(); i++)
-        pBuildOffset[i] = &blas.asBuildOffsetInfo[i];
+    assert(blasIds.size() == inputs.size());
+    VkDeviceSize total = 0;
+    m_deforming.clear();
+    for (size_t i = 0;  i < blasIds.size();  i++)
+        {
+            assert(inputs[i].flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+            VkAccelerationStructureBuildGeometryInfoKHR buildInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+            buildInfo.type          = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+            buildInfo.mode          = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+            buildInfo.flags         = inputs[i].flags;
+            buildInfo.geometryCount = static_cast<uint32_t>(inputs[i].asGeometry.size());
+            buildInfo.pGeometries   = inputs[i].asGeometry.data();
+
+            std::vector<uint32_t> maxPrimCount(inputs[i].asBuildOffsetInfo.size());
+            for (size_t tt = 0;  tt < maxPrimCount.size();  tt++)
+                maxPrimCount[tt] = inputs[i].asBuildOffsetInfo[tt].primitiveCount;
+            VkAccelerationStructureBuildSizesInfoKHR sizeInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+            vkGetAccelerationStructureBuildSizesKHR(m_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+                                                    &buildInfo, maxPrimCount.data(), &sizeInfo);
+
+            DeformingBlas blas;
+            blas.blasId        = blasIds[i];
+            blas.input         = inputs[i];
+            blas.scratchOffset = total;
+            m_deforming.push_back(blas);
+            VkDeviceSize size = std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize);
+            total += (size + m_scratchAlignment - 1) / m_scratchAlignment * m_scratchAlignment;
+        }
 
-    VkCommandBuffer cmdBuf = VK->createTempCmdBuffer();
+    if (m_blasScratch.buffer)
+        m_blasScratch.destroy(VK->m_device);
+    if (total == 0)
+        return;
+    m_blasScratch = VK->createBufferWrap(total + m_scratchAlignment,
+                                         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                         | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    NAME(m_blasScratch.buffer, VK_OBJECT_TYPE_BUFFER, "BLAS update scratch buffer");
+    printf("Deforming BLASes: %zd, sharing %.1f MB of scratch\n",
+           m_deforming.size(), total / (1024.0 * 1024.0));
+}
 
-    // Update the instance buffer on the device side and build the TLAS
-    // Update the acceleration structure. Note the VK_TRUE parameter to trigger the update,
-    // and the existing BLAS being passed and updated in place
-    vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildInfos, pBuildOffset.data());
+void RaytracingBuilderKHR::cmdUpdateBlas(VkCommandBuffer cmdBuf, const std::vector<bool>& rebuild)
+{
+    if (m_deforming.empty())
+        return;
+    assert(rebuild.size() == m_deforming.size());
 
-    VK->submitTempCmdBuffer(cmdBuf);
+    VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr,
+        m_blasScratch.buffer};
+    VkDeviceAddress scratch = vkGetBufferDeviceAddress(m_device, &bufferInfo);
+    scratch = (scratch + m_scratchAlignment - 1) / m_scratchAlignment * m_scratchAlignment;
+
+    // Their ranges don't overlap, so the builds need no barriers
+    // between them.
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(m_deforming.size());
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos(m_deforming.size());
+    for (size_t i = 0;  i < m_deforming.size();  i++)
+        {
+            const DeformingBlas& blas = m_deforming[i];
+            VkAccelerationStructureBuildGeometryInfoKHR& buildInfo = buildInfos[i];
+            buildInfo = {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+            buildInfo.type          = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+            buildInfo.mode          = rebuild[i] ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR
+                                                 : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+            buildInfo.flags         = blas.input.flags;
+            buildInfo.geometryCount = static_cast<uint32_t>(blas.input.asGeometry.size());
+            buildInfo.pGeometries   = blas.input.asGeometry.data();
+            buildInfo.srcAccelerationStructure  = rebuild[i] ? VK_NULL_HANDLE : m_blas[blas.blasId].accel;
+            buildInfo.dstAccelerationStructure  = m_blas[blas.blasId].accel;
+            buildInfo.scratchData.deviceAddress = scratch + blas.scratchOffset;
+            rangeInfos[i] = blas.input.asBuildOffsetInfo.data();
+        }
+    vkCmdBuildAccelerationStructuresKHR(cmdBuf, static_cast<uint32_t>(buildInfos.size()),
+                                        buildInfos.data(), rangeInfos.data());
+    m_tlasDirty = true;
 }
-    
+
 void RaytracingBuilderKHR::buildTlas(
                                  const std::vector<VkAccelerationStructureInstanceKHR>& instances,
                                  VkBuildAccelerationStructureFlagsKHR flags,
                                  bool update, bool motion)
 {
     //printf("RaytracingBuilderKHR::buildTlas (30)\n");
-    // Cannot call buildTlas twice except to update.
-    //assert(m_tlas.accel == VK_NULL_HANDLE || update);
+    // The instances here are VkAccelerationStructureInstanceKHR, not
+    // the (larger) motion instances a motion TLAS needs.
+    assert(!motion && "buildTlas takes no motion instances");
     uint32_t countInstance = static_cast<uint32_t>(instances.size());
 
-    // Command buffer to create the TLAS
-    VkCommandBuffer    cmdBuf = VK->createTempCmdBuffer();
+    m_instances = instances;
+    setTransforms();
 
-    // Create a buffer holding the actual instance data (matrices++) for use by the AS builder
-    BufferWrap instancesBuffer = VK->createStagedBufferWrap(cmdBuf, instances,
-                                                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-                                                  | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+    // An update just hands the new instances to the next frame's
+    // cmdUpdateTlas, rather than stalling on a build here.
+    if (update)
+        {
+            assert(m_tlas.accel != VK_NULL_HANDLE && countInstance * sizeof(instances[0]) == m_instanceSlice);
+            m_tlasDirty = true;
+            return;
+        }
+    m_tlasFlags = flags;
+
+    // The persistent instance buffer: one slice per frame in flight
+    // for cmdUpdateTlas, and a last one for this build.
+    uint32_t slices = static_cast<uint32_t>(VK->m_frames.size()) + 1;
+    if (m_instanceBuffer.buffer)
+        m_instanceBuffer.destroy(VK->m_device);  // Only at startup; see scratchAddress
+    m_instanceSlice  = std::max<VkDeviceSize>(1, countInstance) * sizeof(VkAccelerationStructureInstanceKHR);
+    m_instanceBuffer = VK->createBufferWrap(slices * m_instanceSlice,
+                                            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                            | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    NAME(m_instanceBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "TLAS instance buffer");
+
+    // Host writes are visible to the build once it is submitted; no barrier.
+    VkDeviceSize slice = (slices - 1) * m_instanceSlice;
+    memcpy((char*)m_instanceBuffer.mapped + slice, m_instances.data(), countInstance * sizeof(m_instances[0]));
     VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr,
-        instancesBuffer.buffer};
-    VkDeviceAddress           instBufferAddr = vkGetBufferDeviceAddress(m_device, &bufferInfo);
-    
-    // Make sure the copy of the instance buffer are copied before triggering the acceleration structure build
-    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+        m_instanceBuffer.buffer};
+    VkDeviceAddress instBufferAddr = vkGetBufferDeviceAddress(m_device, &bufferInfo) + slice;
 
     // Creating the TLAS
-    cmdCreateTlas(cmdBuf, countInstance, instBufferAddr, flags, update, motion);
-
-    // Finalizing and destroying temporary data
+    VkCommandBuffer cmdBuf = VK->createTempCmdBuffer();
+    cmdCreateTlas(cmdBuf, countInstance, instBufferAddr, flags, false, motion);
     VK->submitTempCmdBuffer(cmdBuf);
-    
-    instancesBuffer.destroy(VK->m_device);
+    markBuilt();
  }
 
+// Replace the instances, with at most as many as buildTlas was given
+// (the TLAS's memory, and the instance buffer's slices, are sized for
+// those).  If only transforms (or masks) changed, the next
+// cmdUpdateTlas may refit; a different count, or a different BLAS in
+// any slot, rebuilds.
+void RaytracingBuilderKHR::setInstances(const std::vector<VkAccelerationStructureInstanceKHR>& instances)
+{
+    assert(instances.size() * sizeof(VkAccelerationStructureInstanceKHR) <= m_instanceSlice);
+    bool sameBlases = instances.size() == m_instances.size();
+    if (sameBlases && memcmp(instances.data(), m_instances.data(), instances.size() * sizeof(instances[0])) == 0)
+        return;
+    for (size_t i = 0;  sameBlases && i < instances.size();  i++)
+        sameBlases = instances[i].accelerationStructureReference == m_instances[i].accelerationStructureReference;
+
+    m_instances = instances;
+    setTransforms();
+    m_forceRebuild |= !sameBlases;
+    m_tlasDirty = true;
+}
+
+// m_transforms from m_instances' (row major, 3x4) transforms
+void RaytracingBuilderKHR::setTransforms()
+{
+    m_transforms.resize(m_instances.size());
+    for (size_t i = 0;  i < m_instances.size();  i++) {
+        const VkTransformMatrixKHR& t = m_instances[i].transform;
+        m_transforms[i] = glm::transpose(glm::mat4(t.matrix[0][0], t.matrix[0][1], t.matrix[0][2], t.matrix[0][3],
+                                                   t.matrix[1][0], t.matrix[1][1], t.matrix[1][2], t.matrix[1][3],
+                                                   t.matrix[2][0], t.matrix[2][1], t.matrix[2][2], t.matrix[2][3],
+                                                   0, 0, 0, 1)); }
+}
+
+// Refitting keeps the tree built for the old transforms, only
+// growing its boxes, so tracing slows down as instances wander from
+// where they were at the last full build.  Rebuild once any instance
+// has moved (or turned, or scaled) by more than m_rebuildThreshold of
+// the scene's size then, or after m_maxRefits refits.
+bool RaytracingBuilderKHR::needsRebuild() const
+{
+    if (m_forceRebuild || !hasFlag(m_tlasFlags, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR))
+        return true;
+    if (m_refitsSinceBuild >= m_maxRefits)
+        return true;
+
+    for (size_t i = 0;  i < m_transforms.size();  i++) {
+        glm::mat4 d = m_transforms[i] - m_builtTransforms[i];
+        float moved  = glm::length(glm::vec3(d[3])) / m_builtExtent;
+        float turned = glm::length(glm::vec3(d[0])) + glm::length(glm::vec3(d[1]))
+            + glm::length(glm::vec3(d[2]));
+        if (moved + turned > m_rebuildThreshold)
+            return true; }
+    return false;
+}
+
+void RaytracingBuilderKHR::markBuilt()
+{
+    m_builtTransforms = m_transforms;
+    m_refitsSinceBuild = 0;
+    m_tlasDirty = false;
+    m_forceRebuild = false;
+
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (const glm::mat4& t : m_transforms) {
+        lo = glm::min(lo, glm::vec3(t[3]));
+        hi = glm::max(hi, glm::vec3(t[3])); }
+    m_builtExtent = m_transforms.empty() ? 1.0f : std::max(1.0f, glm::length(hi - lo));
+}
+
+// Record this frame's TLAS refit or rebuild into cmdBuf, if any
+// instance changed.  frameIndex's slice of the instance buffer was
+// last read by the frame that used the slot before, which its fence
+// says is done.
+void RaytracingBuilderKHR::cmdUpdateTlas(VkCommandBuffer cmdBuf, uint32_t frameIndex)
+{
+    if (!m_tlasDirty)
+        return;
+
+    uint32_t countInstance = static_cast<uint32_t>(m_instances.size());
+    VkDeviceSize slice = frameIndex * m_instanceSlice;
+    memcpy((char*)m_instanceBuffer.mapped + slice, m_instances.data(), countInstance * sizeof(m_instances[0]));
+    VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr,
+        m_instanceBuffer.buffer};
+    VkDeviceAddress instBufferAddr = vkGetBufferDeviceAddress(m_device, &bufferInfo) + slice;
+
+    bool rebuild = needsRebuild();
+    cmdCreateTlas(cmdBuf, countInstance, instBufferAddr, m_tlasFlags, !rebuild, false);
+    if (rebuild)
+        markBuilt();
+    else {
+        m_refitsSinceBuild++;
+        m_tlasDirty = false; }
+}
+
 
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
-// Convert an OBJ model into the ray tracing geometry used to build the BLAS
+// Convert an OBJ model (or one of its levels of detail) into the ray
+// tracing geometry used to build the BLAS
 //
-BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model)
+BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model, uint32_t lod)
 {
     //printf("VkApp::objectToVkGeometryKHR (45)\n");
+    // A model with split triangles has its own BLAS geometry, positions
+    // only.  Coarser LODs are ranges of its LOD index buffer.
+    bool split = lod == 0 && model.blasVertexBuffer.buffer != VK_NULL_HANDLE;
+
     // BLAS builder requires raw device addresses.
     VkBufferDeviceAddressInfo _b1{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-        nullptr, model.vertexBuffer.buffer};
+        nullptr, split ? model.blasVertexBuffer.buffer : model.vertexBuffer.buffer};
     VkDeviceAddress vertexAddress = vkGetBufferDeviceAddress(m_device, &_b1);
 
     
     VkBufferDeviceAddressInfo _b2{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-        nullptr, model.indexBuffer.buffer};
+        nullptr, split ? model.blasIndexBuffer.buffer
+                 : lod > 0 ? model.lodIndexBuffer.buffer : model.indexBuffer.buffer};
     VkDeviceAddress indexAddress  = vkGetBufferDeviceAddress(m_device, &_b2);
 
-    uint32_t maxPrimitiveCount = model.nbIndices / 3;
+    uint32_t maxPrimitiveCount = (split ? model.nbBlasIndices : model.lods[lod].indexCount) / 3;
 
+    // Host builds read the CPU copy (positions only) instead.
+    bool onHost = lod == 0 && !model.hostPositions.empty();
 
-    // Describe buffer as array of Vertex.
+    // Describe buffer as array of Vertex (or of positions).
     VkAccelerationStructureGeometryTrianglesDataKHR triangles{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR};
     triangles.vertexFormat             = VK_FORMAT_R32G32B32_SFLOAT;  // vec3 vertex position data.
     triangles.vertexData.deviceAddress = vertexAddress;
-    triangles.vertexStride             = sizeof(Vertex);
+    triangles.vertexStride             = split || onHost ? sizeof(glm::vec3) : sizeof(Vertex);
     // Describe index data (32-bit unsigned int)
     triangles.indexType               = VK_INDEX_TYPE_UINT32;
     triangles.indexData.deviceAddress = indexAddress;
+    if (onHost) {
+        triangles.vertexData.hostAddress = model.hostPositions.data();
+        triangles.indexData.hostAddress  = model.hostIndices.data(); }
     // Indicate identity transform by setting transformData to null device pointer.
     //triangles.transformData = {};
-    triangles.maxVertex = model.nbVertices;
+    triangles.maxVertex = split ? model.nbBlasVertices : model.nbVertices;
 
     // Identify the above data as containing opaque triangles.
     VkAccelerationStructureGeometryKHR asGeom{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
@@ -488,17 +914,18 @@ BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model)
     asGeom.flags              = VK_GEOMETRY_OPAQUE_BIT_KHR;
     asGeom.geometry.triangles = triangles;
 
-    // The entire array will be used to build the BLAS.
+    // The LOD's range of the array will be used to build the BLAS.
     VkAccelerationStructureBuildRangeInfoKHR offset;
     offset.firstVertex     = 0;
     offset.primitiveCount  = maxPrimitiveCount;
-    offset.primitiveOffset = 0;
+    offset.primitiveOffset = model.lods[lod].firstIndex * sizeof(uint32_t);
     offset.transformOffset = 0;
 
     // Our blas is made from only one geometry, but could be made of many geometries
     BlasInput input;
     input.asGeometry.emplace_back(asGeom);
     input.asBuildOffsetInfo.emplace_back(offset);
+    input.onHost = onHost;
 
     return input;
 }
@@ -524,9 +951,48 @@ void VkApp::createRtAccelerationStructure()
         // We could add more geometry in each BLAS, but we add only one for now
         allBlas.emplace_back(blas); }
 
-    m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
-
-    // TLAS 
+    // Static BLASes are compacted, and cached on disk by content.
+    std::vector<uint64_t> cacheKeys(m_objData.size());
+    for (size_t i = 0;  i < m_objData.size();  i++) {
+        allBlas[i].flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+        cacheKeys[i] = m_objData[i].contentHash; }
+
+    // Coarser LODs' BLASes follow the objects'.
+    for (ObjData& obj : m_objData)
+        for (uint32_t l = 1;  l < obj.lods.size();  l++) {
+            ObjLod& lod = obj.lods[l];
+            lod.blasId = static_cast<uint32_t>(allBlas.size());
+            allBlas.push_back(objectToVkGeometryKHR(obj, l));
+            allBlas.back().flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+            cacheKeys.push_back(hashBytes(&lod.contentHash, sizeof(lod.contentHash), obj.contentHash)); }
+
+    // Skinned objects' BLASes are refit in-frame, which needs
+    // ALLOW_UPDATE, and the refits need the same flags as the build
+    // (and its memory: no compaction).  Built each run, not cached.
+    std::vector<uint32_t>  skinnedIds;
+    std::vector<BlasInput> skinnedBlas;
+    for (const SkinnedObject& skinned : m_skinned) {
+        BlasInput& blas = allBlas[skinned.objIndex];
+        blas.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR
+            | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+        cacheKeys[skinned.objIndex] = 0;
+        skinnedIds.push_back(skinned.objIndex);
+        skinnedBlas.push_back(blas); }
+
+    m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR, cacheKeys);
+    m_rtBuilder.setupBlasUpdates(skinnedIds, skinnedBlas);
+    for (ObjData& obj : m_objData)
+        for (ObjLod& lod : obj.lods)
+            lod.blasAddress = m_rtBuilder.getBlasDeviceAddress(lod.blasId);
+
+    // Host builds are done with the CPU copies.
+    for (ObjData& obj : m_objData) {
+        std::vector<glm::vec3>().swap(obj.hostPositions);
+        std::vector<uint32_t>().swap(obj.hostIndices); }
+
+    // TLAS, at first with every instance at full detail: its memory,
+    // and the instance buffer's slices, are sized for all of them.
+    // selectInstances then picks each frame's.
     std::vector<VkAccelerationStructureInstanceKHR> tlas;
     tlas.reserve(m_objInst.size());
     for(const ObjInst& inst : m_objInst) {
@@ -535,15 +1001,27 @@ void VkApp::createRtAccelerationStructure()
         _i.instanceCustomIndex = inst.objIndex; 
         _i.accelerationStructureReference = m_rtBuilder.getBlasDeviceAddress(inst.objIndex);
         _i.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-        _i.mask  = 0xFF;       //  Only be hit if rayMask & instance.mask != 0
+        _i.mask  = eInstanceAll;  //  Only be hit if rayMask & instance.mask != 0
         _i.instanceShaderBindingTableRecordOffset = 0; // Use the same hit group for all objects
         tlas.emplace_back(_i); }
     
-    m_rtBuilder.buildTlas(tlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+    // ALLOW_UPDATE, so that moved instances can be refit.
+    m_rtBuilder.buildTlas(tlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+                          | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
                           false, false);
 
-    m_scratch1.destroy(m_device);
-    m_scratch2.destroy(m_device);
+    // The BLAS builds may still be waiting in m_batch.
+    VkDevice device = m_device;
+    m_batch.destroyAfterFlush([device, s1 = m_scratch1]() mutable {
+        s1.destroy(device); });
+}
+
+// Move instance index (of m_objInst).  Takes effect in the next
+// drawFrame, for both renderers: the ray tracer's selectInstances
+// reads the transforms each frame.
+void VkApp::setInstanceTransform(uint32_t index, const glm::mat4& transform)
+{
+    m_objInst[index].transform = transform;
 }
 
 
@@ -38,6 +38,12 @@ struct WrapAccelerationStructure
     BufferWrap bw;
 };
 
+// Allocate accel_.size bytes, and create the acceleration structure in
+// them.  Host commands (vkBuildAccelerationStructuresKHR, ...) need it
+// hostVisible.
+WrapAccelerationStructure createAcceleration(VkApp* VK, VkAccelerationStructureCreateInfoKHR& accel_,
+                                             bool hostVisible = false);
+
 
 // Inputs used to build Bottom-level acceleration structure.
 // You manage the lifetime of the buffer(s) referenced by the VkAccelerationStructureGeometryKHRs within.
@@ -48,6 +54,7 @@ struct BlasInput
     std::vector<VkAccelerationStructureGeometryKHR>       asGeometry;
     std::vector<VkAccelerationStructureBuildRangeInfoKHR> asBuildOffsetInfo;
     VkBuildAccelerationStructureFlagsKHR                  flags{0};
+    bool onHost{false};  // The geometry has host addresses: build on the CPU
 };
 
 
@@ -68,18 +75,31 @@ public:
     // Return the Acceleration Structure Device Address of a BLAS Id
     VkDeviceAddress getBlasDeviceAddress(uint32_t blasId);
 
-    // Create all the BLAS from the vector of BlasInput
+    // Create all the BLAS from the vector of BlasInput (or load them
+    // from VK->m_asCache, for non-zero cacheKeys)
     void buildBlas(const std::vector<BlasInput>&        input,
                    VkBuildAccelerationStructureFlagsKHR flags
-                       = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
-
-    // Refit BLAS number blasIdx from updated buffer contents.
-    void updateBlas(uint32_t blasIdx, BlasInput& blas, VkBuildAccelerationStructureFlagsKHR flags);
+                       = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+                   const std::vector<uint64_t>&         cacheKeys = {});
+
+    // Deforming geometry.  setupBlasUpdates names the BLASes (built
+    // with ALLOW_UPDATE) whose vertices change in place every frame,
+    // and gives each an aligned range of one pooled scratch buffer.
+    // cmdUpdateBlas then records, into the frame's command buffer, one
+    // build command refitting them all in place, or rebuilding the
+    // ones flagged in rebuild.  The TLAS becomes dirty, since its
+    // instances' bounds moved.  The caller orders the build after the
+    // vertex writes, and against the previous use of blasScratch().
+    void setupBlasUpdates(const std::vector<uint32_t>& blasIds, const std::vector<BlasInput>& inputs);
+    void cmdUpdateBlas(VkCommandBuffer cmdBuf, const std::vector<bool>& rebuild);
+    BufferWrap* blasScratch() { return &m_blasScratch; }
 
     // Build TLAS from an array of VkAccelerationStructureInstanceKHR
-    // - Use motion=true with VkAccelerationStructureMotionInstanceNV
     // - The resulting TLAS will be stored in m_tlas
-    // - update is to rebuild the Tlas with updated matrices, flag must have the 'allow_update'
+    // - Include ALLOW_UPDATE in flags to animate instances later
+    // - update=true only replaces the instances (same count); the
+    //   next cmdUpdateTlas refits or rebuilds the TLAS in-frame
+    // - motion must be false; see cmdCreateTlas for motion TLASes
 
     void buildTlas(const std::vector<VkAccelerationStructureInstanceKHR>& instances,
                    VkBuildAccelerationStructureFlagsKHR flags
@@ -87,7 +107,23 @@ public:
                    bool                                 update = false,
                    bool                                 motion = false);
 
-    // Creating the TLAS, called by buildTlas
+    // Per-frame instances (animation, LOD, culling): set them, then
+    // record cmdUpdateTlas into the frame's command buffer (no submit,
+    // no wait).  It writes the instances into the frame's slice of a
+    // persistent host visible buffer, and refits the TLAS in place
+    // (or rebuilds it into the same memory when the instances' BLASes
+    // changed, or refits have degraded it; see needsRebuild).  The
+    // caller orders the build against the TLAS's readers and the
+    // previous use of tlasScratch().
+    void setInstances(const std::vector<VkAccelerationStructureInstanceKHR>& instances);
+    bool tlasDirty() const { return m_tlasDirty; }
+    void cmdUpdateTlas(VkCommandBuffer cmdBuf, uint32_t frameIndex);
+    BufferWrap* tlasBuffer() { return &m_tlas.bw; }
+    BufferWrap* tlasScratch() { return &m_tlasScratch; }
+
+    // Creating the TLAS, called by buildTlas and cmdUpdateTlas.  A
+    // motion TLAS (VK_NV_ray_tracing_motion_blur, which must then be
+    // enabled) reads VkAccelerationStructureMotionInstanceNV.
     void cmdCreateTlas(VkCommandBuffer                      cmdBuf,          // Command buffer
                        uint32_t                             countInstance,   // number of instances
                        VkDeviceAddress                      instBufferAddr,  // Buffer address of instances
@@ -104,6 +140,39 @@ protected:
     // Setup
     VkDevice                 m_device{VK_NULL_HANDLE};
     uint32_t                 m_queueIndex{0};
+    VkDeviceSize             m_scratchAlignment{256};  // minAccelerationStructureScratchOffsetAlignment
+
+    // TLAS animation.  The instance buffer has a slice per frame in
+    // flight, plus one for buildTlas.
+    std::vector<VkAccelerationStructureInstanceKHR> m_instances;
+    std::vector<glm::mat4>   m_transforms;       // Current, and as of the
+    std::vector<glm::mat4>   m_builtTransforms;  //   last full build
+    float                    m_builtExtent{1.0f};  // Scene size at the last full build
+    VkBuildAccelerationStructureFlagsKHR m_tlasFlags{0};
+    BufferWrap               m_instanceBuffer{};   // Host visible, persistently mapped
+    VkDeviceSize             m_instanceSlice{0};   // Bytes per slice
+    BufferWrap               m_tlasScratch{};
+    VkDeviceSize             m_tlasScratchSize{0};
+    bool                     m_tlasDirty{false};
+    bool                     m_forceRebuild{false};  // The instances' BLASes changed
+    uint32_t                 m_refitsSinceBuild{0};
+    uint32_t                 m_maxRefits{64};        // Rebuild after this many refits,
+    float                    m_rebuildThreshold{0.25f};  // or when moved this far
+
+    // Deforming BLASes, and their shared scratch
+    struct DeformingBlas
+    {
+        uint32_t     blasId{0};
+        BlasInput    input;
+        VkDeviceSize scratchOffset{0};
+    };
+    std::vector<DeformingBlas> m_deforming;
+    BufferWrap                 m_blasScratch{};
+
+    bool  needsRebuild() const;
+    void  markBuilt();
+    void  setTransforms();
+    VkDeviceAddress scratchAddress(VkDeviceSize size);
 
     struct BuildAccelerationStructure
     {
@@ -114,18 +183,20 @@ protected:
         const VkAccelerationStructureBuildRangeInfoKHR* rangeInfo;
         WrapAccelerationStructure as;  // result acceleration structure
         VkAccelerationStructureKHR cleanupAS;
+        BufferWrap                 cleanupBw;  // cleanupAS's buffer
     };
 
 
     void cmdCreateBlas(VkCommandBuffer                          cmdBuf,
                        std::vector<uint32_t>                    indices,
                        std::vector<BuildAccelerationStructure>& buildAs,
-                       VkDeviceAddress                          scratchAddress,
                        VkQueryPool                              queryPool);
     void cmdCompactBlas(VkCommandBuffer cmdBuf, std::vector<uint32_t> indices,
                         std::vector<BuildAccelerationStructure>& buildAs, VkQueryPool queryPool);
     void destroyNonCompacted(std::vector<uint32_t> indices,
                              std::vector<BuildAccelerationStructure>& buildAs);
+    void buildBlasOnHost(const std::vector<uint32_t>&             indices,
+                         std::vector<BuildAccelerationStructure>& buildAs);
     bool hasFlag(VkFlags item, VkFlags flag) { return (item & flag) == flag; }
 };
 
@@ -0,0 +1,294 @@
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cassert>
+
+#include "allocator_wrap.h"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void MemoryAllocator::setup(VkDevice device, VkPhysicalDevice physicalDevice,
+                            VkDeviceSize blockSize)
+{
+    m_device = device;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memProperties);
+
+    // The buddy system needs a power of two block size.
+    m_blockSize = minBuddySize;
+    m_maxOrder = 0;
+    while (m_blockSize < blockSize) {
+        m_blockSize *= 2;
+        m_maxOrder++; }
+}
+
+void MemoryAllocator::destroy()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& pool : m_pools)
+        for (auto& block : pool.blocks)
+            if (block.memory != VK_NULL_HANDLE)
+                vkFreeMemory(m_device, block.memory, nullptr);
+    m_pools.clear();
+    m_deviceAllocations = 0;
+    m_resourceCount = 0;
+}
+
+uint32_t MemoryAllocator::findPool(uint32_t memoryType, Kind kind, Strategy strategy)
+{
+    for (uint32_t i = 0;  i < m_pools.size();  i++)
+        if (m_pools[i].memoryType == memoryType && m_pools[i].kind == kind
+            && m_pools[i].strategy == strategy)
+            return i;
+
+    Pool pool{memoryType, kind, strategy};
+    pool.hostVisible = m_memProperties.memoryTypes[memoryType].propertyFlags
+                       & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    m_pools.push_back(pool);
+    return (uint32_t)m_pools.size() - 1;
+}
+
+bool MemoryAllocator::createBlock(Pool& pool, VkDeviceSize size, bool dedicated, Block& block)
+{
+    VkMemoryAllocateFlagsInfo memFlags = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, nullptr,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
+
+    VkMemoryAllocateInfo allocInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    allocInfo.pNext = pool.kind == eBuffer ? &memFlags : nullptr;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = pool.memoryType;
+
+    block = Block();
+    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS)
+        return false;
+    m_deviceAllocations++;
+
+    block.size = size;
+    block.dedicated = dedicated;
+    if (pool.hostVisible)
+        vkMapMemory(m_device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped);
+
+    if (!dedicated && pool.strategy == eBuddy) {
+        block.freeLists.resize(m_maxOrder + 1);
+        block.freeLists[m_maxOrder].insert(0); }
+    return true;
+}
+
+// Take a free node of the given order, splitting a larger one if needed.
+bool MemoryAllocator::buddyAllocate(Block& block, uint32_t order, VkDeviceSize& offset)
+{
+    uint32_t k = order;
+    while (k <= m_maxOrder && block.freeLists[k].empty())
+        k++;
+    if (k > m_maxOrder)
+        return false;
+
+    offset = *block.freeLists[k].begin();
+    block.freeLists[k].erase(block.freeLists[k].begin());
+    while (k > order) {
+        k--;
+        block.freeLists[k].insert(offset + (minBuddySize << k)); }
+    return true;
+}
+
+// Return a node, merging it with its buddy for as long as the buddy is free too.
+void MemoryAllocator::buddyFree(Block& block, VkDeviceSize offset, uint32_t order)
+{
+    while (order < m_maxOrder) {
+        VkDeviceSize buddy = offset ^ (minBuddySize << order);
+        auto it = block.freeLists[order].find(buddy);
+        if (it == block.freeLists[order].end())
+            break;
+        block.freeLists[order].erase(it);
+        offset = std::min(offset, buddy);
+        order++; }
+    block.freeLists[order].insert(offset);
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements,
+                                           uint32_t memoryTypeIndex, Kind kind,
+                                           Strategy strategy)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    MemoryAllocation result;
+    result.size = requirements.size;
+    result.pool = findPool(memoryTypeIndex, kind, strategy);
+    Pool& pool = m_pools[result.pool];
+
+    // Index of an unused block slot (or a new one) in pool.blocks.
+    auto freeSlot = [&pool]() {
+        for (uint32_t b = 0;  b < pool.blocks.size();  b++)
+            if (pool.blocks[b].memory == VK_NULL_HANDLE)
+                return b;
+        pool.blocks.emplace_back();
+        return (uint32_t)pool.blocks.size() - 1; };
+
+    bool found = false;
+    VkDeviceSize used = 0;
+
+    if (requirements.size > m_blockSize / 2) {
+        // Too big to share a block.
+        result.block = freeSlot();
+        if (!createBlock(pool, requirements.size, true, pool.blocks[result.block]))
+            throw std::runtime_error("failed to allocate device memory!");
+        result.offset = 0;
+        used = requirements.size;
+        found = true; }
+
+    else if (strategy == eBuddy) {
+        VkDeviceSize nodeSize = minBuddySize;
+        result.order = 0;
+        while (nodeSize < requirements.size || nodeSize < requirements.alignment) {
+            nodeSize *= 2;
+            result.order++; }
+        used = nodeSize;
+
+        for (uint32_t b = 0;  !found && b < pool.blocks.size();  b++) {
+            Block& block = pool.blocks[b];
+            if (block.memory != VK_NULL_HANDLE && !block.dedicated
+                && buddyAllocate(block, result.order, result.offset)) {
+                result.block = b;
+                found = true; } }
+
+        if (!found) {
+            result.block = freeSlot();
+            Block& block = pool.blocks[result.block];
+            if (!createBlock(pool, m_blockSize, false, block)
+                || !buddyAllocate(block, result.order, result.offset))
+                throw std::runtime_error("failed to allocate device memory!");
+            found = true; } }
+
+    else {
+        for (uint32_t b = 0;  !found && b < pool.blocks.size();  b++) {
+            Block& block = pool.blocks[b];
+            if (block.memory == VK_NULL_HANDLE || block.dedicated)
+                continue;
+            // Never less aligned than a buddy node, so device addresses
+            // (e.g. AS scratch) keep the same guarantee in either pool.
+            VkDeviceSize offset = alignUp(block.top, std::max(requirements.alignment,
+                                                              minBuddySize));
+            if (offset + requirements.size <= block.size) {
+                result.block = b;
+                result.offset = offset;
+                used = offset + requirements.size - block.top;
+                block.top = offset + requirements.size;
+                found = true; } }
+
+        if (!found) {
+            result.block = freeSlot();
+            Block& block = pool.blocks[result.block];
+            if (!createBlock(pool, m_blockSize, false, block))
+                throw std::runtime_error("failed to allocate device memory!");
+            result.offset = 0;
+            used = block.top = requirements.size;
+            found = true; } }
+
+    Block& block = pool.blocks[result.block];
+    block.allocations++;
+    block.used += used;
+    block.requested += requirements.size;
+    m_resourceCount++;
+
+    result.memory = block.memory;
+    if (block.mapped)
+        result.mapped = static_cast<char*>(block.mapped) + result.offset;
+    return result;
+}
+
+void MemoryAllocator::free(const MemoryAllocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(allocation.pool < m_pools.size());
+    Pool& pool = m_pools[allocation.pool];
+    Block& block = pool.blocks[allocation.block];
+    assert(block.memory == allocation.memory);
+
+    block.allocations--;
+    block.requested -= allocation.size;
+    m_resourceCount--;
+
+    if (block.dedicated) {
+        vkFreeMemory(m_device, block.memory, nullptr);
+        m_deviceAllocations--;
+        block = Block();
+        return; }
+
+    if (pool.strategy == eBuddy) {
+        buddyFree(block, allocation.offset, allocation.order);
+        block.used -= minBuddySize << allocation.order; }
+    else if (block.allocations == 0) {
+        block.top = 0;
+        block.used = 0; }
+
+    // Give an empty block back to the driver, unless it is the pool's last one.
+    if (block.allocations == 0) {
+        int live = 0;
+        for (auto& b : pool.blocks)
+            live += b.memory != VK_NULL_HANDLE && !b.dedicated;
+        if (live > 1) {
+            vkFreeMemory(m_device, block.memory, nullptr);
+            m_deviceAllocations--;
+            block = Block(); } }
+}
+
+VkDeviceSize MemoryAllocator::largestFree(const Pool& pool, const Block& block) const
+{
+    if (block.dedicated)
+        return 0;
+    if (pool.strategy == eLinear)
+        return block.size - block.top;
+    for (int k = (int)m_maxOrder;  k >= 0;  k--)
+        if (!block.freeLists[k].empty())
+            return minBuddySize << k;
+    return 0;
+}
+
+void MemoryAllocator::printStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double MB = 1024.0 * 1024.0;
+
+    printf("Memory allocator: %u vkAllocateMemory allocations for %u resources\n",
+           m_deviceAllocations, m_resourceCount);
+
+    for (const Pool& pool : m_pools) {
+        uint32_t blocks = 0, dedicated = 0, allocations = 0;
+        VkDeviceSize size = 0, used = 0, requested = 0, freeBytes = 0, largest = 0;
+        for (const Block& block : pool.blocks) {
+            if (block.memory == VK_NULL_HANDLE)
+                continue;
+            blocks++;
+            dedicated += block.dedicated;
+            allocations += block.allocations;
+            size += block.size;
+            used += block.used;
+            requested += block.requested;
+            if (!block.dedicated) {
+                freeBytes += block.size - block.used;
+                largest = std::max(largest, largestFree(pool, block)); } }
+        if (blocks == 0)
+            continue;
+
+        // Internal: lost to rounding/alignment.  External: free space
+        // not usable by a single allocation the size of all of it.
+        double internal = used ? 100.0 * (used - requested) / used : 0.0;
+        double external = freeBytes ? 100.0 * (1.0 - double(largest) / freeBytes) : 0.0;
+        bool deviceLocal = m_memProperties.memoryTypes[pool.memoryType].propertyFlags
+                           & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+        printf("  type %2u %-6s %-6s %-6s %3u blocks (%u dedicated) %5u allocs  "
+               "%8.2f MB reserved %8.2f MB used %8.2f MB requested  "
+               "fragmentation: %5.1f%% internal %5.1f%% external\n",
+               pool.memoryType, deviceLocal ? "device" : "host",
+               pool.kind == eBuffer ? "buffer" : "image",
+               pool.strategy == eBuddy ? "buddy" : "linear",
+               blocks, dedicated, allocations,
+               size / MB, used / MB, requested / MB, internal, external); }
+}
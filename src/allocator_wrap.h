@@ -0,0 +1,97 @@
+
+#pragma once
+
+#include <mutex>
+#include <set>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+// A sub-allocation of one of the allocator's VkDeviceMemory blocks.
+struct MemoryAllocation
+{
+    VkDeviceMemory memory{VK_NULL_HANDLE};
+    VkDeviceSize   offset{0};      // Offset within memory; bind the resource here
+    VkDeviceSize   size{0};        // Size requested
+    void*          mapped{nullptr}; // Host pointer to offset, for host visible memory
+    uint32_t       pool{0};        // Internal: where this came from, for free()
+    uint32_t       block{0};
+    uint32_t       order{0};       // Internal: buddy size class
+};
+
+// Device memory sub-allocator.  Instead of one vkAllocateMemory per
+// buffer/image, memory is taken from large blocks (blockSize bytes)
+// and carved up by one of two strategies:
+//
+//  eBuddy:  power-of-two buddy system; any allocation can be freed
+//           at any time.  For long lived resources.
+//  eLinear: a bump pointer; a block is reset when all of its
+//           allocations have been freed.  For short lived resources
+//           (staging, scratch).
+//
+// Pools are kept per memory type, per strategy, and separately for
+// buffers and images (which sidesteps bufferImageGranularity).  All
+// buffer pools allocate with VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT
+// since every buffer in this app may be used by device address.
+// Host visible blocks are mapped once, persistently.  Requests over
+// half a block get a dedicated allocation of their own.
+class MemoryAllocator
+{
+public:
+    enum Strategy { eBuddy, eLinear };
+    enum Kind     { eBuffer, eImage };
+
+    void setup(VkDevice device, VkPhysicalDevice physicalDevice,
+               VkDeviceSize blockSize = 64*1024*1024);
+    void destroy();
+
+    // Throws std::runtime_error if the memory cannot be allocated.
+    MemoryAllocation allocate(const VkMemoryRequirements& requirements,
+                              uint32_t memoryTypeIndex, Kind kind,
+                              Strategy strategy = eBuddy);
+    void free(const MemoryAllocation& allocation);
+
+    // Usage and fragmentation, per pool.
+    void printStats();
+
+private:
+    struct Block
+    {
+        VkDeviceMemory memory{VK_NULL_HANDLE};
+        VkDeviceSize   size{0};
+        void*          mapped{nullptr};
+        bool           dedicated{false};
+
+        std::vector<std::set<VkDeviceSize>> freeLists;  // eBuddy: free offsets per order
+        VkDeviceSize   top{0};                          // eLinear: bump pointer
+
+        uint32_t       allocations{0};
+        VkDeviceSize   used{0};       // Bytes handed out, including rounding and alignment
+        VkDeviceSize   requested{0};  // Bytes actually asked for
+    };
+
+    struct Pool
+    {
+        uint32_t           memoryType;
+        Kind               kind;
+        Strategy           strategy;
+        bool               hostVisible;
+        std::vector<Block> blocks;
+    };
+
+    VkDevice         m_device{VK_NULL_HANDLE};
+    VkDeviceSize     m_blockSize{0};
+    uint32_t         m_maxOrder{0};
+    std::vector<Pool> m_pools;
+    VkPhysicalDeviceMemoryProperties m_memProperties{};
+    uint32_t         m_deviceAllocations{0};  // Live vkAllocateMemory count
+    uint32_t         m_resourceCount{0};      // Live sub-allocations
+    std::mutex       m_mutex;
+
+    static constexpr VkDeviceSize minBuddySize = 256;
+
+    uint32_t findPool(uint32_t memoryType, Kind kind, Strategy strategy);
+    bool     createBlock(Pool& pool, VkDeviceSize size, bool dedicated, Block& block);
+    bool     buddyAllocate(Block& block, uint32_t order, VkDeviceSize& offset);
+    void     buddyFree(Block& block, VkDeviceSize offset, uint32_t order);
+    VkDeviceSize largestFree(const Pool& pool, const Block& block) const;
+};
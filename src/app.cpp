@@ -110,6 +110,9 @@ void key_cb(GLFWwindow* window, int key, int scancode, int action, int mods)
 
     if (pressed && key == GLFW_KEY_ESCAPE)
         glfwSetWindowShouldClose(window, 1);
+
+    if (action == GLFW_PRESS && key == GLFW_KEY_F12)
+        app->m_captureRequested = true;
 }
 
 static float lastTime = 0;
@@ -154,6 +157,50 @@ App::App(int argc, char** argv)
         std::string arg = argv[argi++];
         if (arg == "-d")
             doApiDump = true;
+        else if (arg == "-f" && argi<argc)
+            m_framesInFlight = std::max(1, std::min(8, atoi(argv[argi++])));
+        else if (arg == "-a")
+            m_asyncCompute = true;
+        else if (arg == "-t" && argi<argc)
+            m_recordThreads = std::max(1, std::min(64, atoi(argv[argi++])));
+        else if (arg == "-n")
+            m_asCache = false;
+        else if (arg == "-H")
+            m_hostAsBuilds = true;
+        else if (arg == "-s" && argi<argc)
+            m_splitBudget = std::max(0.0f, (float)atof(argv[argi++]));
+        else if (arg == "-c" && argi<argc)
+            m_cullRadius = std::max(0.0f, (float)atof(argv[argi++]));
+        else if (arg == "-l" && argi<argc)
+            m_lodPixelError = std::max(0.0f, (float)atof(argv[argi++]));
+        else if (arg == "-L")
+            m_hideLights = true;
+        else if (arg == "-e" && argi<argc)
+            m_envMapFile = argv[argi++];
+        else if (arg == "-E" && argi<argc)
+            m_envIntensity = std::max(0.0f, (float)atof(argv[argi++]));
+        else if (arg == "-r" && argi<argc && std::string(argv[argi]) == "di") {
+            m_restir |= eRestirDI;
+            argi++; }
+        else if (arg == "-r" && argi<argc && std::string(argv[argi]) == "gi") {
+            m_restir |= eRestirGI;
+            argi++; }
+        else if (arg == "-g" && argi<argc)
+            m_cacheCellSize = std::max(0.0f, (float)atof(argv[argi++]));
+        else if (arg == "-G")
+            m_showCache = true;
+        else if (arg == "-p" && argi<argc)
+            m_guideRes = std::max(0, atoi(argv[argi++]));
+        else if (arg == "-R" && argi<argc && std::string(argv[argi]) == "half") {
+            m_traceMode = eTraceHalf;
+            argi++; }
+        else if (arg == "-R" && argi<argc && std::string(argv[argi]) == "checker") {
+            m_traceMode = eTraceChecker;
+            argi++; }
+        else if (arg == "-D" && argi<argc)
+            m_targetGpuMs = std::max(0.0f, (float)atof(argv[argi++]));
+        else if (arg == "-m" && argi<argc)
+            m_extraModels.push_back(argv[argi++]);
         else {
             printf("Unknown argument: %s\n", arg.c_str());
             exit(-1); } }
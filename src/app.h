@@ -7,8 +7,27 @@ public:
     GLFWwindow* GLFW_window;
     App(int argc, char** argv);
     bool doApiDump;
+    int m_framesInFlight = 2;  // -f N
+    bool m_asyncCompute = false;  // -a: denoise on a compute-only queue
+    int m_recordThreads = 1;   // -t N: threads recording rasterize's draws
+    bool m_asCache = true;     // -n: don't cache acceleration structures on disk
+    bool m_hostAsBuilds = false;  // -H: build static BLASes on the CPU, if the device can
+    float m_splitBudget = 0.0f;   // -s percent: split long, thin triangles for the BLAS
+    float m_cullRadius = 0.0f;    // -c r: leave instances farther than r out of the TLAS (0: none)
+    float m_lodPixelError = 1.0f; // -l pixels: ray traced LODs' allowed projected error
+    bool m_hideLights = false;    // -L: emitter-only objects are unseen by camera rays
+    std::string m_envMapFile;     // -e file.hdr: environment map lighting
+    float m_envIntensity = 1.0f;  // -E scale: its brightness
+    int m_restir = 0;             // -r di, -r gi: ReSTIR passes (RestirModes bits)
+    float m_cacheCellSize = 0.0f; // -g size: radiance cache with cells this small, up close (0: none)
+    bool m_showCache = false;     // -G: show the radiance cache instead
+    int m_guideRes = 0;           // -p res: path guiding with a res^3 grid of quadtrees (0: none)
+    int m_traceMode = 0;          // -R half, -R checker: trace some pixels each frame (TraceModes)
+    float m_targetGpuMs = 0.0f;   // -D ms: dynamic resolution, holding GPU frames to ms (0: none)
+    std::vector<std::string> m_extraModels;  // -m path: more models (e.g. animated characters)
     
     bool m_show_gui = true;
+    bool m_captureRequested = false;  // F12: capture the G-buffer for cpu_denoise.exe
     Camera myCamera;
     void updateCamera();
 };
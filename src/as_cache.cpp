@@ -0,0 +1,203 @@
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "vkapp.h"
+#include "as_cache.h"
+
+// Serialized data, and deserialization sources, must be aligned so.
+static const VkDeviceSize serialAlignment = 256;
+
+// The serialized header: driver UUID, compatibility UUID, serialized
+// size, deserialized size, handle count (zero for a BLAS).
+static const size_t headerSize = 2 * VK_UUID_SIZE + 3 * sizeof(uint64_t);
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0;  i < size;  i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull; }
+    return hash;
+}
+
+// The first aligned address in bw, and where it is mapped.
+static VkDeviceAddress alignedAddress(VkDevice device, const BufferWrap& bw, char*& mapped)
+{
+    VkBufferDeviceAddressInfo info{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr, bw.buffer};
+    VkDeviceAddress address = vkGetBufferDeviceAddress(device, &info);
+    VkDeviceAddress aligned = (address + serialAlignment - 1) / serialAlignment * serialAlignment;
+    mapped = (char*)bw.mapped + (aligned - address);
+    return aligned;
+}
+
+void AsCache::setup(VkApp* _VK, const std::string& dir)
+{
+    VK = _VK;
+    m_dir = dir;
+    if (m_dir.empty())
+        return;
+
+    VkPhysicalDeviceIDProperties idProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES};
+    VkPhysicalDeviceProperties2 properties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, &idProperties};
+    vkGetPhysicalDeviceProperties2(VK->m_physicalDevice, &properties);
+
+    char tag[2 * VK_UUID_SIZE + 16];
+    for (int i = 0;  i < VK_UUID_SIZE;  i++)
+        snprintf(tag + 2*i, 3, "%02x", idProperties.deviceUUID[i]);
+    snprintf(tag + 2*VK_UUID_SIZE, 16, "_%08x", properties.properties.driverVersion);
+    m_deviceTag = tag;
+
+    std::error_code error;
+    fs::create_directories(m_dir, error);
+    if (error) {
+        printf("AS cache: can't create %s; caching off\n", m_dir.c_str());
+        m_dir.clear(); }
+}
+
+std::string AsCache::path(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx_", (unsigned long long)key);
+    return m_dir + "/" + name + m_deviceTag + ".blas";
+}
+
+bool AsCache::load(uint64_t key, WrapAccelerationStructure& as)
+{
+    if (!enabled())
+        return false;
+
+    std::ifstream file(path(key), std::ios::binary | std::ios::ate);
+    if (!file) {
+        m_misses++;
+        return false; }
+    size_t size = (size_t)file.tellg();
+    std::vector<char> data(size);
+    file.seekg(0);
+    if (size < headerSize || !file.read(data.data(), size)) {
+        m_misses++;
+        return false; }
+
+    VkAccelerationStructureVersionInfoKHR version{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR};
+    version.pVersionData = (const uint8_t*)data.data();
+    VkAccelerationStructureCompatibilityKHR compatibility;
+    vkGetDeviceAccelerationStructureCompatibilityKHR(VK->m_device, &version, &compatibility);
+    uint64_t serializedSize, deserializedSize;
+    memcpy(&serializedSize, data.data() + 2*VK_UUID_SIZE, sizeof(uint64_t));
+    memcpy(&deserializedSize, data.data() + 2*VK_UUID_SIZE + sizeof(uint64_t), sizeof(uint64_t));
+    if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR
+        || serializedSize != size) {
+        m_incompatible++;
+        return false; }
+
+    BufferWrap staging = VK->createBufferWrap(size + serialAlignment,
+                                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                              | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
+    char* mapped;
+    VkDeviceAddress src = alignedAddress(VK->m_device, staging, mapped);
+    memcpy(mapped, data.data(), size);
+
+    VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+    createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+    createInfo.size = deserializedSize;
+    as = createAcceleration(VK, createInfo);
+
+    VkCommandBuffer cmdBuf = VK->createTempCmdBuffer();
+    VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR};
+    copyInfo.src.deviceAddress = src;
+    copyInfo.dst  = as.accel;
+    copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+    vkCmdCopyMemoryToAccelerationStructureKHR(cmdBuf, &copyInfo);
+    VK->submitTempCmdBuffer(cmdBuf);
+
+    VkDevice device = VK->m_device;
+    VK->m_batch.destroyAfterFlush([device, staging]() mutable { staging.destroy(device); });
+
+    m_hits++;
+    m_bytesRead += size;
+    return true;
+}
+
+void AsCache::store(const std::vector<uint64_t>& keys, const std::vector<VkAccelerationStructureKHR>& accels)
+{
+    if (!enabled() || accels.empty())
+        return;
+    uint32_t count = (uint32_t)accels.size();
+
+    // The serialized sizes, read on the CPU.
+    VkQueryPool queryPool;
+    VkQueryPoolCreateInfo qpci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    qpci.queryCount = count;
+    qpci.queryType  = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+    vkCreateQueryPool(VK->m_device, &qpci, nullptr, &queryPool);
+    vkResetQueryPool(VK->m_device, queryPool, 0, count);
+
+    VkCommandBuffer cmdBuf = VK->createTempCmdBuffer();
+    vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuf, count, accels.data(),
+                                                  VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+                                                  queryPool, 0);
+    VK->submitTempCmdBuffer(cmdBuf);
+    VK->m_batch.flush();
+
+    std::vector<VkDeviceSize> sizes(count);
+    vkGetQueryPoolResults(VK->m_device, queryPool, 0, count, count * sizeof(VkDeviceSize),
+                          sizes.data(), sizeof(VkDeviceSize),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    vkDestroyQueryPool(VK->m_device, queryPool, nullptr);
+
+    // One readback buffer, with an aligned range per acceleration structure.
+    std::vector<VkDeviceSize> offsets(count);
+    VkDeviceSize total = 0;
+    for (uint32_t i = 0;  i < count;  i++) {
+        offsets[i] = total;
+        total += (sizes[i] + serialAlignment - 1) / serialAlignment * serialAlignment; }
+    BufferWrap readback = VK->createBufferWrap(total + serialAlignment,
+                                               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                               | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                               | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
+    char* mapped;
+    VkDeviceAddress base = alignedAddress(VK->m_device, readback, mapped);
+
+    cmdBuf = VK->createTempCmdBuffer();
+    for (uint32_t i = 0;  i < count;  i++) {
+        VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR};
+        copyInfo.src  = accels[i];
+        copyInfo.dst.deviceAddress = base + offsets[i];
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+        vkCmdCopyAccelerationStructureToMemoryKHR(cmdBuf, &copyInfo); }
+
+    // The flush's wait covers execution only; the serialized data must
+    // also be made visible to the host before it's read through mapped.
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    VK->submitTempCmdBuffer(cmdBuf);
+    VK->m_batch.flush();
+
+    for (uint32_t i = 0;  i < count;  i++) {
+        std::ofstream file(path(keys[i]), std::ios::binary);
+        if (!file.write(mapped + offsets[i], sizes[i])) {
+            printf("AS cache: can't write %s\n", path(keys[i]).c_str());
+            continue; }
+        m_stored++;
+        m_bytesWritten += sizes[i]; }
+
+    readback.destroy(VK->m_device);
+}
+
+void AsCache::printStats()
+{
+    if (!enabled())
+        return;
+    printf("AS cache: %u loaded (%.1f MB), %u missing, %u incompatible, %u stored (%.1f MB)\n",
+           m_hits, m_bytesRead / (1024.0 * 1024.0), m_misses, m_incompatible,
+           m_stored, m_bytesWritten / (1024.0 * 1024.0));
+}
@@ -0,0 +1,58 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "acceleration_wrap.h"
+
+class VkApp;
+
+// An on-disk cache of serialized (compacted) BLASes, so that later
+// runs deserialize them instead of building.
+//
+// A BLAS's file is named by a key (a hash of the mesh's vertices and
+// indices, mixed with its build flags), plus the device's UUID and
+// driver version: any change to either is a miss.  Serialized data
+// begins with a driver UUID and a compatibility UUID, which load()
+// also checks with vkGetDeviceAccelerationStructureCompatibilityKHR,
+// treating an incompatible file as a miss.
+//
+// Both directions record into temp command buffers (so, at startup,
+// into m_batch), via host visible staging buffers destroyed after the
+// next flush.  store() flushes twice: once to read the serialized
+// sizes, once to read the data.
+class AsCache
+{
+public:
+    void setup(VkApp* _VK, const std::string& dir = "as_cache");
+    bool enabled() const { return !m_dir.empty(); }
+
+    // Create as, and record its deserialization; false on a miss.
+    bool load(uint64_t key, WrapAccelerationStructure& as);
+
+    // Serialize the acceleration structures (built and, if requested,
+    // compacted) and write their files.
+    void store(const std::vector<uint64_t>& keys, const std::vector<VkAccelerationStructureKHR>& accels);
+
+    void printStats();
+
+private:
+    VkApp*      VK{nullptr};
+    std::string m_dir;
+    std::string m_deviceTag;     // Device UUID and driver version, in file names
+
+    // Statistics
+    uint32_t     m_hits{0};
+    uint32_t     m_misses{0};
+    uint32_t     m_incompatible{0};
+    uint32_t     m_stored{0};
+    VkDeviceSize m_bytesRead{0};
+    VkDeviceSize m_bytesWritten{0};
+
+    std::string path(uint64_t key) const;
+};
+
+// FNV-1a, for cache keys.
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull);
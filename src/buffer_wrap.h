@@ -1,14 +1,24 @@
 
 # pragma once
 
+#include "allocator_wrap.h"
+
 struct BufferWrap
 {
-    VkBuffer buffer;
-    VkDeviceMemory memory;
+    VkBuffer buffer{};
+    VkDeviceMemory memory{};
+    VkDeviceSize offset{0};           // Where in memory the buffer is bound
+    void* mapped{nullptr};            // Persistent host pointer, for host visible buffers
+
+    MemoryAllocation allocation{};
+    MemoryAllocator* allocator{nullptr};  // Null if memory is owned outright
     
     void destroy(VkDevice& device)
     {
         vkDestroyBuffer(device, buffer, nullptr);
-        vkFreeMemory(device, memory, nullptr);
+        if (allocator)
+            allocator->free(allocation);
+        else
+            vkFreeMemory(device, memory, nullptr);
     }
 };
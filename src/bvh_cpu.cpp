@@ -0,0 +1,405 @@
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+#include "bvh_cpu.h"
+
+static const int maxBins         = 64;
+static const int maxDepth        = 64;  // Deeper nodes become leaves, whatever their size
+static const int maxSpatialDepth = 48;  // No spatial splits below this
+
+// A triangle, or (after spatial splits) the part of one in a box.
+struct Ref
+{
+    Aabb     bounds;
+    uint32_t prim;
+};
+
+// The build's tree, flattened into CpuBvh::nodes at the end.  Kept
+// as separate allocations so subtrees can be built concurrently.
+struct BuildNode
+{
+    Aabb                       bounds;
+    std::unique_ptr<BuildNode> child[2];
+    std::vector<uint32_t>      prims;  // Leaves only
+};
+
+struct Split
+{
+    float    cost{1e30f};
+    int      axis{-1};     // -1: no valid split
+    int      bin{0};       // Left takes bins [0, bin]
+    bool     spatial{false};
+    Aabb     left, right;
+    uint32_t leftCount{0}, rightCount{0};
+};
+
+// Per axis, the references binned by centroid.
+struct ObjectBins
+{
+    Aabb     bounds[3][maxBins];
+    uint32_t count[3][maxBins]{};
+
+    void merge(const ObjectBins& other)
+    {
+        for (int a = 0;  a < 3;  a++)
+            for (int b = 0;  b < maxBins;  b++) {
+                bounds[a][b].grow(other.bounds[a][b]);
+                count[a][b] += other.count[a][b]; }
+    }
+};
+
+// Per axis, the references clipped into equal slabs of the node, and
+// the counts of references starting (entry) and ending (exit) in each.
+struct SpatialBins
+{
+    Aabb     bounds[3][maxBins];
+    uint32_t entry[3][maxBins]{};
+    uint32_t exit[3][maxBins]{};
+
+    void merge(const SpatialBins& other)
+    {
+        for (int a = 0;  a < 3;  a++)
+            for (int b = 0;  b < maxBins;  b++) {
+                bounds[a][b].grow(other.bounds[a][b]);
+                entry[a][b] += other.entry[a][b];
+                exit[a][b]  += other.exit[a][b]; }
+    }
+};
+
+static vec3 center(const Aabb& b)
+{
+    return 0.5f * (b.lo + b.hi);
+}
+
+// The best of the planes between bins on one axis.  Left of the
+// plane after bin i are leftAdd[0..i]; right are rightAdd[i+1..].
+static void sweep(const Aabb* bounds, const uint32_t* leftAdd, const uint32_t* rightAdd,
+                  int bins, int axis, bool spatial, float nodeArea,
+                  const BvhOptions& options, Split& best)
+{
+    Aabb     rightBox[maxBins];
+    uint32_t rightCount[maxBins];
+    Aabb     box;
+    uint32_t count = 0;
+    for (int i = bins - 1;  i > 0;  i--) {
+        box.grow(bounds[i]);
+        count += rightAdd[i];
+        rightBox[i]   = box;
+        rightCount[i] = count; }
+
+    box = Aabb();
+    count = 0;
+    for (int i = 0;  i < bins - 1;  i++) {
+        box.grow(bounds[i]);
+        count += leftAdd[i];
+        if (count == 0 || rightCount[i + 1] == 0)
+            continue;
+        float cost = options.traversalCost
+            + options.intersectCost * (box.area() * count + rightBox[i + 1].area() * rightCount[i + 1])
+            / nodeArea;
+        if (cost < best.cost)
+            best = {cost, axis, i, spatial, box, rightBox[i + 1], count, rightCount[i + 1]}; }
+}
+
+class BvhBuilder
+{
+public:
+    BvhBuilder(ThreadPool& pool, const std::vector<Vertex>& vertices,
+               const std::vector<uint32_t>& indices, const BvhOptions& options)
+        : pool(pool), vertices(vertices), indices(indices), options(options)
+    {
+        bins = std::max(2, std::min(maxBins, options.bins));
+    }
+
+    void build(BuildNode& root)
+    {
+        uint32_t triangles = (uint32_t)(indices.size() / 3);
+        std::vector<Ref> refs(triangles);
+        pool.parallelFor(0, (int)triangles, [&](int b, int e) {
+            for (int t = b;  t < e;  t++) {
+                refs[t].prim = t;
+                for (int k = 0;  k < 3;  k++)
+                    refs[t].bounds.grow(vertex(t, k)); } }, 4096);
+
+        references    = triangles;
+        maxReferences = (uint32_t)(triangles * (1.0f + std::max(0.0f, options.maxDuplication)));
+        Aabb bounds;
+        for (const Ref& ref : refs)
+            bounds.grow(ref.bounds);
+        rootArea = bounds.area();
+        buildNode(root, refs, 0);
+    }
+
+    std::atomic<uint32_t> spatialSplits{0};
+
+private:
+    ThreadPool&                  pool;
+    const std::vector<Vertex>&   vertices;
+    const std::vector<uint32_t>& indices;
+    const BvhOptions&            options;
+    int                          bins;
+    float                        rootArea{0};
+    std::atomic<uint32_t>        references{0};
+    uint32_t                     maxReferences{0};
+
+    const vec3& vertex(uint32_t prim, int k) const { return vertices[indices[3 * prim + k]].pos; }
+
+    int objectBin(const Aabb& centroids, int axis, float c) const
+    {
+        float extent = centroids.hi[axis] - centroids.lo[axis];
+        if (extent <= 0.0f)
+            return 0;
+        return std::max(0, std::min(bins - 1, int((c - centroids.lo[axis]) * (bins / extent))));
+    }
+
+    int spatialBin(const Aabb& node, int axis, float x) const
+    {
+        float extent = node.hi[axis] - node.lo[axis];
+        return std::max(0, std::min(bins - 1, int((x - node.lo[axis]) * (bins / extent))));
+    }
+
+    // The box of the part of prim between lo and hi on axis, within clip.
+    Aabb clipTriangle(uint32_t prim, int axis, float lo, float hi, const Aabb& clip) const
+    {
+        Aabb box;
+        for (int k = 0;  k < 3;  k++) {
+            const vec3& a = vertex(prim, k);
+            const vec3& b = vertex(prim, (k + 1) % 3);
+            if (a[axis] >= lo && a[axis] <= hi)
+                box.grow(a);
+            for (float plane : {lo, hi})
+                if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+                    vec3 p = glm::mix(a, b, (plane - a[axis]) / (b[axis] - a[axis]));
+                    p[axis] = plane;
+                    box.grow(p); } }
+        return box.intersect(clip);
+    }
+
+    // Fill bins from all refs; large nodes are binned in parallel chunks.
+    template <typename Bins, typename Fill>
+    void binRefs(const std::vector<Ref>& refs, Bins& result, Fill fill)
+    {
+        if ((int)refs.size() < options.parallelThreshold) {
+            fill(0, (int)refs.size(), result);
+            return; }
+        std::mutex mutex;
+        pool.parallelFor(0, (int)refs.size(), [&](int b, int e) {
+            auto local = std::make_unique<Bins>();
+            fill(b, e, *local);
+            std::lock_guard<std::mutex> lock(mutex);
+            result.merge(*local); }, 1024);
+    }
+
+    Split objectSplit(const std::vector<Ref>& refs, const Aabb& node, const Aabb& centroids)
+    {
+        auto binned = std::make_unique<ObjectBins>();
+        binRefs(refs, *binned, [&](int b, int e, ObjectBins& out) {
+            for (int r = b;  r < e;  r++) {
+                vec3 c = center(refs[r].bounds);
+                for (int a = 0;  a < 3;  a++) {
+                    int bin = objectBin(centroids, a, c[a]);
+                    out.bounds[a][bin].grow(refs[r].bounds);
+                    out.count[a][bin]++; } } });
+
+        Split best;
+        for (int a = 0;  a < 3;  a++)
+            if (centroids.hi[a] > centroids.lo[a])
+                sweep(binned->bounds[a], binned->count[a], binned->count[a], bins, a, false,
+                      node.area(), options, best);
+        return best;
+    }
+
+    Split spatialSplit(const std::vector<Ref>& refs, const Aabb& node)
+    {
+        auto binned = std::make_unique<SpatialBins>();
+        binRefs(refs, *binned, [&](int b, int e, SpatialBins& out) {
+            for (int r = b;  r < e;  r++) {
+                const Ref& ref = refs[r];
+                for (int a = 0;  a < 3;  a++) {
+                    if (node.hi[a] <= node.lo[a])
+                        continue;
+                    float width = (node.hi[a] - node.lo[a]) / bins;
+                    int first = spatialBin(node, a, ref.bounds.lo[a]);
+                    int last  = spatialBin(node, a, ref.bounds.hi[a]);
+                    for (int bin = first;  bin <= last;  bin++) {
+                        if (first == last) {
+                            out.bounds[a][bin].grow(ref.bounds);
+                            continue; }
+                        float lo = node.lo[a] + bin * width;
+                        Aabb part = clipTriangle(ref.prim, a, lo, lo + width, ref.bounds);
+                        if (!part.empty())
+                            out.bounds[a][bin].grow(part); }
+                    out.entry[a][first]++;
+                    out.exit[a][last]++; } } });
+
+        Split best;
+        for (int a = 0;  a < 3;  a++)
+            if (node.hi[a] > node.lo[a])
+                sweep(binned->bounds[a], binned->entry[a], binned->exit[a], bins, a, true,
+                      node.area(), options, best);
+        return best;
+    }
+
+    void partitionObject(std::vector<Ref>& refs, const Split& split, const Aabb& centroids,
+                         std::vector<Ref>& left, std::vector<Ref>& right)
+    {
+        for (const Ref& ref : refs)
+            (objectBin(centroids, split.axis, center(ref.bounds)[split.axis]) <= split.bin
+             ? left : right).push_back(ref);
+    }
+
+    // References straddling the plane are split in two, unless moving
+    // the whole reference to one side is cheaper (reference unsplitting).
+    void partitionSpatial(std::vector<Ref>& refs, const Split& split, const Aabb& node,
+                          std::vector<Ref>& left, std::vector<Ref>& right)
+    {
+        int   axis  = split.axis;
+        float plane = node.lo[axis] + (split.bin + 1) * (node.hi[axis] - node.lo[axis]) / bins;
+        float areaL = split.left.area(), areaR = split.right.area();
+        float countL = (float)split.leftCount, countR = (float)split.rightCount;
+        uint32_t duplicates = 0;
+        for (const Ref& ref : refs) {
+            if (ref.bounds.hi[axis] <= plane) {
+                left.push_back(ref);
+                continue; }
+            if (ref.bounds.lo[axis] >= plane) {
+                right.push_back(ref);
+                continue; }
+
+            Aabb toLeft = split.left,  toRight = split.right;
+            toLeft.grow(ref.bounds);
+            toRight.grow(ref.bounds);
+            float costSplit = areaL * countL + areaR * countR;
+            float costLeft  = toLeft.area() * countL + areaR * (countR - 1);
+            float costRight = areaL * (countL - 1) + toRight.area() * countR;
+            Aabb partL = clipTriangle(ref.prim, axis, -1e30f, plane, ref.bounds);
+            Aabb partR = clipTriangle(ref.prim, axis, plane, 1e30f, ref.bounds);
+            if (partR.empty() || (costLeft < costSplit && costLeft <= costRight))
+                left.push_back(ref);
+            else if (partL.empty() || costRight < costSplit)
+                right.push_back(ref);
+            else {
+                left.push_back({partL, ref.prim});
+                right.push_back({partR, ref.prim});
+                duplicates++; } }
+        references += duplicates;
+        spatialSplits++;
+    }
+
+    void buildNode(BuildNode& node, std::vector<Ref>& refs, int depth)
+    {
+        Aabb centroids;
+        for (const Ref& ref : refs) {
+            node.bounds.grow(ref.bounds);
+            centroids.grow(center(ref.bounds)); }
+        uint32_t count = (uint32_t)refs.size();
+
+        Split best;
+        if (count > 1 && depth < maxDepth) {
+            best = objectSplit(refs, node.bounds, centroids);
+            bool overlapping = best.axis < 0
+                || best.left.intersect(best.right).area() > options.splitAlpha * rootArea;
+            if (options.spatialSplits && overlapping && depth < maxSpatialDepth
+                && references.load() < maxReferences) {
+                Split spatial = spatialSplit(refs, node.bounds);
+                if (spatial.cost < best.cost)
+                    best = spatial; } }
+
+        float leafCost = options.intersectCost * count;
+        bool  small    = count <= (uint32_t)options.maxLeafSize;
+        if (count <= 1 || depth >= maxDepth || (small && (best.axis < 0 || leafCost <= best.cost))) {
+            for (const Ref& ref : refs)
+                node.prims.push_back(ref.prim);
+            return; }
+
+        std::vector<Ref> left, right;
+        if (best.axis >= 0 && best.spatial)
+            partitionSpatial(refs, best, node.bounds, left, right);
+        else if (best.axis >= 0)
+            partitionObject(refs, best, centroids, left, right);
+        if (left.empty() || right.empty()) {
+            // No usable plane (e.g. all centroids coincide): halve the list.
+            left.assign(refs.begin(), refs.begin() + count / 2);
+            right.assign(refs.begin() + count / 2, refs.end()); }
+        std::vector<Ref>().swap(refs);
+
+        node.child[0] = std::make_unique<BuildNode>();
+        node.child[1] = std::make_unique<BuildNode>();
+        if ((int)left.size() >= options.parallelThreshold && (int)right.size() >= options.parallelThreshold) {
+            ThreadPool::TaskGroup group;
+            pool.run(group, [&]() { buildNode(*node.child[0], left, depth + 1); });
+            buildNode(*node.child[1], right, depth + 1);
+            pool.wait(group); }
+        else {
+            buildNode(*node.child[0], left, depth + 1);
+            buildNode(*node.child[1], right, depth + 1); }
+    }
+};
+
+// Depth first into nodes; returns node's index.
+static uint32_t flatten(CpuBvh& bvh, const BuildNode& node, uint32_t depth)
+{
+    uint32_t index = (uint32_t)bvh.nodes.size();
+    bvh.nodes.push_back({node.bounds});
+    bvh.stats.maxDepth = std::max(bvh.stats.maxDepth, depth);
+    if (!node.child[0]) {
+        bvh.nodes[index].index = (uint32_t)bvh.primIndices.size();
+        bvh.nodes[index].count = (uint32_t)node.prims.size();
+        bvh.primIndices.insert(bvh.primIndices.end(), node.prims.begin(), node.prims.end());
+        bvh.stats.leaves++;
+        return index; }
+    flatten(bvh, *node.child[0], depth + 1);
+    uint32_t right = flatten(bvh, *node.child[1], depth + 1);
+    bvh.nodes[index].index = right;
+    return index;
+}
+
+void CpuBvh::build(ThreadPool& pool, const std::vector<Vertex>& vertices,
+                   const std::vector<uint32_t>& indices, const BvhOptions& options)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    nodes.clear();
+    primIndices.clear();
+    stats = BvhStats();
+    if (indices.size() < 3)
+        return;
+
+    BuildNode  root;
+    BvhBuilder builder(pool, vertices, indices, options);
+    builder.build(root);
+    flatten(*this, root, 0);
+
+    stats.buildMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+    stats.triangles     = (uint32_t)(indices.size() / 3);
+    stats.references    = (uint32_t)primIndices.size();
+    stats.nodes         = (uint32_t)nodes.size();
+    stats.spatialSplits = builder.spatialSplits.load();
+    stats.sahCost       = sahCost(options);
+}
+
+double CpuBvh::sahCost(const BvhOptions& options) const
+{
+    if (nodes.empty() || nodes[0].bounds.area() <= 0.0f)
+        return 0.0;
+    double rootArea = nodes[0].bounds.area();
+    double cost = 0.0;
+    for (const BvhNode& node : nodes) {
+        double relative = node.bounds.area() / rootArea;
+        cost += node.count ? options.intersectCost * node.count * relative
+                           : options.traversalCost * relative; }
+    return cost;
+}
+
+void CpuBvh::printStats(const char* label) const
+{
+    printf("%-24s %8u tris %8u refs (%5u spatial) %8u nodes %8u leaves (%.2f/leaf) depth %2u  SAH %8.2f  %8.2f ms\n",
+           label, stats.triangles, stats.references, stats.spatialSplits, stats.nodes, stats.leaves,
+           stats.leaves ? double(stats.references) / stats.leaves : 0.0, stats.maxDepth,
+           stats.sahCost, stats.buildMs);
+}
@@ -0,0 +1,87 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "shaders/shared_structs.h"
+#include "thread_pool.h"
+
+// A CPU bounding volume hierarchy over a triangle mesh (vertices and
+// indices as in ModelData), for measuring BVH quality and build
+// speed on machines without a GPU.  The driver's BLAS builds are
+// opaque; this gives a reference SAH cost for the same triangles,
+// and a place to try build options.
+//
+// The build is top-down binned SAH (object splits), optionally with
+// spatial splits (SBVH), which split triangles straddling a plane
+// into two references when that beats the best object split.  Both
+// the binning of large nodes and the subtrees run on a ThreadPool.
+
+struct Aabb
+{
+    vec3 lo{1e30f};
+    vec3 hi{-1e30f};
+
+    void  grow(const vec3& p) { lo = glm::min(lo, p);  hi = glm::max(hi, p); }
+    void  grow(const Aabb& b) { lo = glm::min(lo, b.lo);  hi = glm::max(hi, b.hi); }
+    bool  empty() const { return lo.x > hi.x || lo.y > hi.y || lo.z > hi.z; }
+    float area() const
+    {
+        if (empty())
+            return 0.0f;
+        vec3 d = hi - lo;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+    Aabb  intersect(const Aabb& b) const { return {glm::max(lo, b.lo), glm::min(hi, b.hi)}; }
+};
+
+// Depth first: an interior node's left child follows it, and index
+// is its right child.  A leaf's count triangles are primIndices[index...].
+struct BvhNode
+{
+    Aabb     bounds;
+    uint32_t index{0};
+    uint32_t count{0};  // Zero for interior nodes
+};
+
+struct BvhOptions
+{
+    int   bins{32};               // Per axis, for both split kinds
+    int   maxLeafSize{8};         // Larger leaves are always split
+    float traversalCost{1.0f};    // SAH cost of visiting a node,
+    float intersectCost{1.0f};    //   and of testing a triangle
+    bool  spatialSplits{false};
+    float splitAlpha{1e-5f};      // Try spatial splits when the object split's child
+                                  //   overlap is this fraction of the root's area
+    float maxDuplication{0.3f};   // References at most (1 + this) times the triangles
+    int   parallelThreshold{4096};  // Nodes with fewer references build on one thread
+};
+
+struct BvhStats
+{
+    double   sahCost{0};
+    uint32_t nodes{0};
+    uint32_t leaves{0};
+    uint32_t maxDepth{0};
+    uint32_t triangles{0};
+    uint32_t references{0};      // Triangles in leaves; more than triangles with spatial splits
+    uint32_t spatialSplits{0};
+    double   buildMs{0};
+};
+
+class CpuBvh
+{
+public:
+    std::vector<BvhNode>  nodes;
+    std::vector<uint32_t> primIndices;  // Triangle indices, referenced by leaves
+    BvhStats              stats;
+
+    void build(ThreadPool& pool, const std::vector<Vertex>& vertices,
+               const std::vector<uint32_t>& indices, const BvhOptions& options = {});
+
+    // Sum over nodes of their cost times their area, over the root's area.
+    double sahCost(const BvhOptions& options) const;
+
+    void printStats(const char* label) const;
+};
@@ -0,0 +1,98 @@
+// Command line harness for the CPU BVH builder (bvh_cpu.h).
+//
+//   bvh_tool.exe <model> [-bins n] [-leaf n] [-alpha a] [-dup d] [-split percent] [-threads n] [-runs n]
+//      Reads the model as rtrt.exe does (default: the living room),
+//      and builds its BVH with binned SAH, then again with spatial
+//      splits, reporting each build's SAH cost, node counts and time
+//      (the fastest of -runs builds).  With -split, also builds both
+//      after rtrt.exe -s's triangle splitting.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "bvh_cpu.h"
+#include "model_data.h"
+#include "triangle_split.h"
+
+static void usage()
+{
+    printf("Usage: bvh_tool.exe [model] [-bins n] [-leaf n] [-alpha a] [-dup d] [-split percent] [-threads n] [-runs n]\n");
+    exit(-1);
+}
+
+static void buildAndReport(ThreadPool& pool, const std::vector<Vertex>& vertices,
+                           const std::vector<uint32_t>& indices, const BvhOptions& options,
+                           int runs, const char* label)
+{
+    CpuBvh bvh;
+    double fastest = 1e30;
+    for (int r = 0;  r < runs;  r++) {
+        bvh.build(pool, vertices, indices, options);
+        fastest = std::min(fastest, bvh.stats.buildMs); }
+    bvh.stats.buildMs = fastest;
+    bvh.printStats(label);
+}
+
+int main(int argc, char** argv)
+{
+    std::string modelName = "models/living_room/living_room.obj";
+    int argi = 1;
+    if (argi < argc && argv[argi][0] != '-')
+        modelName = argv[argi++];
+
+    BvhOptions options;
+    int threads = 0;
+    int runs = 1;
+    float split = 0.0f;
+    while (argi < argc) {
+        std::string arg = argv[argi++];
+        if (argi >= argc)
+            usage();
+        if (arg == "-bins")
+            options.bins = atoi(argv[argi++]);
+        else if (arg == "-leaf")
+            options.maxLeafSize = std::max(1, atoi(argv[argi++]));
+        else if (arg == "-alpha")
+            options.splitAlpha = atof(argv[argi++]);
+        else if (arg == "-dup")
+            options.maxDuplication = atof(argv[argi++]);
+        else if (arg == "-threads")
+            threads = atoi(argv[argi++]);
+        else if (arg == "-split")
+            split = atof(argv[argi++]);
+        else if (arg == "-runs")
+            runs = std::max(1, atoi(argv[argi++]));
+        else {
+            printf("Unknown argument: %s\n", arg.c_str());
+            usage(); } }
+
+    ModelData model;
+    model.readAssimpFile(modelName, mat4(1.0f));
+
+    ThreadPool pool(threads);
+    printf("%s: %zu triangles; %d bins, leaves up to %d, %u threads\n", modelName.c_str(),
+           model.indicies.size() / 3, options.bins, options.maxLeafSize, pool.size());
+
+    options.spatialSplits = false;
+    buildAndReport(pool, model.vertices, model.indicies, options, runs, "binned SAH");
+    options.spatialSplits = true;
+    buildAndReport(pool, model.vertices, model.indicies, options, runs, "binned SAH + spatial");
+
+    if (split <= 0.0f)
+        return 0;
+    SplitMesh splitMesh = splitTriangles(model.vertices, model.indicies, split / 100.0f);
+    printf("Split %u triangles, into %zd more\n", splitMesh.splitCount,
+           splitMesh.remap.size() - model.indicies.size() / 3);
+    if (splitMesh.splitCount == 0)
+        return 0;
+    std::vector<Vertex> positions;
+    for (const vec3& p : splitMesh.positions)
+        positions.push_back({p, vec3(0), vec2(0)});
+    options.spatialSplits = false;
+    buildAndReport(pool, positions, splitMesh.indices, options, runs, "split + binned SAH");
+    options.spatialSplits = true;
+    buildAndReport(pool, positions, splitMesh.indices, options, runs, "split + spatial");
+    return 0;
+}
@@ -0,0 +1,85 @@
+
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+
+#include "vkapp.h"
+#include "command_batch.h"
+
+void CommandBatch::setup(VkApp* _VK)
+{
+    VK = _VK;
+}
+
+void CommandBatch::begin()
+{
+    assert(!m_active);
+    m_active = true;
+    m_segments = 0;
+    m_submits = 0;
+}
+
+void CommandBatch::end()
+{
+    flush();
+    m_active = false;
+    printf("Command batch: %u one-shot command buffers in %u submits (%u submits and waits avoided)\n",
+           m_segments, m_submits, m_segments > m_submits ? m_segments - m_submits : 0);
+}
+
+VkCommandBuffer CommandBatch::beginSegment()
+{
+    assert(m_active);
+    if (m_cmdBuf == VK_NULL_HANDLE) {
+        VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocateInfo.commandBufferCount = 1;
+        allocateInfo.commandPool        = VK->m_cmdPool;
+        allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        if (vkAllocateCommandBuffers(VK->m_device, &allocateInfo, &m_cmdBuf) != VK_SUCCESS)
+            throw std::runtime_error("failed to allocate batch command buffer!");
+
+        VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(m_cmdBuf, &beginInfo); }
+    return m_cmdBuf;
+}
+
+void CommandBatch::endSegment(VkCommandBuffer cmdBuf)
+{
+    assert(cmdBuf == m_cmdBuf);
+    m_segments++;
+
+    // The helpers don't say what they touch, so order everything: the
+    // same guarantee a separate submit followed by a wait gave, less
+    // host visibility (which needs a flush).
+    VkMemoryBarrier2 barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    barrier.srcStageMask  = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+    barrier.dstStageMask  = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+    VkDependencyInfo dependency{VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependency.memoryBarrierCount = 1;
+    dependency.pMemoryBarriers    = &barrier;
+    vkCmdPipelineBarrier2(cmdBuf, &dependency);
+}
+
+void CommandBatch::destroyAfterFlush(std::function<void()> destroy)
+{
+    if (m_active)
+        m_destroys.push_back(destroy);
+    else
+        destroy();  // Not deferring: the work is already done
+}
+
+void CommandBatch::flush()
+{
+    if (m_cmdBuf != VK_NULL_HANDLE) {
+        // Ends, submits (behind any pending uploads), waits, and frees.
+        VK->executeTempCmdBuffer(m_cmdBuf);
+        m_cmdBuf = VK_NULL_HANDLE;
+        m_submits++; }
+
+    for (auto& destroy : m_destroys)
+        destroy();
+    m_destroys.clear();
+}
@@ -0,0 +1,50 @@
+
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+class VkApp;
+
+// Deferred recording of one-shot (createTempCmdBuffer /
+// submitTempCmdBuffer) work.
+//
+// Between begin() and end(), createTempCmdBuffer hands out the batch's
+// one open command buffer instead of a new one, and
+// submitTempCmdBuffer, instead of submitting and waiting, closes the
+// caller's segment with a full memory barrier (all commands, all
+// writes) so that each segment still sees the previous ones' results
+// as if they had been separate, waited on, submits.  Nothing reaches
+// the GPU until a flush point: flush(), end(), or code that needs
+// results on the CPU calling flush() itself (e.g. reading query
+// results).  A flush is one submit and one fence wait.
+//
+// Objects a segment uses can't be destroyed right after the segment
+// (the old code's pattern); destroyAfterFlush() keeps them until the
+// next flush has waited.
+class CommandBatch
+{
+public:
+    void setup(VkApp* _VK);
+
+    void begin();
+    void end();         // flush(), stop deferring, and print the counts
+    bool active() const { return m_active; }
+
+    VkCommandBuffer beginSegment();                 // For createTempCmdBuffer
+    void            endSegment(VkCommandBuffer cmdBuf);  // For submitTempCmdBuffer
+
+    void destroyAfterFlush(std::function<void()> destroy);
+    void flush();
+
+private:
+    VkApp*          VK{nullptr};
+    bool            m_active{false};
+    VkCommandBuffer m_cmdBuf{VK_NULL_HANDLE};   // Open, if any segments since the last flush
+    std::vector<std::function<void()>> m_destroys;
+
+    // Statistics
+    uint32_t m_segments{0};
+    uint32_t m_submits{0};
+};
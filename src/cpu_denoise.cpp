@@ -0,0 +1,187 @@
+
+// Command line harness for the CPU denoise/reprojection kernels.
+//
+//   cpu_denoise.exe compare <dump.gbd> [-tol t] [-bad fraction] [-bench n] [-threads n]
+//      Runs both kernels on a G-buffer dump captured with F12 in
+//      rtrt.exe and compares against the GPU results in the dump.
+//
+//   cpu_denoise.exe denoise <dump.gbd> <out.pfm> [-iter n] [-threads n]
+//      Offline denoise of the dump's colCurr image.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "denoise_cpu.h"
+
+struct Diff
+{
+    double maxErr{0};
+    double sumErr{0};
+    size_t bad{0};
+    size_t count{0};
+};
+
+// Per channel difference; a channel is bad if off by more than
+// tol relative to the GPU value (absolute below 1.0).
+static void compareChannel(Diff& diff, float cpu, float gpu, float tol)
+{
+    double err = std::fabs(double(cpu) - double(gpu));
+    if (std::isnan(cpu) != std::isnan(gpu))
+        err = INFINITY;
+    else if (std::isnan(cpu))
+        err = 0.0;
+    diff.maxErr = std::max(diff.maxErr, err);
+    diff.sumErr += std::isfinite(err) ? err : 0.0;
+    diff.count++;
+    if (err > tol * std::max(1.0, std::fabs(double(gpu))))
+        diff.bad++;
+}
+
+static bool report(const char* what, const Diff& diff, double maxBad)
+{
+    double frac = diff.count ? double(diff.bad) / diff.count : 0.0;
+    bool pass = frac <= maxBad;
+    printf("%-24s max err %-12g mean err %-12g out of tolerance %zu/%zu (%.4f%%)  %s\n",
+           what, diff.maxErr, diff.count ? diff.sumErr / diff.count : 0.0,
+           diff.bad, diff.count, 100.0 * frac, pass ? "PASS" : "FAIL");
+    return pass;
+}
+
+template <typename F>
+static double timeIt(int runs, F f)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0;  r < runs;  r++)
+        f();
+    std::chrono::duration<double, std::milli> ms = std::chrono::high_resolution_clock::now() - start;
+    return ms.count() / runs;
+}
+
+static const std::vector<vec4>* require(const GBufferDump& dump, const char* name)
+{
+    const std::vector<vec4>* img = dump.find(name);
+    if (!img)
+        printf("Dump has no %s image\n", name);
+    return img;
+}
+
+static void usage()
+{
+    printf("Usage: cpu_denoise.exe compare <dump.gbd> [-tol t] [-bad fraction] [-bench n] [-threads n]\n");
+    printf("       cpu_denoise.exe denoise <dump.gbd> <out.pfm> [-iter n] [-threads n]\n");
+    exit(-1);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+        usage();
+
+    std::string mode = argv[1];
+    std::string dumpName = argv[2];
+    std::string outName;
+    int argi = 3;
+    if (mode == "denoise") {
+        if (argc < 4)
+            usage();
+        outName = argv[argi++]; }
+    else if (mode != "compare")
+        usage();
+
+    float tol = 1e-3f;
+    double maxBad = 0.001;
+    int bench = 0;
+    int threads = 0;
+    int iterations = -1;
+    while (argi < argc) {
+        std::string arg = argv[argi++];
+        if (argi >= argc)
+            usage();
+        if (arg == "-tol")
+            tol = atof(argv[argi++]);
+        else if (arg == "-bad")
+            maxBad = atof(argv[argi++]);
+        else if (arg == "-bench")
+            bench = atoi(argv[argi++]);
+        else if (arg == "-threads")
+            threads = atoi(argv[argi++]);
+        else if (arg == "-iter")
+            iterations = atoi(argv[argi++]);
+        else {
+            printf("Unknown argument: %s\n", arg.c_str());
+            usage(); } }
+
+    GBufferDump dump;
+    if (!readGBufferDump(dumpName, dump))
+        return 1;
+    if (iterations < 0)
+        iterations = dump.atrousIterations;
+
+    ThreadPool pool(threads);
+    printf("%s: %dx%d, %zu images; %s, %u threads\n", dumpName.c_str(), dump.width, dump.height,
+           dump.images.size(), denoiseSimdName(), pool.size());
+
+    const std::vector<vec4>* colCurr = require(dump, "colCurr");
+    const std::vector<vec4>* kdCurr  = require(dump, "kdCurr");
+    const std::vector<vec4>* ndCurr  = require(dump, "ndCurr");
+    if (!colCurr || !kdCurr || !ndCurr)
+        return 1;
+
+    std::vector<vec4> denoised;
+    auto runDenoise = [&] {
+        denoiseCPU(pool, dump.width, dump.height, *colCurr, *kdCurr, *ndCurr,
+                   dump.pcDenoise, iterations, denoised); };
+
+    if (mode == "denoise") {
+        printf("denoise: %.3f ms\n", timeIt(1, runDenoise));
+        return writePFM(outName, dump.width, dump.height, denoised) ? 0 : 1; }
+
+    bool pass = true;
+
+    // The A-Trous chain against the GPU's final m_scImageBuffer.
+    if (const std::vector<vec4>* gpu = require(dump, "denoised")) {
+        runDenoise();
+        Diff diff;
+        for (size_t i = 0;  i < denoised.size();  i++) {
+            compareChannel(diff, denoised[i].x, (*gpu)[i].x, tol);
+            compareChannel(diff, denoised[i].y, (*gpu)[i].y, tol);
+            compareChannel(diff, denoised[i].z, (*gpu)[i].z, tol); }
+        pass = report("denoise", diff, maxBad) && pass; }
+
+    // Reprojection against the GPU's colCurr.  The color is checked
+    // where the frame's own path traced sample was blended in; without
+    // a sample image (older dumps) only the history length (.w) can be.
+    const std::vector<vec4>* colPrev = dump.find("colPrev");
+    const std::vector<vec4>* ndPrev  = dump.find("ndPrev");
+    const std::vector<vec4>* sample  = dump.find("sample");
+    std::vector<vec4> reprojected;
+    auto runReproject = [&] {
+        reprojectCPU(pool, dump.width, dump.height, dump.mats, *colPrev, *ndPrev, *ndCurr,
+                     sample, reprojected); };
+    if (colPrev && ndPrev) {
+        runReproject();
+        Diff diffW, diffRGB;
+        for (size_t i = 0;  i < reprojected.size();  i++) {
+            compareChannel(diffW, reprojected[i].w, (*colCurr)[i].w, tol);
+            if (sample && (*sample)[i].w > 0.0f) {
+                compareChannel(diffRGB, reprojected[i].x, (*colCurr)[i].x, tol);
+                compareChannel(diffRGB, reprojected[i].y, (*colCurr)[i].y, tol);
+                compareChannel(diffRGB, reprojected[i].z, (*colCurr)[i].z, tol); } }
+        pass = report("reproject history length", diffW, maxBad) && pass;
+        if (sample)
+            pass = report("reproject color", diffRGB, maxBad) && pass; }
+    else
+        printf("No colPrev/ndPrev in dump; reprojection not checked\n");
+
+    if (bench > 0) {
+        printf("denoise:   %.3f ms\n", timeIt(bench, runDenoise));
+        if (colPrev && ndPrev)
+            printf("reproject: %.3f ms\n", timeIt(bench, runReproject)); }
+
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,498 @@
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "denoise_cpu.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// A minimal float vector type: 8 lanes of AVX2, 4 lanes of NEON, or a
+// single lane of plain C++.  The kernels below are written once
+// against it.
+namespace {
+
+#if defined(__AVX2__)
+const int LANES = 8;
+struct vfloat { __m256 v; };
+struct vint   { __m256i v; };
+
+inline vfloat vset(float a)             { return {_mm256_set1_ps(a)}; }
+inline vfloat vload(const float* p)     { return {_mm256_loadu_ps(p)}; }
+inline void   vstore(float* p, vfloat a) { _mm256_storeu_ps(p, a.v); }
+inline vfloat operator+(vfloat a, vfloat b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline vfloat operator-(vfloat a, vfloat b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline vfloat operator*(vfloat a, vfloat b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline vfloat operator/(vfloat a, vfloat b) { return {_mm256_div_ps(a.v, b.v)}; }
+inline vfloat vmin(vfloat a, vfloat b)  { return {_mm256_min_ps(a.v, b.v)}; }
+inline vfloat vmax(vfloat a, vfloat b)  { return {_mm256_max_ps(a.v, b.v)}; }
+inline vfloat vsqrt(vfloat a)           { return {_mm256_sqrt_ps(a.v)}; }
+inline vfloat vfloor(vfloat a)          { return {_mm256_floor_ps(a.v)}; }
+// Lane mask, all ones where a == b
+inline vfloat veq(vfloat a, vfloat b)   { return {_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)}; }
+inline vfloat vlt(vfloat a, vfloat b)   { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline vfloat vselect(vfloat m, vfloat a, vfloat b) { return {_mm256_blendv_ps(b.v, a.v, m.v)}; }
+inline vint   vtrunc(vfloat a) { return {_mm256_cvttps_epi32(a.v)}; }
+inline vfloat vpow2i(vint n)   // 2^n for integer n
+{
+    __m256i e = _mm256_add_epi32(n.v, _mm256_set1_epi32(127));
+    return {_mm256_castsi256_ps(_mm256_slli_epi32(e, 23))};
+}
+inline void   vstorei(int* p, vint a) { _mm256_storeu_si256((__m256i*)p, a.v); }
+const char* SIMD_NAME = "AVX2";
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+const int LANES = 4;
+struct vfloat { float32x4_t v; };
+struct vint   { int32x4_t v; };
+
+inline vfloat vset(float a)             { return {vdupq_n_f32(a)}; }
+inline vfloat vload(const float* p)     { return {vld1q_f32(p)}; }
+inline void   vstore(float* p, vfloat a) { vst1q_f32(p, a.v); }
+inline vfloat operator+(vfloat a, vfloat b) { return {vaddq_f32(a.v, b.v)}; }
+inline vfloat operator-(vfloat a, vfloat b) { return {vsubq_f32(a.v, b.v)}; }
+inline vfloat operator*(vfloat a, vfloat b) { return {vmulq_f32(a.v, b.v)}; }
+inline vfloat operator/(vfloat a, vfloat b) { return {vdivq_f32(a.v, b.v)}; }
+inline vfloat vmin(vfloat a, vfloat b)  { return {vminq_f32(a.v, b.v)}; }
+inline vfloat vmax(vfloat a, vfloat b)  { return {vmaxq_f32(a.v, b.v)}; }
+inline vfloat vsqrt(vfloat a)           { return {vsqrtq_f32(a.v)}; }
+inline vfloat vfloor(vfloat a)          { return {vrndmq_f32(a.v)}; }
+inline vfloat veq(vfloat a, vfloat b)   { return {vreinterpretq_f32_u32(vceqq_f32(a.v, b.v))}; }
+inline vfloat vlt(vfloat a, vfloat b)   { return {vreinterpretq_f32_u32(vcltq_f32(a.v, b.v))}; }
+inline vfloat vselect(vfloat m, vfloat a, vfloat b)
+{
+    return {vbslq_f32(vreinterpretq_u32_f32(m.v), a.v, b.v)};
+}
+inline vint   vtrunc(vfloat a) { return {vcvtq_s32_f32(a.v)}; }
+inline vfloat vpow2i(vint n)
+{
+    int32x4_t e = vaddq_s32(n.v, vdupq_n_s32(127));
+    return {vreinterpretq_f32_s32(vshlq_n_s32(e, 23))};
+}
+inline void   vstorei(int* p, vint a) { vst1q_s32(p, a.v); }
+const char* SIMD_NAME = "NEON";
+
+#else
+const int LANES = 1;
+struct vfloat { float v; };
+struct vint   { int v; };
+
+inline float  maskBits(bool b) { uint32_t u = b ? 0xffffffffu : 0u; float f; memcpy(&f, &u, 4); return f; }
+inline uint32_t floatBits(float f) { uint32_t u; memcpy(&u, &f, 4); return u; }
+
+inline vfloat vset(float a)             { return {a}; }
+inline vfloat vload(const float* p)     { return {*p}; }
+inline void   vstore(float* p, vfloat a) { *p = a.v; }
+inline vfloat operator+(vfloat a, vfloat b) { return {a.v + b.v}; }
+inline vfloat operator-(vfloat a, vfloat b) { return {a.v - b.v}; }
+inline vfloat operator*(vfloat a, vfloat b) { return {a.v * b.v}; }
+inline vfloat operator/(vfloat a, vfloat b) { return {a.v / b.v}; }
+inline vfloat vmin(vfloat a, vfloat b)  { return {std::min(a.v, b.v)}; }
+inline vfloat vmax(vfloat a, vfloat b)  { return {std::max(a.v, b.v)}; }
+inline vfloat vsqrt(vfloat a)           { return {std::sqrt(a.v)}; }
+inline vfloat vfloor(vfloat a)          { return {std::floor(a.v)}; }
+inline vfloat veq(vfloat a, vfloat b)   { return {maskBits(a.v == b.v)}; }
+inline vfloat vlt(vfloat a, vfloat b)   { return {maskBits(a.v < b.v)}; }
+inline vfloat vselect(vfloat m, vfloat a, vfloat b) { return {floatBits(m.v) ? a.v : b.v}; }
+inline vint   vtrunc(vfloat a) { return {(int)a.v}; }
+inline vfloat vpow2i(vint n)   { return {std::ldexp(1.0f, n.v)}; }
+inline void   vstorei(int* p, vint a) { *p = a.v; }
+const char* SIMD_NAME = "scalar";
+#endif
+
+// exp(x) for the vector type; the Cephes single precision
+// polynomial, accurate to a couple of ulps over the clamped range.
+inline vfloat vexp(vfloat x)
+{
+    x = vmin(x, vset(88.3762626647949f));
+    x = vmax(x, vset(-87.0f));
+
+    vfloat fx = vfloor(x * vset(1.44269504088896341f) + vset(0.5f));
+    x = x - fx * vset(0.693359375f);
+    x = x - fx * vset(-2.12194440e-4f);
+
+    vfloat y = vset(1.9875691500E-4f);
+    y = y * x + vset(1.3981999507E-3f);
+    y = y * x + vset(8.3334519073E-3f);
+    y = y * x + vset(4.1665795894E-2f);
+    y = y * x + vset(1.6666665459E-1f);
+    y = y * x + vset(5.0000001201E-1f);
+    y = y * x * x + x + vset(1.0f);
+
+    return y * vpow2i(vtrunc(fx));
+}
+
+// A single channel image with a border of zeros on all sides, so the
+// A-Trous taps' loads stay in memory.  Taps outside the image are
+// left out of the sum, as denoise.comp skips them.
+struct Plane
+{
+    int pad{0};
+    int stride{0};
+    std::vector<float> data;
+
+    void init(int width, int height, int _pad)
+    {
+        pad = _pad;
+        // The extra LANES on the right let the last vector of a row run past the width.
+        stride = pad + width + pad + LANES;
+        data.assign(size_t(stride) * (pad + height + pad), 0.0f);
+    }
+
+    float* row(int y) { return data.data() + size_t(y + pad) * stride + pad; }
+};
+
+const float gaussian[5] = {1.0f/16.0f, 4.0f/16.0f, 6.0f/16.0f, 4.0f/16.0f, 1.0f/16.0f};
+
+}  // namespace
+
+const char* denoiseSimdName()
+{
+    return SIMD_NAME;
+}
+
+////////////////////////////////////////////////////////////////////////
+// A-Trous denoise
+void denoiseCPU(ThreadPool& pool, int width, int height,
+                const std::vector<vec4>& color,
+                const std::vector<vec4>& kd,
+                const std::vector<vec4>& nd,
+                PushConstantDenoise pc, int iterations,
+                std::vector<vec4>& result)
+{
+    int maxStep = 1 << std::max(0, iterations - 1);
+    int pad = 2 * maxStep;
+
+    // Inputs split into planes: the clamped Kd and the current color
+    // (un-padded use), plus the demodulated color and the normal:depth
+    // which are read at offsets.
+    Plane kR, kG, kB, vR, vG, vB;
+    Plane dR, dG, dB, nX, nY, nZ, dep;
+    for (Plane* p : {&kR, &kG, &kB, &vR, &vG, &vB, &dR, &dG, &dB, &nX, &nY, &nZ, &dep})
+        p->init(width, height, pad);
+
+    pool.parallelFor(0, height, [&](int y0, int y1) {
+        for (int y = y0;  y < y1;  y++) {
+            float *kr = kR.row(y), *kg = kG.row(y), *kb = kB.row(y);
+            float *vr = vR.row(y), *vg = vG.row(y), *vb = vB.row(y);
+            float *nx = nX.row(y), *ny = nY.row(y), *nz = nZ.row(y), *d = dep.row(y);
+            for (int x = 0;  x < width;  x++) {
+                const vec4& k = kd[size_t(y) * width + x];
+                const vec4& c = color[size_t(y) * width + x];
+                const vec4& n = nd[size_t(y) * width + x];
+                kr[x] = std::min(std::max(k.x, 0.1f), 1.0f);
+                kg[x] = std::min(std::max(k.y, 0.1f), 1.0f);
+                kb[x] = std::min(std::max(k.z, 0.1f), 1.0f);
+                vr[x] = c.x;  vg[x] = c.y;  vb[x] = c.z;
+                nx[x] = n.x;  ny[x] = n.y;  nz[x] = n.z;  d[x] = n.w; } } });
+
+    int stepwidth = 1;
+    for (int a = 0;  a < iterations;  a++) {
+        // pDem = pVal/pKd, computed once per pass rather than per tap.
+        pool.parallelFor(0, height, [&](int y0, int y1) {
+            for (int y = y0;  y < y1;  y++) {
+                for (int x = 0;  x < width;  x++) {
+                    dR.row(y)[x] = vR.row(y)[x] / kR.row(y)[x];
+                    dG.row(y)[x] = vG.row(y)[x] / kG.row(y)[x];
+                    dB.row(y)[x] = vB.row(y)[x] / kB.row(y)[x]; } } });
+
+        // Per pass constants of the depth and normal weights; a zero
+        // factor turns that weight off (weight 1, i.e. exp(0)).
+        float depthScale = pc.depthFactor == 0.0f ? 0.0f : -1.0f / pc.depthFactor;
+        float normScale  = pc.normFactor == 0.0f ? 0.0f
+                         : -1.0f / (float(stepwidth * stepwidth) * pc.normFactor);
+        int step = stepwidth;
+
+        // Each lane's x offset within a vector, for the taps' bounds test.
+        float laneOffsets[LANES];
+        for (int k = 0;  k < LANES;  k++)
+            laneOffsets[k] = float(k);
+
+        pool.parallelFor(0, height, [&](int y0, int y1) {
+            for (int y = y0;  y < y1;  y++) {
+                for (int x = 0;  x < width;  x += LANES) {
+                    vfloat cNx = vload(nX.row(y) + x);
+                    vfloat cNy = vload(nY.row(y) + x);
+                    vfloat cNz = vload(nZ.row(y) + x);
+                    vfloat cD  = vload(dep.row(y) + x);
+
+                    vfloat numR = vset(0.0f), numG = vset(0.0f), numB = vset(0.0f);
+                    vfloat den  = vset(0.0f);
+
+                    for (int i = -2;  i <= 2;  i++) {
+                        for (int j = -2;  j <= 2;  j++) {
+                            // denoise.comp offsets by ivec2(i,j): i is along x.
+                            int px = x + i * step;
+                            int py = y + j * step;
+                            if (py < 0 || py >= height)
+                                continue;
+
+                            vfloat t = cD - vload(dep.row(py) + px);
+                            vfloat ex = t * t * vset(depthScale);
+
+                            vfloat ux = cNx - vload(nX.row(py) + px);
+                            vfloat uy = cNy - vload(nY.row(py) + px);
+                            vfloat uz = cNz - vload(nZ.row(py) + px);
+                            ex = ex + (ux * ux + uy * uy + uz * uz) * vset(normScale);
+
+                            // exp(a)*exp(b) == exp(a+b): one exp per tap.
+                            vfloat w = vset(gaussian[i + 2] * gaussian[j + 2]) * vexp(ex);
+                            if (px < 0 || px + LANES > width) {
+                                vfloat tx = vset(float(px)) + vload(laneOffsets);
+                                w = vselect(vlt(tx, vset(0.0f)), vset(0.0f),
+                                            vselect(vlt(tx, vset(float(width))), w, vset(0.0f))); }
+
+                            numR = numR + vload(dR.row(py) + px) * w;
+                            numG = numG + vload(dG.row(py) + px) * w;
+                            numB = numB + vload(dB.row(py) + px) * w;
+                            den  = den + w; } }
+
+                    // outVal = cKd*numerator/denominator, or cVal if denominator is 0.
+                    vfloat zero = veq(den, vset(0.0f));
+                    vfloat oR = vselect(zero, vload(vR.row(y) + x), vload(kR.row(y) + x) * numR / den);
+                    vfloat oG = vselect(zero, vload(vG.row(y) + x), vload(kG.row(y) + x) * numG / den);
+                    vfloat oB = vselect(zero, vload(vB.row(y) + x), vload(kB.row(y) + x) * numB / den);
+
+                    // The color planes are only read at the center pixel,
+                    // so the result can replace them in place.
+                    vstore(vR.row(y) + x, oR);
+                    vstore(vG.row(y) + x, oG);
+                    vstore(vB.row(y) + x, oB); } } });
+
+        stepwidth *= 2; }
+
+    result.resize(size_t(width) * height);
+    for (int y = 0;  y < height;  y++)
+        for (int x = 0;  x < width;  x++)
+            result[size_t(y) * width + x] = vec4(vR.row(y)[x], vG.row(y)[x], vB.row(y)[x], 0.0f);
+}
+
+////////////////////////////////////////////////////////////////////////
+// History reprojection
+void reprojectCPU(ThreadPool& pool, int width, int height,
+                  const MatrixUniforms& mats,
+                  const std::vector<vec4>& colPrev,
+                  const std::vector<vec4>& ndPrev,
+                  const std::vector<vec4>& ndCurr,
+                  const std::vector<vec4>* sample,
+                  std::vector<vec4>& result)
+{
+    result.resize(size_t(width) * height);
+
+    const float n_threshold = 0.80f;
+    const float d_threshold = 0.15f;
+
+    glm::mat4 toWorld = mats.viewInverse * mats.projInverse;
+    glm::vec3 eyeW = glm::vec3(mats.viewInverse * glm::vec4(0, 0, 0, 1));
+    glm::mat4 prior = mats.priorViewProj;
+
+    // imageLoad of an out-of-bounds texel returns vec4(0).
+    auto load = [width, height](const std::vector<vec4>& img, int x, int y) {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return vec4(0.0f);
+        return img[size_t(y) * width + x]; };
+
+    pool.parallelFor(0, height, [&](int y0, int y1) {
+        alignas(32) float lane[LANES], dep[LANES], hit[LANES];
+        alignas(32) float nx[LANES], ny[LANES], nz[LANES];
+        alignas(32) float sx[LANES], sy[LANES], ox[LANES], oy[LANES];
+        alignas(32) int   ix[LANES], iy[LANES];
+
+        for (int y = y0;  y < y1;  y++) {
+            for (int x0 = 0;  x0 < width;  x0 += LANES) {
+                int count = std::min(LANES, width - x0);
+
+                // Camera ray direction (before normalizing) for each lane.
+                for (int l = 0;  l < LANES;  l++) {
+                    int x = std::min(x0 + l, width - 1);
+                    const vec4& n = ndCurr[size_t(y) * width + x];
+                    lane[l] = float(x0 + l);
+                    nx[l] = n.x;  ny[l] = n.y;  nz[l] = n.z;  dep[l] = n.w;
+                    hit[l] = n.w > 0.0f ? 1.0f : 0.0f; }  // No first hit leaves depth 0
+
+                vfloat px = (vload(lane) + vset(0.5f)) / vset(float(width)) * vset(2.0f) - vset(1.0f);
+                vfloat py = vset((float(y) + 0.5f) / float(height) * 2.0f - 1.0f);
+
+                // pixelH = viewInverse * projInverse * vec4(ndc, 1, 1)
+                auto row = [&](int r) {
+                    return vset(toWorld[0][r]) * px + vset(toWorld[1][r]) * py
+                         + vset(toWorld[2][r] + toWorld[3][r]); };
+                vfloat hw = row(3);
+                vfloat dx = row(0) / hw - vset(eyeW.x);
+                vfloat dy = row(1) / hw - vset(eyeW.y);
+                vfloat dz = row(2) / hw - vset(eyeW.z);
+                vfloat inv = vset(1.0f) / vsqrt(dx * dx + dy * dy + dz * dz);
+
+                // firstPos = eye + rayDirection * firstDepth, as in raytrace.rchit.
+                vfloat d  = vload(dep);
+                vfloat wx = vset(eyeW.x) + dx * inv * d;
+                vfloat wy = vset(eyeW.y) + dy * inv * d;
+                vfloat wz = vset(eyeW.z) + dz * inv * d;
+
+                // screen = ((priorViewProj * firstPos).xy/w + 1)/2
+                auto prj = [&](int r) {
+                    return vset(prior[0][r]) * wx + vset(prior[1][r]) * wy
+                         + vset(prior[2][r]) * wz + vset(prior[3][r]); };
+                vfloat sw = prj(3);
+                vfloat scx = (prj(0) / sw + vset(1.0f)) / vset(2.0f);
+                vfloat scy = (prj(1) / sw + vset(1.0f)) / vset(2.0f);
+                vstore(sx, scx);
+                vstore(sy, scy);
+
+                // floc = screen*size - 0.5;  offset = fract(floc);  iloc = ivec2(floc)
+                vfloat flx = scx * vset(float(width)) - vset(0.5f);
+                vfloat fly = scy * vset(float(height)) - vset(0.5f);
+                vstore(ox, flx - vfloor(flx));
+                vstore(oy, fly - vfloor(fly));
+                vstorei(ix, vtrunc(flx));
+                vstorei(iy, vtrunc(fly));
+
+                // The 2x2 fetch is a gather; done per lane.
+                for (int l = 0;  l < count;  l++) {
+                    int x = x0 + l;
+                    size_t idx = size_t(y) * width + x;
+
+                    vec4  P(0.0f);
+                    float total_weight = 0.0f;
+                    for (int i = 0;  i <= 1;  i++) {
+                        for (int j = 0;  j <= 1;  j++) {
+                            float bx = i == 0 ? 1.0f - ox[l] : ox[l];
+                            float by = j == 0 ? 1.0f - oy[l] : oy[l];
+                            vec4 prevNd = load(ndPrev, ix[l] + i, iy[l] + j);
+                            float depth_weight  = std::fabs(dep[l] - prevNd.w) < d_threshold ? 1.0f : 0.0f;
+                            float normal_weight = nx[l] * prevNd.x + ny[l] * prevNd.y + nz[l] * prevNd.z
+                                                  > n_threshold ? 1.0f : 0.0f;
+                            float final_weight = bx * by * depth_weight * normal_weight;
+                            total_weight += final_weight;
+                            P += load(colPrev, ix[l] + i, iy[l] + j) * final_weight; } }
+
+                    bool offScreen = sx[l] < 0.0f || sx[l] > 1.0f || sy[l] < 0.0f || sy[l] > 1.0f;
+                    if (hit[l] == 0.0f || offScreen || total_weight == 0.0f) {
+                        result[idx] = vec4(vec3(0.3f), 1.0f);
+                        continue; }
+
+                    P = P / total_weight;
+                    float newN = P.w + 1.0f;
+                    vec3 newAve = vec3(P);
+                    if (sample && (*sample)[idx].w == 0.0f)
+                        newN = P.w;
+                    else if (sample)
+                        newAve = newAve + (vec3((*sample)[idx]) - newAve) / newN;
+
+                    // The shader skips the store on NaN/inf, leaving last
+                    // frame's color, which raytrace() copied into colPrev.
+                    if (std::isfinite(newAve.x) && std::isfinite(newAve.y)
+                        && std::isfinite(newAve.z) && std::isfinite(newN))
+                        result[idx] = vec4(newAve, newN);
+                    else
+                        result[idx] = colPrev[idx]; } } } });
+}
+
+////////////////////////////////////////////////////////////////////////
+// G-buffer dump files:
+//   "GBD1", int width, height, atrousIterations, imageCount,
+//   MatrixUniforms, PushConstantDenoise,
+//   then per image: char name[16], float rgba[width*height*4]
+const std::vector<vec4>* GBufferDump::find(const std::string& name) const
+{
+    for (size_t i = 0;  i < names.size();  i++)
+        if (names[i] == name)
+            return &images[i];
+    return nullptr;
+}
+
+std::vector<vec4>& GBufferDump::add(const std::string& name)
+{
+    names.push_back(name);
+    images.emplace_back(size_t(width) * height, vec4(0.0f));
+    return images.back();
+}
+
+bool writeGBufferDump(const std::string& filename, const GBufferDump& dump)
+{
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        printf("Could not open %s for writing\n", filename.c_str());
+        return false; }
+
+    int header[4] = {dump.width, dump.height, dump.atrousIterations, (int)dump.images.size()};
+    fwrite("GBD1", 1, 4, f);
+    fwrite(header, sizeof(header), 1, f);
+    fwrite(&dump.mats, sizeof(MatrixUniforms), 1, f);
+    fwrite(&dump.pcDenoise, sizeof(PushConstantDenoise), 1, f);
+
+    for (size_t i = 0;  i < dump.images.size();  i++) {
+        char name[16] = {};
+        strncpy(name, dump.names[i].c_str(), sizeof(name) - 1);
+        fwrite(name, sizeof(name), 1, f);
+        fwrite(dump.images[i].data(), sizeof(vec4), dump.images[i].size(), f); }
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+bool readGBufferDump(const std::string& filename, GBufferDump& dump)
+{
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        printf("Could not open %s\n", filename.c_str());
+        return false; }
+
+    char magic[4];
+    int  header[4];
+    bool ok = fread(magic, 4, 1, f) == 1 && memcmp(magic, "GBD1", 4) == 0
+        && fread(header, sizeof(header), 1, f) == 1
+        && fread(&dump.mats, sizeof(MatrixUniforms), 1, f) == 1
+        && fread(&dump.pcDenoise, sizeof(PushConstantDenoise), 1, f) == 1;
+
+    if (ok) {
+        dump.width = header[0];
+        dump.height = header[1];
+        dump.atrousIterations = header[2];
+        dump.names.clear();
+        dump.images.clear();
+        for (int i = 0;  ok && i < header[3];  i++) {
+            char name[16];
+            ok = fread(name, sizeof(name), 1, f) == 1;
+            name[15] = 0;
+            std::vector<vec4>& img = dump.add(name);
+            ok = ok && fread(img.data(), sizeof(vec4), img.size(), f) == img.size(); } }
+
+    fclose(f);
+    if (!ok)
+        printf("%s is not a valid G-buffer dump\n", filename.c_str());
+    return ok;
+}
+
+bool writePFM(const std::string& filename, int width, int height, const std::vector<vec4>& image)
+{
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        printf("Could not open %s for writing\n", filename.c_str());
+        return false; }
+
+    // PFM rows run bottom to top; a negative scale means little-endian.
+    fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+    std::vector<float> row(size_t(width) * 3);
+    for (int y = height - 1;  y >= 0;  y--) {
+        for (int x = 0;  x < width;  x++) {
+            const vec4& p = image[size_t(y) * width + x];
+            row[3 * x + 0] = p.x;  row[3 * x + 1] = p.y;  row[3 * x + 2] = p.z; }
+        fwrite(row.data(), sizeof(float), row.size(), f); }
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
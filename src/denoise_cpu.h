@@ -0,0 +1,68 @@
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "shaders/shared_structs.h"
+#include "thread_pool.h"
+
+// CPU versions of the A-Trous filter in shaders/denoise.comp and the
+// history reprojection in shaders/raytrace.rgen.  These follow the
+// GLSL line for line (including the filter's skipped taps outside the
+// image, and the zeros the reprojection gets from out-of-bounds
+// imageLoad) so they can validate captured GPU output, and double as
+// an offline denoiser on machines without a GPU.
+
+// A set of captured G-buffer images, plus the uniforms and push
+// constants that produced them.  Written by VkApp::captureGBuffer,
+// read by the cpu_denoise tool.  Images are width*height RGBA32F,
+// the same layout as the VK_FORMAT_R32G32B32A32_SFLOAT images.
+struct GBufferDump
+{
+    int                 width{0};
+    int                 height{0};
+    int                 atrousIterations{0};
+    MatrixUniforms      mats{};
+    PushConstantDenoise pcDenoise{};
+
+    std::vector<std::string>       names;
+    std::deque<std::vector<vec4>> images;  // deque: add() keeps earlier references valid
+
+    // Returns nullptr if no image of that name was captured.
+    const std::vector<vec4>* find(const std::string& name) const;
+    std::vector<vec4>&       add(const std::string& name);
+};
+
+bool writeGBufferDump(const std::string& filename, const GBufferDump& dump);
+bool readGBufferDump(const std::string& filename, GBufferDump& dump);
+
+// Writes the .xyz of an image as a (bottom-to-top) PFM file.
+bool writePFM(const std::string& filename, int width, int height, const std::vector<vec4>& image);
+
+// Runs iterations passes of denoise.comp on color (stepwidth 1, 2, 4, ...),
+// exactly as VkApp::denoise does, leaving the final pass in result.
+void denoiseCPU(ThreadPool& pool, int width, int height,
+                const std::vector<vec4>& color,
+                const std::vector<vec4>& kd,
+                const std::vector<vec4>& nd,
+                PushConstantDenoise pc, int iterations,
+                std::vector<vec4>& result);
+
+// The history part of raytrace.rgen.  The first hit is rebuilt from
+// ndCurr (normal, depth) and the camera matrices.  sample is the
+// frame's path traced color, with .w 0 where raytrace blended none in
+// (an untraced pixel keeps its history).  If sample is null, the .xyz
+// of each reprojected pixel is the history color before blending; .w
+// is always the new history length.
+void reprojectCPU(ThreadPool& pool, int width, int height,
+                  const MatrixUniforms& mats,
+                  const std::vector<vec4>& colPrev,
+                  const std::vector<vec4>& ndPrev,
+                  const std::vector<vec4>& ndCurr,
+                  const std::vector<vec4>* sample,
+                  std::vector<vec4>& result);
+
+// Name of the instruction set the kernels were compiled for.
+const char* denoiseSimdName();
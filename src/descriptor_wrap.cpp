@@ -62,9 +62,10 @@ void DescriptorWrap::destroy(VkDevice device)
     vkDestroyDescriptorPool(device, descPool, nullptr);
 }
 
-void DescriptorWrap::write(VkDevice& device, uint index, const VkBuffer& buffer)
+void DescriptorWrap::write(VkDevice& device, uint index, const VkBuffer& buffer,
+                           VkDeviceSize range)
 {
-    VkDescriptorBufferInfo desBuf{buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo desBuf{buffer, 0, range};
     VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
     writeSet.dstSet          = descSet;
     writeSet.dstBinding      = index;
@@ -19,7 +19,8 @@ public:
     void destroy(VkDevice device);
 
     // Any data can be written into a descriptor set.  Apparently I need only these few types:
-    void write(VkDevice& device, uint index, const VkBuffer& buffer);
+    void write(VkDevice& device, uint index, const VkBuffer& buffer,
+               VkDeviceSize range=VK_WHOLE_SIZE);
     void write(VkDevice& device, uint index, const VkDescriptorImageInfo& textureDesc);
     void write(VkDevice& device, uint index, const std::vector<ImageWrap>& textures);
     void write(VkDevice& device, uint index, const VkAccelerationStructureKHR& tlas);
@@ -0,0 +1,85 @@
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#define STBI_FAILURE_USERMSG
+#include "stb_image.h"
+
+#include "env_map.h"
+
+static const float pi = 3.14159265f;
+
+bool loadEnvMap(const std::string& path, EnvMap& env, int lowWidth)
+{
+    int channels;
+    stbi_set_flip_vertically_on_load(false);
+    float* data = stbi_loadf(path.c_str(), &env.width, &env.height, &channels, 4);
+    if (!data) {
+        printf("Environment map %s: %s\n", path.c_str(), stbi_failure_reason());
+        return false; }
+    env.pixels.assign((vec4*)data, (vec4*)data + (size_t)env.width * env.height);
+    stbi_image_free(data);
+
+    // Box filter, each low resolution pixel averaging the pixels whose
+    // corners fall in it.
+    env.lowWidth  = std::max(1, std::min(lowWidth, env.width));
+    env.lowHeight = std::max(1, env.height * env.lowWidth / env.width);
+    env.low.assign((size_t)env.lowWidth * env.lowHeight, vec4(0.0f));
+    std::vector<float> counts(env.low.size(), 0.0f);
+    for (int y = 0;  y < env.height;  y++)
+        for (int x = 0;  x < env.width;  x++) {
+            size_t l = (size_t)(y * env.lowHeight / env.height) * env.lowWidth + x * env.lowWidth / env.width;
+            env.low[l] += env.pixels[(size_t)y * env.width + x];
+            counts[l] += 1.0f; }
+    for (size_t l = 0;  l < env.low.size();  l++)
+        env.low[l] /= std::max(1.0f, counts[l]);
+
+    // A pixel's share: its luminance times its solid angle.
+    std::vector<float> weights(env.low.size());
+    for (int y = 0;  y < env.lowHeight;  y++) {
+        float sinTheta = std::sin(pi * (y + 0.5f) / env.lowHeight);
+        for (int x = 0;  x < env.lowWidth;  x++) {
+            const vec4& c = env.low[(size_t)y * env.lowWidth + x];
+            weights[(size_t)y * env.lowWidth + x] = (0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b) * sinTheta; } }
+    env.alias = buildAliasTable(weights);
+
+    printf("Environment map %s: %dx%d, sampled at %dx%d\n", path.c_str(), env.width, env.height,
+           env.lowWidth, env.lowHeight);
+    return true;
+}
+
+std::vector<EnvAlias> buildAliasTable(const std::vector<float>& weights)
+{
+    size_t n = weights.size();
+    std::vector<EnvAlias> table(n);
+    double sum = 0.0;
+    for (float w : weights)
+        sum += std::max(0.0f, w);
+
+    // Scaled so the average is 1; entries below it borrow from entries above.
+    std::vector<float>    scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0;  i < n;  i++) {
+        float pdf = sum > 0.0 ? (float)(std::max(0.0f, weights[i]) / sum) : 1.0f / n;
+        table[i].pdf = pdf;
+        scaled[i] = pdf * n;
+        (scaled[i] < 1.0f ? small : large).push_back((uint32_t)i); }
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        table[s].q = scaled[s];
+        table[s].alias = l;
+        scaled[l] -= 1.0f - scaled[s];
+        if (scaled[l] < 1.0f) {
+            large.pop_back();
+            small.push_back(l); } }
+    // What's left is 1, up to roundoff.
+    for (uint32_t i : large) {
+        table[i].q = 1.0f;
+        table[i].alias = i; }
+    for (uint32_t i : small) {
+        table[i].q = 1.0f;
+        table[i].alias = i; }
+    return table;
+}
@@ -0,0 +1,35 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "shaders/shared_structs.h"
+
+// An HDR environment map (equirectangular, +y up: row 0 looks straight
+// up), and what the ray tracer needs to sample it.
+//
+// Camera rays see the full resolution map.  Every other ray, after a
+// bounce, sees a box filtered low resolution copy: it is what a
+// diffuse bounce integrates anyway, and being small it is cheap to
+// sample exactly.  The alias table draws the low resolution map's
+// pixels in proportion to their luminance times sin(theta) (their
+// solid angle), so that next event estimation goes where the light
+// is; raytrace.rgen turns a pixel's pdf into a solid angle density
+// for MIS against BRDF sampling.
+struct EnvMap
+{
+    int                   width{0}, height{0};
+    std::vector<vec4>     pixels;
+    int                   lowWidth{0}, lowHeight{0};
+    std::vector<vec4>     low;
+    std::vector<EnvAlias> alias;  // Per pixel of low
+};
+
+// Reads a Radiance .hdr (or any file stb_image reads as float), and
+// builds the low resolution map, at most lowWidth wide, and its alias
+// table.  False, with a message, if it can't be read.
+bool loadEnvMap(const std::string& path, EnvMap& env, int lowWidth = 256);
+
+// The alias table of weights (Vose's method); uniform if all are zero.
+std::vector<EnvAlias> buildAliasTable(const std::vector<float>& weights);
@@ -1,6 +1,8 @@
 
 # pragma once
 
+#include "allocator_wrap.h"
+
 struct ImageWrap
 {
     VkImage          image{};
@@ -8,11 +10,18 @@ struct ImageWrap
     VkSampler        sampler{};
     VkImageView      imageView{};
     VkImageLayout    imageLayout{};
+    VkDeviceSize     offset{0};     // Where in memory the image is bound
+
+    MemoryAllocation allocation{};
+    MemoryAllocator* allocator{nullptr};  // Null if memory is owned outright
     
     void destroy(VkDevice device)
     {
         vkDestroyImage(device, image, nullptr);
-        vkFreeMemory(device, memory, nullptr);
+        if (allocator)
+            allocator->free(allocation);
+        else
+            vkFreeMemory(device, memory, nullptr);
         vkDestroyImageView(device, imageView, nullptr);
         vkDestroySampler(device, sampler, nullptr);
     }
@@ -0,0 +1,207 @@
+
+#include <algorithm>
+#include <cmath>
+
+#include "light_tree.h"
+#include "bvh_cpu.h"
+
+static const float pi = 3.14159265f;
+static const int   lightBins = 12;
+
+// A cone of directions; empty until grown.
+struct Cone
+{
+    vec3  axis{0.0f};
+    float cosThetaO{2.0f};  // > 1: empty
+    float cosThetaE{1.0f};
+};
+
+// The smallest cone (near enough) holding both.
+static Cone coneUnion(const Cone& a, const Cone& b)
+{
+    if (a.cosThetaO > 1.0f)
+        return b;
+    if (b.cosThetaO > 1.0f)
+        return a;
+    Cone result;
+    result.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+    float thetaA = std::acos(std::clamp(a.cosThetaO, -1.0f, 1.0f));
+    float thetaB = std::acos(std::clamp(b.cosThetaO, -1.0f, 1.0f));
+    float thetaD = std::acos(std::clamp(glm::dot(a.axis, b.axis), -1.0f, 1.0f));
+    if (std::min(thetaD + thetaB, pi) <= thetaA) {
+        result.axis = a.axis;
+        result.cosThetaO = a.cosThetaO;
+        return result; }
+    if (std::min(thetaD + thetaA, pi) <= thetaB) {
+        result.axis = b.axis;
+        result.cosThetaO = b.cosThetaO;
+        return result; }
+
+    // Rotate a's axis toward b's, to the middle of the spanned arc.
+    float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+    vec3  normal = glm::cross(a.axis, b.axis);
+    if (thetaO >= pi || glm::dot(normal, normal) < 1e-12f) {
+        result.axis = a.axis;
+        result.cosThetaO = -1.0f;  // Every direction
+        return result; }
+    normal = glm::normalize(normal);
+    float thetaR = thetaO - thetaA;
+    vec3  w = a.axis * std::cos(thetaR) + glm::cross(normal, a.axis) * std::sin(thetaR);
+    result.axis = glm::normalize(w);
+    result.cosThetaO = std::cos(thetaO);
+    return result;
+}
+
+// The orientation measure of a cone: the solid angle its lights may
+// shine into, weighted by cosine.
+static float coneMeasure(const Cone& cone)
+{
+    float thetaO = std::acos(std::clamp(cone.cosThetaO, -1.0f, 1.0f));
+    float thetaE = std::acos(std::clamp(cone.cosThetaE, -1.0f, 1.0f));
+    float thetaW = std::min(thetaO + thetaE, pi);
+    float sinO = std::sin(thetaO), cosO = std::cos(thetaO);
+    return 2.0f * pi * (1.0f - cosO)
+        + 0.5f * pi * (2.0f * thetaW * sinO - std::cos(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinO + cosO);
+}
+
+// Surface area, with flat (or thin) boxes thickened a little, so that
+// coplanar lights, or lights in a row, still compare by extent.
+static float boxMeasure(const Aabb& box)
+{
+    if (box.empty())
+        return 0.0f;
+    vec3  d = box.hi - box.lo;
+    float floor = 1e-3f * std::max(d.x, std::max(d.y, d.z)) + 1e-12f;
+    d = glm::max(d, vec3(floor));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+struct LightBounds
+{
+    Aabb  box;
+    Cone  cone;
+    float power{0.0f};
+
+    void grow(const LightBounds& b)
+    {
+        box.grow(b.box);
+        cone = coneUnion(cone, b.cone);
+        power += b.power;
+    }
+    float cost() const { return power * boxMeasure(box) * coneMeasure(cone); }
+};
+
+class LightTreeBuilder
+{
+public:
+    LightTreeBuilder(std::vector<Emitter>& emitters) : m_emitters(emitters)
+    {
+        for (const Emitter& e : emitters) {
+            LightBounds b;
+            b.box.grow(e.v0);
+            b.box.grow(e.v1);
+            b.box.grow(e.v2);
+            b.cone.axis = e.normal;
+            b.cone.cosThetaO = 1.0f;
+            b.cone.cosThetaE = 0.0f;  // Diffuse: out to 90 degrees
+            b.power = 2.0f * pi * e.area * (0.2126f * e.emission.r + 0.7152f * e.emission.g + 0.0722f * e.emission.b);
+            m_bounds.push_back(b);
+            m_centroids.push_back((e.v0 + e.v1 + e.v2) / 3.0f);
+            m_order.push_back((uint32_t)m_order.size()); }
+    }
+
+    std::vector<LightNode> build()
+    {
+        if (m_emitters.empty())
+            return {};
+        m_nodes.push_back({});
+        m_nodes[0].parent = 0;
+        build(0, 0, (uint32_t)m_emitters.size());
+        return std::move(m_nodes);
+    }
+
+private:
+    std::vector<Emitter>&    m_emitters;
+    std::vector<LightBounds> m_bounds;
+    std::vector<vec3>        m_centroids;
+    std::vector<uint32_t>    m_order;
+    std::vector<LightNode>   m_nodes;
+
+    void build(uint32_t node, uint32_t begin, uint32_t end)
+    {
+        LightBounds total;
+        Aabb centroids;
+        for (uint32_t i = begin;  i < end;  i++) {
+            total.grow(m_bounds[m_order[i]]);
+            centroids.grow(m_centroids[m_order[i]]); }
+        LightNode& n = m_nodes[node];
+        n.boundsMin = total.box.lo;
+        n.boundsMax = total.box.hi;
+        n.power     = total.power;
+        n.axis      = total.cone.axis;
+        n.cosThetaO = total.cone.cosThetaO;
+        n.cosThetaE = total.cone.cosThetaE;
+        if (end - begin == 1) {
+            n.leaf  = 1;
+            n.child = m_order[begin];
+            m_emitters[n.child].node = node;
+            return; }
+        n.leaf = 0;
+
+        // The cheapest split over every axis's bins.  The cost is
+        // regularized against splitting thin boxes across.
+        vec3  extent = centroids.hi - centroids.lo;
+        float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+        float bestCost = 1e30f;
+        int   bestAxis = -1, bestBin = 0;
+        for (int axis = 0;  axis < 3;  axis++) {
+            if (extent[axis] <= 0.0f)
+                continue;
+            LightBounds bins[lightBins];
+            for (uint32_t i = begin;  i < end;  i++)
+                bins[binOf(m_centroids[m_order[i]], centroids, axis)].grow(m_bounds[m_order[i]]);
+            LightBounds below[lightBins];
+            LightBounds sweep;
+            for (int b = 0;  b < lightBins - 1;  b++) {
+                sweep.grow(bins[b]);
+                below[b] = sweep; }
+            sweep = LightBounds();
+            float regularize = maxExtent / extent[axis];
+            for (int b = lightBins - 1;  b > 0;  b--) {
+                sweep.grow(bins[b]);
+                if (below[b - 1].box.empty() || sweep.box.empty())
+                    continue;
+                float cost = regularize * (below[b - 1].cost() + sweep.cost());
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b; } } }
+
+        // Lights at one point (or zero power everywhere): halve them.
+        uint32_t mid = begin + (end - begin) / 2;
+        if (bestAxis >= 0) {
+            uint32_t* split = std::partition(m_order.data() + begin, m_order.data() + end, [&](uint32_t i) {
+                return binOf(m_centroids[i], centroids, bestAxis) < bestBin; });
+            uint32_t splitIndex = (uint32_t)(split - m_order.data());
+            if (splitIndex > begin && splitIndex < end)
+                mid = splitIndex; }
+
+        uint32_t children = (uint32_t)m_nodes.size();
+        m_nodes[node].child = children;
+        m_nodes.resize(children + 2);
+        m_nodes[children].parent = m_nodes[children + 1].parent = node;
+        build(children, begin, mid);
+        build(children + 1, mid, end);
+    }
+
+    static int binOf(const vec3& p, const Aabb& centroids, int axis)
+    {
+        float t = (p[axis] - centroids.lo[axis]) / (centroids.hi[axis] - centroids.lo[axis]);
+        return std::min(lightBins - 1, std::max(0, (int)(t * lightBins)));
+    }
+};
+
+std::vector<LightNode> buildLightTree(std::vector<Emitter>& emitters)
+{
+    return LightTreeBuilder(emitters).build();
+}
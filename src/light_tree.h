@@ -0,0 +1,21 @@
+
+#pragma once
+
+#include <vector>
+
+#include "shaders/shared_structs.h"
+
+// A light tree (Conty Estevez and Kulla, "Importance Sampling of Many
+// Lights with Adaptive Tree Splitting"): a BVH over the emitters whose
+// nodes also carry total power and an orientation cone, so a shading
+// point can estimate each subtree's contribution from its distance,
+// its direction, and which way its lights face.  raytrace.rgen picks
+// an emitter by walking down from the root, taking each child in
+// proportion to that estimate, and recovers the probability of an
+// emitter hit by chance by walking up from its leaf.
+//
+// The build is top down, splitting at the binned minimum of the
+// surface area orientation heuristic (area times cone measure times
+// power), one emitter per leaf.  The root is nodes[0].  Each emitter's
+// node is set to its leaf.
+std::vector<LightNode> buildLightTree(std::vector<Emitter>& emitters);
@@ -0,0 +1,330 @@
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+
+#include "mesh_simplify.h"
+
+// A symmetric 4x4 matrix, the sum of w*(n,d)(n,d)^T over the planes
+// n.p + d = 0 near a vertex; (p,1)Q(p,1) is their weighted sum of
+// squared distances to p.
+struct Quadric
+{
+    double a[10]{};  // xx xy xz xd yy yz yd zz zd dd
+    double weight{0.0};
+
+    void addPlane(const glm::dvec3& n, double d, double w)
+    {
+        a[0] += w * n.x * n.x;  a[1] += w * n.x * n.y;  a[2] += w * n.x * n.z;  a[3] += w * n.x * d;
+        a[4] += w * n.y * n.y;  a[5] += w * n.y * n.z;  a[6] += w * n.y * d;
+        a[7] += w * n.z * n.z;  a[8] += w * n.z * d;
+        a[9] += w * d * d;
+        weight += w;
+    }
+
+    void add(const Quadric& q)
+    {
+        for (int i = 0;  i < 10;  i++)
+            a[i] += q.a[i];
+        weight += q.weight;
+    }
+
+    // Mean squared distance of p to the planes
+    double error(const vec3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+            + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+            + a[7] * z * z + 2 * a[8] * z + a[9];
+        return std::max(0.0, e) / std::max(weight, 1e-30);
+    }
+};
+
+static const double borderWeight = 10.0;  // Border planes, relative to face planes
+
+class Simplifier
+{
+public:
+    Simplifier(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+    // Collapse edges, cheapest first, until at most target triangles
+    // remain or no collapse is allowed.
+    void reduce(uint32_t target);
+    MeshLod snapshot() const;
+    uint32_t triangles() const { return m_alive; }
+
+private:
+    struct Collapse
+    {
+        double   cost;
+        uint32_t from, to;           // Position ids: from moves onto to
+        uint32_t fromStamp, toStamp;  // Their stamps when queued
+        bool operator<(const Collapse& c) const { return cost > c.cost; }  // Cheapest on top
+    };
+
+    const std::vector<Vertex>&   m_vertices;
+    const std::vector<uint32_t>& m_indices;
+
+    std::vector<uint32_t> m_wedge;      // Vertex -> position id
+    std::vector<std::vector<uint32_t>> m_wedgeVertices;  // Position id -> its vertices
+    std::vector<vec3>     m_pos;        // Per position id
+    std::vector<Quadric>  m_quadric;
+    std::vector<uint32_t> m_stamp;      // Bumped when a position's quadric or triangles change
+    std::vector<bool>     m_removed;    // Collapsed onto another
+    std::vector<std::vector<uint32_t>> m_triangles;  // Position id -> triangles (some dead)
+    std::vector<uint32_t> m_tri;        // 3 position ids per triangle
+    std::vector<bool>     m_dead;
+    uint32_t              m_alive{0};
+    double                m_maxError{0.0};
+    std::priority_queue<Collapse> m_queue;
+
+    bool hasCorner(uint32_t t, uint32_t p) const
+    {
+        return m_tri[3 * t] == p || m_tri[3 * t + 1] == p || m_tri[3 * t + 2] == p;
+    }
+    void neighbors(uint32_t p, std::vector<uint32_t>& out) const;
+    void queueEdge(uint32_t a, uint32_t b);
+    bool allowed(uint32_t from, uint32_t to) const;
+    void collapse(uint32_t from, uint32_t to);
+    uint32_t closestVertex(uint32_t vertex, uint32_t p) const;
+};
+
+Simplifier::Simplifier(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+    : m_vertices(vertices), m_indices(indices)
+{
+    // Weld: sort the vertices by position; runs of equal ones share an id.
+    std::vector<uint32_t> order(vertices.size());
+    for (uint32_t i = 0;  i < order.size();  i++)
+        order[i] = i;
+    auto less = [&](uint32_t i, uint32_t j) {
+        const vec3& p = vertices[i].pos;
+        const vec3& q = vertices[j].pos;
+        return p.x < q.x || (p.x == q.x && (p.y < q.y || (p.y == q.y && p.z < q.z))); };
+    std::sort(order.begin(), order.end(), less);
+    m_wedge.resize(vertices.size());
+    for (size_t i = 0;  i < order.size();  i++) {
+        if (i == 0 || vertices[order[i]].pos != vertices[order[i - 1]].pos) {
+            m_pos.push_back(vertices[order[i]].pos);
+            m_wedgeVertices.emplace_back(); }
+        m_wedge[order[i]] = (uint32_t)m_pos.size() - 1;
+        m_wedgeVertices.back().push_back(order[i]); }
+
+    size_t positions = m_pos.size();
+    m_quadric.resize(positions);
+    m_stamp.resize(positions, 0);
+    m_removed.resize(positions, false);
+    m_triangles.resize(positions);
+
+    uint32_t count = (uint32_t)(indices.size() / 3);
+    m_tri.resize(3 * count);
+    m_dead.resize(count, false);
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    for (uint32_t t = 0;  t < count;  t++) {
+        for (int k = 0;  k < 3;  k++)
+            m_tri[3 * t + k] = m_wedge[indices[3 * t + k]];
+        uint32_t a = m_tri[3 * t], b = m_tri[3 * t + 1], c = m_tri[3 * t + 2];
+        if (a == b || b == c || c == a) {
+            m_dead[t] = true;
+            continue; }
+        m_alive++;
+        for (int k = 0;  k < 3;  k++) {
+            m_triangles[m_tri[3 * t + k]].push_back(t);
+            uint32_t p = m_tri[3 * t + k], q = m_tri[3 * t + (k + 1) % 3];
+            edgeUses[(uint64_t)std::min(p, q) << 32 | std::max(p, q)]++; }
+
+        glm::dvec3 p0(m_pos[a]), p1(m_pos[b]), p2(m_pos[c]);
+        glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+        double area2 = glm::length(n);
+        if (area2 <= 0.0)
+            continue;
+        n /= area2;
+        for (int k = 0;  k < 3;  k++)
+            m_quadric[m_tri[3 * t + k]].addPlane(n, -glm::dot(n, p0), 0.5 * area2); }
+
+    // A border edge (of one triangle) gets a plane through it,
+    // perpendicular to its triangle, so collapses keep to the border.
+    for (uint32_t t = 0;  t < count;  t++) {
+        if (m_dead[t])
+            continue;
+        glm::dvec3 p0(m_pos[m_tri[3 * t]]), p1(m_pos[m_tri[3 * t + 1]]), p2(m_pos[m_tri[3 * t + 2]]);
+        glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+        if (glm::length(n) <= 0.0)
+            continue;
+        n = glm::normalize(n);
+        for (int k = 0;  k < 3;  k++) {
+            uint32_t p = m_tri[3 * t + k], q = m_tri[3 * t + (k + 1) % 3];
+            if (edgeUses[(uint64_t)std::min(p, q) << 32 | std::max(p, q)] != 1)
+                continue;
+            glm::dvec3 e = glm::dvec3(m_pos[q]) - glm::dvec3(m_pos[p]);
+            glm::dvec3 bn = glm::cross(e, n);
+            double length = glm::length(bn);
+            if (length <= 0.0)
+                continue;
+            bn /= length;
+            double d = -glm::dot(bn, glm::dvec3(m_pos[p]));
+            m_quadric[p].addPlane(bn, d, borderWeight * glm::dot(e, e));
+            m_quadric[q].addPlane(bn, d, borderWeight * glm::dot(e, e)); } }
+
+    for (uint32_t t = 0;  t < count;  t++)
+        if (!m_dead[t])
+            for (int k = 0;  k < 3;  k++) {
+                uint32_t p = m_tri[3 * t + k], q = m_tri[3 * t + (k + 1) % 3];
+                if (p < q || edgeUses[(uint64_t)q << 32 | p] == 1)  // Each edge once
+                    queueEdge(p, q); }
+}
+
+// The live positions sharing a live triangle with p
+void Simplifier::neighbors(uint32_t p, std::vector<uint32_t>& out) const
+{
+    out.clear();
+    for (uint32_t t : m_triangles[p])
+        if (!m_dead[t])
+            for (int k = 0;  k < 3;  k++)
+                if (m_tri[3 * t + k] != p)
+                    out.push_back(m_tri[3 * t + k]);
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+// Queue the cheaper direction of collapsing edge a-b.
+void Simplifier::queueEdge(uint32_t a, uint32_t b)
+{
+    Quadric q = m_quadric[a];
+    q.add(m_quadric[b]);
+    double toB = q.error(m_pos[b]);
+    double toA = q.error(m_pos[a]);
+    if (toB <= toA)
+        m_queue.push({toB, a, b, m_stamp[a], m_stamp[b]});
+    else
+        m_queue.push({toA, b, a, m_stamp[b], m_stamp[a]});
+}
+
+bool Simplifier::allowed(uint32_t from, uint32_t to) const
+{
+    // Link condition: the endpoints' common neighbors are only the
+    // far corners of the triangles on the edge.
+    std::vector<uint32_t> nFrom, nTo, common;
+    neighbors(from, nFrom);
+    neighbors(to, nTo);
+    std::set_intersection(nFrom.begin(), nFrom.end(), nTo.begin(), nTo.end(), std::back_inserter(common));
+    uint32_t shared = 0;
+    for (uint32_t t : m_triangles[from])
+        if (!m_dead[t] && hasCorner(t, to))
+            shared++;
+    if (common.size() != shared)
+        return false;
+
+    // No triangle that stays may flip, or become a sliver.
+    for (uint32_t t : m_triangles[from]) {
+        if (m_dead[t] || hasCorner(t, to))
+            continue;
+        vec3 p[3], q[3];
+        for (int k = 0;  k < 3;  k++) {
+            p[k] = m_pos[m_tri[3 * t + k]];
+            q[k] = m_tri[3 * t + k] == from ? m_pos[to] : p[k]; }
+        vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        vec3 after  = glm::cross(q[1] - q[0], q[2] - q[0]);
+        float lengthAfter = glm::length(after);
+        if (lengthAfter <= 1e-12f || glm::dot(before, after) < 0.2f * glm::length(before) * lengthAfter)
+            return false; }
+    return true;
+}
+
+void Simplifier::collapse(uint32_t from, uint32_t to)
+{
+    for (uint32_t t : m_triangles[from]) {
+        if (m_dead[t])
+            continue;
+        if (hasCorner(t, to)) {
+            m_dead[t] = true;
+            m_alive--;
+            continue; }
+        for (int k = 0;  k < 3;  k++)
+            if (m_tri[3 * t + k] == from)
+                m_tri[3 * t + k] = to;
+        m_triangles[to].push_back(t); }
+    std::vector<uint32_t>().swap(m_triangles[from]);
+    m_removed[from] = true;
+    m_quadric[to].add(m_quadric[from]);
+    m_stamp[from]++;
+    m_stamp[to]++;
+
+    std::vector<uint32_t>& tris = m_triangles[to];
+    tris.erase(std::remove_if(tris.begin(), tris.end(), [this](uint32_t t) { return m_dead[t]; }), tris.end());
+
+    // to's edges cost more now, with from's quadric.
+    std::vector<uint32_t> around;
+    neighbors(to, around);
+    for (uint32_t n : around)
+        queueEdge(to, n);
+}
+
+void Simplifier::reduce(uint32_t target)
+{
+    while (m_alive > target && !m_queue.empty()) {
+        Collapse c = m_queue.top();
+        m_queue.pop();
+        if (m_removed[c.from] || m_removed[c.to]
+            || c.fromStamp != m_stamp[c.from] || c.toStamp != m_stamp[c.to])
+            continue;  // Stale
+        if (!allowed(c.from, c.to))
+            continue;
+        m_maxError = std::max(m_maxError, c.cost);
+        collapse(c.from, c.to); }
+}
+
+// Of position p's vertices, the one whose normal and UV are closest
+// to vertex's: a corner that moved keeps its side of a seam.
+uint32_t Simplifier::closestVertex(uint32_t vertex, uint32_t p) const
+{
+    const Vertex& v = m_vertices[vertex];
+    uint32_t best = m_wedgeVertices[p][0];
+    float    bestDistance = 1e30f;
+    for (uint32_t w : m_wedgeVertices[p]) {
+        const Vertex& c = m_vertices[w];
+        float distance = glm::dot(c.nrm - v.nrm, c.nrm - v.nrm) + glm::dot(c.texCoord - v.texCoord, c.texCoord - v.texCoord);
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = w; } }
+    return best;
+}
+
+MeshLod Simplifier::snapshot() const
+{
+    MeshLod lod;
+    lod.error = (float)std::sqrt(m_maxError);
+    lod.indices.reserve(3 * m_alive);
+    lod.sourceTriangles.reserve(m_alive);
+    for (uint32_t t = 0;  t < m_dead.size();  t++) {
+        if (m_dead[t])
+            continue;
+        for (int k = 0;  k < 3;  k++) {
+            uint32_t vertex = m_indices[3 * t + k];
+            uint32_t p = m_tri[3 * t + k];
+            lod.indices.push_back(m_wedge[vertex] == p ? vertex : closestVertex(vertex, p)); }
+        lod.sourceTriangles.push_back(t); }
+    return lod;
+}
+
+std::vector<MeshLod> buildLodChain(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+                                   int maxLods, float ratio, uint32_t minTriangles)
+{
+    std::vector<MeshLod> lods;
+    uint32_t previous = (uint32_t)(indices.size() / 3);
+    if (previous < 2 * minTriangles)
+        return lods;
+
+    Simplifier simplifier(vertices, indices);
+    for (int l = 0;  l < maxLods;  l++) {
+        uint32_t target = (uint32_t)(ratio * previous);
+        if (target < minTriangles)
+            break;
+        simplifier.reduce(target);
+        // Stuck: every remaining collapse would damage the surface.
+        if (simplifier.triangles() > previous - (previous - target) / 4)
+            break;
+        previous = simplifier.triangles();
+        lods.push_back(simplifier.snapshot()); }
+    return lods;
+}
@@ -0,0 +1,34 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "shaders/shared_structs.h"
+
+// Quadric error metric (Garland-Heckbert) mesh simplification, for
+// levels of detail that share the model's vertex buffer.
+//
+// Vertices at the same position are welded, so edges are collapsed
+// across seams in normals or UVs; each collapse moves one endpoint
+// onto the other (no new vertices), whichever has the smaller error.
+// A collapse is refused if it would flip or flatten a triangle, or
+// pinch the surface (the link condition).  Open borders are held in
+// place by extra quadrics perpendicular to them.
+//
+// A level's triangles are a subset of the original triangles (with
+// moved corners), so each keeps its material: sourceTriangles[i] is
+// level triangle i's original.
+struct MeshLod
+{
+    std::vector<uint32_t> indices;          // Into the original vertices
+    std::vector<uint32_t> sourceTriangles;  // Per triangle of indices
+    float                 error{0.0f};      // Largest displacement so far, in object space
+};
+
+// Successively coarser levels, each with about ratio times the
+// triangles of the one before, until maxLods levels, or fewer than
+// minTriangles triangles, or no more progress.  The original mesh
+// (level 0) is not included.
+std::vector<MeshLod> buildLodChain(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+                                   int maxLods = 4, float ratio = 0.5f, uint32_t minTriangles = 64);
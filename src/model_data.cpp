@@ -0,0 +1,283 @@
+//////////////////////////////////////////////////////////////////////
+// Uses the ASSIMP library to read mesh models in of 30+ file types
+// into a ModelData.
+////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <assimp/Importer.hpp>
+#include <assimp/version.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+#include "model_data.h"
+
+// Local objects and procedures defined and used here:
+void recurseModelNodes(ModelData* meshdata,
+                       const  aiScene* aiscene,
+                       const  aiNode* node,
+                       const aiMatrix4x4& parentTr,
+                       const int level=0);
+
+
+static mat4 toGlm(const aiMatrix4x4& m)
+{
+    return mat4(m.a1, m.b1, m.c1, m.d1,
+                m.a2, m.b2, m.c2, m.d2,
+                m.a3, m.b3, m.c3, m.d3,
+                m.a4, m.b4, m.c4, m.d4);
+}
+
+// The node hierarchy, parents first, into skeleton.nodes.
+static void collectSkeletonNodes(Skeleton& skeleton, const aiNode* node, int parent)
+{
+    int index = (int)skeleton.nodes.size();
+    skeleton.nodes.push_back({node->mName.C_Str(), toGlm(node->mTransformation), parent});
+    for (unsigned int i=0;  i<node->mNumChildren;  ++i)
+        collectSkeletonNodes(skeleton, node->mChildren[i], index);
+}
+
+void ModelData::readAssimpFile(const std::string& path, const mat4& M)
+{
+    printf("ReadAssimpFile File:  %s \n", path.c_str());
+  
+    aiMatrix4x4 modelTr(M[0][0], M[1][0], M[2][0], M[3][0],
+                        M[0][1], M[1][1], M[2][1], M[3][1],
+                        M[0][2], M[1][2], M[2][2], M[3][2],
+                        M[0][3], M[1][3], M[2][3], M[3][3]);
+
+    // Does the file exist?
+    std::ifstream find_it(path.c_str());
+    if (find_it.fail()) {
+        std::cerr << "File not found: "  << path << std::endl;
+        exit(-1); }
+
+    // Invoke assimp to read the file.
+    printf("Assimp %d.%d Reading %s\n", aiGetVersionMajor(), aiGetVersionMinor(), path.c_str());
+    Assimp::Importer importer;
+    const aiScene* aiscene = importer.ReadFile(path.c_str(),
+                                               aiProcess_Triangulate|aiProcess_GenSmoothNormals);
+    
+    if (!aiscene) {
+        printf("... Failed to read.\n");
+        exit(-1); }
+
+    if (!aiscene->mRootNode) {
+        printf("Scene has no rootnode.\n");
+        exit(-1); }
+
+    printf("Assimp mNumMeshes: %d\n", aiscene->mNumMeshes);
+    printf("Assimp mNumMaterials: %d\n", aiscene->mNumMaterials);
+    printf("Assimp mNumTextures: %d\n", aiscene->mNumTextures);
+
+    for (int i=0;  i<aiscene->mNumMaterials;  i++) {
+        aiMaterial* mtl = aiscene->mMaterials[i];
+        aiString name;
+        mtl->Get(AI_MATKEY_NAME, name);
+        aiColor3D emit(0.f,0.f,0.f); 
+        aiColor3D diff(0.f,0.f,0.f), spec(0.f,0.f,0.f); 
+        float alpha = 20.0;
+        bool he = mtl->Get(AI_MATKEY_COLOR_EMISSIVE, emit);
+        bool hd = mtl->Get(AI_MATKEY_COLOR_DIFFUSE, diff);
+        bool hs = mtl->Get(AI_MATKEY_COLOR_SPECULAR, spec);
+        bool ha = mtl->Get(AI_MATKEY_SHININESS, &alpha, NULL);
+        aiColor3D trans;
+        bool ht = mtl->Get(AI_MATKEY_COLOR_TRANSPARENT, trans);
+
+        Material newmat;
+        if (!emit.IsBlack()) { // An emitter
+            newmat.diffuse = {1,1,1};  // An emitter needs (1,1,1), else black screen!  WTF???
+            newmat.specular = {0,0,0};
+            newmat.shininess = 0.0;
+            newmat.emission = {emit.r, emit.g, emit.b};
+            newmat.textureId = -1; }
+        
+        else {
+            vec3 Kd(0.5f, 0.5f, 0.5f); 
+            vec3 Ks(0.03f, 0.03f, 0.03f);
+            if (AI_SUCCESS == hd) Kd = vec3(diff.r, diff.g, diff.b);
+            if (AI_SUCCESS == hs) Ks = vec3(spec.r, spec.g, spec.b);
+            newmat.diffuse = {Kd[0], Kd[1], Kd[2]};
+            newmat.specular = {Ks[0], Ks[1], Ks[2]};
+            newmat.shininess = alpha; //sqrtf(2.0f/(2.0f+alpha));
+            newmat.emission = {0,0,0};
+            newmat.textureId = -1;  }
+        
+        aiString texPath;
+        if (AI_SUCCESS == mtl->GetTexture(aiTextureType_DIFFUSE, 0, &texPath)) {
+            fs::path fullPath = path;
+            fullPath.replace_filename(texPath.C_Str());
+            printf("Texture: %ls\n", fullPath.c_str());
+            newmat.textureId = textures.size();
+            auto xxx = fullPath.u8string();
+            textures.push_back(std::string(xxx));
+        }
+        
+        materials.push_back(newmat);
+    }
+    
+    // A skeleton, if any mesh is skinned.  The model transform is
+    // its own node, above the root, so animating the root keeps it.
+    bool skinned = false;
+    for (unsigned int m=0;  m<aiscene->mNumMeshes;  m++)
+        skinned = skinned || aiscene->mMeshes[m]->HasBones();
+    if (skinned) {
+        skeleton.nodes.push_back({"model transform", M, -1});
+        collectSkeletonNodes(skeleton, aiscene->mRootNode, 0); }
+
+    recurseModelNodes(this, aiscene, aiscene->mRootNode, modelTr);
+
+    if (!skinned)
+        return;
+
+    for (unsigned int a=0;  a<aiscene->mNumAnimations;  a++) {
+        const aiAnimation* aianim = aiscene->mAnimations[a];
+        Skeleton::Animation anim;
+        anim.name = aianim->mName.C_Str();
+        anim.duration = (float)aianim->mDuration;
+        if (aianim->mTicksPerSecond > 0)
+            anim.ticksPerSecond = (float)aianim->mTicksPerSecond;
+        for (unsigned int c=0;  c<aianim->mNumChannels;  c++) {
+            const aiNodeAnim* aichannel = aianim->mChannels[c];
+            Skeleton::Channel channel;
+            channel.node = skeleton.findNode(aichannel->mNodeName.C_Str());
+            if (channel.node < 0)
+                continue;
+            for (unsigned int k=0;  k<aichannel->mNumPositionKeys;  k++) {
+                const aiVectorKey& key = aichannel->mPositionKeys[k];
+                channel.positions.push_back({(float)key.mTime, vec3(key.mValue.x, key.mValue.y, key.mValue.z)}); }
+            for (unsigned int k=0;  k<aichannel->mNumRotationKeys;  k++) {
+                const aiQuatKey& key = aichannel->mRotationKeys[k];
+                channel.rotations.push_back({(float)key.mTime,
+                                             glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z)}); }
+            for (unsigned int k=0;  k<aichannel->mNumScalingKeys;  k++) {
+                const aiVectorKey& key = aichannel->mScalingKeys[k];
+                channel.scales.push_back({(float)key.mTime, vec3(key.mValue.x, key.mValue.y, key.mValue.z)}); }
+            anim.channels.push_back(channel); }
+        skeleton.animations.push_back(anim); }
+
+    // Weights sum to one, and each bone's box bounds the (bind pose)
+    // vertices it moves.
+    std::vector<bool> seen(skeleton.bones.size(), false);
+    for (size_t v=0;  v<skin.size();  v++) {
+        float sum = skin[v].weights.x + skin[v].weights.y + skin[v].weights.z + skin[v].weights.w;
+        if (sum <= 0.0f)
+            continue;
+        skin[v].weights /= sum;
+        for (int k=0;  k<4;  k++) {
+            if (skin[v].weights[k] <= 0.0f)
+                continue;
+            Skeleton::Bone& bone = skeleton.bones[skin[v].joints[k]];
+            const vec3& p = vertices[v].pos;
+            bone.boundsMin = seen[skin[v].joints[k]] ? min(bone.boundsMin, p) : p;
+            bone.boundsMax = seen[skin[v].joints[k]] ? max(bone.boundsMax, p) : p;
+            seen[skin[v].joints[k]] = true; } }
+
+    printf("Skeleton: %zd nodes, %zd bones, %zd animations\n",
+           skeleton.nodes.size(), skeleton.bones.size(), skeleton.animations.size());
+}
+
+// The skeleton's bone for aibone, added on first sight.
+uint32_t ModelData::boneIndex(const aiBone* aibone)
+{
+    int node = skeleton.findNode(aibone->mName.C_Str());
+    if (node < 0) {
+        printf("Bone %s has no node; it won't move.\n", aibone->mName.C_Str());
+        node = 0; }
+    for (uint32_t b=0;  b<skeleton.bones.size();  b++)
+        if (skeleton.bones[b].node == node)
+            return b;
+    Skeleton::Bone bone;
+    bone.node = node;
+    bone.offset = toGlm(aibone->mOffsetMatrix);
+    skeleton.bones.push_back(bone);
+    return (uint32_t)skeleton.bones.size() - 1;
+}
+
+// Recursively traverses the assimp node hierarchy, accumulating
+// modeling transformations, and creating and transforming any meshes
+// found.  Meshes comming from assimp can have associated surface
+// properties, so each mesh *copies* the current BRDF as a starting
+// point and modifies it from the assimp data structure.
+void recurseModelNodes(ModelData* meshdata,
+                       const aiScene* aiscene,
+                       const aiNode* node,
+                       const aiMatrix4x4& parentTr,
+                       const int level)
+{
+    // Print line with indentation to show structure of the model node hierarchy.
+    //for (int i=0;  i<level;  i++) printf("| ");
+    //printf("%s \n", node->mName.data);
+
+    // Accumulating transformations while traversing down the hierarchy.
+    aiMatrix4x4 childTr = parentTr*node->mTransformation;
+     
+    // Loop through this node's meshes
+    for (unsigned int m=0;  m<node->mNumMeshes; ++m) {
+        aiMesh* aimesh = aiscene->mMeshes[node->mMeshes[m]];
+        //printf("  %d: %d:%d\n", m, aimesh->mNumVertices, aimesh->mNumFaces);
+
+        // A skinned mesh stays in mesh space, where its bones' offset
+        // matrices start; skinning.comp poses it.
+        bool skinned = aimesh->HasBones() && !meshdata->skeleton.nodes.empty();
+        aiMatrix4x4 meshTr = skinned ? aiMatrix4x4() : childTr;
+        aiMatrix3x3 normalTr = aiMatrix3x3(meshTr); // Really should be inverse-transpose for full generality
+
+        // Loop through all vertices and record the
+        // vertex/normal/texture/tangent data with the node's model
+        // transformation applied.
+        uint faceOffset = meshdata->vertices.size();
+        for (unsigned int t=0;  t<aimesh->mNumVertices;  ++t) {
+            aiVector3D aipnt = meshTr*aimesh->mVertices[t];
+            aiVector3D ainrm = aimesh->HasNormals() ? normalTr*aimesh->mNormals[t] : aiVector3D(0,0,1);
+            aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0,0,0);
+            aiVector3D aitan = aimesh->HasTangentsAndBitangents() ? normalTr*aimesh->mTangents[t] :  aiVector3D(1,0,0);
+
+
+            meshdata->vertices.push_back({{aipnt.x, aipnt.y, aipnt.z},
+                                          {ainrm.x, ainrm.y, ainrm.z},
+                                          {aitex.x, aitex.y}});
+        }
+
+        // Each vertex keeps its four heaviest bones.
+        if (!meshdata->skeleton.nodes.empty())
+            meshdata->skin.resize(meshdata->vertices.size());
+        for (unsigned int b=0;  skinned && b<aimesh->mNumBones;  ++b) {
+            const aiBone* aibone = aimesh->mBones[b];
+            uint32_t bone = meshdata->boneIndex(aibone);
+            for (unsigned int w=0;  w<aibone->mNumWeights;  ++w) {
+                const aiVertexWeight& weight = aibone->mWeights[w];
+                SkinVertex& sv = meshdata->skin[faceOffset + weight.mVertexId];
+                int lightest = 0;
+                for (int k=1;  k<4;  k++)
+                    if (sv.weights[k] < sv.weights[lightest])
+                        lightest = k;
+                if (weight.mWeight > sv.weights[lightest]) {
+                    sv.joints[lightest]  = bone;
+                    sv.weights[lightest] = weight.mWeight; } } }
+        
+        // Loop through all faces, recording indices
+        for (unsigned int t=0;  t<aimesh->mNumFaces;  ++t) {
+            aiFace* aiface = &aimesh->mFaces[t];
+            for (int i=2;  i<aiface->mNumIndices;  i++) {
+                meshdata->matIndx.push_back(aimesh->mMaterialIndex);
+                meshdata->indicies.push_back(aiface->mIndices[0]+faceOffset);
+                meshdata->indicies.push_back(aiface->mIndices[i-1]+faceOffset);
+                meshdata->indicies.push_back(aiface->mIndices[i]+faceOffset); } }; }
+
+
+    // Recurse onto this node's children
+    for (unsigned int i=0;  i<node->mNumChildren;  ++i)
+        recurseModelNodes(meshdata, aiscene, node->mChildren[i], childTr, level+1);
+}
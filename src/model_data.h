@@ -0,0 +1,34 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "skinning.h"
+#include "shaders/shared_structs.h"
+
+struct aiBone;
+
+// A model file's triangles, materials and textures, read with the
+// ASSIMP library (see model_data.cpp).  Needs no Vulkan, so the CPU
+// tools read models exactly as the renderer does.
+//
+// Triangle i has vertices [indicies[3*i]], [indicies[3*i+1]],
+// [indicies[3*i+2]] and material materials[matIndx[i]].
+struct ModelData
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indicies;
+    std::vector<Material> materials;
+    std::vector<int32_t>     matIndx;
+    std::vector<std::string> textures;
+
+    // Skinned models only: the skeleton, and per vertex (parallel to
+    // vertices) its bones.  Skinned meshes' vertices are in the bind
+    // pose, in mesh space.
+    Skeleton skeleton;
+    std::vector<SkinVertex> skin;
+
+    void readAssimpFile(const std::string& path, const mat4& M);
+    uint32_t boneIndex(const aiBone* aibone);
+};
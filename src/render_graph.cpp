@@ -0,0 +1,401 @@
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+
+#include "vkapp.h"
+#include "render_graph.h"
+
+static const VkAccessFlags2 writeAccessMask =
+    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT
+    | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT
+    | VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+
+void RenderGraph::setup(VkApp* _VK)
+{
+    VK = _VK;
+}
+
+void RenderGraph::destroy()
+{
+    for (ResourceData& res : m_resources)
+        if (res.transient && res.image->image != VK_NULL_HANDLE) {
+            vkDestroyImageView(VK->m_device, res.image->imageView, nullptr);
+            vkDestroyImage(VK->m_device, res.image->image, nullptr);
+            *res.image = ImageWrap(); }
+    for (Slot& slot : m_slots)
+        VK->m_allocator.free(slot.allocation);
+    m_slots.clear();
+    m_passes.clear();
+    m_resources.clear();
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, ImageWrap* image,
+                                               VkImageLayout layout,
+                                               VkImageAspectFlags aspect)
+{
+    ResourceData res;
+    res.name = name;
+    res.image = image;
+    res.aspect = aspect;
+    res.layout = layout;
+    res.currentLayout = layout;
+    m_resources.push_back(res);
+    return (Resource)m_resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string& name, BufferWrap* buffer)
+{
+    ResourceData res;
+    res.name = name;
+    res.buffer = buffer;
+    m_resources.push_back(res);
+    return (Resource)m_resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::importMemory(const std::string& name)
+{
+    ResourceData res;
+    res.name = name;
+    m_resources.push_back(res);
+    return (Resource)m_resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::alternate(const std::string& name,
+                                             const std::vector<Resource>& choices,
+                                             std::function<uint32_t()> select)
+{
+    ResourceData res = m_resources[choices[0]];
+    assert(!res.transient);
+    res.name = name;
+    res.choices = choices;
+    res.select = select;
+    m_resources.push_back(res);
+    return (Resource)m_resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::transientImage(const std::string& name, ImageWrap* image,
+                                                  VkFormat format, VkImageUsageFlags usage,
+                                                  VkImageLayout layout, VkImageAspectFlags aspect)
+{
+    ResourceData res;
+    res.name = name;
+    res.image = image;
+    res.aspect = aspect;
+    res.transient = true;
+    res.format = format;
+    res.usage = usage;
+    res.layout = layout;
+    m_resources.push_back(res);
+    return (Resource)m_resources.size() - 1;
+}
+
+RenderGraph::Pass RenderGraph::addPass(const std::string& name, VkPipelineStageFlags2 shaderStages,
+                                       std::function<void(VkCommandBuffer)> record,
+                                       std::function<bool()> enabled)
+{
+    m_passes.push_back({name, shaderStages, record, enabled, {}});
+    return (Pass)m_passes.size() - 1;
+}
+
+void RenderGraph::use(Pass pass, Resource resource, Usage usage)
+{
+    PassData& p = m_passes[pass];
+    ResourceData& res = m_resources[resource];
+    UseData u{resource, p.shaderStages, 0, res.layout, false};
+
+    switch (usage) {
+    case eSampled:          u.access = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;  break;
+    case eStorageRead:      u.access = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;  break;
+    case eStorageWrite:     u.access = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;  break;
+    case eStorageReadWrite: u.access = VK_ACCESS_2_SHADER_STORAGE_READ_BIT
+                                       | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;  break;
+    case eUniform:          u.access = VK_ACCESS_2_UNIFORM_READ_BIT;  break;
+    case eVertexIndex:
+        u.stages = VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT;
+        u.access = VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT;
+        break;
+    case eColorAttachment:
+        u.stages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+        u.access = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+        break;
+    case eDepthAttachment:
+        u.stages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT
+                   | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+        u.access = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+                   | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        break;
+    case eTransferSrc:
+    case eTransferDst:
+        u.stages = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        u.access = usage == eTransferSrc ? VK_ACCESS_2_TRANSFER_READ_BIT
+                                         : VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        // Copies are legal in GENERAL; only change layout for the others.
+        if (res.image && res.layout != VK_IMAGE_LAYOUT_GENERAL)
+            u.layout = usage == eTransferSrc ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                             : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        break;
+    case eAccelerationBuild:
+        u.stages = VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+        u.access = VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR
+                   | VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        break;
+    case eAccelerationInput:
+        u.stages = VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+        u.access = VK_ACCESS_2_SHADER_READ_BIT;
+        break;
+    case eAccelerationRead: u.access = VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR;  break; }
+    u.write = (u.access & writeAccessMask) != 0;
+
+    // Several uses of one resource in a pass become one.
+    for (UseData& other : p.uses)
+        if (other.resource == resource) {
+            assert(other.layout == u.layout && "one layout per resource per pass");
+            other.stages |= u.stages;
+            other.access |= u.access;
+            other.write = other.write || u.write;
+            return; }
+    p.uses.push_back(u);
+}
+
+void RenderGraph::compile()
+{
+    // Lifetimes of the transients, over all passes.
+    for (uint32_t p = 0;  p < m_passes.size();  p++)
+        for (const UseData& u : m_passes[p].uses) {
+            ResourceData& res = m_resources[u.resource];
+            res.firstPass = std::min(res.firstPass, p);
+            res.lastPass  = std::max(res.lastPass, p); }
+
+    std::vector<Resource> transients;
+    for (Resource r = 0;  r < m_resources.size();  r++) {
+        ResourceData& res = m_resources[r];
+        if (!res.transient)
+            continue;
+        if (res.firstPass == ~0u)
+            throw std::runtime_error("render graph transient " + res.name + " is never used!");
+
+        VkImageCreateInfo imageInfo{VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+        imageInfo.imageType     = VK_IMAGE_TYPE_2D;
+        imageInfo.extent        = {VK->windowSize.width, VK->windowSize.height, 1};
+        imageInfo.mipLevels     = 1;
+        imageInfo.arrayLayers   = 1;
+        imageInfo.format        = res.format;
+        imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage         = res.usage;
+        imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+        *res.image = ImageWrap();
+        if (vkCreateImage(VK->m_device, &imageInfo, nullptr, &res.image->image) != VK_SUCCESS)
+            throw std::runtime_error("failed to create render graph image " + res.name + "!");
+        vkGetImageMemoryRequirements(VK->m_device, res.image->image, &res.requirements);
+        transients.push_back(r); }
+
+    // Largest first, each into the first slot holding nothing alive at
+    // the same time (and with a memory type in common).
+    std::sort(transients.begin(), transients.end(), [this](Resource a, Resource b) {
+        return m_resources[a].requirements.size > m_resources[b].requirements.size; });
+
+    VkDeviceSize requested = 0;
+    for (Resource r : transients) {
+        ResourceData& res = m_resources[r];
+        requested += res.requirements.size;
+        for (uint32_t s = 0;  s < m_slots.size() && res.slot == ~0u;  s++) {
+            Slot& slot = m_slots[s];
+            if (!(slot.requirements.memoryTypeBits & res.requirements.memoryTypeBits))
+                continue;
+            bool overlap = false;
+            for (Resource m : slot.members)
+                overlap = overlap || (res.firstPass <= m_resources[m].lastPass
+                                      && m_resources[m].firstPass <= res.lastPass);
+            if (overlap)
+                continue;
+            res.slot = s;
+            slot.members.push_back(r);
+            slot.requirements.size = std::max(slot.requirements.size, res.requirements.size);
+            slot.requirements.alignment = std::max(slot.requirements.alignment,
+                                                   res.requirements.alignment);
+            slot.requirements.memoryTypeBits &= res.requirements.memoryTypeBits; }
+
+        if (res.slot == ~0u) {
+            res.slot = (uint32_t)m_slots.size();
+            Slot slot;
+            slot.members.push_back(r);
+            slot.requirements = res.requirements;
+            m_slots.push_back(slot); } }
+
+    VkDeviceSize allocated = 0;
+    for (Slot& slot : m_slots) {
+        uint32_t memoryType = VK->findMemoryType(slot.requirements.memoryTypeBits,
+                                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        slot.allocation = VK->m_allocator.allocate(slot.requirements, memoryType,
+                                                   MemoryAllocator::eImage);
+        allocated += slot.requirements.size;
+
+        for (Resource r : slot.members) {
+            ResourceData& res = m_resources[r];
+            ImageWrap& image = *res.image;
+            vkBindImageMemory(VK->m_device, image.image, slot.allocation.memory,
+                              slot.allocation.offset);
+            image.memory = VK_NULL_HANDLE;  // Owned by the graph, not by image
+            image.offset = slot.allocation.offset;
+            image.imageView = VK->createImageView(image.image, res.format,
+                                                  (VkImageAspectFlagBits)res.aspect);
+            image.imageLayout = res.layout; } }
+
+    const double MB = 1024.0 * 1024.0;
+    printf("Render graph: %zd passes, %zd resources; %zd transient images in %zd "
+           "memory slots: %.2f MB instead of %.2f MB\n",
+           m_passes.size(), m_resources.size(), transients.size(), m_slots.size(),
+           allocated / MB, requested / MB);
+}
+
+// Add to images/buffers/memory the barrier (if any) needed before use.
+void RenderGraph::barrierFor(const UseData& use, std::vector<VkImageMemoryBarrier2>& images,
+                             std::vector<VkBufferMemoryBarrier2>& buffers,
+                             std::vector<VkMemoryBarrier2>& memory)
+{
+    Resource r = use.resource;
+    while (!m_resources[r].choices.empty())
+        r = m_resources[r].choices[m_resources[r].select()];
+    ResourceData& res = m_resources[r];
+    if ((res.image && res.image->image == VK_NULL_HANDLE)
+        || (res.buffer && res.buffer->buffer == VK_NULL_HANDLE))
+        return;     // An optional image or buffer that was never created
+
+    VkPipelineStageFlags2 srcStages = 0;
+    VkAccessFlags2        srcAccess = 0;
+    VkImageLayout         oldLayout = res.currentLayout;
+    bool                  needed = false;
+
+    if (res.transient && res.fresh) {
+        // Contents are discarded, but the memory may have been in use
+        // by another image of the slot (or by this one, last frame).
+        Slot& slot = m_slots[res.slot];
+        srcStages = slot.stages;
+        srcAccess = slot.writeAccess;
+        oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        slot.stages = 0;
+        slot.writeAccess = 0;
+        res.fresh = false;
+        res.writeStages = res.readStages = res.visibleStages = 0;
+        res.writeAccess = res.visibleAccess = 0;
+        needed = true; }
+
+    else if (use.write || oldLayout != use.layout) {
+        // After the last write (RAW/WAW) and any reads since (WAR).
+        srcStages = res.writeStages | res.readStages;
+        srcAccess = res.writeAccess;
+        needed = srcStages != 0 || oldLayout != use.layout; }
+
+    else if (res.writeAccess != 0
+             && ((use.stages & ~res.visibleStages) || (use.access & ~res.visibleAccess))) {
+        // A read of a write not yet made visible to this stage/access.
+        srcStages = res.writeStages;
+        srcAccess = res.writeAccess;
+        needed = true; }
+
+    // The new state.
+    if (use.write) {
+        res.writeStages = use.stages;
+        res.writeAccess = use.access & writeAccessMask;
+        res.readStages = 0;
+        res.visibleStages = use.stages;
+        res.visibleAccess = use.access; }
+    else {
+        res.readStages |= use.stages;
+        if (needed) {
+            res.visibleStages |= use.stages;
+            res.visibleAccess |= use.access; } }
+    res.currentLayout = use.layout;
+    if (res.transient) {
+        Slot& slot = m_slots[res.slot];
+        slot.stages |= use.stages;
+        slot.writeAccess |= use.access & writeAccessMask; }
+
+    if (!needed)
+        return;
+    if (srcStages == 0)
+        srcStages = VK_PIPELINE_STAGE_2_NONE;
+
+    if (res.image) {
+        VkImageMemoryBarrier2 barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+        barrier.srcStageMask  = srcStages;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstStageMask  = use.stages;
+        barrier.dstAccessMask = use.access;
+        barrier.oldLayout     = oldLayout;
+        barrier.newLayout     = use.layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = res.image->image;
+        barrier.subresourceRange = {res.aspect, 0, VK_REMAINING_MIP_LEVELS,
+                                    0, VK_REMAINING_ARRAY_LAYERS};
+        images.push_back(barrier); }
+    else if (!res.buffer) {
+        VkMemoryBarrier2 barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+        barrier.srcStageMask  = srcStages;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstStageMask  = use.stages;
+        barrier.dstAccessMask = use.access;
+        memory.push_back(barrier); }
+    else {
+        VkBufferMemoryBarrier2 barrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2};
+        barrier.srcStageMask  = srcStages;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstStageMask  = use.stages;
+        barrier.dstAccessMask = use.access;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = res.buffer->buffer;
+        barrier.offset = 0;
+        barrier.size   = VK_WHOLE_SIZE;
+        buffers.push_back(barrier); }
+}
+
+void RenderGraph::execute(VkCommandBuffer cmdBuf)
+{
+    for (ResourceData& res : m_resources)
+        res.fresh = true;
+
+    std::vector<bool> enabled(m_passes.size());
+    for (uint32_t p = 0;  p < m_passes.size();  p++)
+        enabled[p] = !m_passes[p].enabled || m_passes[p].enabled();
+
+    uint32_t batches = 0, barriers = 0, passes = 0;
+    std::vector<VkImageMemoryBarrier2>  images;
+    std::vector<VkBufferMemoryBarrier2> buffers;
+    std::vector<VkMemoryBarrier2>       memory;
+    for (uint32_t p = 0;  p < m_passes.size();  p++) {
+        if (!enabled[p])
+            continue;
+        PassData& pass = m_passes[p];
+        passes++;
+
+        images.clear();
+        buffers.clear();
+        memory.clear();
+        for (const UseData& use : pass.uses)
+            barrierFor(use, images, buffers, memory);
+
+        if (!images.empty() || !buffers.empty() || !memory.empty()) {
+            VkDependencyInfo dependency{VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+            dependency.memoryBarrierCount       = (uint32_t)memory.size();
+            dependency.pMemoryBarriers          = memory.data();
+            dependency.imageMemoryBarrierCount  = (uint32_t)images.size();
+            dependency.pImageMemoryBarriers     = images.data();
+            dependency.bufferMemoryBarrierCount = (uint32_t)buffers.size();
+            dependency.pBufferMemoryBarriers    = buffers.data();
+            vkCmdPipelineBarrier2(cmdBuf, &dependency);
+            batches++;
+            barriers += images.size() + buffers.size() + memory.size(); }
+
+        pass.record(cmdBuf); }
+
+    if (enabled != m_lastEnabled) {
+        printf("Render graph: %u passes recorded with %u barriers in %u batches\n",
+               passes, barriers, batches);
+        m_lastEnabled = enabled; }
+}
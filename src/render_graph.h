@@ -0,0 +1,161 @@
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "buffer_wrap.h"
+#include "image_wrap.h"
+
+class VkApp;
+
+// A small render graph for the per-frame work of drawFrame.
+//
+// Each pass declares, with use(), the images and buffers it reads and
+// writes.  execute() walks the enabled passes in order, tracks each
+// resource's layout and last accesses (across frames too), and puts
+// in front of each pass a single vkCmdPipelineBarrier2 holding just
+// the barriers its uses need: read-after-write and write-after-write
+// hazards get a memory dependency, write-after-read only an execution
+// dependency, and read-after-read nothing at all.  A pass's record
+// function contains no barriers of its own.
+//
+// Transient images live only within a frame.  compile() creates them
+// at the window size, and images whose lifetimes (the span of passes
+// using them, in declaration order) don't overlap share memory.  Their
+// contents are undefined at each frame's first use.
+//
+// The graph is declared once; a pass's enabled() is evaluated every
+// frame (e.g. ray tracer vs. rasterizer).  Aliasing is computed over
+// all passes, so it is valid for any subset of them.
+class RenderGraph
+{
+public:
+    typedef uint32_t Resource;
+    typedef uint32_t Pass;
+
+    // How a pass uses a resource.  Shader uses (and
+    // eAccelerationRead) happen in the pass's stages; the others imply
+    // their own stage.
+    enum Usage {
+        eSampled,           // Texture read through a sampler
+        eStorageRead,       // imageLoad, or a storage buffer read
+        eStorageWrite,      // imageStore, or a storage buffer write
+        eStorageReadWrite,
+        eUniform,
+        eVertexIndex,
+        eColorAttachment,
+        eDepthAttachment,
+        eTransferSrc,
+        eTransferDst,
+        eAccelerationBuild, // Built or refit (the AS's buffer), or build scratch
+        eAccelerationInput, // Vertices or instances read by a build
+        eAccelerationRead };  // Traced against, or read by a TLAS build
+
+    void setup(VkApp* _VK);
+    void destroy();
+
+    // An image owned elsewhere, which may not exist yet; the graph
+    // reads *image only in execute().  Its uses see it in layout (as
+    // its descriptors and render passes expect), and it must already
+    // be in that layout when execute() first runs.
+    Resource importImage(const std::string& name, ImageWrap* image, VkImageLayout layout,
+                         VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT);
+    Resource importBuffer(const std::string& name, BufferWrap* buffer);
+
+    // A set of buffers not known when the graph is declared (e.g. one
+    // per loaded model); its barriers are global memory barriers.
+    Resource importMemory(const std::string& name);
+
+    // Stands for one of choices (imported resources of the same kind
+    // and layout), picked by select() each time a pass using it runs;
+    // e.g. the halves of a double buffer.
+    Resource alternate(const std::string& name, const std::vector<Resource>& choices,
+                       std::function<uint32_t()> select);
+
+    // An image created (into *image, which stays owned by the graph)
+    // by compile(), and used in the given layout.
+    Resource transientImage(const std::string& name, ImageWrap* image, VkFormat format,
+                            VkImageUsageFlags usage, VkImageLayout layout,
+                            VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT);
+
+    Pass addPass(const std::string& name, VkPipelineStageFlags2 shaderStages,
+                 std::function<void(VkCommandBuffer)> record,
+                 std::function<bool()> enabled = nullptr);
+    void use(Pass pass, Resource resource, Usage usage);
+
+    void compile();     // Lifetimes, aliasing, and the transient images
+    void execute(VkCommandBuffer cmdBuf);
+
+private:
+    struct ResourceData
+    {
+        std::string        name;
+        ImageWrap*         image{nullptr};
+        BufferWrap*        buffer{nullptr};
+        VkImageAspectFlags aspect{0};
+        VkImageLayout      layout{VK_IMAGE_LAYOUT_UNDEFINED};  // For its uses
+
+        // Alternates
+        std::vector<Resource>      choices;
+        std::function<uint32_t()>  select;
+
+        // Transients
+        bool               transient{false};
+        VkFormat           format{VK_FORMAT_UNDEFINED};
+        VkImageUsageFlags  usage{0};
+        uint32_t           firstPass{~0u}, lastPass{0};
+        uint32_t           slot{~0u};   // Into m_slots
+        VkMemoryRequirements requirements{};
+
+        // Tracked state
+        VkImageLayout         currentLayout{VK_IMAGE_LAYOUT_UNDEFINED};
+        VkPipelineStageFlags2 writeStages{0};    // Last write
+        VkAccessFlags2        writeAccess{0};
+        VkPipelineStageFlags2 readStages{0};     // Reads since the last write
+        VkPipelineStageFlags2 visibleStages{0};  // Stages and accesses that have
+        VkAccessFlags2        visibleAccess{0};  //   seen the last write
+        bool                  fresh{true};       // Transient: not yet used this frame
+    };
+
+    struct UseData
+    {
+        Resource              resource;
+        VkPipelineStageFlags2 stages;
+        VkAccessFlags2        access;
+        VkImageLayout         layout;
+        bool                  write;
+    };
+
+    struct PassData
+    {
+        std::string                          name;
+        VkPipelineStageFlags2                shaderStages;
+        std::function<void(VkCommandBuffer)> record;
+        std::function<bool()>                enabled;
+        std::vector<UseData>                 uses;
+    };
+
+    // Memory shared by transients with disjoint lifetimes, and what
+    // has touched it since the last barrier handing it on.
+    struct Slot
+    {
+        std::vector<Resource> members;
+        VkMemoryRequirements  requirements{};
+        MemoryAllocation      allocation{};
+        VkPipelineStageFlags2 stages{0};
+        VkAccessFlags2        writeAccess{0};
+    };
+
+    VkApp*                    VK{nullptr};
+    std::vector<ResourceData> m_resources;
+    std::vector<PassData>     m_passes;
+    std::vector<Slot>         m_slots;
+    std::vector<bool>         m_lastEnabled;  // To report when the pass set changes
+
+    void barrierFor(const UseData& use, std::vector<VkImageMemoryBarrier2>& images,
+                    std::vector<VkBufferMemoryBarrier2>& buffers,
+                    std::vector<VkMemoryBarrier2>& memory);
+};
@@ -0,0 +1,115 @@
+
+// Path guiding, after Muller et al., "Practical Path Guiding for
+// Efficient Light-Transport Simulation": where light arrives from,
+// learned from the paths traced, and sampled alongside the BRDF.
+// Include after raytrace.glsl.
+//
+// Space is a uniform grid over the scene (GuideGrid).  Each cell has a
+// directional quadtree over the sphere, mapped to the unit square
+// preserving area (so every leaf covers 4pi/eGuideLeaves steradians),
+// holding the energy arriving from within each node.  Unlike the
+// paper's, the trees are complete, to a fixed depth, and learned
+// continuously: every path adds, for each bounce it made, the radiance
+// that arrived along it over the direction's pdf to its leaf's
+// accumulator; guiding.comp then decays the trees, adds the frame's
+// samples to the leaves, and sums the nodes above them.
+//
+// Needs GL_KHR_shader_subgroup_ballot, for the counters.
+
+layout(set=0, binding=eGuideGrid, scalar) buffer GuideGrid_ { GuideGrid g; } guideGrid;
+layout(set=0, binding=eGuideAccum, scalar) buffer GuideAccum { uint a[]; } guideAccum;
+layout(set=0, binding=eGuideTree, scalar) buffer GuideTree { float t[]; } guideTree;
+
+const int   guideMaxVertices = 8;       // Bounces of a path added to the trees
+const float guideFixedPoint  = 64.0;    // guideAccum's units per unit of energy,
+const float guideMaxEnergy   = 4096.0;  //   and the most a sample may add
+
+// The sphere as the unit square: u = (1 + y)/2, v = phi/2pi (y up).
+vec2 GuideDirToUv(vec3 dir)
+{
+    return vec2(0.5 * (1.0 + clamp(dir.y, -1.0, 1.0)), fract(atan(dir.z, dir.x) / (2.0 * PI) + 1.0));
+}
+
+vec3 GuideUvToDir(vec2 uv)
+{
+    float y = 2.0 * uv.x - 1.0;
+    float r = sqrt(max(0.0, 1.0 - y * y));
+    float phi = 2.0 * PI * uv.y;
+    return vec3(r * cos(phi), y, r * sin(phi));
+}
+
+// A node's index within its tree: the levels (1, 4, 16, 64 nodes)
+// one after another, each in rows.
+uint GuideNode(int level, ivec2 xy)
+{
+    return ((1u << (2 * level)) - 1u) / 3u + uint(xy.y * (1 << level) + xy.x);
+}
+
+ivec2 GuideLeaf(vec3 dir)
+{
+    return min(ivec2(GuideDirToUv(dir) * float(eGuideLeafRes)), ivec2(int(eGuideLeafRes) - 1));
+}
+
+// P's cell; true if its tree has learned anything.
+bool GuideCell(vec3 P, out uint cell)
+{
+    vec3  lo = guideGrid.g.boundsMin;
+    vec3  hi = guideGrid.g.boundsMax;
+    int   res = int(guideGrid.g.res);
+    ivec3 c = clamp(ivec3((P - lo) / (hi - lo) * float(res)), ivec3(0), ivec3(res - 1));
+    cell = uint((c.z * res + c.y) * res + c.x);
+    return guideTree.t[cell * eGuideNodes] > 0.0;
+}
+
+// A direction from cell's tree: down from the root, picking children
+// by their energy, then uniformly within the leaf.
+vec3 SampleGuide(uint cell, inout uint seed)
+{
+    uint  base = cell * eGuideNodes;
+    ivec2 xy = ivec2(0);
+    for (int level = 1;  level <= 3;  level++) {
+        xy *= 2;
+        float e00 = guideTree.t[base + GuideNode(level, xy)];
+        float e10 = guideTree.t[base + GuideNode(level, xy + ivec2(1, 0))];
+        float e01 = guideTree.t[base + GuideNode(level, xy + ivec2(0, 1))];
+        float e11 = guideTree.t[base + GuideNode(level, xy + ivec2(1, 1))];
+        float r = rnd(seed) * (e00 + e10 + e01 + e11);
+        if (r >= e00 + e10 + e01)
+            xy += ivec2(1, 1);
+        else if (r >= e00 + e10)
+            xy.y++;
+        else if (r >= e00)
+            xy.x++; }
+    return GuideUvToDir((vec2(xy) + vec2(rnd(seed), rnd(seed))) / float(eGuideLeafRes));
+}
+
+// SampleGuide's pdf of dir, per solid angle.
+float PdfGuide(uint cell, vec3 dir)
+{
+    uint base = cell * eGuideNodes;
+    return guideTree.t[base + GuideNode(3, GuideLeaf(dir))] / guideTree.t[base]
+        * float(eGuideLeaves) / (4.0 * PI);
+}
+
+// A training sample: energy (arriving radiance's luminance over the
+// direction's pdf) from dir, at a point in cell.
+void GuideAddSample(uint cell, vec3 dir, float energy)
+{
+    if (isnan(energy) || isinf(energy) || energy <= 0.0)
+        return;
+    ivec2 leaf = GuideLeaf(dir);
+    atomicAdd(guideAccum.a[cell * eGuideLeaves + uint(leaf.y) * eGuideLeafRes + uint(leaf.x)],
+              uint(min(energy, guideMaxEnergy) * guideFixedPoint));
+}
+
+// Counts an event (a guided direction, or a training sample) for the
+// cost report: one atomic per subgroup.
+void GuideCount(bool training)
+{
+    uvec4 ballot = subgroupBallot(true);
+    if (subgroupElect()) {
+        if (training)
+            atomicAdd(guideGrid.g.trainingSamples, subgroupBallotBitCount(ballot));
+        else
+            atomicAdd(guideGrid.g.guidedSamples, subgroupBallotBitCount(ballot)); }
+}
@@ -1,11 +1,17 @@
 
 #version 450
+#extension GL_EXT_shader_explicit_arithmetic_types_int64  : require
+#extension GL_GOOGLE_include_directive : enable
+
+#include "shared_structs.h"
 
 layout(location = 0) out vec4 fragColor;
 layout(set=0, binding=0) uniform sampler2D renderedImage;
 
+layout(push_constant) uniform _pcPost { PushConstantPost pc; };
+
 void main()
 {
-    vec2 uv = gl_FragCoord.xy/vec2(1280, 768);
+    vec2 uv = min(gl_FragCoord.xy * pc.uvScale, pc.uvMax);
     fragColor = pow(texture(renderedImage, uv).rgba, vec4(1.0/2.2));
 }
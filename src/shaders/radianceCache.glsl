@@ -0,0 +1,90 @@
+
+// A world space radiance cache: a hash grid of cells, keyed by
+// position quantized to a cell size growing with distance from the
+// camera, and by the normal's dominant axis.  A cell holds the
+// outgoing radiance of the surfaces inside it, averaged over
+// directions (as though diffuse).  Include after raytrace.glsl.
+//
+// raytrace.rgen's training paths (one pixel in cacheTrainPeriod, at
+// random each frame) run in full, and add each vertex's estimate to
+// its cell: the radiance gathered beyond it over the throughput up to
+// it.  All other paths end in the cache at their first bounce, if the
+// cell has samples enough.  radianceCache.comp then folds the frame's
+// samples into the cells, and frees those without samples for a while.
+//
+// Samples are added with integer atomics, in fixed point.
+
+layout(set=0, binding=eCacheKeys, scalar) buffer CacheKeys { uint k[]; } cacheKeys;
+layout(set=0, binding=eCacheAccum, scalar) buffer CacheAccum { uvec4 a[]; } cacheAccum;
+layout(set=0, binding=eCacheCells, scalar) buffer CacheCells { CacheCell c[]; } cacheCells;
+
+const uint  cacheProbes      = 8;       // Slots tried, after a key's hashed slot
+const uint  cacheTrainPeriod = 16;
+const int   cacheMaxVertices = 8;       // Of a training path, fed to the cache
+const float cacheMinSamples  = 4.0;     // Before a cell may end paths
+const float cacheLevelDist   = 4.0;     // Cells double in size every this far (times 2^level)
+const float cacheFixedPoint  = 256.0;   // cacheAccum's units per unit of radiance,
+const float cacheMaxRadiance = 256.0;   //   and the most a sample may add
+
+uint CacheHash(uint x)  // PCG's output permutation
+{
+    uint state = x * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// The slot of P's cell (N its surface's normal), found or, with
+// insert, claimed.  False if absent, or the probed slots are full.
+bool CacheFind(vec3 P, vec3 N, bool insert, out uint slot)
+{
+    vec3  eye = (mats.viewInverse * vec4(0, 0, 0, 1)).xyz;
+    uint  level = uint(clamp(log2(1.0 + length(P - eye) / cacheLevelDist), 0.0, 15.0));
+    ivec3 cell = ivec3(floor(P / (pcRay.cacheCellSize * exp2(float(level)))));
+    vec3  a = abs(N);
+    uint  axis = a.x > a.y && a.x > a.z ? 0u : (a.y > a.z ? 1u : 2u);
+    uint  face = 2u * axis + (N[axis] < 0.0 ? 1u : 0u);
+
+    uint h = CacheHash(uint(cell.x) + CacheHash(uint(cell.y) + CacheHash(uint(cell.z) + CacheHash(level * 6u + face))));
+    uint checksum = max(CacheHash(h ^ 0x9e3779b9u), 1u);  // 0 marks a free slot
+    for (uint i = 0;  i <= cacheProbes;  i++) {
+        slot = (h + i) % pcRay.cacheCapacity;
+        uint key = cacheKeys.k[slot];
+        if (key == checksum)
+            return true;
+        if (key == 0u) {
+            if (!insert)
+                return false;
+            key = atomicCompSwap(cacheKeys.k[slot], 0u, checksum);
+            if (key == 0u || key == checksum)
+                return true; } }
+    return false;
+}
+
+// The cached radiance at P, if its cell has cacheMinSamples.
+bool CacheLookup(vec3 P, vec3 N, out vec3 radiance)
+{
+    uint slot;
+    radiance = vec3(0.0);
+    if (!CacheFind(P, N, false, slot) || cacheCells.c[slot].samples < cacheMinSamples)
+        return false;
+    radiance = cacheCells.c[slot].radiance;
+    return true;
+}
+
+void CacheAddSample(uint slot, vec3 radiance)
+{
+    if (any(isnan(radiance)) || any(isinf(radiance)))
+        return;
+    uvec3 fixedPoint = uvec3(min(max(radiance, vec3(0.0)), vec3(cacheMaxRadiance)) * cacheFixedPoint);
+    atomicAdd(cacheAccum.a[slot].x, fixedPoint.x);
+    atomicAdd(cacheAccum.a[slot].y, fixedPoint.y);
+    atomicAdd(cacheAccum.a[slot].z, fixedPoint.z);
+    atomicAdd(cacheAccum.a[slot].w, 1u);
+}
+
+// Whether this pixel's path trains the cache this frame.
+bool CacheTrainingPath()
+{
+    uint pixel = gl_LaunchIDEXT.y * gl_LaunchSizeEXT.x + gl_LaunchIDEXT.x;
+    return CacheHash(pixel ^ CacheHash(pcRay.frameSeed)) % cacheTrainPeriod == 0u;
+}
@@ -0,0 +1,467 @@
+// Declarations and functions shared by the ray generation shaders:
+// raytrace.rgen, the path tracer, and the ReSTIR passes (restir*.rgen).
+// Include after shared_structs.h and RNG.glsl.
+
+#define PI 3.14159f
+
+// The ray payload, attached to a ray; used to communicate between shader stages.
+layout(location=0) rayPayloadEXT RayPayload payload;
+layout(location=1) rayPayloadEXT bool occluded;  // Shadow rays' (raytraceShadow.rmiss)
+
+// Push constant for ray tracing shaders
+layout(push_constant) uniform _PushConstantRay { PushConstantRay pcRay; };
+
+// Ray tracing descriptor set: 0:acceleration structure, and 1: color output image
+layout(set=0, binding=0) uniform accelerationStructureEXT topLevelAS;
+layout(set=0, binding=1, rgba32f) uniform image2D colCurr; // Output image: m_rtColCurrBuffer
+layout(set=0, binding=2, rgba32f) uniform image2D colPrev;
+layout(set=0, binding=3, rgba32f) uniform image2D NdCurr;
+layout(set=0, binding=4, rgba32f) uniform image2D NdPrev;
+layout(set=0, binding=5, rgba32f) uniform image2D KdCurr;
+layout(set=0, binding=6, rgba32f) uniform image2D KdPrev;
+layout(set=0, binding=eSampleImage, rgba32f) uniform image2D sampleImage;
+layout(set=0, binding=eEnvMap) uniform sampler2D envMap;     // Environment, seen by camera rays
+layout(set=0, binding=eEnvLow) uniform sampler2D envLow;     //   ... by all others
+layout(set=0, binding=eEnvAlias, scalar) buffer EnvAliases { EnvAlias a[]; } envAlias;
+layout(set=0, binding=eLights, scalar) buffer Lights { Emitter e[]; } lights;
+layout(set=0, binding=eLightTree, scalar) buffer LightTree { LightNode n[]; } lightTree;
+layout(set=0, binding=eDIReservoirs, scalar) buffer DIReservoirs { DIReservoir r[]; } diReservoirs;
+layout(set=0, binding=eDIFinal, scalar) buffer DIFinal { DIReservoir r[]; } diFinal;
+layout(set=0, binding=eGIReservoirs, scalar) buffer GIReservoirs { GIReservoir r[]; } giReservoirs;
+layout(set=0, binding=eGIFinal, scalar) buffer GIFinal { GIReservoir r[]; } giFinal;
+
+// Object model descriptor set: 0: matrices, 1:object buffer addresses, 2: texture list
+layout(set=1, binding=0) uniform _MatrixUniforms { MatrixUniforms mats; };
+layout(set=1, binding=1, scalar) buffer ObjDesc_ { ObjDesc i[]; } objDesc;
+layout(set=1, binding=2) uniform sampler2D textureSamplers[];
+
+// Object buffered data; dereferenced from ObjDesc addresses
+layout(buffer_reference, scalar) buffer Vertices {Vertex v[]; }; // Position, normals, ..
+layout(buffer_reference, scalar) buffer Indices {ivec3 i[]; }; // Triangle indices
+layout(buffer_reference, scalar) buffer Materials {Material m[]; }; // Array of all materials
+layout(buffer_reference, scalar) buffer MatIndices {int i[]; }; // Material ID for each triangle
+layout(buffer_reference, scalar) buffer PrimRemaps {PrimRemap r[]; }; // Split BLAS triangle to model's
+layout(buffer_reference, scalar) buffer EmitterIndices {uint i[]; }; // Each triangle's emitter, or noEmitter
+
+// The hit in payload, resolved to the model's triangle: its shading
+// normal, material (with any texture applied) and emitter index.
+struct HitPoint
+{
+    vec3     P;
+    vec3     N;         // Interpolated, not normalized
+    Material mat;
+    uint     emitter;   // noEmitter if not sampled by the light tree
+};
+
+HitPoint ResolveHit()
+{
+    HitPoint hit;
+    hit.P = payload.hitPos;
+
+    // If something was hit, find the object data.
+    // Object data (containg 4 device addresses)
+    ObjDesc    objResources = objDesc.i[payload.instanceIndex];
+    
+    // Dereference the object's 4 device addresses
+    Vertices   vertices    = Vertices(objResources.vertexAddress);
+    Indices    indices     = Indices(objResources.indexAddress);
+    Materials  materials   = Materials(objResources.materialAddress);
+    MatIndices matIndices  = MatIndices(objResources.materialIndexAddress);
+
+    // A hit on a piece of a split triangle: find the model's
+    // triangle, and the hit's barycentrics in it.
+    if (objResources.primRemapAddress != 0) {
+        PrimRemap remap = PrimRemaps(objResources.primRemapAddress).r[payload.primitiveIndex];
+        vec2 uv = payload.bc.x*remap.c0 + payload.bc.y*remap.c1 + payload.bc.z*remap.c2;
+        payload.bc = vec3(1.0 - uv.x - uv.y, uv.x, uv.y);
+        payload.primitiveIndex = int(remap.prim); }
+  
+    // Use gl_PrimitiveID to access the triangle's vertices and material
+    ivec3 ind    = indices.i[payload.primitiveIndex]; // The triangle hit
+    int matIdx   = matIndices.i[payload.primitiveIndex]; // The triangles material index
+    hit.mat      = materials.m[matIdx]; // The triangles material
+
+    // Vertex of the triangle (Vertex has pos, nrm, tex)
+    Vertex v0 = vertices.v[ind.x];
+    Vertex v1 = vertices.v[ind.y];
+    Vertex v2 = vertices.v[ind.z];
+
+    // Computing the normal and tex coord at hit position
+    const vec3 bc   = payload.bc; // The barycentric coordinates of the hit point
+    hit.N           = bc.x*v0.nrm      + bc.y*v1.nrm      + bc.z*v2.nrm;
+    const vec2 uv   = bc.x*v0.texCoord + bc.y*v1.texCoord + bc.z*v2.texCoord;
+
+    // If the material has a texture, read diffuse color from it.
+    if (hit.mat.textureId >= 0) {
+        uint txtId = objResources.txtOffset + hit.mat.textureId;
+        hit.mat.diffuse = texture(textureSamplers[(txtId)], uv).xyz;
+    }
+
+    hit.emitter = noEmitter;
+    if (objResources.emitterAddress != 0)
+        hit.emitter = EmitterIndices(objResources.emitterAddress).i[payload.primitiveIndex];
+    return hit;
+}
+
+float Luminance(vec3 c)
+{
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// The size of the image being rendered: the top left part of the
+// images, with dynamic resolution.  raytrace's launch may be larger;
+// see LaunchPixel.
+ivec2 RenderSize()
+{
+    return ivec2(pcRay.renderWidth, pcRay.renderHeight);
+}
+
+// Likewise last frame's, for lookups in the history images and buffers.
+ivec2 PriorRenderSize()
+{
+    return ivec2(pcRay.priorWidth, pcRay.priorHeight);
+}
+
+// eTraceHalf's traced pixel in each 2x2 block, for phase 0..3;
+// reconstruct.comp's PixelTraced matches.
+ivec2 HalfOffset(uint phase)
+{
+    const ivec2 offsets[4] = ivec2[4](ivec2(0, 0), ivec2(1, 1), ivec2(1, 0), ivec2(0, 1));
+    return offsets[phase & 3u];
+}
+
+// The pixel raytrace's invocation shades, and whether its path is
+// traced this frame (pcRay.traceMode), or only its primary hit.  The
+// reduced modes launch at the render size rounded up to even, with the
+// traced pixels packed into the first half (checker) or quarter
+// (half) of the launch, so that warps trace whole paths or none; the
+// rest of the launch covers the other pixels.  Pixels beyond the
+// render size are skipped by the caller.
+ivec2 LaunchPixel(out bool traced)
+{
+    ivec2 id = ivec2(gl_LaunchIDEXT.xy);
+    ivec2 halves = ivec2(gl_LaunchSizeEXT.xy) / 2;
+    traced = true;
+    if (pcRay.traceMode == eTraceChecker) {
+        int parity = (id.y + int(pcRay.tracePhase)) & 1;
+        traced = id.x < halves.x;
+        return traced ? ivec2(2 * id.x + parity, id.y)
+                      : ivec2(2 * (id.x - halves.x) + 1 - parity, id.y); }
+    if (pcRay.traceMode == eTraceHalf) {
+        uint quarter = (id.x >= halves.x ? 1u : 0u) + (id.y >= halves.y ? 2u : 0u);
+        traced = quarter == 0u;
+        return 2 * (id % halves) + HalfOffset(pcRay.tracePhase + quarter); }
+    return id;
+}
+
+// The camera ray through pixel's center.
+void CameraRay(ivec2 pixel, out vec3 rayOrigin, out vec3 rayDirection)
+{
+    const vec2 pixelCenter = vec2(pixel) + vec2(0.5);
+    vec2 pixelNDC = pixelCenter/vec2(RenderSize())*2.0 - 1.0;
+ 
+    // W means world
+    vec3 eyeW   = (mats.viewInverse * vec4(0, 0, 0, 1)).xyz;
+    vec4 pixelH = mats.viewInverse * mats.projInverse * vec4(pixelNDC.x, pixelNDC.y, 1, 1);
+    vec3 pixelW = pixelH.xyz/pixelH.w;
+    rayOrigin    = eyeW;
+    rayDirection = normalize(pixelW - eyeW);
+}
+
+// A shadow ray from P in direction L: whether nothing is hit within tMax.
+bool Unoccluded(vec3 P, vec3 L, float tMax)
+{
+    occluded = true;
+    traceRayEXT(topLevelAS,
+                gl_RayFlagsTerminateOnFirstHitEXT | gl_RayFlagsSkipClosestHitShaderEXT
+                | gl_RayFlagsOpaqueEXT,
+                eRayBounce, 0, 0,
+                1,        // missIndex: raytraceShadow.rmiss
+                P, 0.001, L, tMax,
+                1         // payload (location = 1)
+                );
+    return !occluded;
+}
+
+// A uniformly distributed point on an emitter.
+vec3 SampleEmitter(Emitter emitter, inout uint seed)
+{
+    float r1 = sqrt(rnd(seed)), r2 = rnd(seed);
+    return (1.0 - r1) * emitter.v0 + r1 * (1.0 - r2) * emitter.v1 + r1 * r2 * emitter.v2;
+}
+
+// Project 4 functions
+/////// ------------ GGX ----------
+float G1(vec3 V, vec3 H, vec3 N, float alpha, float tan_theta_m)
+{ // Note: V can wi or wo
+    float dotVH = dot(V, H);
+    float dotVN = dot(V, N);
+
+    return clamp(dotVH / dotVN, 0.0f, 1.0f) * 2.0f / (1.0f + sqrt(1.0f + pow(alpha * tan_theta_m, 2)));
+}
+
+vec3 EvalBrdf(vec3 N, vec3 L, vec3 V, Material mat) // wi = L, wo = V
+{
+    vec3 Kd = mat.diffuse;
+    vec3 Ks = mat.specular;
+    vec3 H = normalize(V + L);
+
+    float alpha = mat.shininess;
+    float alphaSqr = pow(alpha, 2);
+
+    float dotLN = dot(L, N);
+    float dotVN = dot(V, N);
+    float dotHN = dot(H, N);
+    float dotLH = dot(L, H);
+
+    float tan_theta_m = sqrt((1.0f - pow(dotHN, 2))) / dotHN;
+    float tan_theta_v = sqrt((1.0f - pow(dotVN, 2))) / dotVN;
+    float tan_square_theta_m = pow(tan_theta_m, 2);
+    float tan_square_theta_v = pow(tan_theta_v, 2);
+    
+    // F - Done
+    float dotLH5 = pow(1.0f - dotLH, 5);
+    vec3 F = Ks + (vec3(1.0) - Ks) * dotLH5;
+    
+    // D 
+    float denom = PI * pow(dotHN, 4) * pow(alphaSqr + tan_square_theta_m, 2);
+    float D = clamp(dotHN, 0.0, 1.0) * (alphaSqr / denom);
+
+    // G
+    float G = 1.0f;
+    if(dotVN <= 1.0f || tan_theta_v != 0.0f)
+        G = G1(L, H, N, alpha, tan_theta_v) * G1(V, H, N, alpha, tan_theta_v);
+
+    return max(dot(N, L), 0.0f) * ((Kd / PI) + ((D * F * G) / (4.0f * abs(dotLN) * abs(dotVN)) ) );
+}
+
+vec3 SampleLobe(vec3 A, float c, float phi)
+{
+    float s = sqrt(1.0 - pow(c, 2));
+    vec3 K = vec3(s * cos(phi), s * sin(phi), c);
+
+    if (abs(A.z - 1.0) < 1e-3)
+        return K;
+    
+    if (abs(A.z + 1.0) < 1e-3)
+        return vec3(K.x, -K.y, -K.z);
+
+    A = normalize(A);
+    vec3 B = normalize(vec3(-A.y, A.x, 0.0));
+    vec3 C = cross(A, B);
+
+    return K.x * B + K.y * C + K.z * A;
+}
+
+vec3 SampleBrdf(inout uint seed, in vec3 N)
+{
+    return SampleLobe(N, sqrt(rnd(seed)), 2 * PI * rnd(seed));
+}
+
+float PdfBrdf(vec3 N, vec3 Wi)
+{
+    return abs(dot(N, Wi)) / PI;
+}
+
+// Environment map (env_map.h): equirectangular, +y up, v = 0 at the
+// zenith.  Directions are sampled by the low resolution map's alias
+// table, then uniformly in the pixel's rectangle in (u,v), so a
+// direction's pdf is its pixel's probability over the pixel's solid
+// angle: (2 PI / width) * (PI / height) * sin(theta).
+vec2 DirToUv(vec3 dir)
+{
+    return vec2(atan(dir.z, dir.x) / (2.0 * PI) + 0.5, acos(clamp(dir.y, -1.0, 1.0)) / PI);
+}
+
+vec3 UvToDir(vec2 uv)
+{
+    float phi = (uv.x - 0.5) * 2.0 * PI;
+    float theta = uv.y * PI;
+    return vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+vec3 EnvRadiance(vec3 dir, bool camera)
+{
+    vec2 uv = DirToUv(dir);
+    vec3 L = camera ? textureLod(envMap, uv, 0.0).rgb : textureLod(envLow, uv, 0.0).rgb;
+    return L * pcRay.envIntensity;
+}
+
+float PdfEnv(vec3 dir)
+{
+    vec2  uv = DirToUv(dir);
+    ivec2 pixel = min(ivec2(uv * vec2(pcRay.envWidth, pcRay.envHeight)),
+                      ivec2(pcRay.envWidth - 1, pcRay.envHeight - 1));
+    float sinTheta = sqrt(max(1.0 - dir.y * dir.y, 0.0));
+    if (sinTheta < 1e-6)
+        return 0.0;
+    float pdf = envAlias.a[pixel.y * pcRay.envWidth + pixel.x].pdf;
+    return pdf * pcRay.envWidth * pcRay.envHeight / (2.0 * PI * PI * sinTheta);
+}
+
+vec3 SampleEnv(inout uint seed)
+{
+    int count = pcRay.envWidth * pcRay.envHeight;
+    int index = min(int(rnd(seed) * count), count - 1);
+    EnvAlias entry = envAlias.a[index];
+    if (rnd(seed) >= entry.q)
+        index = int(entry.alias);
+    vec2 pixel = vec2(index % pcRay.envWidth, index / pcRay.envWidth);
+    vec2 uv = (pixel + vec2(rnd(seed), rnd(seed))) / vec2(pcRay.envWidth, pcRay.envHeight);
+    return UvToDir(uv);
+}
+
+// Light tree (light_tree.h): a conservative estimate of a node's
+// emitters' contribution at P, with normal N, after Conty Estevez and
+// Kulla: power over squared distance, times the best cosines within
+// the angle its bounds subtend, at the emitters (lights are two
+// sided) and at P.
+float CosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    return cosA > cosB ? 1.0 : cosA * cosB + sinA * sinB;  // cos(max(0, A - B))
+}
+
+float SinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    return cosA > cosB ? 0.0 : sinA * cosB - cosA * sinB;  // sin(max(0, A - B))
+}
+
+float LightImportance(vec3 P, vec3 N, LightNode node)
+{
+    vec3  center = 0.5 * (node.boundsMin + node.boundsMax);
+    vec3  diag = node.boundsMax - node.boundsMin;
+    float r2 = 0.25 * dot(diag, diag);
+    vec3  d = P - center;
+    float d2 = dot(d, d);
+    vec3  wi = d2 > 0.0 ? d / sqrt(d2) : N;  // From the lights toward P
+
+    float cosB = d2 > r2 ? sqrt(1.0 - r2 / d2) : -1.0;  // The bounding sphere's half angle
+    float sinB = sqrt(max(1.0 - cosB * cosB, 0.0));
+    float cosW = abs(dot(node.axis, wi));
+    float sinW = sqrt(max(1.0 - cosW * cosW, 0.0));
+    float sinO = sqrt(max(1.0 - node.cosThetaO * node.cosThetaO, 0.0));
+    float cosX = CosSubClamped(sinW, cosW, sinO, node.cosThetaO);
+    float sinX = SinSubClamped(sinW, cosW, sinO, node.cosThetaO);
+    float cosP = CosSubClamped(sinX, cosX, sinB, cosB);
+    if (cosP <= node.cosThetaE)
+        return 0.0;
+
+    float cosI = dot(-wi, N);
+    float sinI = sqrt(max(1.0 - cosI * cosI, 0.0));
+    float cosIP = CosSubClamped(sinI, cosI, sinB, cosB);
+    return node.power * cosP * max(cosIP, 0.0) / max(d2, r2);
+}
+
+// Walks down the tree, taking each child in proportion to its
+// importance.  Returns the emitter and its probability, or -1 if the
+// walk ends where nothing can contribute.
+int SampleLightTree(vec3 P, vec3 N, inout uint seed, out float pmf)
+{
+    uint node = 0;
+    pmf = 1.0;
+    while (lightTree.n[node].leaf == 0) {
+        uint  child = lightTree.n[node].child;
+        float i0 = LightImportance(P, N, lightTree.n[child]);
+        float i1 = LightImportance(P, N, lightTree.n[child + 1]);
+        if (i0 + i1 <= 0.0)
+            return -1;
+        float p0 = i0 / (i0 + i1);
+        if (rnd(seed) < p0) {
+            node = child;
+            pmf *= p0; }
+        else {
+            node = child + 1;
+            pmf *= 1.0 - p0; } }
+    return int(lightTree.n[node].child);
+}
+
+// The probability of SampleLightTree(P, N) picking emitter: the same
+// choices, made from its leaf up.
+float PmfLightTree(vec3 P, vec3 N, uint emitter)
+{
+    uint  node = lights.e[emitter].node;
+    float pmf = 1.0;
+    while (node != 0) {
+        uint  parent = lightTree.n[node].parent;
+        uint  child = lightTree.n[parent].child;
+        float i0 = LightImportance(P, N, lightTree.n[child]);
+        float i1 = LightImportance(P, N, lightTree.n[child + 1]);
+        if (i0 + i1 <= 0.0)
+            return 0.0;
+        pmf *= (node == child ? i0 : i1) / (i0 + i1);
+        node = parent; }
+    return pmf;
+}
+
+// The power heuristic's weight of a sample drawn with pdf pa, against
+// another strategy that would have drawn it with pdf pb.
+float MisWeight(float pa, float pb)
+{
+    return pa*pa / max(pa*pa + pb*pb, 1e-30);
+}
+
+// Next event estimation at P: an emitter picked by the light tree,
+// and a point on it, with a shadow ray.  Unweighted, it stands for all
+// of the emitters' direct light; L and pdf (per solid angle, 0 if
+// nothing was found) let the caller weight it against the same
+// direction found by its bounce sampling, whatever pdf that has.
+vec3 DirectFromLights(vec3 P, vec3 N, vec3 V, Material mat, inout uint seed, out vec3 L, out float pdf)
+{
+    L = N;
+    pdf = 0.0;
+    if (pcRay.lightCount == 0)
+        return vec3(0.0);
+    float pmf;
+    int e = SampleLightTree(P, N, seed, pmf);
+    if (e < 0)
+        return vec3(0.0);
+    Emitter emitter = lights.e[e];
+    vec3  Y = SampleEmitter(emitter, seed);
+    L = Y - P;
+    float d2 = dot(L, L);
+    float d  = sqrt(d2);
+    L /= d;
+    float cosL = abs(dot(emitter.normal, L));
+    if (dot(N, L) <= 0.0 || cosL <= 1e-6)
+        return vec3(0.0);
+    float pl = pmf * d2 / (emitter.area * cosL);  // Per solid angle
+    if (!Unoccluded(P, L, d * 0.999))  // Short of the emitter itself
+        return vec3(0.0);
+    pdf = pl;
+    return EvalBrdf(N, L, V, mat) * emitter.emission / pl;
+}
+
+// The environment's, likewise.
+vec3 DirectFromEnv(vec3 P, vec3 N, vec3 V, Material mat, inout uint seed, out vec3 L, out float pdf)
+{
+    L = N;
+    pdf = 0.0;
+    if (!pcRay.useEnv)
+        return vec3(0.0);
+    vec3  Le = SampleEnv(seed);
+    float pe = PdfEnv(Le);
+    if (dot(N, Le) <= 0.0 || pe <= 1e-6 || !Unoccluded(P, Le, 10000.0))
+        return vec3(0.0);
+    L = Le;
+    pdf = pe;
+    return EvalBrdf(N, L, V, mat) * EnvRadiance(L, false) / pe;
+}
+
+// The weight of an emitter (at distance dist along dir) found by
+// the bounce sampled at lastP (pdf brdfPdf), against DirectFromLights
+// having sampled it there.
+float EmitterMisWeight(vec3 lastP, vec3 lastN, float brdfPdf, uint emitter, vec3 dir, float dist)
+{
+    if (pcRay.lightCount == 0 || emitter == noEmitter)
+        return 1.0;
+    Emitter e = lights.e[emitter];
+    float cosL = abs(dot(e.normal, dir));
+    float pl = PmfLightTree(lastP, lastN, emitter) * dist * dist / max(e.area * cosL, 1e-12);
+    return MisWeight(brdfPdf, pl);
+}
+
+// ... and of the environment, against DirectFromEnv.
+float EnvMisWeight(float brdfPdf, vec3 dir)
+{
+    return MisWeight(brdfPdf, PdfEnv(dir));
+}
@@ -0,0 +1,126 @@
+// ReSTIR DI (Bitterli et al., "Spatiotemporal Reservoir Resampling for
+// Real-Time Ray Tracing with Dynamic Direct Lighting"), shared by
+// restirDI.rgen and restirDISpatial.rgen, and ReSTIR GI (Ouyang et
+// al., "ReSTIR GI: Path Resampling for Real-Time Path Tracing"), by
+// restirGI.rgen and restirGISpatial.rgen.  Include after raytrace.glsl.
+//
+// The target function is the unshadowed contribution of a light
+// sample without the BRDF: luminance(Le) * cos at the surface * cos at
+// the emitter / d^2.  It needs only a pixel's position and normal, so
+// neighbours' samples are cheap to re-evaluate; raytrace.rgen applies
+// the BRDF and a final shadow ray when shading.
+
+const int   diCandidates    = 8;     // Light tree samples per pixel per frame
+const int   diSpatialTaps   = 4;     // Neighbours per pixel in spatial reuse
+const float diSpatialRadius = 30.0;  //   within this many pixels
+const float diHistoryCap    = 20.0;  // Temporal M, as a multiple of a frame's candidates
+const int   giSpatialTaps   = 4;
+const float giSpatialRadius = 30.0;
+const float giHistoryCap    = 30.0;  // Temporal M: one candidate per frame
+const float giMaxJacobian   = 10.0;  // Reuse rejected beyond this change in solid angle
+
+float DITarget(vec3 P, vec3 N, vec3 lightPos, uint emitter)
+{
+    if (emitter == noEmitter)
+        return 0.0;
+    Emitter e = lights.e[emitter];
+    vec3  L = lightPos - P;
+    float d2 = dot(L, L);
+    if (d2 <= 0.0)
+        return 0.0;
+    L *= inversesqrt(d2);
+    return Luminance(e.emission) * max(dot(N, L), 0.0) * abs(dot(e.normal, L)) / d2;
+}
+
+DIReservoir EmptyReservoir()
+{
+    DIReservoir r;
+    r.lightPos = vec3(0.0);
+    r.emitter  = noEmitter;
+    r.pos      = vec3(0.0);
+    r.W        = 0.0;
+    r.nrm      = vec3(0.0);
+    r.M        = 0.0;
+    return r;
+}
+
+// Whether a neighbour's (or last frame's) reservoir was made on about
+// the same surface as this pixel's: similar normal and plane.
+bool SimilarSurface(DIReservoir r, vec3 P, vec3 N, float dist)
+{
+    return r.M > 0.0 && dot(r.nrm, N) > 0.9 && abs(dot(r.pos - P, N)) < 0.05 * dist;
+}
+
+// Streams reservoir r into the one being built (sample, weight sum
+// wSum): r is chosen with probability proportional to its target at
+// P,N times its W and M.
+void CombineReservoir(inout DIReservoir result, inout float wSum, DIReservoir r,
+                      vec3 P, vec3 N, inout uint seed)
+{
+    float w = DITarget(P, N, r.lightPos, r.emitter) * r.W * r.M;
+    wSum += w;
+    result.M += r.M;
+    if (w > 0.0 && rnd(seed) * wSum < w) {
+        result.lightPos = r.lightPos;
+        result.emitter  = r.emitter; }
+}
+
+// ReSTIR GI's target function is the sample's radiance alone, as in
+// the paper: the reflection at the primary hit is left to raytrace.rgen.
+// Zero if the sample point is behind P, or faces away from it.
+float GITarget(vec3 P, vec3 N, GIReservoir r)
+{
+    vec3 L = r.samplePos - P;
+    if (dot(N, L) <= 0.0 || dot(r.sampleNrm, L) >= 0.0)
+        return 0.0;
+    return Luminance(r.radiance);
+}
+
+// The change in solid angle of a small area at r's sample point, as
+// seen from P instead of the primary hit the sample was traced from:
+// r's W (per solid angle there) times this is per solid angle at P.
+float GIJacobian(vec3 P, GIReservoir r)
+{
+    vec3  toNew = P - r.samplePos;
+    vec3  toOld = r.pos - r.samplePos;
+    float d2New = dot(toNew, toNew);
+    float d2Old = dot(toOld, toOld);
+    float cosNew = abs(dot(r.sampleNrm, toNew)) * inversesqrt(d2New);
+    float cosOld = abs(dot(r.sampleNrm, toOld)) * inversesqrt(d2Old);
+    if (cosOld <= 1e-6 || d2New <= 0.0)
+        return 0.0;
+    float J = (cosNew / d2New) / (cosOld / d2Old);
+    return J > giMaxJacobian || J < 1.0 / giMaxJacobian ? 0.0 : J;
+}
+
+GIReservoir EmptyGIReservoir()
+{
+    GIReservoir r;
+    r.samplePos = vec3(0.0);
+    r.W         = 0.0;
+    r.sampleNrm = vec3(0.0);
+    r.M         = 0.0;
+    r.radiance  = vec3(0.0);
+    r.pos       = vec3(0.0);
+    r.nrm       = vec3(0.0);
+    return r;
+}
+
+bool SimilarSurface(GIReservoir r, vec3 P, vec3 N, float dist)
+{
+    return r.M > 0.0 && dot(r.nrm, N) > 0.9 && abs(dot(r.pos - P, N)) < 0.05 * dist;
+}
+
+// As for DI, with r's W moved into P's solid angle.  The chosen
+// sample's pos becomes P, as it is now traced from there.
+void CombineReservoir(inout GIReservoir result, inout float wSum, GIReservoir r,
+                      vec3 P, vec3 N, inout uint seed)
+{
+    float w = GITarget(P, N, r) * r.W * r.M * GIJacobian(P, r);
+    wSum += w;
+    result.M += r.M;
+    if (w > 0.0 && rnd(seed) * wSum < w) {
+        result.samplePos = r.samplePos;
+        result.sampleNrm = r.sampleNrm;
+        result.radiance  = r.radiance; }
+}
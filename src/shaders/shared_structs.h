@@ -8,6 +8,7 @@ using vec2 = glm::vec2;
 using vec3 = glm::vec3;
 using vec4 = glm::vec4;
 using mat4 = glm::mat4;
+using uvec4 = glm::uvec4;
 using uint = unsigned int;
 #endif
 
@@ -29,7 +30,66 @@ END_ENUM();
 START_ENUM(RtBindings)
 eTlas = 0,  // Top-level acceleration structure
 eOutImage = 1,   // Ray tracer output image
-eColorHistoryImage = 2
+eColorHistoryImage = 2,
+eEnvMap = 7,      // Environment map, full resolution: seen by camera rays
+eEnvLow = 8,      //   ... low resolution: seen by all other rays, and sampled
+eEnvAlias = 9,    // The low resolution map's alias table
+eLights = 10,     // The emitters
+eLightTree = 11,  //   ... and their tree
+eDIReservoirs = 12,  // ReSTIR DI: this frame's reservoirs after temporal reuse,
+eDIFinal = 13,       //   ... and after spatial reuse (next frame's history)
+eGIReservoirs = 14,  // ReSTIR GI: the same two stages
+eGIFinal = 15,
+eCacheKeys = 16,     // Radiance cache: each slot's cell (a hash; 0: free),
+eCacheAccum = 17,    //   ... this frame's samples,
+eCacheCells = 18,    //   ... and the resolved radiance
+eGuideGrid = 19,     // Path guiding: the grid, and its counters,
+eGuideAccum = 20,    //   ... this frame's training samples,
+eGuideTree = 21,     //   ... and each cell's quadtree
+eSampleImage = 22    // The frame's path traced sample, before blending (G-buffer capture)
+END_ENUM();
+
+// Path guiding's directional quadtrees (pathGuiding.glsl): complete,
+// down to eGuideLeafRes x eGuideLeafRes leaves over the sphere.
+START_ENUM(GuideSizes)
+eGuideLeafRes = 8,
+eGuideLeaves = 64,
+eGuideNodes = 85  // 1 + 4 + 16 + 64
+END_ENUM();
+
+// PushConstantRay.cache: the radiance cache (radianceCache.glsl)
+START_ENUM(CacheModes)
+eCacheOff = 0,
+eCacheOn = 1,     // Paths end in the cache after their first bounce
+eCacheShow = 2    // Show the cache's radiance at primary hits
+END_ENUM();
+
+// PushConstantRay.traceMode: which pixels' paths raytrace traces each
+// frame; reconstruct.comp fills in the rest.
+START_ENUM(TraceModes)
+eTraceFull = 0,
+eTraceHalf = 1,     // One of each 2x2 block, in turn
+eTraceChecker = 2   // Every other pixel, alternating
+END_ENUM();
+
+// TLAS instance masks, and rays' cull masks: an instance is only hit
+// by rays whose cull mask shares a bit with its mask.
+START_ENUM(RayMasks)
+eRayCamera = 0x01,        // Primary rays
+eRayBounce = 0x02,        // Every later segment of a path
+eInstanceAll = 0xFF,      // Seen by every ray
+eInstanceNoCamera = 0xFE  // Light geometry hidden from the camera (-L)
+END_ENUM();
+
+// PushConstantRay.restir's bits: which ReSTIR passes run (vkapp_restir.cpp)
+START_ENUM(RestirModes)
+eRestirDI = 1,    // Direct light from emitters at primary hits
+eRestirGI = 2     // Indirect light at primary hits
+END_ENUM();
+
+// ObjDesc.emitterAddress's entry for a triangle that doesn't emit
+START_ENUM(EmitterIndices)
+noEmitter = 0xFFFFFFFFu
 END_ENUM();
 // clang-format on
 
@@ -43,9 +103,23 @@ struct ObjDesc
     uint64_t indexAddress;          // Address of the index buffer
     uint64_t materialAddress;       // Address of the material buffer
     uint64_t materialIndexAddress;  // Address of the triangle material index buffer
+    uint64_t primRemapAddress;      // Address of the BLAS's PrimRemaps, or 0 if not split
+    uint64_t emitterAddress;        // Address of each triangle's emitter index (or noEmitter), or 0 if none emit
+};
+
+// Triangle splitting (triangle_split.h): BLAS triangle i is part of
+// the model's triangle prim, its corners at barycentrics (1-u-v, u, v)
+// of that one, with (u,v) = c0, c1, c2.
+struct PrimRemap
+{
+    vec2 c0;
+    vec2 c1;
+    vec2 c2;
+    uint prim;
 };
 
-// An emitter
+// An emitter: a world space triangle whose material emits (lights
+// are two sided)
 struct Emitter
 {
     vec3 v0;
@@ -54,7 +128,25 @@ struct Emitter
     vec3 emission;
     vec3 normal;
     float area;
-    uint index;
+    uint index;     // Its model's triangle
+    uint node;      // Its light tree leaf (light_tree.h)
+};
+
+// A node of the light tree (light_tree.h): the bounds, total power
+// and orientation cone of the emitters below it.  The cone holds
+// their normals within acos(cosThetaO) of axis, and each emits within
+// acos(cosThetaE) beyond its normal.
+struct LightNode
+{
+    vec3  boundsMin;
+    float power;
+    vec3  boundsMax;
+    float cosThetaO;
+    vec3  axis;
+    float cosThetaE;
+    uint  child;    // Interior: the first of its two (adjacent) children; leaf: its emitter
+    uint  parent;   // Unused at the root
+    uint  leaf;
 };
 
 // Uniform buffer set at each frame
@@ -108,9 +200,6 @@ struct PushConstantRay
     ALIGNAS(4) uint frameSeed;
     ALIGNAS(4) int depth;
     ALIGNAS(4) float rr;
-    ALIGNAS(16) vec4 tempLightPos;
-    ALIGNAS(16) vec4 tempLightInt;
-    ALIGNAS(16) vec4 tempAmbient;
     ALIGNAS(4) bool fullBRDF;
     ALIGNAS(4) bool bilinear;
     ALIGNAS(4) float n_threshold;
@@ -119,10 +208,90 @@ struct PushConstantRay
     ALIGNAS(4) bool useHistory;
     ALIGNAS(4) bool doExplicit;
     ALIGNAS(4) bool clear;
+    ALIGNAS(4) bool useEnv;          // Environment lighting (-e)
+    ALIGNAS(4) float envIntensity;
+    ALIGNAS(4) int envWidth;         // Of the low resolution map
+    ALIGNAS(4) int envHeight;
+    ALIGNAS(4) int lightCount;       // Emitters; 0: no next event estimation
+    ALIGNAS(4) int restir;           // RestirModes bits
+    ALIGNAS(4) int cache;            // CacheModes
+    ALIGNAS(4) float cacheCellSize;  // Its finest cells' size
+    ALIGNAS(4) uint cacheCapacity;   // Its slots
+    ALIGNAS(4) bool guiding;         // Path guiding (pathGuiding.glsl)
+    ALIGNAS(4) int traceMode;        // TraceModes
+    ALIGNAS(4) uint tracePhase;      // Which pixels it traces this frame
+    ALIGNAS(4) int renderWidth;      // The images' top left part rendered (dynamic resolution),
+    ALIGNAS(4) int renderHeight;
+    ALIGNAS(4) int priorWidth;       //   ... and last frame's, which the history holds
+    ALIGNAS(4) int priorHeight;
+    ALIGNAS(4) bool captureSample;   // Write the sample to eSampleImage too
     // @@ Set alignmentTest to a known value in C++;  Test for that value in the shader!
     ALIGNAS(4) int alignmentTest;
 };
 
+// Push constant structure for skinning.comp: one dispatch per
+// skinned object, reading and writing through device addresses.
+struct PushConstantSkinning
+{
+    uint64_t restAddress;   // Vertex[]: the bind pose
+    uint64_t skinAddress;   // SkinWeights[]
+    uint64_t boneAddress;   // mat4[]: this frame's skinning matrices
+    uint64_t outAddress;    // Vertex[]: the posed vertices
+    uint     vertexCount;
+};
+
+// Push constant structure for radianceCache.comp, which resolves the
+// radiance cache's samples once per frame.
+struct PushConstantCache
+{
+    uint64_t keyAddress;     // uint[capacity]
+    uint64_t accumAddress;   // uvec4[capacity]
+    uint64_t cellAddress;    // CacheCell[capacity]
+    uint     capacity;
+    uint     maxAge;         // Frames without samples before a cell is freed
+    float    maxSamples;     // The most samples a cell's radiance averages
+};
+
+// Path guiding's spatial subdivision: res^3 cells over the scene's
+// bounds.  The counters are this frame's, for the cost report, and
+// are reset by guiding.comp.
+struct GuideGrid
+{
+    vec3  boundsMin;
+    uint  res;
+    vec3  boundsMax;
+    float guideFraction;    // Of bounces that sample the quadtree, where trained
+    uint  guidedSamples;    // Directions drawn from quadtrees
+    uint  trainingSamples;  // Path vertices added to them
+};
+
+// Push constant structure for guiding.comp, which rebuilds the
+// quadtrees from each frame's training samples.
+struct PushConstantGuide
+{
+    uint64_t gridAddress;    // GuideGrid
+    uint64_t accumAddress;   // uint[cells * eGuideLeaves]
+    uint64_t treeAddress;    // float[cells * eGuideNodes]
+    uint64_t statsAddress;   // uint[2]: this frame slot's copy of the counters
+    uint     cells;
+    float    decay;          // Of the quadtrees' energy, per frame
+};
+
+// A radiance cache cell: the outgoing radiance of the surfaces inside
+// it, averaged over directions and its last samples.
+struct CacheCell
+{
+    vec3  radiance;
+    float samples;
+    uint  age;      // Frames since its last sample
+};
+
+struct SkinWeights  // Up to four bones per vertex; the C++ side is SkinVertex
+{
+    uvec4 joints;
+    vec4  weights;
+};
+
 struct Vertex  // Created by readModel; used in shaders
 {
     vec3 pos;
@@ -140,6 +309,45 @@ struct Material  // Created by readModel; used in shaders
 };
 
 
+// An entry of the environment map's alias table (env_map.h): pixel i
+// is drawn with probability pdf, by picking an entry uniformly and
+// keeping it with probability q, else taking its alias.
+struct EnvAlias
+{
+    float q;
+    uint  alias;
+    float pdf;    // Of drawing this pixel
+};
+
+// A ReSTIR DI reservoir (restir.glsl): one pixel's light sample, a
+// point on an emitter, standing for M candidates, with its unbiased
+// contribution weight W (an estimate of 1/pdf, in area measure).
+struct DIReservoir
+{
+    vec3  lightPos;
+    uint  emitter;  // noEmitter: no sample
+    vec3  pos;      // The pixel's primary hit,
+    float W;
+    vec3  nrm;      //   and its normal; 0 if none (or emissive)
+    float M;
+};
+
+// A ReSTIR GI reservoir (restir.glsl): one pixel's indirect sample,
+// the point a ray from its primary hit reached, with the radiance
+// leaving that point back toward where it was traced from.  W is an
+// estimate of 1/pdf in solid angle at pos; reused at another primary
+// hit, it is rescaled by the Jacobian between the two solid angles.
+struct GIReservoir
+{
+    vec3  samplePos;
+    float W;
+    vec3  sampleNrm;
+    float M;
+    vec3  radiance;
+    vec3  pos;      // The primary hit the sample was traced from,
+    vec3  nrm;      //   and its normal; 0 if none (or emissive)
+};
+
 // Push constant structure for the ray tracer
 struct PushConstantDenoise
 {
@@ -150,6 +358,26 @@ struct PushConstantDenoise
     int  stepwidth;
     //ALIGNAS(4) bool demodulate;
     //ALIGNAS(4) bool splitscreen;
+    int  width;    // The render size; pixels beyond are left out
+    int  height;
+};
+
+// Push constant structure for reconstruct.comp
+struct PushConstantReconstruct
+{
+    int  traceMode;   // As PushConstantRay's
+    uint tracePhase;
+    int  width;       // The render size
+    int  height;
+};
+
+// Push constant structure for post.frag: texture coordinates from
+// window pixels, and the largest, which keeps the filter within the
+// rendered part of the image.
+struct PushConstantPost
+{
+    vec2 uvScale;
+    vec2 uvMax;
 };
 
 struct RayPayload
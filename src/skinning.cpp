@@ -0,0 +1,85 @@
+
+#include <algorithm>
+#include <cmath>
+
+#include "skinning.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+int Skeleton::findNode(const std::string& name) const
+{
+    for (size_t i = 0;  i < nodes.size();  i++)
+        if (nodes[i].name == name)
+            return (int)i;
+    return -1;
+}
+
+// Keyframe interpolation: the keys bracketing time, linearly blended.
+static glm::vec3 sample(const std::vector<Skeleton::Key<glm::vec3>>& keys, float time,
+                        const glm::vec3& otherwise)
+{
+    if (keys.empty())
+        return otherwise;
+    if (keys.size() == 1 || time <= keys.front().time)
+        return keys.front().value;
+    for (size_t k = 1;  k < keys.size();  k++)
+        if (time < keys[k].time) {
+            float t = (time - keys[k-1].time) / (keys[k].time - keys[k-1].time);
+            return glm::mix(keys[k-1].value, keys[k].value, t); }
+    return keys.back().value;
+}
+
+static glm::quat sample(const std::vector<Skeleton::Key<glm::quat>>& keys, float time,
+                        const glm::quat& otherwise)
+{
+    if (keys.empty())
+        return otherwise;
+    if (keys.size() == 1 || time <= keys.front().time)
+        return keys.front().value;
+    for (size_t k = 1;  k < keys.size();  k++)
+        if (time < keys[k].time) {
+            float t = (time - keys[k-1].time) / (keys[k].time - keys[k-1].time);
+            return glm::normalize(glm::slerp(keys[k-1].value, keys[k].value, t)); }
+    return keys.back().value;
+}
+
+void Skeleton::pose(uint32_t animation, double seconds, std::vector<glm::mat4>& skinning) const
+{
+    std::vector<glm::mat4> local(nodes.size());
+    for (size_t n = 0;  n < nodes.size();  n++)
+        local[n] = nodes[n].local;
+
+    if (animation < animations.size()) {
+        const Animation& anim = animations[animation];
+        float ticks = float(seconds * anim.ticksPerSecond);
+        if (anim.duration > 0)
+            ticks = std::fmod(ticks, anim.duration);
+        for (const Channel& channel : anim.channels) {
+            glm::vec3 t = sample(channel.positions, ticks, glm::vec3(0.0f));
+            glm::quat r = sample(channel.rotations, ticks, glm::quat(1, 0, 0, 0));
+            glm::vec3 s = sample(channel.scales, ticks, glm::vec3(1.0f));
+            local[channel.node] = glm::translate(glm::mat4(1.0f), t) * glm::mat4_cast(r)
+                * glm::scale(glm::mat4(1.0f), s); } }
+
+    // Parents come first.
+    std::vector<glm::mat4> global(nodes.size());
+    for (size_t n = 0;  n < nodes.size();  n++)
+        global[n] = nodes[n].parent < 0 ? local[n] : global[nodes[n].parent] * local[n];
+
+    skinning.resize(bones.size());
+    for (size_t b = 0;  b < bones.size();  b++)
+        skinning[b] = global[bones[b].node] * bones[b].offset;
+}
+
+float skinDeformation(const Skeleton& skeleton, const std::vector<glm::mat4>& a,
+                      const std::vector<glm::mat4>& b, float radius)
+{
+    float worst = 0.0f;
+    for (size_t i = 0;  i < skeleton.bones.size() && i < a.size() && i < b.size();  i++) {
+        const Skeleton::Bone& bone = skeleton.bones[i];
+        for (int c = 0;  c < 8;  c++) {
+            glm::vec4 corner((c & 1) ? bone.boundsMax.x : bone.boundsMin.x,
+                             (c & 2) ? bone.boundsMax.y : bone.boundsMin.y,
+                             (c & 4) ? bone.boundsMax.z : bone.boundsMin.z, 1.0f);
+            worst = std::max(worst, glm::length(glm::vec3(a[i] * corner - b[i] * corner))); } }
+    return worst / std::max(radius, 1e-6f);
+}
@@ -0,0 +1,81 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// A skeleton and its animations, as read from a model file (see
+// readAssimpFile), and the CPU side of skinning: posing the bones at
+// a time gives the skinning matrices that skinning.comp applies.
+//
+// Nodes are stored parents first, so one pass computes the global
+// transforms.  A bone is a node plus an offset matrix taking the
+// mesh's bind pose into the bone's space.
+struct Skeleton
+{
+    struct Node
+    {
+        std::string name;
+        glm::mat4   local{1.0f};    // Transform relative to parent, when not animated
+        int         parent{-1};
+    };
+
+    struct Bone
+    {
+        int       node{-1};
+        glm::mat4 offset{1.0f};     // Mesh (bind pose) space to bone space
+        glm::vec3 boundsMin{0.0f};  // Bind pose box of the vertices it moves
+        glm::vec3 boundsMax{0.0f};
+    };
+
+    template <typename T> struct Key
+    {
+        float time;                 // In ticks
+        T     value;
+    };
+
+    struct Channel                  // One node's keyframes
+    {
+        int node{-1};
+        std::vector<Key<glm::vec3>> positions;
+        std::vector<Key<glm::quat>> rotations;
+        std::vector<Key<glm::vec3>> scales;
+    };
+
+    struct Animation
+    {
+        std::string          name;
+        float                duration{0};        // In ticks
+        float                ticksPerSecond{25};
+        std::vector<Channel> channels;
+    };
+
+    std::vector<Node>      nodes;
+    std::vector<Bone>      bones;
+    std::vector<Animation> animations;
+
+    int findNode(const std::string& name) const;
+
+    // The skinning matrix (global transform * offset) of each bone,
+    // for animation at seconds (looping); the bind pose if there is
+    // no such animation.
+    void pose(uint32_t animation, double seconds, std::vector<glm::mat4>& skinning) const;
+};
+
+// Per vertex: up to four bones (indices into Skeleton::bones), with
+// weights summing to one.  A vertex with no weights isn't skinned.
+struct SkinVertex
+{
+    glm::uvec4 joints{0};
+    glm::vec4  weights{0.0f};
+};
+
+// How far the skinning matrices a move each bone's box from where
+// the matrices b put it, as a fraction of radius.  The measure of
+// deformation behind refit-or-rebuild decisions.
+float skinDeformation(const Skeleton& skeleton, const std::vector<glm::mat4>& a,
+                      const std::vector<glm::mat4>& b, float radius);
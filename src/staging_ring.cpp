@@ -0,0 +1,299 @@
+
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+
+#include "vkapp.h"
+#include "staging_ring.h"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void StagingRing::setup(VkApp* _VK, uint32_t queueFamily, VkQueue queue, VkDeviceSize size)
+{
+    VK = _VK;
+    m_queueFamily = queueFamily;
+    m_queue = queue;
+
+    VkCommandPoolCreateInfo poolCreateInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolCreateInfo.queueFamilyIndex = m_queueFamily;
+    if (vkCreateCommandPool(VK->m_device, &poolCreateInfo, nullptr, &m_cmdPool) != VK_SUCCESS)
+        throw std::runtime_error("failed to create upload command pool!");
+
+    VkSemaphoreTypeCreateInfo typeInfo{VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue  = 0;
+    VkSemaphoreCreateInfo semCreateInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, &typeInfo};
+    if (vkCreateSemaphore(VK->m_device, &semCreateInfo, nullptr, &m_timeline) != VK_SUCCESS)
+        throw std::runtime_error("failed to create upload timeline semaphore!");
+
+    m_size = size;
+    m_ring = VK->createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    // To destroy: destroy()
+}
+
+void StagingRing::destroy()
+{
+    finish();
+    m_acquires.clear();
+    m_ring.destroy(VK->m_device);
+    vkDestroySemaphore(VK->m_device, m_timeline, nullptr);
+    vkDestroyCommandPool(VK->m_device, m_cmdPool, nullptr);
+}
+
+bool StagingRing::ownershipTransfer() const
+{
+    return m_queueFamily != VK->m_graphicsQueueIndex;
+}
+
+VkCommandBuffer StagingRing::cmd()
+{
+    if (m_current.cmdBuf == VK_NULL_HANDLE) {
+        VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocateInfo.commandBufferCount = 1;
+        allocateInfo.commandPool = m_cmdPool;
+        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        vkAllocateCommandBuffers(VK->m_device, &allocateInfo, &m_current.cmdBuf);
+
+        VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(m_current.cmdBuf, &beginInfo); }
+    return m_current.cmdBuf;
+}
+
+uint64_t StagingRing::completedTicket()
+{
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(VK->m_device, m_timeline, &value);
+    return value;
+}
+
+// Release the ring space of finished batches, oldest first.  With
+// wait, block on the oldest one instead of just polling.
+void StagingRing::retire(bool wait)
+{
+    uint64_t completed = completedTicket();
+    while (!m_inFlight.empty()) {
+        Batch& batch = m_inFlight.front();
+        if (batch.ticket > completed) {
+            if (!wait)
+                break;
+            VkSemaphoreWaitInfo waitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+            waitInfo.semaphoreCount = 1;
+            waitInfo.pSemaphores = &m_timeline;
+            waitInfo.pValues = &batch.ticket;
+            vkWaitSemaphores(VK->m_device, &waitInfo, UINT64_MAX);
+            completed = batch.ticket;
+            wait = false; }
+
+        vkFreeCommandBuffers(VK->m_device, m_cmdPool, 1, &batch.cmdBuf);
+        for (auto& buffer : batch.oversized)
+            buffer.destroy(VK->m_device);
+        m_used -= batch.bytes;
+        m_inFlight.pop_front(); }
+}
+
+StagingRegion StagingRing::alloc(VkDeviceSize size, VkDeviceSize alignment)
+{
+    m_uploads++;
+    m_bytes += size;
+    StagingRegion region;
+
+    if (size > m_size) {
+        BufferWrap staging = VK->createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                                  | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
+        region.buffer = staging.buffer;
+        region.mapped = staging.mapped;
+        m_current.oversized.push_back(staging);
+        return region; }
+
+    while (true) {
+        if (m_used == 0)
+            m_head = 0;
+
+        // Space needed at the head, or at the start if it has to wrap.
+        VkDeviceSize offset = alignUp(m_head, alignment);
+        VkDeviceSize need = offset - m_head + size;
+        if (offset + size > m_size) {
+            offset = 0;
+            need = m_size - m_head + size; }
+
+        if (m_used + need <= m_size) {
+            m_used += need;
+            m_current.bytes += need;
+            m_head = offset + size;
+            region.buffer = m_ring.buffer;
+            region.offset = offset;
+            region.mapped = static_cast<char*>(m_ring.mapped) + offset;
+            return region; }
+
+        // Full: hand the current batch to the GPU, then wait for the
+        // oldest batch to free its space.
+        if (m_current.bytes > 0) {
+            cmd();
+            flush(); }
+        else if (m_inFlight.empty())
+            throw std::runtime_error("staging ring accounting error!");
+        VkDeviceSize before = m_used;
+        retire(false);
+        if (m_used == before) {
+            m_stalls++;
+            retire(true); } }
+}
+
+void StagingRing::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size,
+                               const void* data)
+{
+    StagingRegion region = alloc(size);
+    memcpy(region.mapped, data, size);
+
+    VkBufferCopy copyRegion{region.offset, dstOffset, size};
+    vkCmdCopyBuffer(cmd(), region.buffer, dst, 1, &copyRegion);
+    releaseBuffer(dst);
+}
+
+void StagingRing::releaseBuffer(VkBuffer buffer)
+{
+    VkBufferMemoryBarrier barrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    barrier.srcQueueFamilyIndex = m_queueFamily;
+    barrier.dstQueueFamilyIndex = VK->m_graphicsQueueIndex;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size   = VK_WHOLE_SIZE;
+    if (!ownershipTransfer())
+        return;  // Same family: the timeline semaphore wait is enough.
+
+    // Release: only the source half of the dependency.
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, nullptr, 1, &barrier, 0, nullptr);
+
+    // Acquire: only the destination half.
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    m_currentAcquire.buffers.push_back(barrier);
+}
+
+void StagingRing::releaseImage(VkImage image, VkImageLayout layout, uint32_t mipLevels)
+{
+    VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    barrier.oldLayout = layout;
+    barrier.newLayout = layout;
+    barrier.srcQueueFamilyIndex = m_queueFamily;
+    barrier.dstQueueFamilyIndex = VK->m_graphicsQueueIndex;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    if (!ownershipTransfer())
+        return;
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    m_currentAcquire.images.push_back(barrier);
+}
+
+void StagingRing::afterAcquire(std::function<void(VkCommandBuffer)> work)
+{
+    cmd();  // The work belongs to the batch being recorded.
+    m_currentAcquire.work.push_back(work);
+}
+
+uint64_t StagingRing::flush()
+{
+    if (m_current.cmdBuf == VK_NULL_HANDLE) {
+        // Nothing recorded, but an oversized alloc() may be pending.
+        for (auto& buffer : m_current.oversized)
+            buffer.destroy(VK->m_device);
+        m_used -= m_current.bytes;
+        m_current = Batch();
+        return m_lastTicket; }
+
+    vkEndCommandBuffer(m_current.cmdBuf);
+    m_current.ticket = ++m_lastTicket;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &m_current.ticket;
+
+    VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO, &timelineInfo};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &m_current.cmdBuf;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &m_timeline;
+    if (vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        throw std::runtime_error("failed to submit staging copies!");
+    m_submits++;
+
+    m_currentAcquire.ticket = m_current.ticket;
+    m_acquires.push_back(std::move(m_currentAcquire));
+    m_currentAcquire = Acquire();
+
+    m_inFlight.push_back(m_current);
+    m_current = Batch();
+    retire(false);
+    return m_lastTicket;
+}
+
+void StagingRing::finish()
+{
+    flush();
+    while (!m_inFlight.empty())
+        retire(true);
+}
+
+VkCommandBuffer StagingRing::takeAcquires(uint64_t upTo, uint64_t& waitValue)
+{
+    waitValue = 0;
+    VkCommandBuffer cmdBuf = VK_NULL_HANDLE;
+
+    while (!m_acquires.empty() && m_acquires.front().ticket <= upTo) {
+        Acquire& acquire = m_acquires.front();
+        waitValue = acquire.ticket;
+        if (!acquire.buffers.empty() || !acquire.images.empty() || !acquire.work.empty()) {
+            if (cmdBuf == VK_NULL_HANDLE) {
+                VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+                allocateInfo.commandBufferCount = 1;
+                allocateInfo.commandPool = VK->m_cmdPool;
+                allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                vkAllocateCommandBuffers(VK->m_device, &allocateInfo, &cmdBuf);
+
+                VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                vkBeginCommandBuffer(cmdBuf, &beginInfo); }
+
+            if (!acquire.buffers.empty() || !acquire.images.empty())
+                vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                     VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+                                     acquire.buffers.size(), acquire.buffers.data(),
+                                     acquire.images.size(), acquire.images.data());
+            for (auto& work : acquire.work)
+                work(cmdBuf); }
+        m_acquires.pop_front(); }
+
+    if (cmdBuf != VK_NULL_HANDLE)
+        vkEndCommandBuffer(cmdBuf);
+    return cmdBuf;
+}
+
+void StagingRing::printStats()
+{
+    printf("Staging ring (queue family %u%s): %u uploads, %.2f MB in %u submits, "
+           "%u stalls on a full ring\n",
+           m_queueFamily, ownershipTransfer() ? ", dedicated transfer" : "",
+           m_uploads, m_bytes / (1024.0 * 1024.0), m_submits, m_stalls);
+}
@@ -0,0 +1,129 @@
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "buffer_wrap.h"
+
+class VkApp;
+
+// A piece of the staging ring: copy from buffer at offset, after
+// writing the data through mapped.
+struct StagingRegion
+{
+    VkBuffer     buffer{VK_NULL_HANDLE};
+    VkDeviceSize offset{0};
+    void*        mapped{nullptr};
+};
+
+// The upload context: host to device uploads through one persistently
+// mapped ring buffer, executed on the transfer queue.
+//
+// An upload is a sub-allocation from the ring (alloc) plus a memcpy,
+// and a copy command recorded into cmd().  Copies accumulate in one
+// command buffer until flush() submits it to the transfer queue.  The
+// submit signals a timeline semaphore, and the value it signals is the
+// batch's ticket.  The ring space used by a batch is released once its
+// ticket is reached.  alloc() only blocks if the ring is full of
+// in-flight data.  Requests bigger than the whole ring get a transient
+// staging buffer of their own, destroyed with their batch.
+//
+// The graphics queue never waits on the CPU for an upload; it waits
+// on the timeline semaphore instead.  If the transfer queue is from
+// another family, every destination is released by the transfer queue
+// (releaseBuffer/releaseImage) and acquired by the graphics queue.  The
+// acquire barriers, and any graphics-only follow-up work such as mip
+// blits (afterAcquire), are recorded by takeAcquires into a command
+// buffer that the caller submits ahead of its own work, together with
+// a wait on timeline() for the returned value.
+//
+// submitTempCmdBuffer takes everything flushed so far (so setup code
+// sees its uploads), while submitFrame takes only completed batches.
+// Code that streams data in while rendering must therefore keep the
+// ticket returned by flush() and not use the data before
+// isComplete(ticket).
+class StagingRing
+{
+public:
+    void setup(VkApp* _VK, uint32_t queueFamily, VkQueue queue,
+               VkDeviceSize size = 32*1024*1024);
+    void destroy();
+
+    StagingRegion alloc(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+    // Allocate, copy data in, record a copy to dst, and release dst.
+    void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, const void* data);
+
+    // The transfer queue command buffer of the batch being recorded.
+    VkCommandBuffer cmd();
+
+    // Hand a destination written in cmd() over to the graphics queue.
+    void releaseBuffer(VkBuffer buffer);
+    void releaseImage(VkImage image, VkImageLayout layout, uint32_t mipLevels);
+
+    // Graphics queue work to run once this batch has been acquired.
+    void afterAcquire(std::function<void(VkCommandBuffer)> work);
+
+    uint64_t flush();       // Submit the current batch, if any; returns the last ticket
+    void     finish();      // flush(), then wait on the CPU for every batch
+
+    VkSemaphore timeline() const { return m_timeline; }
+    uint64_t    lastTicket() const { return m_lastTicket; }
+    uint64_t    completedTicket();
+    bool        isComplete(uint64_t ticket) { return ticket <= completedTicket(); }
+
+    // A graphics queue command buffer (allocated from VK->m_cmdPool,
+    // ended, and owned by the caller from now on) holding the acquires
+    // and follow-up work of the batches up to ticket upTo.  Returns
+    // VK_NULL_HANDLE if there are none.  The caller's submit must wait
+    // on timeline() for waitValue.
+    VkCommandBuffer takeAcquires(uint64_t upTo, uint64_t& waitValue);
+
+    void printStats();
+
+private:
+    struct Batch
+    {
+        VkCommandBuffer         cmdBuf{VK_NULL_HANDLE};
+        uint64_t                ticket{0};
+        VkDeviceSize            bytes{0};   // Ring space to release when done
+        std::vector<BufferWrap> oversized;
+    };
+
+    struct Acquire
+    {
+        uint64_t                              ticket{0};
+        std::vector<VkBufferMemoryBarrier>    buffers;
+        std::vector<VkImageMemoryBarrier>     images;
+        std::vector<std::function<void(VkCommandBuffer)>> work;
+    };
+
+    VkApp*        VK{nullptr};
+    uint32_t      m_queueFamily{0};
+    VkQueue       m_queue{VK_NULL_HANDLE};
+    VkCommandPool m_cmdPool{VK_NULL_HANDLE};
+    VkSemaphore   m_timeline{VK_NULL_HANDLE};
+    uint64_t      m_lastTicket{0};
+
+    BufferWrap   m_ring{};
+    VkDeviceSize m_size{0};
+    VkDeviceSize m_head{0};     // Next free byte
+    VkDeviceSize m_used{0};     // Bytes held by batches in flight or recording
+
+    Batch               m_current{};
+    Acquire             m_currentAcquire{};
+    std::deque<Batch>   m_inFlight;
+    std::deque<Acquire> m_acquires;  // Flushed, not yet taken by the graphics queue
+
+    // Statistics
+    uint32_t     m_uploads{0};
+    uint32_t     m_submits{0};
+    uint32_t     m_stalls{0};
+    VkDeviceSize m_bytes{0};
+
+    bool ownershipTransfer() const;
+    void retire(bool wait);
+};
@@ -0,0 +1,131 @@
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small pool of worker threads for CPU-side work (CPU kernels,
+// BVH builds, command recording, ...).  Work is grouped into a
+// TaskGroup; wait() on a group runs queued tasks on the calling
+// thread until the group is done, so tasks may safely spawn and wait
+// on nested groups.
+class ThreadPool
+{
+public:
+    struct TaskGroup
+    {
+        std::atomic<int> pending{0};
+    };
+
+    explicit ThreadPool(unsigned count = 0)
+    {
+        if (count == 0)
+            count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0;  i < count;  i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto& w : workers)
+            w.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+    // Queue one task as part of group.
+    void run(TaskGroup& group, std::function<void()> task)
+    {
+        group.pending++;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back({&group, std::move(task)});
+        }
+        wakeup.notify_one();
+    }
+
+    // Block until all tasks of group are done, helping with queued work meanwhile.
+    void wait(TaskGroup& group)
+    {
+        while (group.pending.load() > 0) {
+            if (!runOne())
+                std::this_thread::yield(); }
+    }
+
+    // Split [begin,end) into roughly equal chunks, one per task, and
+    // call body(chunkBegin, chunkEnd) for each.  Returns when all are done.
+    void parallelFor(int begin, int end, const std::function<void(int, int)>& body,
+                     int minChunk = 1)
+    {
+        int count = end - begin;
+        if (count <= 0)
+            return;
+        int chunks = std::min<int>(count / std::max(1, minChunk), 4 * (int)size());
+        chunks = std::max(1, chunks);
+        int chunkSize = (count + chunks - 1) / chunks;
+
+        TaskGroup group;
+        for (int b = begin;  b < end;  b += chunkSize) {
+            int e = std::min(end, b + chunkSize);
+            run(group, [&body, b, e] { body(b, e); }); }
+        wait(group);
+    }
+
+private:
+    struct Task
+    {
+        TaskGroup*            group;
+        std::function<void()> fn;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<Task>         queue;
+    std::mutex               mutex;
+    std::condition_variable  wakeup;
+    bool                     stopping{false};
+
+    bool runOne()
+    {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.empty())
+                return false;
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task.fn();
+        task.group->pending--;
+        return true;
+    }
+
+    void workerLoop()
+    {
+        for (;;) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping && queue.empty())
+                    return;
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+            task.fn();
+            task.group->pending--; }
+    }
+};
@@ -0,0 +1,112 @@
+
+#include <algorithm>
+#include <queue>
+
+#include "triangle_split.h"
+
+static const uint32_t noPiece = ~0u;
+
+// A triangle, or a piece of one: positions, and corner barycentrics
+// (u,v of (1-u-v, u, v)) in the original.
+struct Piece
+{
+    vec3     p[3];
+    vec2     c[3];
+    uint32_t prim;
+    uint32_t next{noPiece};  // The original's next piece
+};
+
+// The piece's bounding box surface area beyond its own (two sided)
+// area, and their ratio.
+static float excessArea(const Piece& piece, float& ratio)
+{
+    vec3  lo = glm::min(piece.p[0], glm::min(piece.p[1], piece.p[2]));
+    vec3  hi = glm::max(piece.p[0], glm::max(piece.p[1], piece.p[2]));
+    vec3  d  = hi - lo;
+    float boxArea = 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    float area = glm::length(glm::cross(piece.p[1] - piece.p[0], piece.p[2] - piece.p[0]));
+    ratio = boxArea / std::max(area, 1e-20f);
+    return boxArea - area;
+}
+
+SplitMesh splitTriangles(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+                         float budget, float threshold)
+{
+    SplitMesh result;
+    uint32_t  triangles = (uint32_t)(indices.size() / 3);
+    uint32_t  maxExtra  = (uint32_t)(budget * triangles);
+
+    std::vector<Piece> pieces(triangles);
+    using Entry = std::pair<float, uint32_t>;  // Excess area, piece
+    std::priority_queue<Entry> queue;
+    for (uint32_t t = 0;  t < triangles;  t++) {
+        Piece& piece = pieces[t];
+        for (int k = 0;  k < 3;  k++)
+            piece.p[k] = vertices[indices[3 * t + k]].pos;
+        piece.c[0] = vec2(0, 0);
+        piece.c[1] = vec2(1, 0);
+        piece.c[2] = vec2(0, 1);
+        piece.prim = t;
+        float ratio, excess = excessArea(piece, ratio);
+        if (ratio > threshold)
+            queue.push({excess, t}); }
+
+    // Halve the worst piece at its longest edge's midpoint: (a,b,c)
+    // split on a-b at m is (a,m,c) and (m,b,c), keeping the winding.
+    std::vector<bool> split(triangles, false);
+    while (!queue.empty() && pieces.size() - triangles < maxExtra) {
+        uint32_t index = queue.top().second;
+        queue.pop();
+        Piece piece = pieces[index];
+        int   k = 0;
+        float longest = -1.0f;
+        for (int e = 0;  e < 3;  e++) {
+            float length2 = glm::dot(piece.p[(e + 1) % 3] - piece.p[e], piece.p[(e + 1) % 3] - piece.p[e]);
+            if (length2 > longest) {
+                longest = length2;
+                k = e; } }
+        int  k1 = (k + 1) % 3;
+        vec3 m  = 0.5f * (piece.p[k] + piece.p[k1]);
+        vec2 cm = 0.5f * (piece.c[k] + piece.c[k1]);
+
+        Piece a = piece, b = piece;
+        a.p[k1] = m;  a.c[k1] = cm;
+        b.p[k]  = m;  b.c[k]  = cm;
+        uint32_t bIndex = (uint32_t)pieces.size();
+        a.next = bIndex;
+        b.next = piece.next;
+        pieces[index] = a;
+        pieces.push_back(b);
+        split[piece.prim] = true;
+
+        float ratio, excess = excessArea(a, ratio);
+        if (ratio > threshold)
+            queue.push({excess, index});
+        excess = excessArea(b, ratio);
+        if (ratio > threshold)
+            queue.push({excess, bIndex}); }
+
+    for (uint32_t t = 0;  t < triangles;  t++)
+        result.splitCount += split[t];
+    if (result.splitCount == 0)
+        return result;
+
+    // Unsplit triangles use the model's vertices; pieces get their own.
+    result.positions.reserve(vertices.size() + 3 * (pieces.size() - triangles + result.splitCount));
+    for (const Vertex& v : vertices)
+        result.positions.push_back(v.pos);
+    result.indices.reserve(3 * pieces.size());
+    result.remap.reserve(pieces.size());
+    for (uint32_t t = 0;  t < triangles;  t++)
+        for (uint32_t p = t;  p != noPiece;  p = pieces[p].next) {
+            const Piece& piece = pieces[p];
+            for (int k = 0;  k < 3;  k++) {
+                if (split[t]) {
+                    result.indices.push_back((uint32_t)result.positions.size());
+                    result.positions.push_back(piece.p[k]); }
+                else
+                    result.indices.push_back(indices[3 * t + k]); }
+            result.remap.push_back({piece.c[0], piece.c[1], piece.c[2], t}); }
+
+    return result;
+}
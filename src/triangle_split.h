@@ -0,0 +1,30 @@
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "shaders/shared_structs.h"
+
+// Pre-build splitting of long, thin triangles, for the BLAS only.  A
+// diagonal floorboard or trim has a bounding box far larger than
+// itself, and overlaps everything nearby; split in two along its
+// longest edge, again and again, its pieces' boxes hug it.
+//
+// The triangles whose boxes' surface areas exceed their own (two
+// sided) areas by more than threshold times are split, worst (largest
+// excess area) first, until the count has grown by budget (0.1: 10%).
+// Vertex attributes are untouched: remap[i] gives BLAS triangle i's
+// original triangle, and the barycentrics of its corners in that one,
+// so shading (raytrace.rgen) resolves hits to the original material,
+// normals and UVs.  The rasterizer keeps drawing the original mesh.
+struct SplitMesh
+{
+    std::vector<vec3>      positions;  // The model's, then the pieces'
+    std::vector<uint32_t>  indices;    // Triangles in the original's order, pieces together
+    std::vector<PrimRemap> remap;      // Per triangle of indices
+    uint32_t               splitCount{0};  // Original triangles split; 0: nothing to do
+};
+
+SplitMesh splitTriangles(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+                         float budget, float threshold = 8.0f);
@@ -26,15 +26,23 @@ VkApp::VkApp(App* _app) : app(_app)
 	createPhysicalDevice();		// -> m_physicalDevice i.e. the GPU
 	chooseQueueIndex();		    // -> m_graphicsQueueIndex
 	createDevice();			    // -> m_device
+	createAllocator();		    // -> m_allocator
 	getCommandQueue();		    // -> m_queue
 
 	loadExtensions();		    // Auto generated; loads namespace of all known extensions
 
 	getSurface();			    // -> m_surface
 	createCommandPool();		// -> m_cmdPool
+	m_staging.setup(this, m_transferQueueIndex, m_transferQueue); // -> m_staging
+	createFrameData();		    // -> m_frames, m_commandBuffer
+
+	// From here on, one-shot command buffers are recorded into as few
+	// submits as the flush points allow.
+	m_batch.setup(this);
+	m_batch.begin();
 
 	createSwapchain();		    // -> m_swapchain
-	createDepthResource();		// -> m_depthImage, ...
+	createRenderGraph();		// -> m_graph, m_depthImage, m_denoiseBuffer
 	createPostRenderPass();		// -> m_postRenderPass
 	createPostFrameBuffers();	// -> m_framebuffers
 
@@ -47,6 +55,9 @@ VkApp::VkApp(App* _app) : app(_app)
 	#endif
 
 	myloadModel("models/living_room/living_room.obj", glm::mat4(1.0f));
+	for (const std::string& model : app->m_extraModels)
+		myloadModel(model, glm::mat4(1.0f));
+	finishLods();  // Before the ObjDescs are uploaded
 
 	//createScBuffer();
 	//createRtBuffers();
@@ -63,14 +74,29 @@ VkApp::VkApp(App* _app) : app(_app)
 	// //init ray tracing capabilities
 	createRtBuffers();
 	initRayTracing();
+	m_asCache.setup(this, app->m_asCache ? "as_cache" : "");
 	createRtAccelerationStructure();
+	createEnvironment();
+	createLightTree();
+	createRestir();
+	createRadianceCache();
+	createPathGuiding();
 	createRtDescriptorSet();
 	createRtPipeline();
 	createRtShaderBindingTable();
+	createSkinning();
 
-	createDenoiseBuffer();
 	createDenoiseDescriptorSet();
 	createDenoiseCompPipeline();
+	createReconstruct();
+	createAsyncDenoise();
+	createDynamicResolution();
+
+	m_batch.end();
+	m_asCache.printStats();
+	m_staging.finish();
+	m_staging.printStats();
+	m_allocator.printStats();
 }
 
 void VkApp::drawFrame()
@@ -81,31 +107,41 @@ void VkApp::drawFrame()
 	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
 	{   // Extra indent for code clarity
-		updateCameraBuffer();
-
-		// Draw scene
-		if (useRaytracer) 
-		{
-			raytrace();
-			denoise();
-		}
-		else 
-		{
-			rasterize();
-		}
-
-		postProcess(); //  tone mapper and output to swapchain image.
+		writeFrameTimestamp(false);
 
+		updateCameraBuffer();
+		updateSkinning();
+		selectInstances();
+		if (useRaytracer)
+			updateRtConstants();
+
+		// With async compute, this frame's A-Trous runs on the compute
+		// queue after submitFrame; see createAsyncDenoise.
+		m_asyncThisFrame = m_asyncDenoise && useRaytracer;
+
+		// Draw scene: raytrace and denoise, or rasterize; then
+		// postProcess, the tone mapper and output to swapchain image.
+		// The graph puts the barriers between them, including those
+		// against the previous frame's use of the shared images.
+		m_graph.execute(m_commandBuffer);
+
+		writeFrameTimestamp(true);
 	}   // Done recording;  Execute!
 
 	vkEndCommandBuffer(m_commandBuffer);
 
 	submitFrame();  // Submit for display
+
+	if (app->m_captureRequested || m_captureStage > 0)
+		captureGBuffer();
 }
 
 
 VkCommandBuffer VkApp::createTempCmdBuffer()
 {
+	if (m_batch.active())
+		return m_batch.beginSegment();
+
 	VkCommandBufferAllocateInfo allocateInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
 	allocateInfo.commandBufferCount = 1;
 	allocateInfo.commandPool = m_cmdPool;
@@ -121,58 +157,137 @@ VkCommandBuffer VkApp::createTempCmdBuffer()
 
 void VkApp::submitTempCmdBuffer(VkCommandBuffer cmdBuffer)
 {
+	if (m_batch.active())
+		m_batch.endSegment(cmdBuffer);
+	else
+		executeTempCmdBuffer(cmdBuffer);
+}
+
+void VkApp::executeTempCmdBuffer(VkCommandBuffer cmdBuffer)
+{
+	// Anything staged so far is submitted to the transfer queue, and
+	// this command buffer waits (on the GPU) for all of it.
+	uint64_t waitValue = 0;
+	m_staging.flush();
+	VkCommandBuffer acquireCmd = m_staging.takeAcquires(m_staging.lastTicket(), waitValue);
+
 	vkEndCommandBuffer(cmdBuffer);
 
-	VkSubmitInfo submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &cmdBuffer;
-	vkQueueSubmit(m_queue, 1, &submitInfo, {});
-	vkQueueWaitIdle(m_queue);
-	vkFreeCommandBuffers(m_device, m_cmdPool, 1, &cmdBuffer);
+	VkCommandBuffer cmdBuffers[2] = { acquireCmd, cmdBuffer };
+	VkSemaphore timeline = m_staging.timeline();
+	const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo{ VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timelineInfo.waitSemaphoreValueCount = 1;
+	timelineInfo.pWaitSemaphoreValues = &waitValue;
+
+	VkSubmitInfo submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO, &timelineInfo };
+	submitInfo.waitSemaphoreCount = waitValue > 0 ? 1 : 0;
+	submitInfo.pWaitSemaphores = &timeline;
+	submitInfo.pWaitDstStageMask = &waitStageMask;
+	submitInfo.commandBufferCount = acquireCmd ? 2 : 1;
+	submitInfo.pCommandBuffers = acquireCmd ? cmdBuffers : &cmdBuffer;
+	vkResetFences(m_device, 1, &m_tempFence);
+	vkQueueSubmit(m_queue, 1, &submitInfo, m_tempFence);
+
+	// Wait for this submit only, not for every frame in flight.
+	vkWaitForFences(m_device, 1, &m_tempFence, VK_TRUE, UINT64_MAX);
+	vkFreeCommandBuffers(m_device, m_cmdPool, submitInfo.commandBufferCount,
+		submitInfo.pCommandBuffers);
 }
 
 void VkApp::prepareFrame()
 {
+	// Next frame-in-flight slot; its command buffer becomes m_commandBuffer.
+	m_frameIndex = (m_frameIndex + 1) % m_frames.size();
+	FrameData& frame = m_frames[m_frameIndex];
+	m_commandBuffer = frame.cmdBuf;
+
+	// Use a fence to wait until the slot's previous frame (F frames
+	// ago) has finished execution before reusing its resources.
+	double waitStart = glfwGetTime();
+	while (VK_TIMEOUT == vkWaitForFences(m_device, 1, &frame.fence, VK_TRUE, 1'000'000))
+	{
+	}
+	reportFrameTiming(1000.0 * (glfwGetTime() - waitStart));
+	if (!frame.acquireCmds.empty()) {
+		vkFreeCommandBuffers(m_device, m_cmdPool, frame.acquireCmds.size(), frame.acquireCmds.data());
+		frame.acquireCmds.clear(); }
+	readFrameTimestamps();
+	readGuidingStats();
+
 	// Acquire the next image from the swap chain --> m_swapchainIndex
-	VkResult result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, m_readSemaphore,
+	VkResult result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, frame.readSemaphore,
 		(VkFence)VK_NULL_HANDLE, &m_swapchainIndex);
 
 	// Check if window has been resized -- or other(??) swapchain specific event
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
 		recreateSizedResources(windowSize);
 	}
-
-	// Use a fence to wait until the command buffer has finished execution before using it again
-	while (VK_TIMEOUT == vkWaitForFences(m_device, 1, &m_waitFence, VK_TRUE, 1'000'000))
-	{
-	}
 }
 
 void VkApp::submitFrame()
 {
-	vkResetFences(m_device, 1, &m_waitFence);
-
-	// Pipeline stage at which the queue submission will wait (via pWaitSemaphores)
-	const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	FrameData& frame = m_frames[m_frameIndex];
+	vkResetFences(m_device, 1, &frame.fence);
+
+	// Uploads staged during this frame go to the transfer queue now.
+	// The frame only picks up uploads the transfer queue has already
+	// finished, so it never stalls behind a copy; later ones are
+	// acquired by a later frame.
+	uint64_t waitValue = 0;
+	m_staging.flush();
+	VkCommandBuffer acquireCmd = m_staging.takeAcquires(m_staging.completedTicket(), waitValue);
+	VkCommandBuffer cmdBuffers[2] = { acquireCmd, m_commandBuffer };
+	if (acquireCmd)
+		frame.acquireCmds.push_back(acquireCmd);
+
+	// Semaphores waited on, the pipeline stages at which they are
+	// waited for, and their values (ignored for binary semaphores).
+	std::vector<VkSemaphore> waitSemaphores = { frame.readSemaphore };
+	std::vector<VkPipelineStageFlags> waitStageMasks = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	std::vector<uint64_t> waitValues = { 0 };
+	std::vector<VkSemaphore> signalSemaphores = { frame.writtenSemaphore };
+	std::vector<uint64_t> signalValues = { 0 };
+	if (waitValue > 0) {
+		waitSemaphores.push_back(m_staging.timeline());
+		waitStageMasks.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+		waitValues.push_back(waitValue); }
+	if (m_asyncThisFrame) {
+		// Copying into the double buffer half, and post sampling the
+		// previous result, wait for the previous async frame.
+		waitSemaphores.push_back(m_asyncDone);
+		waitStageMasks.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		waitValues.push_back(m_asyncFrame);
+		signalSemaphores.push_back(m_asyncInputs);
+		signalValues.push_back(m_asyncFrame + 1); }
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo{ VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timelineInfo.waitSemaphoreValueCount = waitValues.size();
+	timelineInfo.pWaitSemaphoreValues = waitValues.data();
+	timelineInfo.signalSemaphoreValueCount = signalValues.size();
+	timelineInfo.pSignalSemaphoreValues = signalValues.data();
 
 	// The submit info structure specifies a command buffer queue submission batch
 	VkSubmitInfo _si_{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
-	_si_.pNext = nullptr;
-	_si_.pWaitDstStageMask = &waitStageMask; //  pipeline stages to wait for
-	_si_.waitSemaphoreCount = 1;
-	_si_.pWaitSemaphores = &m_readSemaphore;  // waited upon before execution
-	_si_.signalSemaphoreCount = 1;
-	_si_.pSignalSemaphores = &m_writtenSemaphore; // signaled when execution finishes
-	_si_.commandBufferCount = 1;
-	_si_.pCommandBuffers = &m_commandBuffer;
-	if (vkQueueSubmit(m_queue, 1, &_si_, m_waitFence) != VK_SUCCESS) {
+	_si_.pNext = &timelineInfo;
+	_si_.pWaitDstStageMask = waitStageMasks.data(); //  pipeline stages to wait for
+	_si_.waitSemaphoreCount = waitSemaphores.size();
+	_si_.pWaitSemaphores = waitSemaphores.data();  // waited upon before execution
+	_si_.signalSemaphoreCount = signalSemaphores.size();
+	_si_.pSignalSemaphores = signalSemaphores.data(); // signaled when execution finishes
+	_si_.commandBufferCount = acquireCmd ? 2 : 1;
+	_si_.pCommandBuffers = acquireCmd ? cmdBuffers : &m_commandBuffer;
+	if (vkQueueSubmit(m_queue, 1, &_si_, frame.fence) != VK_SUCCESS) {
 		throw std::runtime_error("failed to submit draw command buffer!");
 	}
+	if (m_asyncThisFrame)
+		submitAsyncDenoise();
 
 	// Present frame
 	VkPresentInfoKHR _i_{ VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
 	_i_.waitSemaphoreCount = 1;
-	_i_.pWaitSemaphores = &m_writtenSemaphore;;
+	_i_.pWaitSemaphores = &frame.writtenSemaphore;
 	_i_.swapchainCount = 1;
 	_i_.pSwapchains = &m_swapchain;
 	_i_.pImageIndices = &m_swapchainIndex;
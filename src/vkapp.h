@@ -2,6 +2,7 @@
 #pragma once
 
 #include <algorithm>
+#include <memory>
 #include "vulkan/vulkan_core.h"
 //#include <vulkan/vulkan.hpp>  // A modern C++ API for Vulkan. Beware 14K lines of code
 
@@ -25,6 +26,14 @@
 #include "image_wrap.h"
 #include "descriptor_wrap.h"
 #include "acceleration_wrap.h"
+#include "staging_ring.h"
+#include "command_batch.h"
+#include "as_cache.h"
+#include "thread_pool.h"
+#include "render_graph.h"
+#include "denoise_cpu.h"
+#include "skinning.h"
+#include "mesh_simplify.h"
 
 //#include "raytracing_wrap.h"
 #define GLM_FORCE_RADIANS
@@ -32,6 +41,20 @@
 #include <glm/glm.hpp>
 
 // The OBJ model: Vulkan buffers of object data
+// A level of detail of an ObjData: a range of its index buffer (level
+// 0) or lodIndexBuffer (coarser ones), with its own BLAS, and ObjDesc
+// (the ray tracer's custom index, and the rasterizer's objIndex).
+struct ObjLod
+{
+    uint32_t firstIndex{0};
+    uint32_t indexCount{0};
+    float    error{0.0f};   // Object space geometric error
+    uint64_t contentHash{0};  // Of its indices; with the object's, its BLAS's cache key
+    uint32_t blasId{0};     // Into m_rtBuilder's BLASes
+    uint64_t blasAddress{0};  // Its device address, once built
+    uint32_t descIndex{0};  // Into m_objDesc
+};
+
 struct ObjData
 {
     uint32_t     nbIndices{0};
@@ -41,6 +64,35 @@ struct ObjData
     BufferWrap indexBuffer;     // Buffer of triangle indices
     BufferWrap matColorBuffer;  // Buffer of materials
     BufferWrap matIndexBuffer;  // Buffer of each triangle's material index
+    uint64_t   contentHash{0};  // Of the BLAS's geometry; the AS cache's key
+
+    // Object space bounds, for instance culling and LOD selection
+    glm::vec3  boundsMin{0.0f};
+    glm::vec3  boundsMax{0.0f};
+    bool       emitterOnly{false};  // Every triangle's material emits
+
+    // Finest first.  lods[0] is the whole mesh, with the object's own
+    // BLAS and ObjDesc (both indexed like m_objData).  Coarser levels
+    // (see vkapp_lods.cpp) share vertexBuffer.
+    std::vector<ObjLod> lods;
+    BufferWrap lodIndexBuffer;     // The coarser levels' indices,
+    BufferWrap lodMatIndexBuffer;  //   and their triangles' material indices
+    BufferWrap emitterBuffer;      // Each triangle's index in lightList, if any emit,
+    BufferWrap lodEmitterBuffer;   //   and the coarser levels'
+
+    // With triangle splitting (-s), the BLAS is built from these
+    // instead, and primRemapBuffer maps its triangles back to the
+    // model's (see triangle_split.h).
+    uint32_t   nbBlasIndices{0};
+    uint32_t   nbBlasVertices{0};
+    BufferWrap blasVertexBuffer;  // vec3 positions
+    BufferWrap blasIndexBuffer;
+    BufferWrap primRemapBuffer;   // PrimRemap per BLAS triangle
+
+    // CPU copies of the BLAS's geometry, kept only until its host
+    // build (m_hostAsBuilds)
+    std::vector<vec3>     hostPositions;
+    std::vector<uint32_t> hostIndices;
 };
 
 #define NAME(handle, objType, name)  { \
@@ -53,6 +105,9 @@ struct ObjData
         vkSetDebugUtilsObjectNameEXT(m_device, &imageNameInfo); }
 
 
+// Returns an address of a buffer on the GPU (in vkapp_loadModel.cpp).
+VkDeviceAddress getBufferDeviceAddress(VkDevice device, VkBuffer buffer);
+
 // Pair each instance with its instance transform
 struct ObjInst
 {
@@ -60,7 +115,57 @@ struct ObjInst
     uint32_t  objIndex;     // Model index
 };
 
+// A skinned object: its ObjData's vertex buffer holds the posed
+// vertices, written each frame by skinning.comp from the bind pose.
+struct SkinnedObject
+{
+    uint32_t   objIndex{0};     // Into m_objData; also its BLAS's index
+    Skeleton   skeleton;
+    BufferWrap restBuffer;      // Vertex[]: the bind pose
+    BufferWrap skinBuffer;      // SkinVertex[]
+    BufferWrap boneBuffer;      // mat4[bones] per frame in flight; host visible
+    std::vector<glm::mat4> bones;       // This frame's skinning matrices
+    std::vector<glm::mat4> builtBones;  // ... as of the BLAS's last full build
+    float      radius{1.0f};    // Of the bind pose's bounding sphere
+    uint32_t   refits{0};       // Since the last full build
+    bool       rebuild{false};  // This frame's BLAS update is a full build
+};
+
+// A static model's LOD chain, simplified on m_lodPool (or read from
+// the cache) while the rest of the scene loads.
+struct LodTask
+{
+    uint32_t              objIndex{0};
+    std::vector<Vertex>   vertices;
+    std::vector<uint32_t> indices;
+    std::vector<int32_t>  matIndx;
+    std::vector<uint32_t> emitterOf;  // Per triangle, if any emit
+    std::vector<MeshLod>  lods;
+    bool                  cached{false};  // Read from the LOD cache
+    double                buildMs{0};
+};
+
 class App;
+struct ModelData;
+
+// Raygen shaders of the ReSTIR passes, each with an SBT region
+enum RestirRaygen
+{
+    eRestirDIInitial,   // restirDI.rgen: candidates and temporal reuse
+    eRestirDISpatial,   // restirDISpatial.rgen
+    eRestirGIInitial,   // restirGI.rgen: candidates and temporal reuse
+    eRestirGISpatial,   // restirGISpatial.rgen
+    eRestirRaygenCount
+};
+
+// Passes timed on the GPU (writePassTimestamp), reported with the
+// frame timing.
+enum TimedPass
+{
+    eTimeRaytrace,
+    eTimeGuiding,       // Path guiding's training step
+    eTimedPassCount
+};
 
 class VkApp
 {
@@ -86,7 +191,7 @@ public:
     VkApp(App* _app);
 
     // @@ Variables managed by ImGui
-    int frameCount;
+    int frameCount{0};
     void drawFrame();
 
     void destroyAllVulkanResources();
@@ -95,6 +200,7 @@ public:
     void recreateSizedResources(VkExtent2D size);
     VkCommandBuffer createTempCmdBuffer();
     void submitTempCmdBuffer(VkCommandBuffer cmdBuffer);
+    void executeTempCmdBuffer(VkCommandBuffer cmdBuffer);  // Submit and wait, batch or not
     VkShaderModule createShaderModule(std::string code);
     VkPipelineShaderStageCreateInfo createShaderStageInfo(const std::string&    code,
                                                           VkShaderStageFlagBits stage,
@@ -108,12 +214,20 @@ public:
     void createPhysicalDevice();
 
     uint32_t m_graphicsQueueIndex{VK_QUEUE_FAMILY_IGNORED};
+    uint32_t m_transferQueueIndex{VK_QUEUE_FAMILY_IGNORED};  // == graphics if no dedicated one
+    uint32_t m_computeQueueIndex{VK_QUEUE_FAMILY_IGNORED};   // Compute-only, with -a
     void chooseQueueIndex();
 
     VkDevice m_device{};
+    bool m_hostAsBuilds{false};  // -H, and accelerationStructureHostCommands is supported
     void createDevice();
 
+    MemoryAllocator m_allocator;
+    void createAllocator();
+
     VkQueue m_queue{};
+    VkQueue m_transferQueue{};  // Uploads; may be m_queue
+    VkQueue m_computeQueue{};   // Async denoising, if m_asyncDenoise
     void getCommandQueue();
     
     void loadExtensions();
@@ -122,23 +236,89 @@ public:
     void getSurface();
     
     VkCommandPool m_cmdPool{VK_NULL_HANDLE};
-    VkCommandBuffer m_commandBuffer{};
+    VkFence m_tempFence{VK_NULL_HANDLE};  // For submitTempCmdBuffer
+    VkCommandBuffer m_commandBuffer{};  // The current frame's m_frames[].cmdBuf
     void createCommandPool();
 
+    // Frames in flight (App's -f N): the CPU records frame N+1 while
+    // the GPU still runs frame N.  Each frame has its own command
+    // buffer, sync objects, timestamp queries and slice of m_matrixBW.
+    struct FrameData
+    {
+        VkCommandBuffer cmdBuf{};
+        VkFence         fence{};             // Signaled when the GPU is done with the frame
+        VkSemaphore     readSemaphore{};     // Swapchain image acquired
+        VkSemaphore     writtenSemaphore{};  // Rendering done; image may be presented
+        bool            timed{false};        // Timestamps were written
+        bool            passTimed[eTimedPassCount]{};  // ... and those of these passes
+        float           renderScale{0.0f};   // Dynamic resolution's, if ray traced
+        std::vector<VkCommandBuffer> acquireCmds;  // Upload acquires submitted with the frame
+        std::vector<VkCommandPool>   recordPools;  // Per recording thread (-t N)
+        std::vector<VkCommandBuffer> recordCmds;   // Secondary, one from each recordPools[]
+    };
+    std::vector<FrameData> m_frames;
+    uint32_t m_frameIndex{0};  // Into m_frames
+    void createFrameData();
+    void destroyFrameData();
+
+    // With -t N (N > 1), rasterize's draws are split into N ranges of
+    // m_objInst, each recorded by a worker into a secondary command
+    // buffer of its own pool (per frame, so reset once the frame's
+    // fence has signaled) and executed in the scanline render pass.
+    std::unique_ptr<ThreadPool> m_recordPool;
+
+    // Frame timing report: CPU frame time, time blocked on the frame
+    // fence, GPU time per frame, and GPU idle time between frames.
+    struct FrameTiming
+    {
+        double   cpuMs{0}, waitMs{0}, gpuMs{0}, idleMs{0};
+        uint32_t frames{0}, gpuFrames{0}, idleFrames{0};
+        double   passMs[eTimedPassCount]{};
+        uint32_t passFrames[eTimedPassCount]{};
+        double   renderScale{0};  // Summed over the ray traced frames timed,
+        uint32_t scaledFrames{0}; //   ... for dynamic resolution
+        double   lastFrameTime{0}, lastReportTime{0};
+        uint64_t lastGpuEnd{0};
+        bool     haveGpuEnd{false};
+    };
+    FrameTiming m_timing{};
+    VkQueryPool m_timestampPool{};
+    float       m_timestampPeriod{1.0f};  // Nanoseconds per tick
+    void writeFrameTimestamp(bool end);
+    void writePassTimestamp(TimedPass pass, bool end);
+    void readFrameTimestamps();
+    void reportFrameTiming(double waitMs);
+
+    // Dynamic resolution (-D ms): the ray tracer renders the top left
+    // m_renderSize of its images, which are allocated at the window's
+    // size, and post stretches it over the window.  The scale is
+    // adjusted from each frame's GPU time, to hold it to m_targetGpuMs.
+    float      m_targetGpuMs{0.0f};  // 0: always the window's size
+    float      m_renderScale{1.0f};  // Of the window's width and height
+    VkExtent2D m_renderSize{0, 0};
+    VkExtent2D m_priorRenderSize{0, 0};  // Last frame's, which the history holds
+    void createDynamicResolution();
+    void updateRenderScale(double gpuMs);
+
+    // All host to device uploads go through this; see staging_ring.h.
+    StagingRing m_staging;
+
+    // Defers one-shot command buffers during startup; see command_batch.h.
+    CommandBatch m_batch;
+
     VkSwapchainKHR m_swapchain{VK_NULL_HANDLE};
     uint32_t       m_imageCount{0};
     std::vector<VkImage>     m_swapchainImages{};  // from vkGetSwapchainImagesKHR
     std::vector<VkImageView> m_imageViews{};
     std::vector<VkImageMemoryBarrier> m_barriers{};  // Filled in  VkImageMemoryBarrier objects
-    VkFence m_waitFence{}; 
-    VkSemaphore m_readSemaphore{};
-    VkSemaphore m_writtenSemaphore{};
     VkExtent2D windowSize{0, 0}; // Size of the window
     void createSwapchain();
     void destroySwapchain();
 
-    ImageWrap m_depthImage;
-    void createDepthResource();
+    ImageWrap m_depthImage;  // A render graph transient
+
+    RenderGraph m_graph;  // drawFrame's passes; see render_graph.h
+    void createRenderGraph();
     
     VkPipelineLayout m_postPipelineLayout{VK_NULL_HANDLE};
     VkRenderPass m_postRenderPass{};
@@ -170,14 +350,14 @@ public:
     
     ImageWrap m_rtKdCurrBuffer{};
     ImageWrap m_rtKdPrevBuffer{};
+    ImageWrap m_rtSampleBuffer{};  // Written only for the G-buffer capture
     
     ImageWrap m_rtNdCurrBuffer{};
     ImageWrap m_rtNdPrevBuffer{};
     
     void createRtBuffers();
     
-    ImageWrap m_denoiseBuffer{};
-    void createDenoiseBuffer();
+    ImageWrap m_denoiseBuffer{};  // A render graph transient
 
     // Arrays of objects instances and textures in the scene
     std::vector<ObjData>  m_objData{};  // Obj data in Vulkan Buffers
@@ -185,6 +365,8 @@ public:
     std::vector<ImageWrap>  m_objText{}; // All textures of the scene
     std::vector<ObjInst>  m_objInst{}; // Instances paring an object and a transform
     BufferWrap m_lightBuff{};          // Buffer of light list
+    BufferWrap m_lightTreeBW{};        //   and of its light tree (light_tree.h)
+    void createLightTree();
     void myloadModel(const std::string& filename, glm::mat4 transform);
 
     BufferWrap m_objDescriptionBW{};  // Device buffer of the OBJ descriptions
@@ -197,7 +379,8 @@ public:
     VkPipeline                  m_scanlinePipeline{};
     void createScPipeline();
 
-    BufferWrap m_matrixBW{};  // Device-Host of the camera matrices
+    BufferWrap m_matrixBW{};  // Camera matrices; one host visible slice per frame in flight
+    VkDeviceSize m_matrixSlice{0};  // Aligned size of a slice (dynamic UBO offset step)
     void   createMatrixBuffer();
     
     RaytracingBuilderKHR m_rtBuilder{};
@@ -214,11 +397,41 @@ public:
     // // Accelleration structure objects and functions
 
     BufferWrap m_scratch1;
-    BufferWrap m_scratch2;
-    BlasInput objectToVkGeometryKHR(const ObjData& model);
+    AsCache    m_asCache;    // Serialized BLASes on disk; off with -n
+    BlasInput objectToVkGeometryKHR(const ObjData& model, uint32_t lod = 0);
     void createBottomLevelAS();
 	void createTopLevelAS();
     void createRtAccelerationStructure();
+    void setInstanceTransform(uint32_t index, const glm::mat4& transform);  // Animation
+
+    // Per-frame instance selection (vkapp_instances.cpp): each frame
+    // the TLAS gets the instances within app->m_cullRadius of the eye,
+    // each with the coarsest LOD whose error projects to at most
+    // app->m_lodPixelError pixels, and its visibility class's mask.
+    // The rasterizer draws the same levels.
+    std::vector<VkAccelerationStructureInstanceKHR> m_selected;
+    std::vector<uint32_t> m_instanceLods;  // Per m_objInst: its level, or culledLod
+    static const uint32_t culledLod = ~0u;
+    uint32_t m_culledInstances{0};  // By the last selectInstances
+    void selectInstances();
+
+    // Levels of detail (vkapp_lods.cpp): myloadModel queues each
+    // static model's simplification, which finishLods waits for and
+    // uploads.
+    std::unique_ptr<ThreadPool>           m_lodPool;
+    ThreadPool::TaskGroup                 m_lodGroup;
+    std::vector<std::unique_ptr<LodTask>> m_lodTasks;
+    void startLods(uint32_t objIndex, const ModelData& meshdata, const std::vector<uint32_t>& emitterOf);
+    void finishLods();
+
+    // Environment lighting (vkapp_env.cpp, -e): the map at full
+    // resolution for camera rays, box filtered for the rest, and the
+    // low resolution map's alias table for importance sampling.
+    ImageWrap  m_envImage{};
+    ImageWrap  m_envLowImage{};
+    BufferWrap m_envAliasBW{};
+    void createEnvironment();
+    ImageWrap createEnvImage(int width, int height, const std::vector<glm::vec4>& pixels);
 
     DescriptorWrap m_rtDesc{};
     void createRtDescriptorSet();
@@ -232,8 +445,53 @@ public:
     VkStridedDeviceAddressRegionKHR m_missRegion{};
     VkStridedDeviceAddressRegionKHR m_hitRegion{};
     VkStridedDeviceAddressRegionKHR m_callRegion{};
+    VkStridedDeviceAddressRegionKHR m_restirRegion[eRestirRaygenCount]{};
     void createRtShaderBindingTable();
 
+    // ReSTIR (vkapp_restir.cpp, -r): per pixel reservoirs, resampled
+    // by passes of their own before raytrace.
+    BufferWrap m_diReservoirBW{};  // DI: after temporal reuse
+    BufferWrap m_diFinalBW{};      //   after spatial reuse; next frame's history
+    BufferWrap m_giReservoirBW{};  // GI: likewise
+    BufferWrap m_giFinalBW{};
+    void createRestir();
+    void restir(RestirRaygen pass);
+
+    // Radiance cache (vkapp_radianceCache.cpp, -g): a hash grid that
+    // raytrace feeds from training paths and ends other paths in; the
+    // "radiance cache" pass resolves each frame's samples.
+    BufferWrap       m_cacheKeyBW{};
+    BufferWrap       m_cacheAccumBW{};
+    BufferWrap       m_cacheCellBW{};
+    VkPipelineLayout m_cachePipelineLayout{};
+    VkPipeline       m_cachePipeline{};
+    uint32_t m_cacheMaxAge{30};          // Frames
+    float    m_cacheMaxSamples{128.0f};
+    void createRadianceCache();
+    void destroyRadianceCache();
+    void resolveRadianceCache(VkCommandBuffer cmdBuf);
+
+    // Path guiding (vkapp_guiding.cpp, -p res): a res^3 grid of
+    // directional quadtrees, trained by raytrace's paths and sampled
+    // by their bounces; the "path guiding" pass updates the trees.
+    // Its costs are reported with the frame timing.
+    BufferWrap       m_guideGridBW{};
+    BufferWrap       m_guideAccumBW{};
+    BufferWrap       m_guideTreeBW{};
+    BufferWrap       m_guideStatsBW{};   // Host visible, a slice per frame in flight
+    VkPipelineLayout m_guidePipelineLayout{};
+    VkPipeline       m_guidePipeline{};
+    uint32_t m_guideCells{0};
+    float    m_guideDecay{0.95f};
+    float    m_guideFraction{0.5f};
+    double   m_guidedSamples{0}, m_trainingSamples{0};  // Since the last report
+    uint32_t m_guideFrames{0};
+    void createPathGuiding();
+    void destroyPathGuiding();
+    void trainPathGuiding(VkCommandBuffer cmdBuf);
+    void readGuidingStats();
+    void reportGuiding();
+
     DescriptorWrap m_postDesc{};
     void createPostDescriptor();
 
@@ -244,6 +502,51 @@ public:
     VkPipeline       m_denoisePipeline{};
     void createDenoiseCompPipeline();
 
+    // Reduced tracing (vkapp_reconstruct.cpp, -R half or checker):
+    // raytrace traces some pixels' paths each frame, and the
+    // "reconstruct" pass fills in the rest before denoising.
+    DescriptorWrap   m_reconstructDesc{};
+    VkPipelineLayout m_reconstructPipelineLayout{};
+    VkPipeline       m_reconstructPipeline{};
+    void createReconstruct();
+    void destroyReconstruct();
+    VkExtent2D traceExtent();
+    void reconstruct();
+
+    // Async compute denoising (-a).  Frame N's ray traced images are
+    // copied into the N%2 half of a double buffer, and A-Trous runs on
+    // m_computeQueue while frame N+1 traces; post shows it in frame N+1.
+    bool            m_asyncDenoise{false};      // A compute-only queue was found
+    bool            m_asyncThisFrame{false};    // ...and this frame uses it
+    uint64_t        m_asyncFrame{0};            // Async frames submitted so far
+    ImageWrap       m_asyncColor[2]{}, m_asyncKd[2]{}, m_asyncNd[2]{}, m_asyncTemp[2]{};
+    DescriptorWrap  m_asyncDesc[2][2]{};        // [parity][ping or pong]
+    DescriptorWrap  m_asyncPostDesc[2]{};       // Post samples asyncResult(parity)
+    VkCommandPool   m_asyncCmdPool{VK_NULL_HANDLE};
+    VkCommandBuffer m_asyncCmdBuf[2]{};         // Recorded once, per parity
+    VkSemaphore     m_asyncInputs{VK_NULL_HANDLE};  // Timeline: frame N's inputs copied = N+1
+    VkSemaphore     m_asyncDone{VK_NULL_HANDLE};    // Timeline: frame N denoised = N+1
+    ImageWrap& asyncResult(uint32_t parity);
+    void createAsyncDenoise();
+    void destroyAsyncDenoise();
+    void submitAsyncDenoise();
+
+    // Skinning (models loaded with -m that have bones).  Each frame
+    // updateSkinning poses the skeletons on the CPU, the "skinning"
+    // pass writes the posed vertices, and the "blas update" pass refits
+    // their BLASes, or rebuilds those the pose has moved too far from
+    // their last build (see skinDeformation).
+    std::vector<SkinnedObject> m_skinned;
+    VkPipelineLayout m_skinningPipelineLayout{};
+    VkPipeline       m_skinningPipeline{};
+    float    m_skinRebuildThreshold{0.2f};  // Deformation, as a fraction of the radius
+    uint32_t m_skinMaxRefits{120};          // Refits before a full build regardless
+    void createSkinning();
+    void destroySkinning();
+    void updateSkinning();
+    void skin(VkCommandBuffer cmdBuf);
+    void updateSkinnedBlas(VkCommandBuffer cmdBuf);
+
     void CmdCopyImage(ImageWrap& src, ImageWrap& dst);
 
     void imageLayoutBarrier(VkCommandBuffer cmdbuffer,
@@ -257,34 +560,48 @@ public:
     void ResetRtAccumulation();
     
     glm::mat4 m_priorViewProj{};
+    MatrixUniforms m_frameMatrices{};  // This frame's copy of m_matrixBW
     void updateCameraBuffer();
     void rasterize();
+    void recordRasterDraws(VkCommandBuffer cmdBuf, size_t first, size_t last);
+    void updateRtConstants();
     void raytrace();
-    void denoise();
+    void traceRays(const VkStridedDeviceAddressRegionKHR& rgenRegion, VkExtent2D launch);
+    void copyRtHistory();
+    void denoise(int iteration);
     
     uint32_t m_swapchainIndex{0};
     
     void postProcess();
     void submitFrame();
+
+    // G-buffer capture (F12) for the CPU denoise harness
+    int m_captureStage{0};
+    GBufferDump m_capture{};
+    void captureGBuffer();
+    void readImage(ImageWrap& image, VkExtent2D size, std::vector<vec4>& pixels);
     
     std::string loadFile(const std::string& filename);
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
     
-    BufferWrap createStagedBufferWrap(const VkCommandBuffer& cmdBuf,
-                                      const VkDeviceSize&    size,
+    // The copy is recorded in the staging ring's batch, and is
+    // submitted to the transfer queue by the next m_staging.flush().
+    // The next submitTempCmdBuffer waits for it; a frame picks it up
+    // once it has completed.
+    BufferWrap createStagedBufferWrap(const VkDeviceSize&    size,
                                       const void*            data,
                                       VkBufferUsageFlags     usage);
     template <typename T>
-    BufferWrap createStagedBufferWrap(const VkCommandBuffer& cmdBuf,
-                                      const std::vector<T>&  data,
+    BufferWrap createStagedBufferWrap(const std::vector<T>&  data,
                                       VkBufferUsageFlags     usage)
     {
-        return createStagedBufferWrap(cmdBuf, sizeof(T)*data.size(), data.data(), usage);
+        return createStagedBufferWrap(sizeof(T)*data.size(), data.data(), usage);
     }
     
 
+    // transient: short lived (staging, scratch); taken from a linear pool.
     BufferWrap createBufferWrap(VkDeviceSize size, VkBufferUsageFlags usage,
-                                VkMemoryPropertyFlags properties);
+                                VkMemoryPropertyFlags properties, bool transient=false);
 
      void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
     
@@ -292,16 +609,23 @@ public:
     void transitionImageLayout(VkImage image, VkFormat format,
                                VkImageLayout oldLayout, VkImageLayout newLayout,
                                uint32_t mipLevels=1);
+    void transitionImageLayout(VkCommandBuffer cmdBuf, VkImage image, VkFormat format,
+                               VkImageLayout oldLayout, VkImageLayout newLayout,
+                               uint32_t mipLevels=1);
     void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    void copyBufferToImage(VkCommandBuffer cmdBuf, VkBuffer buffer, VkDeviceSize bufferOffset,
+                           VkImage image, uint32_t width, uint32_t height);
     
     ImageWrap createTextureImage(std::string fileName);
-    ImageWrap createBufferImage(VkExtent2D& size);
+    ImageWrap createBufferImage(VkExtent2D& size,
+                                uint32_t sharedFamily=VK_QUEUE_FAMILY_IGNORED);
     
     ImageWrap createImageWrap(uint32_t width, uint32_t height,
                               VkFormat format,
                               VkImageUsageFlags usage,
                               VkMemoryPropertyFlags properties,
-                              uint32_t mipLevels=1);
+                              uint32_t mipLevels=1,
+                              uint32_t sharedFamily=VK_QUEUE_FAMILY_IGNORED);
 
     VkImageView createImageView(VkImage image, VkFormat format,
                                 VkImageAspectFlagBits aspect=VK_IMAGE_ASPECT_COLOR_BIT);
@@ -309,4 +633,6 @@ public:
     
     void generateMipmaps(VkImage image, VkFormat imageFormat,
                          int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
+    void generateMipmaps(VkCommandBuffer cmdBuf, VkImage image, VkFormat imageFormat,
+                         int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
 };
@@ -0,0 +1,96 @@
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+#include "app.h"
+#include "denoise_cpu.h"
+
+// Capture of the ray tracer's G-buffer for the CPU denoise harness
+// (cpu_denoise.exe).  Requested with F12, it spans two frames: the
+// history images are read at the end of the first frame (before the
+// second frame's ray trace overwrites them), and the current images,
+// the path traced sample raytrace blended into the history (written
+// only in that frame; see m_pcRay.captureSample), denoised result and
+// camera matrices at the end of the second.
+// With dynamic resolution, only the rendered part of each image is
+// read, and both frames must have rendered at the same size.
+
+// The top left extent of image, tightly packed into pixels.
+void VkApp::readImage(ImageWrap& image, VkExtent2D extent, std::vector<vec4>& pixels)
+{
+    VkDeviceSize size = extent.width * extent.height * sizeof(vec4);
+    BufferWrap staging = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                          | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
+
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    imageLayoutBarrier(cmdBuf, image.image,
+                       VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(cmdBuf, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           staging.buffer, 1, &region);
+
+    imageLayoutBarrier(cmdBuf, image.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+    submitTempCmdBuffer(cmdBuf);
+
+    pixels.resize(extent.width * extent.height);
+    memcpy(pixels.data(), staging.mapped, size);
+
+    staging.destroy(m_device);
+}
+
+void VkApp::captureGBuffer()
+{
+    app->m_captureRequested = false;
+    if (!useRaytracer) {
+        printf("G-buffer capture needs the ray tracer\n");
+        m_captureStage = 0;
+        return; }
+
+    // The frame just submitted must be done before its images are read.
+    vkQueueWaitIdle(m_queue);
+
+    if (m_captureStage == 0) {
+        m_capture = GBufferDump();
+        m_capture.width  = m_renderSize.width;
+        m_capture.height = m_renderSize.height;
+        // This frame's history copy, which the next frame reprojects
+        // as its m_priorRenderSize.
+        readImage(m_rtColPrevBuffer, m_renderSize, m_capture.add("colPrev"));
+        readImage(m_rtNdPrevBuffer,  m_renderSize, m_capture.add("ndPrev"));
+        m_captureStage = 1;
+        return; }
+
+    // The dump has one size: start over if the resolution changed.
+    if (m_priorRenderSize.width != uint32_t(m_capture.width)
+        || m_priorRenderSize.height != uint32_t(m_capture.height)
+        || m_renderSize.width != m_priorRenderSize.width
+        || m_renderSize.height != m_priorRenderSize.height) {
+        printf("Render size changed during G-buffer capture; retrying\n");
+        app->m_captureRequested = true;
+        m_captureStage = 0;
+        m_capture = GBufferDump();
+        return; }
+
+    m_capture.mats             = m_frameMatrices;
+    m_capture.pcDenoise        = m_pcDenoise;
+    m_capture.atrousIterations = m_num_atrous_iterations;
+    readImage(m_rtColCurrBuffer, m_renderSize, m_capture.add("colCurr"));
+    readImage(m_rtKdCurrBuffer,  m_renderSize, m_capture.add("kdCurr"));
+    readImage(m_rtNdCurrBuffer,  m_renderSize, m_capture.add("ndCurr"));
+    readImage(m_rtSampleBuffer,  m_renderSize, m_capture.add("sample"));
+    readImage(m_scImageBuffer,   m_renderSize, m_capture.add("denoised"));
+    m_captureStage = 0;
+
+    std::string filename = "gbuffer_" + std::to_string(frameCount) + ".gbd";
+    if (writeGBufferDump(filename, m_capture))
+        printf("Wrote G-buffer capture %s\n", filename.c_str());
+    m_capture = GBufferDump();
+}
@@ -18,15 +18,6 @@ using namespace glm;
 #define GROUP_SIZE 128
 
 
-void VkApp::createDenoiseBuffer()
-{
-    m_denoiseBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_denoiseBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_GENERAL, 1);
-    // @@ destroy m_denoiseBuffer
-}
-
 void VkApp::createDenoiseDescriptorSet()
 {
     m_denoiseDesc.setBindings(m_device, {
@@ -66,60 +57,192 @@ void VkApp::createDenoiseCompPipeline()
     // @@ destroy m_denoisePipeline
 }
 
-void VkApp::denoise()
+// One A-Trous iteration: filter m_scImageBuffer into
+// m_denoiseBuffer.  Each iteration, and each copy back, is a render
+// graph pass, which puts the barriers between them.
+void VkApp::denoise(int iteration)
 {
-    // Wait for RT to finish
-    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-    VkImageMemoryBarrier    imgMemBarrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
-    imgMemBarrier.srcAccessMask    = VK_ACCESS_SHADER_WRITE_BIT;
-    imgMemBarrier.dstAccessMask    = VK_ACCESS_SHADER_READ_BIT;
-    imgMemBarrier.image            = m_scImageBuffer.image;
-    imgMemBarrier.oldLayout        = VK_IMAGE_LAYOUT_GENERAL;
-    imgMemBarrier.newLayout        = VK_IMAGE_LAYOUT_GENERAL;
-    imgMemBarrier.subresourceRange = range;
-
-    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr, 1, &imgMemBarrier);
-
     // Project 6 De-noise
     m_pcDenoise.normFactor = 0.003f;
     m_pcDenoise.depthFactor = 0.007f;
 
-    int stepwidth = 1;
-    for(int a = 0; a < m_num_atrous_iterations; a++) 
-    {
-        // Tell the A-Trous algorithm its "hole" size
-        m_pcDenoise.stepwidth = stepwidth;
-        stepwidth *= 2;
-
-        // Select the compute shader, and its descriptor set and push constant
-        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipeline);
-        vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-                                m_denoiseCompPipelineLayout, 0, 1,
-                                &m_denoiseDesc.descSet, 0, nullptr);
-        vkCmdPushConstants(m_commandBuffer, m_denoiseCompPipelineLayout,
-                           VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise),
-                           &m_pcDenoise);
-
-        // Dispatch the shader in batches of 128x1 (WHY???)
-        // This MUST match the shaders's line:
-        //    layout(local_size_x=GROUP_SIZE, local_size_y=1, local_size_z=1) in;
-        vkCmdDispatch(m_commandBuffer,
-                      (windowSize.width + GROUP_SIZE-1) / GROUP_SIZE,
-                      windowSize.height, 1);
-
-        // Wait until denoise shader is done writing to m_denoiseBuffer
-        imgMemBarrier.image = m_denoiseBuffer.image;
-        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                             VK_DEPENDENCY_DEVICE_GROUP_BIT,
-                             0, nullptr, 0, nullptr, 1, &imgMemBarrier);
-
-        // @@ Copy the denoised results (in m_denoiseBuffer) back to
-        // the input buffer (m_scImageBuffer) for the next denoising
-        // loop pass.  See VkApp::raytrace for 4 examples of using
-        // VkApp::CmdCopyImage to copy an image.
-        CmdCopyImage(m_denoiseBuffer, m_scImageBuffer);
-    }
+    // Tell the A-Trous algorithm its "hole" size
+    m_pcDenoise.stepwidth = 1 << iteration;
+    m_pcDenoise.width  = m_renderSize.width;
+    m_pcDenoise.height = m_renderSize.height;
+
+    // Select the compute shader, and its descriptor set and push constant
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_denoiseCompPipelineLayout, 0, 1,
+                            &m_denoiseDesc.descSet, 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_denoiseCompPipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise),
+                       &m_pcDenoise);
+
+    // Dispatch the shader in batches of 128x1 (WHY???)
+    // This MUST match the shaders's line:
+    //    layout(local_size_x=GROUP_SIZE, local_size_y=1, local_size_z=1) in;
+    vkCmdDispatch(m_commandBuffer,
+                  (m_renderSize.width + GROUP_SIZE-1) / GROUP_SIZE,
+                  m_renderSize.height, 1);
+}
+
+// Async compute denoising (-a, when a compute-only queue family
+// exists).  Frame N copies its ray traced color, kd and nd into the
+// N%2 half of a double buffer and signals m_asyncInputs = N+1.  The
+// compute queue waits for that, runs all A-Trous iterations there
+// (ping-ponging between color and temp), and signals m_asyncDone =
+// N+1.  Frame N+1 traces meanwhile, and waits for m_asyncDone only at
+// the stages that copy into the other half (N+1's inputs) or sample
+// frame N's result (post).  The result is thus shown a frame late.
+//
+// The images are shared CONCURRENTly by both families, so no
+// ownership transfers are needed, and stay in GENERAL.
+void VkApp::createAsyncDenoise()
+{
+    if (!m_asyncDenoise)
+        return;
+
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    VkClearColorValue black{{0, 0, 0, 0}};
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    for (uint32_t p = 0;  p < 2;  p++) {
+        for (ImageWrap* image : {&m_asyncColor[p], &m_asyncKd[p], &m_asyncNd[p], &m_asyncTemp[p]}) {
+            *image = createBufferImage(windowSize, m_computeQueueIndex);
+            transitionImageLayout(cmdBuf, image->image, VK_FORMAT_R32G32B32A32_SFLOAT,
+                                  VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+            // Post shows the (empty) result of frame -1 first.
+            vkCmdClearColorImage(cmdBuf, image->image, VK_IMAGE_LAYOUT_GENERAL, &black, 1, &range); }
+
+        // [p][0]: color -> temp, [p][1]: temp -> color.  The same
+        // bindings as m_denoiseDesc, so m_denoiseCompPipelineLayout fits.
+        for (uint32_t i = 0;  i < 2;  i++) {
+            DescriptorWrap& desc = m_asyncDesc[p][i];
+            desc.setBindings(m_device, {
+                    {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+                    {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+                    {2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+                    {3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
+                });
+            desc.write(m_device, 0, (i == 0 ? m_asyncColor[p] : m_asyncTemp[p]).Descriptor());
+            desc.write(m_device, 1, (i == 0 ? m_asyncTemp[p] : m_asyncColor[p]).Descriptor());
+            desc.write(m_device, 2, m_asyncKd[p].Descriptor());
+            desc.write(m_device, 3, m_asyncNd[p].Descriptor()); }
+
+        m_asyncPostDesc[p].setBindings(m_device, {
+                {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT}
+            });
+        m_asyncPostDesc[p].write(m_device, 0, asyncResult(p).Descriptor()); }
+    submitTempCmdBuffer(cmdBuf);
+
+    VkCommandPoolCreateInfo poolCreateInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolCreateInfo.queueFamilyIndex = m_computeQueueIndex;
+    if (vkCreateCommandPool(m_device, &poolCreateInfo, nullptr, &m_asyncCmdPool) != VK_SUCCESS)
+        throw std::runtime_error("failed to create async compute command pool!");
+
+    VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocateInfo.commandPool        = m_asyncCmdPool;
+    allocateInfo.commandBufferCount = 2;
+    allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    if (vkAllocateCommandBuffers(m_device, &allocateInfo, m_asyncCmdBuf) != VK_SUCCESS)
+        throw std::runtime_error("failed to allocate async compute command buffers!");
+
+    // The work never changes, so each parity's command buffer is
+    // recorded once.  Nothing orders one submit's accesses against an
+    // earlier one's except the semaphore chain (inputs N+1 waits for
+    // the copy, which waited for done N), so no leading barrier.
+    PushConstantDenoise pc{};
+    pc.normFactor  = 0.003f;
+    pc.depthFactor = 0.007f;
+    pc.width       = windowSize.width;
+    pc.height      = windowSize.height;
+    VkMemoryBarrier2 barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    barrier.srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    barrier.dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    VkDependencyInfo dependency{VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependency.memoryBarrierCount = 1;
+    dependency.pMemoryBarriers    = &barrier;
+
+    for (uint32_t p = 0;  p < 2;  p++) {
+        // The host never waits on m_asyncDone, so a parity's buffer
+        // may still be pending when it is submitted again.
+        VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        vkBeginCommandBuffer(m_asyncCmdBuf[p], &beginInfo);
+        vkCmdBindPipeline(m_asyncCmdBuf[p], VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipeline);
+        for (int i = 0;  i < m_num_atrous_iterations;  i++) {
+            if (i > 0)
+                vkCmdPipelineBarrier2(m_asyncCmdBuf[p], &dependency);
+            pc.stepwidth = 1 << i;
+            vkCmdBindDescriptorSets(m_asyncCmdBuf[p], VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    m_denoiseCompPipelineLayout, 0, 1,
+                                    &m_asyncDesc[p][i & 1].descSet, 0, nullptr);
+            vkCmdPushConstants(m_asyncCmdBuf[p], m_denoiseCompPipelineLayout,
+                               VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise), &pc);
+            vkCmdDispatch(m_asyncCmdBuf[p],
+                          (windowSize.width + GROUP_SIZE-1) / GROUP_SIZE,
+                          windowSize.height, 1); }
+        vkEndCommandBuffer(m_asyncCmdBuf[p]); }
+
+    VkSemaphoreTypeCreateInfo typeInfo{VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue  = 0;
+    VkSemaphoreCreateInfo semCreateInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, &typeInfo};
+    vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &m_asyncInputs);
+    vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &m_asyncDone);
+    m_asyncFrame = 0;
+    // To destroy: destroyAsyncDenoise();
+}
+
+void VkApp::destroyAsyncDenoise()
+{
+    if (!m_asyncDenoise)
+        return;
+    vkDestroySemaphore(m_device, m_asyncInputs, nullptr);
+    vkDestroySemaphore(m_device, m_asyncDone, nullptr);
+    vkDestroyCommandPool(m_device, m_asyncCmdPool, nullptr);  // And m_asyncCmdBuf
+    for (uint32_t p = 0;  p < 2;  p++) {
+        m_asyncColor[p].destroy(m_device);
+        m_asyncKd[p].destroy(m_device);
+        m_asyncNd[p].destroy(m_device);
+        m_asyncTemp[p].destroy(m_device);
+        m_asyncDesc[p][0].destroy(m_device);
+        m_asyncDesc[p][1].destroy(m_device);
+        m_asyncPostDesc[p].destroy(m_device); }
+}
+
+// The last iteration writes temp if the count is odd, else color.
+ImageWrap& VkApp::asyncResult(uint32_t parity)
+{
+    return (m_num_atrous_iterations & 1) ? m_asyncTemp[parity] : m_asyncColor[parity];
+}
+
+// Called after submitFrame has submitted frame m_asyncFrame's copies
+// (signaling m_asyncInputs = m_asyncFrame+1).
+void VkApp::submitAsyncDenoise()
+{
+    const uint64_t waitValue   = m_asyncFrame + 1;
+    const uint64_t signalValue = m_asyncFrame + 1;
+    const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.waitSemaphoreValueCount   = 1;
+    timelineInfo.pWaitSemaphoreValues      = &waitValue;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues    = &signalValue;
+
+    VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO, &timelineInfo};
+    submitInfo.waitSemaphoreCount   = 1;
+    submitInfo.pWaitSemaphores      = &m_asyncInputs;
+    submitInfo.pWaitDstStageMask    = &waitStageMask;
+    submitInfo.commandBufferCount   = 1;
+    submitInfo.pCommandBuffers      = &m_asyncCmdBuf[m_asyncFrame & 1];
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores    = &m_asyncDone;
+    if (vkQueueSubmit(m_computeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        throw std::runtime_error("failed to submit async denoise!");
+    m_asyncFrame++;
 }
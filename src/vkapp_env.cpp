@@ -0,0 +1,74 @@
+
+#include <cstring>
+
+#include "vkapp.h"
+#include "app.h"
+#include "env_map.h"
+
+// Environment lighting (-e file.hdr; see env_map.h).  The full and low
+// resolution maps become sampled images, and the alias table a storage
+// buffer, all in the ray tracer's descriptor set.  Without a map they
+// are 1x1 and black, and pcRay.useEnv is off.
+
+void VkApp::createEnvironment()
+{
+    EnvMap env;
+    bool useEnv = !app->m_envMapFile.empty() && loadEnvMap(app->m_envMapFile, env);
+    if (!useEnv) {
+        env.width = env.height = env.lowWidth = env.lowHeight = 1;
+        env.pixels = env.low = {vec4(0.0f)};
+        env.alias = {{1.0f, 0, 1.0f}}; }
+
+    m_envImage    = createEnvImage(env.width, env.height, env.pixels);
+    m_envLowImage = createEnvImage(env.lowWidth, env.lowHeight, env.low);
+    m_envAliasBW  = createStagedBufferWrap(env.alias, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+    m_pcRay.useEnv       = useEnv;
+    m_pcRay.envIntensity = app->m_envIntensity;
+    m_pcRay.envWidth     = env.lowWidth;
+    m_pcRay.envHeight    = env.lowHeight;
+}
+
+// An RGBA32F image of pixels, in SHADER_READ_ONLY_OPTIMAL, with a
+// sampler that wraps around in longitude and clamps at the poles.
+ImageWrap VkApp::createEnvImage(int width, int height, const std::vector<glm::vec4>& pixels)
+{
+    const VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    VkDeviceSize imageSize = pixels.size() * sizeof(glm::vec4);
+    StagingRegion staging = m_staging.alloc(imageSize);
+    memcpy(staging.mapped, pixels.data(), static_cast<size_t>(imageSize));
+
+    ImageWrap image = createImageWrap(width, height, format,
+                                      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkCommandBuffer cmdBuf = m_staging.cmd();
+    transitionImageLayout(cmdBuf, image.image, format,
+                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    copyBufferToImage(cmdBuf, staging.buffer, staging.offset, image.image, width, height);
+    m_staging.releaseImage(image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
+    VkImage vkImage = image.image;
+    m_staging.afterAcquire([this, vkImage](VkCommandBuffer gfxCmd) {
+        imageLayoutBarrier(gfxCmd, vkImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL); });
+
+    // Linear filtering of 32 bit floats is optional.
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(m_physicalDevice, format, &formatProperties);
+    VkFilter filter = formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+        ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+    VkSamplerCreateInfo samplerInfo{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerInfo.magFilter    = filter;
+    samplerInfo.minFilter    = filter;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.mipmapMode   = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    if (vkCreateSampler(m_device, &samplerInfo, nullptr, &image.sampler) != VK_SUCCESS)
+        throw std::runtime_error("failed to create environment sampler!");
+
+    image.imageView   = createImageView(image.image, format);
+    image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return image;
+}
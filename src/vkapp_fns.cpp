@@ -27,8 +27,12 @@ void VkApp::destroyAllVulkanResources()
     // ...  All objects created on m_device must be destroyed before m_device.
     destroySwapchain();
     vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+    m_staging.destroy();
+    destroyFrameData();
+    vkDestroyFence(m_device, m_tempFence, nullptr);
     vkDestroyCommandPool(m_device, m_cmdPool, nullptr);
-    m_depthImage.destroy(m_device);
+    m_graph.destroy();  // And its transients: m_depthImage, m_denoiseBuffer
+    destroyAsyncDenoise();
     vkDestroyRenderPass(m_device, m_postRenderPass, nullptr);
 
     for (auto& framebuffer : m_framebuffers)
@@ -41,10 +45,38 @@ void VkApp::destroyAllVulkanResources()
     vkDestroyPipeline(m_device, m_postPipeline, nullptr);
 
     for (auto t : m_objText) t.destroy(m_device);
+    destroySkinning();
+    destroyRadianceCache();
+    destroyPathGuiding();
     //for (auto ob : m_objDesc) ob.destroy(m_device);
+    for (auto& ob : m_objData) {
+        ob.vertexBuffer.destroy(m_device);
+        ob.indexBuffer.destroy(m_device);
+        ob.matColorBuffer.destroy(m_device);
+        ob.matIndexBuffer.destroy(m_device);
+        if (ob.lodIndexBuffer.buffer) {
+            ob.lodIndexBuffer.destroy(m_device);
+            ob.lodMatIndexBuffer.destroy(m_device); }
+        if (ob.emitterBuffer.buffer)
+            ob.emitterBuffer.destroy(m_device);
+        if (ob.lodEmitterBuffer.buffer)
+            ob.lodEmitterBuffer.destroy(m_device);
+        if (ob.primRemapBuffer.buffer) {
+            ob.blasVertexBuffer.destroy(m_device);
+            ob.blasIndexBuffer.destroy(m_device);
+            ob.primRemapBuffer.destroy(m_device); } }
 
     m_matrixBW.destroy(m_device);
     m_objDescriptionBW.destroy(m_device);
+    m_envImage.destroy(m_device);
+    m_envLowImage.destroy(m_device);
+    m_envAliasBW.destroy(m_device);
+    m_lightBuff.destroy(m_device);
+    m_lightTreeBW.destroy(m_device);
+    m_diReservoirBW.destroy(m_device);
+    m_diFinalBW.destroy(m_device);
+    m_giReservoirBW.destroy(m_device);
+    m_giFinalBW.destroy(m_device);
     vkDestroyRenderPass(m_device, m_scanlineRenderPass, nullptr);
     vkDestroyFramebuffer(m_device, m_scanlineFramebuffer, nullptr); 
     m_scDesc.destroy(m_device);
@@ -64,14 +96,16 @@ void VkApp::destroyAllVulkanResources()
     m_rtNdPrevBuffer.destroy(m_device);
     m_rtKdCurrBuffer.destroy(m_device);
     m_rtKdPrevBuffer.destroy(m_device);
+    m_rtSampleBuffer.destroy(m_device);
 
     // Project 6 Cleanup
-    m_denoiseBuffer.destroy(m_device);
     m_denoiseDesc.destroy(m_device);
     vkDestroyPipelineLayout(m_device, m_denoiseCompPipelineLayout, nullptr);
     vkDestroyPipeline(m_device, m_denoisePipeline, nullptr);
+    destroyReconstruct();
 
     // Before this ----
+    m_allocator.destroy();
 	vkDestroyDevice(m_device, nullptr);
     vkDestroyInstance(m_instance, nullptr);
 }
@@ -242,7 +276,42 @@ void VkApp::chooseQueueIndex()
     std::vector<VkQueueFamilyProperties> queueProperties(mpCount);
     vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &mpCount, queueProperties.data());
 
-    m_graphicsQueueIndex = 0;
+    m_graphicsQueueIndex = VK_QUEUE_FAMILY_IGNORED;
+    for (uint32_t i = 0;  i < mpCount;  i++)
+        if ((queueProperties[i].queueFlags & requiredQueueFlags) == requiredQueueFlags) {
+            m_graphicsQueueIndex = i;
+            break; }
+    if (m_graphicsQueueIndex == VK_QUEUE_FAMILY_IGNORED)
+        throw std::runtime_error("no graphics+compute+transfer queue family!");
+
+    // Uploads go to a transfer-only family (the GPU's copy engines) if
+    // there is one, so they run beside rendering instead of in front
+    // of it.  Otherwise they share the graphics family and queue.
+    m_transferQueueIndex = m_graphicsQueueIndex;
+    for (uint32_t i = 0;  i < mpCount;  i++) {
+        VkQueueFlags flags = queueProperties[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT)
+            && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            m_transferQueueIndex = i;
+            break; } }
+    printf("Queue families: graphics %u, transfer %u%s\n", m_graphicsQueueIndex,
+           m_transferQueueIndex,
+           m_transferQueueIndex == m_graphicsQueueIndex ? " (shared)" : " (dedicated)");
+
+    // With -a, denoising runs on a compute-only family (async compute),
+    // overlapping the next frame's ray tracing.
+    m_computeQueueIndex = VK_QUEUE_FAMILY_IGNORED;
+    if (app->m_asyncCompute) {
+        for (uint32_t i = 0;  i < mpCount;  i++) {
+            VkQueueFlags flags = queueProperties[i].queueFlags;
+            if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+                m_computeQueueIndex = i;
+                break; } }
+        if (m_computeQueueIndex == VK_QUEUE_FAMILY_IGNORED)
+            printf("No compute-only queue family; denoising on the graphics queue\n");
+        else
+            printf("Queue families: async compute %u\n", m_computeQueueIndex); }
+    m_asyncDenoise = m_computeQueueIndex != VK_QUEUE_FAMILY_IGNORED;
 
     // @@ Use the api_dump to document the results of the above two
     // step.  How many queue families does your Vulkan offer.  Which
@@ -292,17 +361,36 @@ void VkApp::createDevice()
     // Turn off robustBufferAccess (WHY?)
     features2.features.robustBufferAccess = VK_FALSE;
 
+    // Uploads wait and signal with timeline semaphores.
+    if (!features12.timelineSemaphore)
+        throw std::runtime_error("timelineSemaphore feature not supported!");
+    // The render graph's barriers are vkCmdPipelineBarrier2.
+    if (!features13.synchronization2)
+        throw std::runtime_error("synchronization2 feature not supported!");
+    // Building BLASes on the CPU (-H) needs host commands.
+    m_hostAsBuilds = app->m_hostAsBuilds && accelFeature.accelerationStructureHostCommands;
+    if (app->m_hostAsBuilds && !m_hostAsBuilds)
+        printf("accelerationStructureHostCommands not supported; building BLASes on the GPU\n");
+
     float priority = 1.0;
+    std::vector<VkDeviceQueueCreateInfo> queueInfos;
     VkDeviceQueueCreateInfo queueInfo{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
     queueInfo.queueFamilyIndex = m_graphicsQueueIndex;
     queueInfo.queueCount       = 1;
     queueInfo.pQueuePriorities = &priority;
+    queueInfos.push_back(queueInfo);
+    if (m_transferQueueIndex != m_graphicsQueueIndex) {
+        queueInfo.queueFamilyIndex = m_transferQueueIndex;
+        queueInfos.push_back(queueInfo); }
+    if (m_asyncDenoise) {
+        queueInfo.queueFamilyIndex = m_computeQueueIndex;
+        queueInfos.push_back(queueInfo); }
     
     VkDeviceCreateInfo deviceCreateInfo{VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
     deviceCreateInfo.pNext            = &features2; // This is the whole pNext chain
   
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pQueueCreateInfos    = &queueInfo;
+    deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueInfos.size());
+    deviceCreateInfo.pQueueCreateInfos    = queueInfos.data();
     
     deviceCreateInfo.enabledExtensionCount   = static_cast<uint32_t>(reqDeviceExtensions.size());
     deviceCreateInfo.ppEnabledExtensionNames = reqDeviceExtensions.data();
@@ -315,9 +403,23 @@ void VkApp::createDevice()
 	// To destroy: vkDestroyDevice(m_device, nullptr);
 }
 
+// All buffer and image memory is sub-allocated from large blocks; see
+// allocator_wrap.h.
+void VkApp::createAllocator()
+{
+    m_allocator.setup(m_device, m_physicalDevice);
+    // To destroy: m_allocator.destroy();
+}
+
 void VkApp::getCommandQueue()
 {
     vkGetDeviceQueue(m_device, m_graphicsQueueIndex, 0, &m_queue);
+    if (m_transferQueueIndex != m_graphicsQueueIndex)
+        vkGetDeviceQueue(m_device, m_transferQueueIndex, 0, &m_transferQueue);
+    else
+        m_transferQueue = m_queue;
+    if (m_asyncDenoise)
+        vkGetDeviceQueue(m_device, m_computeQueueIndex, 0, &m_computeQueue);
     // Returns void -- nothing to verify
     // Nothing to destroy -- the queue is owned by the device.
 }
@@ -369,17 +471,13 @@ void VkApp::createCommandPool()
         printf("Failed to create command pool!\n");
     // @@ Verify VK_SUCCESS
     // To destroy: vkDestroyCommandPool(m_device, m_cmdPool, nullptr);
-    
-    // Create a command buffer
-    VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
-    allocateInfo.commandPool        = m_cmdPool;
-    allocateInfo.commandBufferCount = 1;
-    allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    result = vkAllocateCommandBuffers(m_device, &allocateInfo, &m_commandBuffer);
-    if (result != VK_SUCCESS)
-        printf("Failed to allocated command buffers");
-    // @@ Verify VK_SUCCESS
-    // Nothing to destroy -- the pool owns the command buffer.
+
+    // Lets submitTempCmdBuffer wait for its own work, not the whole queue.
+    VkFenceCreateInfo fenceCreateInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    vkCreateFence(m_device, &fenceCreateInfo, nullptr, &m_tempFence);
+    // To destroy: vkDestroyFence(m_device, m_tempFence, nullptr);
+
+    // The per-frame command buffers are allocated by createFrameData.
 }
  
 // 
@@ -564,19 +662,8 @@ void VkApp::createSwapchain()
                          nullptr, m_imageCount, m_barriers.data());
     submitTempCmdBuffer(cmd);
 
-    // Create the three synchronization objects.  These are not
-    // technically part of the swap chain, but they are used
-    // exclusively for synchronizing the swap chain, so I include them
-    // here.
-    VkFenceCreateInfo fenceCreateInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-    vkCreateFence(m_device, &fenceCreateInfo, nullptr, &m_waitFence);
-    
-    VkSemaphoreCreateInfo semCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
-    vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &m_readSemaphore);
-    vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &m_writtenSemaphore);
-    //NAME(m_readSemaphore, VK_OBJECT_TYPE_SEMAPHORE, "m_readSemaphore");
-    //NAME(m_writtenSemaphore, VK_OBJECT_TYPE_SEMAPHORE, "m_writtenSemaphore");
+    // The synchronization objects (a fence and two semaphores) are
+    // per frame in flight now; see createFrameData.
     //NAME(m_queue, VK_OBJECT_TYPE_QUEUE, "m_queue");
         
     windowSize = swapchainExtent;
@@ -592,11 +679,6 @@ void VkApp::destroySwapchain()
     for (int i = 0; i < 3; ++i)
 		vkDestroyImageView(m_device, m_imageViews[i], nullptr);
 
-    // Destroy the synchronization items: 
-	vkDestroyFence(m_device, m_waitFence, nullptr);
-	vkDestroySemaphore(m_device, m_readSemaphore, nullptr);
-	vkDestroySemaphore(m_device, m_writtenSemaphore, nullptr);
-
     // Destroy the actual swapchain:
     vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
     m_swapchain = VK_NULL_HANDLE;
@@ -606,23 +688,6 @@ void VkApp::destroySwapchain()
 
 
 
-void VkApp::createDepthResource() 
-{
-    uint mipLevels = 1;
-
-    // Note m_depthImage is type ImageWrap; a tiny wrapper around
-    // several related Vulkan objects.
-    m_depthImage = createImageWrap(windowSize.width, windowSize.height,
-                                    VK_FORMAT_X8_D24_UNORM_PACK32,
-                                    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                    mipLevels);
-    m_depthImage.imageView = createImageView(m_depthImage.image,
-                                             VK_FORMAT_X8_D24_UNORM_PACK32,
-                                             VK_IMAGE_ASPECT_DEPTH_BIT);
-    // To destroy: m_depthImage.destroy(m_device);
-}
-
 // Gets a list of memory types supported by the GPU, and search
 // through that list for one that matches the requested properties
 // flag.  The (only?) two types requested here are:
@@ -653,7 +718,8 @@ uint32_t VkApp::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags proper
 ImageWrap VkApp::createImageWrap(uint32_t width, uint32_t height,
                                  VkFormat format,
                                  VkImageUsageFlags usage,
-                                 VkMemoryPropertyFlags properties, uint mipLevels)
+                                 VkMemoryPropertyFlags properties, uint mipLevels,
+                                 uint32_t sharedFamily)
 {
     ImageWrap myImage;
     
@@ -671,18 +737,26 @@ ImageWrap VkApp::createImageWrap(uint32_t width, uint32_t height,
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+    // Used by two queue families at once, without ownership transfers.
+    uint32_t families[2] = {m_graphicsQueueIndex, sharedFamily};
+    if (sharedFamily != VK_QUEUE_FAMILY_IGNORED && sharedFamily != m_graphicsQueueIndex) {
+        imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageInfo.queueFamilyIndexCount = 2;
+        imageInfo.pQueueFamilyIndices = families; }
+
     vkCreateImage(m_device, &imageInfo, nullptr, &myImage.image);
 
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(m_device, myImage.image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    vkAllocateMemory(m_device, &allocInfo, nullptr, &myImage.memory);
+    uint32_t memoryType = findMemoryType(memRequirements.memoryTypeBits, properties);
+    myImage.allocation = m_allocator.allocate(memRequirements, memoryType,
+                                              MemoryAllocator::eImage);
+    myImage.allocator = &m_allocator;
+    myImage.memory = myImage.allocation.memory;
+    myImage.offset = myImage.allocation.offset;
     
-    vkBindImageMemory(m_device, myImage.image, myImage.memory, 0);
+    vkBindImageMemory(m_device, myImage.image, myImage.memory, myImage.offset);
 
     myImage.imageView = VK_NULL_HANDLE;
     myImage.sampler = VK_NULL_HANDLE;
@@ -803,8 +877,9 @@ void VkApp::createPostPipeline()
     /*createInfo.setLayoutCount         = 0;
     createInfo.pSetLayouts            = nullptr;*/
     
-    createInfo.pushConstantRangeCount = 0;
-    createInfo.pPushConstantRanges    = nullptr;
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantPost)};
+    createInfo.pushConstantRangeCount = 1;
+    createInfo.pPushConstantRanges    = &pc_info;
     
     vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_postPipelineLayout);
 
@@ -976,7 +1051,21 @@ void VkApp::postProcess()
         vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipeline);
         // Eventually uncomment this
         vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                m_postPipelineLayout, 0, 1, &m_postDesc.descSet, 0, nullptr);
+                                m_postPipelineLayout, 0, 1,
+                                m_asyncThisFrame ? &m_asyncPostDesc[(m_asyncFrame + 1) & 1].descSet
+                                                 : &m_postDesc.descSet,
+                                0, nullptr);
+
+        // The ray traced image is only m_renderSize of scImage (dynamic
+        // resolution), stretched over the window by the sampler's
+        // bilinear filter, up to its last texel's center.
+        vec2 window(windowSize.width, windowSize.height);
+        vec2 shown = useRaytracer ? vec2(m_renderSize.width, m_renderSize.height) : window;
+        PushConstantPost pc{};
+        pc.uvScale = shown / (window * window);
+        pc.uvMax   = (shown - 0.5f) / window;
+        vkCmdPushConstants(m_commandBuffer, m_postPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT,
+                           0, sizeof(PushConstantPost), &pc);
 
         // Weird! This draws 3 vertices but with no vertices/triangles buffers bound in.
         // Hint: The vertex shader fabricates vertices from gl_VertexIndex
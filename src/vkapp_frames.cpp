@@ -0,0 +1,233 @@
+
+#include <cmath>
+#include <cstdio>
+
+#include "vkapp.h"
+#include "app.h"
+
+// Frames in flight.  prepareFrame waits only for the fence of the
+// frame that last used the same slot (F frames ago), so the CPU can
+// record a frame while the GPU is still executing up to F-1 earlier
+// ones.
+
+// Timestamps per frame: its begin and end, then each TimedPass's.
+static const uint32_t queriesPerFrame = 2 + 2 * eTimedPassCount;
+static const char* timedPassNames[eTimedPassCount] = {"raytrace", "path guiding"};
+
+// Dynamic resolution's lower limit, of the window's width and height.
+static const float minRenderScale = 0.5f;
+
+void VkApp::createFrameData()
+{
+    m_frames.resize(app->m_framesInFlight);
+
+    VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocateInfo.commandPool        = m_cmdPool;
+    allocateInfo.commandBufferCount = 1;
+    allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+    // Fences start signaled so the first wait on each returns at once.
+    VkFenceCreateInfo fenceCreateInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    VkSemaphoreCreateInfo semCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+
+    for (FrameData& frame : m_frames) {
+        if (vkAllocateCommandBuffers(m_device, &allocateInfo, &frame.cmdBuf) != VK_SUCCESS)
+            throw std::runtime_error("failed to allocate frame command buffer!");
+        vkCreateFence(m_device, &fenceCreateInfo, nullptr, &frame.fence);
+        vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &frame.readSemaphore);
+        vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &frame.writtenSemaphore); }
+    m_frameIndex = 0;
+    m_commandBuffer = m_frames[0].cmdBuf;
+
+    // Command pools may be used by one thread at a time, so each
+    // recording thread gets its own, per frame in flight.
+    uint32_t threads = app->m_recordThreads;
+    if (threads > 1) {
+        m_recordPool = std::make_unique<ThreadPool>(threads);
+        VkCommandPoolCreateInfo poolCreateInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+        poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolCreateInfo.queueFamilyIndex = m_graphicsQueueIndex;
+        VkCommandBufferAllocateInfo secondaryInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        secondaryInfo.commandBufferCount = 1;
+        secondaryInfo.level              = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        for (FrameData& frame : m_frames) {
+            frame.recordPools.resize(threads);
+            frame.recordCmds.resize(threads);
+            for (uint32_t t = 0;  t < threads;  t++) {
+                if (vkCreateCommandPool(m_device, &poolCreateInfo, nullptr, &frame.recordPools[t]) != VK_SUCCESS)
+                    throw std::runtime_error("failed to create recording command pool!");
+                secondaryInfo.commandPool = frame.recordPools[t];
+                vkAllocateCommandBuffers(m_device, &secondaryInfo, &frame.recordCmds[t]); } }
+        printf("Raster recording threads: %u\n", threads); }
+
+    // Timestamps (begin, end) for each frame, and its timed passes.
+    VkQueryPoolCreateInfo queryInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    queryInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    queryInfo.queryCount = queriesPerFrame * m_frames.size();
+    vkCreateQueryPool(m_device, &queryInfo, nullptr, &m_timestampPool);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    m_timestampPeriod = properties.limits.timestampPeriod;
+
+    printf("Frames in flight: %zd\n", m_frames.size());
+    // To destroy: destroyFrameData();
+}
+
+void VkApp::destroyFrameData()
+{
+    for (FrameData& frame : m_frames) {
+        vkDestroyFence(m_device, frame.fence, nullptr);
+        vkDestroySemaphore(m_device, frame.readSemaphore, nullptr);
+        vkDestroySemaphore(m_device, frame.writtenSemaphore, nullptr);
+        for (VkCommandPool pool : frame.recordPools)
+            vkDestroyCommandPool(m_device, pool, nullptr); }
+    m_recordPool.reset();
+    // The pools own the command buffers.
+    m_frames.clear();
+    vkDestroyQueryPool(m_device, m_timestampPool, nullptr);
+}
+
+// Record the frame's begin or end timestamp into m_commandBuffer.
+void VkApp::writeFrameTimestamp(bool end)
+{
+    FrameData& frame = m_frames[m_frameIndex];
+    uint32_t query = queriesPerFrame * m_frameIndex + (end ? 1 : 0);
+    if (!end) {
+        vkCmdResetQueryPool(m_commandBuffer, m_timestampPool, query, queriesPerFrame);
+        for (bool& timed : frame.passTimed)
+            timed = false; }
+    vkCmdWriteTimestamp(m_commandBuffer,
+                        end ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        m_timestampPool, query);
+    frame.timed = true;
+}
+
+// Likewise for a pass, around its commands; after the frame's begin.
+void VkApp::writePassTimestamp(TimedPass pass, bool end)
+{
+    uint32_t query = queriesPerFrame * m_frameIndex + 2 + 2 * pass + (end ? 1 : 0);
+    vkCmdWriteTimestamp(m_commandBuffer,
+                        end ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        m_timestampPool, query);
+    m_frames[m_frameIndex].passTimed[pass] = true;
+}
+
+// Called once the current slot's fence has signaled: its timestamps,
+// from F frames ago, are available.  Slots are read in submission
+// order, so the previous slot read holds the previous GPU frame.
+void VkApp::readFrameTimestamps()
+{
+    if (!m_frames[m_frameIndex].timed)
+        return;
+
+    uint64_t ticks[2];
+    uint32_t first = queriesPerFrame * m_frameIndex;
+    if (vkGetQueryPoolResults(m_device, m_timestampPool, first, 2,
+                              sizeof(ticks), ticks, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+        return;
+
+    const double msPerTick = m_timestampPeriod * 1e-6;
+    for (uint32_t t = 0;  t < eTimedPassCount;  t++) {
+        uint64_t passTicks[2];
+        if (m_frames[m_frameIndex].passTimed[t]
+            && vkGetQueryPoolResults(m_device, m_timestampPool, first + 2 + 2 * t, 2,
+                                     sizeof(passTicks), passTicks, sizeof(uint64_t),
+                                     VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            m_timing.passMs[t] += (passTicks[1] - passTicks[0]) * msPerTick;
+            m_timing.passFrames[t]++; } }
+    m_timing.gpuMs += (ticks[1] - ticks[0]) * msPerTick;
+    m_timing.gpuFrames++;
+    updateRenderScale((ticks[1] - ticks[0]) * msPerTick);
+    if (m_timing.haveGpuEnd && ticks[0] > m_timing.lastGpuEnd) {
+        m_timing.idleMs += (ticks[0] - m_timing.lastGpuEnd) * msPerTick;
+        m_timing.idleFrames++; }
+    m_timing.lastGpuEnd = ticks[1];
+    m_timing.haveGpuEnd = true;
+}
+
+// Dynamic resolution (-D ms); not with async denoising, whose
+// command buffers are recorded once, for the whole window.
+void VkApp::createDynamicResolution()
+{
+    m_renderSize = m_priorRenderSize = windowSize;
+    m_targetGpuMs = app->m_targetGpuMs;
+    if (m_targetGpuMs > 0.0f && m_asyncDenoise) {
+        printf("Dynamic resolution is not available with async denoising (-a)\n");
+        m_targetGpuMs = 0.0f; }
+    else if (m_targetGpuMs > 0.0f)
+        printf("Dynamic resolution: GPU frames of %.1f ms, at %.0f%% to 100%% of the window's size\n",
+               m_targetGpuMs, 100.0f * minRenderScale);
+}
+
+// After a ray traced frame's GPU time is read: the scale that would
+// have taken it to the target, assuming the cost goes with the pixel
+// count (the scale squared).  That frame was recorded F frames ago,
+// at its own scale; half the way there each frame keeps the
+// correction from overshooting, and within 5% nothing changes.
+void VkApp::updateRenderScale(double gpuMs)
+{
+    FrameData& frame = m_frames[m_frameIndex];
+    float frameScale = frame.renderScale;
+    frame.renderScale = 0.0f;
+    if (frameScale <= 0.0f || !useRaytracer)
+        return;
+    m_timing.renderScale += frameScale;
+    m_timing.scaledFrames++;
+    if (m_targetGpuMs <= 0.0f || gpuMs <= 0.0)
+        return;
+
+    double ratio = m_targetGpuMs / gpuMs;
+    if (ratio > 0.95 && ratio < 1.05)
+        return;
+    float wanted = frameScale * (float)std::sqrt(ratio);
+    m_renderScale = glm::clamp(m_renderScale + 0.5f * (wanted - m_renderScale), minRenderScale, 1.0f);
+}
+
+// Accumulate this frame's CPU side times, and print averages every
+// couple of seconds.
+void VkApp::reportFrameTiming(double waitMs)
+{
+    double now = glfwGetTime();
+    if (m_timing.lastFrameTime > 0) {
+        m_timing.cpuMs  += 1000.0 * (now - m_timing.lastFrameTime);
+        m_timing.waitMs += waitMs;
+        m_timing.frames++; }
+    else
+        m_timing.lastReportTime = now;
+    m_timing.lastFrameTime = now;
+
+    if (now - m_timing.lastReportTime < 2.0 || m_timing.frames == 0)
+        return;
+
+    double n = m_timing.frames;
+    printf("Frames in flight %zd: %6.1f fps  CPU frame %6.2f ms (fence wait %5.2f ms)  "
+           "GPU frame %6.2f ms  GPU idle between frames %5.2f ms\n",
+           m_frames.size(), n / (now - m_timing.lastReportTime),
+           m_timing.cpuMs / n, m_timing.waitMs / n,
+           m_timing.gpuFrames ? m_timing.gpuMs / m_timing.gpuFrames : 0.0,
+           m_timing.idleFrames ? m_timing.idleMs / m_timing.idleFrames : 0.0);
+    bool anyPass = false;
+    for (uint32_t t = 0;  t < eTimedPassCount;  t++)
+        if (m_timing.passFrames[t]) {
+            printf("%s%s %6.2f ms", anyPass ? "  " : "GPU passes: ", timedPassNames[t],
+                   m_timing.passMs[t] / m_timing.passFrames[t]);
+            anyPass = true; }
+    if (anyPass)
+        printf("\n");
+    if (m_targetGpuMs > 0.0f && m_timing.scaledFrames)
+        printf("Dynamic resolution: %.0f%% of the window on average, now %ux%u\n",
+               100.0 * m_timing.renderScale / m_timing.scaledFrames,
+               m_renderSize.width, m_renderSize.height);
+    if (m_pcRay.guiding)
+        reportGuiding();
+
+    FrameTiming next{};
+    next.lastFrameTime  = now;
+    next.lastReportTime = now;
+    next.lastGpuEnd     = m_timing.lastGpuEnd;
+    next.haveGpuEnd     = m_timing.haveGpuEnd;
+    m_timing = next;
+}
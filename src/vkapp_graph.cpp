@@ -0,0 +1,240 @@
+
+#include "vkapp.h"
+#include "app.h"
+
+// drawFrame's work as a render graph.  The passes are declared here
+// once, in the order they run; enabled() picks the ray tracer or the
+// rasterizer each frame.  Declared before the images it imports exist
+// (they are only referenced), but it must run before anything uses
+// the transients it creates: m_depthImage (post frame buffers,
+// scanline frame buffer) and m_denoiseBuffer (denoise descriptors).
+void VkApp::createRenderGraph()
+{
+    typedef RenderGraph G;
+    m_graph.setup(this);
+
+    // Every image imported here is used in GENERAL (its descriptor
+    // layout), and is put in it when created.
+    G::Resource scImage = m_graph.importImage("scImage", &m_scImageBuffer, VK_IMAGE_LAYOUT_GENERAL);
+    G::Resource colCurr = m_graph.importImage("colCurr", &m_rtColCurrBuffer, VK_IMAGE_LAYOUT_GENERAL);
+    G::Resource colPrev = m_graph.importImage("colPrev", &m_rtColPrevBuffer, VK_IMAGE_LAYOUT_GENERAL);
+    G::Resource kdCurr  = m_graph.importImage("kdCurr", &m_rtKdCurrBuffer, VK_IMAGE_LAYOUT_GENERAL);
+    G::Resource kdPrev  = m_graph.importImage("kdPrev", &m_rtKdPrevBuffer, VK_IMAGE_LAYOUT_GENERAL);
+    G::Resource ndCurr  = m_graph.importImage("ndCurr", &m_rtNdCurrBuffer, VK_IMAGE_LAYOUT_GENERAL);
+    G::Resource ndPrev  = m_graph.importImage("ndPrev", &m_rtNdPrevBuffer, VK_IMAGE_LAYOUT_GENERAL);
+    G::Resource sample  = m_graph.importImage("sample", &m_rtSampleBuffer, VK_IMAGE_LAYOUT_GENERAL);
+    G::Resource matrices = m_graph.importBuffer("matrices", &m_matrixBW);
+    G::Resource tlas     = m_graph.importBuffer("tlas", m_rtBuilder.tlasBuffer());
+    G::Resource tlasScratch = m_graph.importBuffer("tlas scratch", m_rtBuilder.tlasScratch());
+    G::Resource diReservoirs = m_graph.importBuffer("di reservoirs", &m_diReservoirBW);
+    G::Resource diFinal      = m_graph.importBuffer("di final", &m_diFinalBW);
+    G::Resource giReservoirs = m_graph.importBuffer("gi reservoirs", &m_giReservoirBW);
+    G::Resource giFinal      = m_graph.importBuffer("gi final", &m_giFinalBW);
+    G::Resource cacheKeys    = m_graph.importBuffer("cache keys", &m_cacheKeyBW);
+    G::Resource cacheAccum   = m_graph.importBuffer("cache accum", &m_cacheAccumBW);
+    G::Resource cacheCells   = m_graph.importBuffer("cache cells", &m_cacheCellBW);
+    G::Resource guideGrid    = m_graph.importBuffer("guide grid", &m_guideGridBW);
+    G::Resource guideAccum   = m_graph.importBuffer("guide accum", &m_guideAccumBW);
+    G::Resource guideTree    = m_graph.importBuffer("guide tree", &m_guideTreeBW);
+
+    // Skinned models' vertex buffers and BLASes, which are loaded
+    // after this; see vkapp_skinning.cpp.
+    G::Resource skinned     = m_graph.importMemory("skinned vertices");
+    G::Resource deforming   = m_graph.importMemory("deforming blas");
+    G::Resource blasScratch = m_graph.importBuffer("blas scratch", m_rtBuilder.blasScratch());
+
+    // Async compute denoising's double buffer: this frame copies into
+    // half m_asyncFrame%2, and post shows the other half's result.
+    // (Imported even without -a; the passes using them stay disabled.)
+    G::Resource asyncColor[2], asyncKd[2], asyncNd[2], asyncDone[2];
+    for (uint32_t p = 0;  p < 2;  p++) {
+        std::string s = std::to_string(p);
+        asyncColor[p] = m_graph.importImage("asyncColor" + s, &m_asyncColor[p], VK_IMAGE_LAYOUT_GENERAL);
+        asyncKd[p]    = m_graph.importImage("asyncKd" + s, &m_asyncKd[p], VK_IMAGE_LAYOUT_GENERAL);
+        asyncNd[p]    = m_graph.importImage("asyncNd" + s, &m_asyncNd[p], VK_IMAGE_LAYOUT_GENERAL);
+        asyncDone[p]  = (m_num_atrous_iterations & 1)
+            ? m_graph.importImage("asyncTemp" + s, &m_asyncTemp[p], VK_IMAGE_LAYOUT_GENERAL)
+            : asyncColor[p]; }
+    auto thisHalf = [this]() { return uint32_t(m_asyncFrame & 1); };
+    auto prevHalf = [this]() { return uint32_t((m_asyncFrame + 1) & 1); };
+    G::Resource asyncInColor = m_graph.alternate("asyncInColor", {asyncColor[0], asyncColor[1]}, thisHalf);
+    G::Resource asyncInKd    = m_graph.alternate("asyncInKd", {asyncKd[0], asyncKd[1]}, thisHalf);
+    G::Resource asyncInNd    = m_graph.alternate("asyncInNd", {asyncNd[0], asyncNd[1]}, thisHalf);
+    G::Resource asyncResult  = m_graph.alternate("asyncResult", {asyncDone[0], asyncDone[1]}, prevHalf);
+
+    // The depth buffer is needed only during rasterize and post, and
+    // the denoise output only during denoising, so they share memory.
+    G::Resource depth = m_graph.transientImage("depth", &m_depthImage,
+                                               VK_FORMAT_X8_D24_UNORM_PACK32,
+                                               VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                                               VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                                               VK_IMAGE_ASPECT_DEPTH_BIT);
+    G::Resource denoised = m_graph.transientImage("denoised", &m_denoiseBuffer,
+                                                  VK_FORMAT_R32G32B32A32_SFLOAT,
+                                                  VK_IMAGE_USAGE_STORAGE_BIT
+                                                  | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                                  VK_IMAGE_LAYOUT_GENERAL);
+
+    auto raytracing = [this]() { return useRaytracer; };
+
+    auto skinning = [this]() { return !m_skinned.empty(); };
+
+    G::Pass skinPass = m_graph.addPass("skinning", VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                   [this](VkCommandBuffer cmdBuf) { this->skin(cmdBuf); }, skinning);
+    m_graph.use(skinPass, skinned, G::eStorageWrite);
+
+    // Refit (or rebuild) the skinned BLASes around the new vertices.
+    G::Pass blasUpdate = m_graph.addPass("blas update", VK_PIPELINE_STAGE_2_NONE,
+                                         [this](VkCommandBuffer cmdBuf) { updateSkinnedBlas(cmdBuf); },
+                                         [this]() { return useRaytracer && !m_skinned.empty(); });
+    m_graph.use(blasUpdate, skinned, G::eAccelerationInput);
+    m_graph.use(blasUpdate, deforming, G::eAccelerationBuild);
+    m_graph.use(blasUpdate, blasScratch, G::eAccelerationBuild);
+
+    // Refit or rebuild the TLAS for instances moved since last frame,
+    // or whose BLASes were just refit.
+    G::Pass tlasUpdate = m_graph.addPass("tlas update", VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                         [this](VkCommandBuffer cmdBuf) {
+                                             m_rtBuilder.cmdUpdateTlas(cmdBuf, m_frameIndex); },
+                                         [this]() { return useRaytracer
+                                                 && (m_rtBuilder.tlasDirty() || !m_skinned.empty()); });
+    m_graph.use(tlasUpdate, tlas, G::eAccelerationBuild);
+    m_graph.use(tlasUpdate, tlasScratch, G::eAccelerationBuild);
+    m_graph.use(tlasUpdate, deforming, G::eAccelerationRead);
+
+    // ReSTIR's passes (vkapp_restir.cpp); raytrace shades their results.
+    auto restirDIOn = [this]() { return useRaytracer && (m_pcRay.restir & eRestirDI); };
+    auto restirGIOn = [this]() { return useRaytracer && (m_pcRay.restir & eRestirGI); };
+    G::Pass diInitial = m_graph.addPass("restir di", VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR,
+                                        [this](VkCommandBuffer) { restir(eRestirDIInitial); }, restirDIOn);
+    m_graph.use(diInitial, diReservoirs, G::eStorageWrite);
+    m_graph.use(diInitial, diFinal, G::eStorageRead);
+    G::Pass diSpatial = m_graph.addPass("restir di spatial", VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR,
+                                        [this](VkCommandBuffer) { restir(eRestirDISpatial); }, restirDIOn);
+    m_graph.use(diSpatial, diReservoirs, G::eStorageRead);
+    m_graph.use(diSpatial, diFinal, G::eStorageWrite);
+    G::Pass giInitial = m_graph.addPass("restir gi", VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR,
+                                        [this](VkCommandBuffer) { restir(eRestirGIInitial); }, restirGIOn);
+    m_graph.use(giInitial, giReservoirs, G::eStorageWrite);
+    m_graph.use(giInitial, giFinal, G::eStorageRead);
+    G::Pass giSpatial = m_graph.addPass("restir gi spatial", VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR,
+                                        [this](VkCommandBuffer) { restir(eRestirGISpatial); }, restirGIOn);
+    m_graph.use(giSpatial, giReservoirs, G::eStorageRead);
+    m_graph.use(giSpatial, giFinal, G::eStorageWrite);
+    for (G::Pass pass : {diInitial, diSpatial, giInitial, giSpatial}) {
+        m_graph.use(pass, matrices, G::eUniform);
+        m_graph.use(pass, tlas, G::eAccelerationRead);
+        m_graph.use(pass, deforming, G::eAccelerationRead);
+        m_graph.use(pass, skinned, G::eStorageRead); }
+
+    G::Pass rt = m_graph.addPass("raytrace", VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR,
+                                 [this](VkCommandBuffer) { raytrace(); }, raytracing);
+    m_graph.use(rt, colCurr, G::eStorageReadWrite);
+    m_graph.use(rt, kdCurr, G::eStorageWrite);
+    m_graph.use(rt, ndCurr, G::eStorageWrite);
+    m_graph.use(rt, colPrev, G::eStorageRead);
+    m_graph.use(rt, kdPrev, G::eStorageRead);
+    m_graph.use(rt, ndPrev, G::eStorageRead);
+    m_graph.use(rt, sample, G::eStorageWrite);
+    m_graph.use(rt, matrices, G::eUniform);
+    m_graph.use(rt, tlas, G::eAccelerationRead);
+    m_graph.use(rt, deforming, G::eAccelerationRead);
+    m_graph.use(rt, skinned, G::eStorageRead);
+    m_graph.use(rt, diFinal, G::eStorageRead);
+    m_graph.use(rt, giFinal, G::eStorageRead);
+    m_graph.use(rt, cacheKeys, G::eStorageReadWrite);
+    m_graph.use(rt, cacheAccum, G::eStorageReadWrite);
+    m_graph.use(rt, cacheCells, G::eStorageRead);
+    m_graph.use(rt, guideGrid, G::eStorageReadWrite);
+    m_graph.use(rt, guideAccum, G::eStorageReadWrite);
+    m_graph.use(rt, guideTree, G::eStorageRead);
+
+    // Fold raytrace's radiance cache samples into its cells.
+    G::Pass cacheResolve = m_graph.addPass("radiance cache", VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                           [this](VkCommandBuffer cmdBuf) { resolveRadianceCache(cmdBuf); },
+                                           [this]() { return useRaytracer && m_pcRay.cache != eCacheOff; });
+    m_graph.use(cacheResolve, cacheKeys, G::eStorageReadWrite);
+    m_graph.use(cacheResolve, cacheAccum, G::eStorageReadWrite);
+    m_graph.use(cacheResolve, cacheCells, G::eStorageReadWrite);
+
+    // Fold raytrace's guiding samples into the quadtrees.
+    G::Pass guiding = m_graph.addPass("path guiding", VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                      [this](VkCommandBuffer cmdBuf) { trainPathGuiding(cmdBuf); },
+                                      [this]() { return useRaytracer && m_pcRay.guiding; });
+    m_graph.use(guiding, guideGrid, G::eStorageReadWrite);
+    m_graph.use(guiding, guideAccum, G::eStorageReadWrite);
+    m_graph.use(guiding, guideTree, G::eStorageReadWrite);
+
+    // Fill in the pixels reduced tracing left without samples.
+    G::Pass fill = m_graph.addPass("reconstruct", VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                   [this](VkCommandBuffer) { reconstruct(); },
+                                   [this]() { return useRaytracer && m_pcRay.traceMode != eTraceFull; });
+    m_graph.use(fill, colCurr, G::eStorageReadWrite);
+    m_graph.use(fill, kdCurr, G::eStorageRead);
+    m_graph.use(fill, ndCurr, G::eStorageRead);
+
+    G::Pass history = m_graph.addPass("rt history", VK_PIPELINE_STAGE_2_NONE,
+                                      [this](VkCommandBuffer) { copyRtHistory(); }, raytracing);
+    m_graph.use(history, colCurr, G::eTransferSrc);
+    m_graph.use(history, kdCurr, G::eTransferSrc);
+    m_graph.use(history, ndCurr, G::eTransferSrc);
+    m_graph.use(history, scImage, G::eTransferDst);
+    m_graph.use(history, colPrev, G::eTransferDst);
+    m_graph.use(history, kdPrev, G::eTransferDst);
+    m_graph.use(history, ndPrev, G::eTransferDst);
+
+    G::Pass asyncInputs = m_graph.addPass("async inputs", VK_PIPELINE_STAGE_2_NONE,
+                                          [this](VkCommandBuffer) {
+                                              uint32_t p = m_asyncFrame & 1;
+                                              CmdCopyImage(m_rtColCurrBuffer, m_asyncColor[p]);
+                                              CmdCopyImage(m_rtKdCurrBuffer, m_asyncKd[p]);
+                                              CmdCopyImage(m_rtNdCurrBuffer, m_asyncNd[p]); },
+                                          [this]() { return m_asyncThisFrame; });
+    m_graph.use(asyncInputs, colCurr, G::eTransferSrc);
+    m_graph.use(asyncInputs, kdCurr, G::eTransferSrc);
+    m_graph.use(asyncInputs, ndCurr, G::eTransferSrc);
+    m_graph.use(asyncInputs, asyncInColor, G::eTransferDst);
+    m_graph.use(asyncInputs, asyncInKd, G::eTransferDst);
+    m_graph.use(asyncInputs, asyncInNd, G::eTransferDst);
+
+    // One filter pass and one copy back per A-Trous iteration, unless
+    // they run on the compute queue.
+    for (int a = 0;  a < m_num_atrous_iterations;  a++) {
+        auto iterating = [this, a]() {
+            return useRaytracer && !m_asyncThisFrame && a < m_num_atrous_iterations; };
+
+        G::Pass filter = m_graph.addPass("atrous " + std::to_string(a),
+                                         VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                         [this, a](VkCommandBuffer) { denoise(a); }, iterating);
+        m_graph.use(filter, scImage, G::eStorageRead);
+        m_graph.use(filter, kdCurr, G::eStorageRead);
+        m_graph.use(filter, ndCurr, G::eStorageRead);
+        m_graph.use(filter, denoised, G::eStorageWrite);
+
+        G::Pass copy = m_graph.addPass("atrous copy " + std::to_string(a), VK_PIPELINE_STAGE_2_NONE,
+                                       [this](VkCommandBuffer) {
+                                           CmdCopyImage(m_denoiseBuffer, m_scImageBuffer); },
+                                       iterating);
+        m_graph.use(copy, denoised, G::eTransferSrc);
+        m_graph.use(copy, scImage, G::eTransferDst); }
+
+    G::Pass raster = m_graph.addPass("rasterize",
+                                     VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT
+                                     | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+                                     [this](VkCommandBuffer) { rasterize(); },
+                                     [this]() { return !useRaytracer; });
+    m_graph.use(raster, scImage, G::eColorAttachment);
+    m_graph.use(raster, depth, G::eDepthAttachment);
+    m_graph.use(raster, matrices, G::eUniform);
+    m_graph.use(raster, skinned, G::eVertexIndex);
+    m_graph.use(raster, skinned, G::eStorageRead);  // scanline.frag's vertex reads
+
+    G::Pass post = m_graph.addPass("post", VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+                                   [this](VkCommandBuffer) { postProcess(); });
+    m_graph.use(post, scImage, G::eSampled);
+    m_graph.use(post, asyncResult, G::eSampled);
+    m_graph.use(post, depth, G::eDepthAttachment);
+
+    m_graph.compile();
+    // To destroy: m_graph.destroy();
+}
@@ -0,0 +1,147 @@
+
+#include "vkapp.h"
+#include "app.h"
+
+// Path guiding (-p res); see pathGuiding.glsl.  raytrace samples its
+// bounces from the quadtree of the cell they leave, mixed with the
+// BRDF, and adds its paths' vertices' radiance to the cells' leaf
+// accumulators; the "path guiding" pass (guiding.comp) then folds the
+// accumulators into the trees.  The trees keep learning while the
+// camera moves, forgetting at m_guideDecay per frame.
+//
+// The cost is reported with the frame timing: the raytrace and
+// training passes' GPU times, and per frame, the guided directions
+// and training samples (counted in GuideGrid, copied out by
+// guiding.comp into a host visible slice per frame in flight).
+
+void VkApp::createPathGuiding()
+{
+    uint32_t res = std::min(app->m_guideRes, 64);
+    m_pcRay.guiding = res > 0;
+    m_guideCells = m_pcRay.guiding ? res * res * res : 1;
+
+    // The grid covers the instances' bounds, padded a little so
+    // surfaces on them don't straddle the edge cells.
+    GuideGrid grid{};
+    grid.boundsMin = vec3(1e30f);
+    grid.boundsMax = vec3(-1e30f);
+    for (const ObjInst& inst : m_objInst) {
+        const ObjData& object = m_objData[inst.objIndex];
+        for (int c = 0;  c < 8;  c++) {
+            vec3 corner((c & 1) ? object.boundsMax.x : object.boundsMin.x,
+                        (c & 2) ? object.boundsMax.y : object.boundsMin.y,
+                        (c & 4) ? object.boundsMax.z : object.boundsMin.z);
+            vec3 p = vec3(inst.transform * vec4(corner, 1.0f));
+            grid.boundsMin = glm::min(grid.boundsMin, p);
+            grid.boundsMax = glm::max(grid.boundsMax, p); } }
+    if (m_objInst.empty())
+        grid.boundsMin = grid.boundsMax = vec3(0.0f);
+    vec3 pad = 0.01f * (grid.boundsMax - grid.boundsMin) + vec3(1e-3f);
+    grid.boundsMin -= pad;
+    grid.boundsMax += pad;
+    grid.res = std::max(res, 1u);
+    grid.guideFraction = m_guideFraction;
+
+    // One cell's worth when off: the descriptors need buffers.
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    m_guideGridBW  = createStagedBufferWrap(sizeof(GuideGrid), &grid, usage);
+    m_guideAccumBW = createBufferWrap(m_guideCells * eGuideLeaves * sizeof(uint32_t),
+                                      usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_guideTreeBW  = createBufferWrap(m_guideCells * eGuideNodes * sizeof(float),
+                                      usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_guideStatsBW = createBufferWrap(m_frames.size() * 2 * sizeof(uint32_t),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    NAME(m_guideGridBW.buffer, VK_OBJECT_TYPE_BUFFER, "Path guiding grid");
+    NAME(m_guideAccumBW.buffer, VK_OBJECT_TYPE_BUFFER, "Path guiding accumulators");
+    NAME(m_guideTreeBW.buffer, VK_OBJECT_TYPE_BUFFER, "Path guiding quadtrees");
+    NAME(m_guideStatsBW.buffer, VK_OBJECT_TYPE_BUFFER, "Path guiding stats");
+
+    // Untrained: an empty tree is sampled as the BRDF alone.
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    for (BufferWrap* bw : {&m_guideAccumBW, &m_guideTreeBW})
+        vkCmdFillBuffer(cmdBuf, bw->buffer, 0, VK_WHOLE_SIZE, 0);
+    submitTempCmdBuffer(cmdBuf);
+
+    if (!m_pcRay.guiding)
+        return;
+
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantGuide)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges    = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_guidePipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_guidePipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/guiding.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_guidePipeline);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+
+    printf("Path guiding: %u^3 cells of %d-node quadtrees, %.1f MB\n", res, (int)eGuideNodes,
+           m_guideCells * (eGuideLeaves * sizeof(uint32_t) + eGuideNodes * sizeof(float)) / 1048576.0);
+    // To destroy: destroyPathGuiding();
+}
+
+void VkApp::destroyPathGuiding()
+{
+    m_guideGridBW.destroy(m_device);
+    m_guideAccumBW.destroy(m_device);
+    m_guideTreeBW.destroy(m_device);
+    m_guideStatsBW.destroy(m_device);
+    vkDestroyPipelineLayout(m_device, m_guidePipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_guidePipeline, nullptr);
+}
+
+// The "path guiding" pass, after raytrace.
+void VkApp::trainPathGuiding(VkCommandBuffer cmdBuf)
+{
+    PushConstantGuide pc{};
+    pc.gridAddress  = getBufferDeviceAddress(m_device, m_guideGridBW.buffer);
+    pc.accumAddress = getBufferDeviceAddress(m_device, m_guideAccumBW.buffer);
+    pc.treeAddress  = getBufferDeviceAddress(m_device, m_guideTreeBW.buffer);
+    pc.statsAddress = getBufferDeviceAddress(m_device, m_guideStatsBW.buffer)
+        + m_frameIndex * 2 * sizeof(uint32_t);
+    pc.cells = m_guideCells;
+    pc.decay = m_guideDecay;
+
+    writePassTimestamp(eTimeGuiding, false);
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_guidePipeline);
+    vkCmdPushConstants(cmdBuf, m_guidePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantGuide), &pc);
+    // Must match guiding.comp's local_size_x.
+    vkCmdDispatch(cmdBuf, (pc.cells + 63) / 64, 1, 1);
+    writePassTimestamp(eTimeGuiding, true);
+
+    // The graph tracks device accesses only; the counters are read
+    // by the host once this frame's fence has signaled.
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// After this frame slot's fence: the counters its last frame copied out.
+void VkApp::readGuidingStats()
+{
+    if (!m_pcRay.guiding || !m_frames[m_frameIndex].passTimed[eTimeGuiding])
+        return;
+    const uint32_t* stats = (const uint32_t*)m_guideStatsBW.mapped + 2 * m_frameIndex;
+    m_guidedSamples   += stats[0];
+    m_trainingSamples += stats[1];
+    m_guideFrames++;
+}
+
+void VkApp::reportGuiding()
+{
+    if (m_guideFrames == 0)
+        return;
+    printf("Path guiding: %.0f guided directions, %.0f training samples per frame\n",
+           m_guidedSamples / m_guideFrames, m_trainingSamples / m_guideFrames);
+    m_guidedSamples = m_trainingSamples = 0;
+    m_guideFrames = 0;
+}
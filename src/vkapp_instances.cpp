@@ -0,0 +1,66 @@
+
+#include <algorithm>
+
+#include "vkapp.h"
+#include "app.h"
+
+// Per-frame instance selection.  createRtAccelerationStructure builds
+// the TLAS once, with every instance at full detail; each frame
+// selectInstances hands the builder this frame's instances, and
+// leaves each instance's level in m_instanceLods for rasterize:
+//
+// - Instances whose bounding sphere lies wholly beyond -c's radius
+//   from the eye are left out.
+// - Each instance gets the coarsest of its object's LODs whose error,
+//   projected from the sphere's nearest point, is within -l pixels.
+// - Its mask puts it in a visibility class (RayMasks): with -L,
+//   objects made only of emitters are hit by bounce rays, and so
+//   still light the scene, but camera rays pass through them.
+//
+// The builder keeps the last frame's list, so an unchanged list costs
+// no TLAS work, moved instances are refit, and anything else (an LOD
+// switch, or an instance culled or back) rebuilds it.
+
+void VkApp::selectInstances()
+{
+    glm::vec3 eye = glm::vec3(m_frameMatrices.viewInverse[3]);
+    // Pixels covered by a unit length, at unit distance
+    float pixelsPerUnit = windowSize.height / (2.0f * app->myCamera.ry);
+
+    m_selected.clear();
+    m_instanceLods.assign(m_objInst.size(), culledLod);
+    m_culledInstances = 0;
+    for (size_t i = 0;  i < m_objInst.size();  i++) {
+        const ObjInst& inst = m_objInst[i];
+        const ObjData& obj = m_objData[inst.objIndex];
+        glm::vec3 center = glm::vec3(inst.transform * glm::vec4(0.5f * (obj.boundsMin + obj.boundsMax), 1.0f));
+        float scale = std::max(glm::length(glm::vec3(inst.transform[0])),
+                               std::max(glm::length(glm::vec3(inst.transform[1])),
+                                        glm::length(glm::vec3(inst.transform[2]))));
+        float radius = 0.5f * scale * glm::length(obj.boundsMax - obj.boundsMin);
+        float distance = std::max(0.0f, glm::length(center - eye) - radius);
+        if (app->m_cullRadius > 0.0f && distance > app->m_cullRadius) {
+            m_culledInstances++;
+            continue; }
+
+        // An error e projects to e*scale*pixelsPerUnit/distance pixels.
+        // LOD errors grow with the level.
+        float allowed = app->m_lodPixelError * distance / (scale * pixelsPerUnit);
+        size_t level = 0;
+        while (level + 1 < obj.lods.size() && obj.lods[level + 1].error <= allowed)
+            level++;
+        const ObjLod& lod = obj.lods[level];
+        m_instanceLods[i] = static_cast<uint32_t>(level);
+
+        VkAccelerationStructureInstanceKHR instance{};
+        instance.transform = toTransformMatrixKHR(inst.transform);
+        instance.instanceCustomIndex = lod.descIndex;  // Its ObjDesc, for the hit's attributes
+        instance.accelerationStructureReference = lod.blasAddress;
+        instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+        instance.mask  = app->m_hideLights && obj.emitterOnly ? eInstanceNoCamera : eInstanceAll;
+        instance.instanceShaderBindingTableRecordOffset = 0;
+        m_selected.push_back(instance); }
+
+    if (useRaytracer)
+        m_rtBuilder.setInstances(m_selected);
+}
@@ -0,0 +1,27 @@
+
+#include <chrono>
+
+#include "vkapp.h"
+#include "light_tree.h"
+
+// Next event estimation's emitters: lightList (gathered by
+// myloadModel) and its light tree, for raytrace.rgen.  With no
+// emitters, both buffers hold one unused entry, and pcRay.lightCount
+// is 0.
+void VkApp::createLightTree()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<LightNode> nodes = buildLightTree(lightList);
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+    printf("Light tree: %zd emitters, %zd nodes; %.1f ms\n", lightList.size(), nodes.size(), ms);
+
+    m_pcRay.lightCount = static_cast<int>(lightList.size());
+    std::vector<Emitter> emitters = lightList;
+    if (emitters.empty()) {
+        emitters.push_back({});
+        nodes.push_back({}); }
+
+    m_lightBuff   = createStagedBufferWrap(emitters, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    m_lightTreeBW = createStagedBufferWrap(nodes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+}
@@ -0,0 +1,171 @@
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "vkapp.h"
+#include "app.h"
+#include "model_data.h"
+
+// Levels of detail for static models.  myloadModel hands each mesh to
+// startLods, which simplifies it (mesh_simplify.h) on m_lodPool while
+// the rest of the scene loads; finishLods waits, then uploads each
+// object's coarser levels into one more index buffer, and a material
+// index buffer, sharing the object's vertex buffer.  Each level gets
+// an ObjDesc here, and a BLAS in createRtAccelerationStructure;
+// selectInstances picks an instance's level for both renderers.
+//
+// A big mesh takes a while to simplify, so the chains are cached on
+// disk beside the AS cache (off with -n), keyed by the mesh's
+// contents.
+
+static const uint32_t lodCacheMagic   = 0x53444f4c;  // "LODS"
+static const uint32_t lodCacheVersion = 1;           // Bump when the simplifier changes
+
+static std::string lodCachePath(const LodTask& task)
+{
+    uint64_t key = hashBytes(&lodCacheVersion, sizeof(lodCacheVersion));
+    key = hashBytes(task.vertices.data(), task.vertices.size() * sizeof(Vertex), key);
+    key = hashBytes(task.indices.data(), task.indices.size() * sizeof(uint32_t), key);
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+    return std::string("as_cache/") + name + ".lods";
+}
+
+// The file: magic, version, level count, then per level its error,
+// triangle count, indices and source triangles.
+static bool readLods(const std::string& path, LodTask& task)
+{
+    std::ifstream file(path, std::ios::binary);
+    uint32_t header[3];
+    if (!file.read((char*)header, sizeof(header))
+        || header[0] != lodCacheMagic || header[1] != lodCacheVersion)
+        return false;
+    std::vector<MeshLod> lods(header[2]);
+    for (MeshLod& lod : lods) {
+        uint32_t triangles;
+        if (!file.read((char*)&lod.error, sizeof(lod.error)) || !file.read((char*)&triangles, sizeof(triangles))
+            || 3 * (size_t)triangles > task.indices.size())
+            return false;
+        lod.indices.resize(3 * triangles);
+        lod.sourceTriangles.resize(triangles);
+        if (!file.read((char*)lod.indices.data(), lod.indices.size() * sizeof(uint32_t))
+            || !file.read((char*)lod.sourceTriangles.data(), lod.sourceTriangles.size() * sizeof(uint32_t)))
+            return false;
+        for (uint32_t i : lod.indices)
+            if (i >= task.vertices.size())
+                return false;
+        for (uint32_t t : lod.sourceTriangles)
+            if (t >= task.matIndx.size())
+                return false; }
+    task.lods = std::move(lods);
+    return true;
+}
+
+static void writeLods(const std::string& path, const LodTask& task)
+{
+    std::ofstream file(path, std::ios::binary);
+    uint32_t header[3] = {lodCacheMagic, lodCacheVersion, (uint32_t)task.lods.size()};
+    file.write((const char*)header, sizeof(header));
+    for (const MeshLod& lod : task.lods) {
+        uint32_t triangles = (uint32_t)lod.sourceTriangles.size();
+        file.write((const char*)&lod.error, sizeof(lod.error));
+        file.write((const char*)&triangles, sizeof(triangles));
+        file.write((const char*)lod.indices.data(), lod.indices.size() * sizeof(uint32_t));
+        file.write((const char*)lod.sourceTriangles.data(), lod.sourceTriangles.size() * sizeof(uint32_t)); }
+    if (!file)
+        printf("LOD cache: can't write %s\n", path.c_str());
+}
+
+void VkApp::startLods(uint32_t objIndex, const ModelData& meshdata, const std::vector<uint32_t>& emitterOf)
+{
+    if (!m_lodPool)
+        m_lodPool = std::make_unique<ThreadPool>();
+
+    m_lodTasks.push_back(std::make_unique<LodTask>());
+    LodTask* task = m_lodTasks.back().get();
+    task->objIndex = objIndex;
+    task->vertices = meshdata.vertices;
+    task->indices  = meshdata.indicies;
+    task->matIndx  = meshdata.matIndx;
+    task->emitterOf = emitterOf;
+    bool useCache  = app->m_asCache;
+    m_lodPool->run(m_lodGroup, [task, useCache]() {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::string path = lodCachePath(*task);
+        task->cached = useCache && readLods(path, *task);
+        if (!task->cached) {
+            task->lods = buildLodChain(task->vertices, task->indices);
+            if (useCache) {
+                std::error_code error;
+                fs::create_directories("as_cache", error);
+                if (!error)
+                    writeLods(path, *task); } }
+        task->buildMs = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - start).count(); });
+}
+
+void VkApp::finishLods()
+{
+    if (!m_lodPool)
+        return;
+    m_lodPool->wait(m_lodGroup);
+    m_lodPool.reset();
+
+    VkBufferUsageFlags flag = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+        | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    VkBufferUsageFlags rtFlags = flag
+        | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+
+    for (const std::unique_ptr<LodTask>& task : m_lodTasks) {
+        ObjData& object = m_objData[task->objIndex];
+        printf("LODs of object %u: %u", task->objIndex, object.nbIndices / 3);
+        for (const MeshLod& level : task->lods)
+            printf(", %zd (%g)", level.sourceTriangles.size(), level.error);
+        printf(" triangles; %.1f ms%s\n", task->buildMs, task->cached ? ", cached" : "");
+        if (task->lods.empty())
+            continue;
+
+        std::vector<uint32_t> lodIndices;
+        std::vector<int32_t>  lodMatIndx;
+        std::vector<uint32_t> lodEmitterOf;
+        std::vector<ObjLod>   lods;
+        for (const MeshLod& level : task->lods) {
+            ObjLod lod;
+            lod.firstIndex  = static_cast<uint32_t>(lodIndices.size());
+            lod.indexCount  = static_cast<uint32_t>(level.indices.size());
+            lod.error       = level.error;
+            lod.contentHash = hashBytes(level.indices.data(), level.indices.size() * sizeof(uint32_t));
+            lodIndices.insert(lodIndices.end(), level.indices.begin(), level.indices.end());
+            for (uint32_t t : level.sourceTriangles) {
+                lodMatIndx.push_back(task->matIndx[t]);
+                if (!task->emitterOf.empty())
+                    lodEmitterOf.push_back(task->emitterOf[t]); }
+            lods.push_back(lod); }
+
+        object.lodIndexBuffer    = createStagedBufferWrap(lodIndices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rtFlags);
+        object.lodMatIndexBuffer = createStagedBufferWrap(lodMatIndx, flag);
+        VkDeviceAddress indexAddress    = getBufferDeviceAddress(m_device, object.lodIndexBuffer.buffer);
+        VkDeviceAddress matIndexAddress = getBufferDeviceAddress(m_device, object.lodMatIndexBuffer.buffer);
+        VkDeviceAddress emitterAddress  = 0;
+        if (!lodEmitterOf.empty()) {
+            object.lodEmitterBuffer = createStagedBufferWrap(lodEmitterOf, flag);
+            emitterAddress = getBufferDeviceAddress(m_device, object.lodEmitterBuffer.buffer); }
+
+        // Each level's ObjDesc is the object's, but for its triangles.
+        for (ObjLod& lod : lods) {
+            ObjDesc desc = m_objDesc[task->objIndex];
+            desc.indexAddress         = indexAddress + lod.firstIndex * sizeof(uint32_t);
+            desc.materialIndexAddress = matIndexAddress + lod.firstIndex / 3 * sizeof(int32_t);
+            desc.primRemapAddress     = 0;
+            // A level's emitting triangles have moved a little from the
+            // emitters sampled, but are still found by them.
+            desc.emitterAddress       = emitterAddress ? emitterAddress + lod.firstIndex / 3 * sizeof(uint32_t) : 0;
+            lod.descIndex = static_cast<uint32_t>(m_objDesc.size());
+            m_objDesc.push_back(desc);
+            object.lods.push_back(lod); } }
+
+    m_lodTasks.clear();
+}
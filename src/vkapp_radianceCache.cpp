@@ -0,0 +1,85 @@
+
+#include "vkapp.h"
+#include "app.h"
+
+// The radiance cache (-g size, -G to show it); see radianceCache.glsl.
+// raytrace adds its training paths' samples to the cells' accumulators
+// and ends the other paths in the cells; the "radiance cache" pass
+// (radianceCache.comp) then resolves the accumulators into the cells.
+// Its memory is fixed: cacheCapacity slots, with cells freed after
+// m_cacheMaxAge frames unused.
+
+static const uint32_t cacheCapacity = 1u << 20;
+
+void VkApp::createRadianceCache()
+{
+    m_pcRay.cache = eCacheOff;
+    if (app->m_cacheCellSize > 0.0f || app->m_showCache) {
+        m_pcRay.cache = app->m_showCache ? eCacheShow : eCacheOn;
+        m_pcRay.cacheCellSize = app->m_cacheCellSize > 0.0f ? app->m_cacheCellSize : 0.05f; }
+
+    // One slot when off: the descriptors need buffers.
+    m_pcRay.cacheCapacity = m_pcRay.cache != eCacheOff ? cacheCapacity : 1;
+    VkDeviceSize slots = m_pcRay.cacheCapacity;
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+        | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    m_cacheKeyBW   = createBufferWrap(slots * sizeof(uint32_t), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_cacheAccumBW = createBufferWrap(slots * sizeof(uvec4), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_cacheCellBW  = createBufferWrap(slots * sizeof(CacheCell), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    NAME(m_cacheKeyBW.buffer, VK_OBJECT_TYPE_BUFFER, "Radiance cache keys");
+    NAME(m_cacheAccumBW.buffer, VK_OBJECT_TYPE_BUFFER, "Radiance cache accumulators");
+    NAME(m_cacheCellBW.buffer, VK_OBJECT_TYPE_BUFFER, "Radiance cache cells");
+
+    // Every slot free.
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    for (BufferWrap* bw : {&m_cacheKeyBW, &m_cacheAccumBW, &m_cacheCellBW})
+        vkCmdFillBuffer(cmdBuf, bw->buffer, 0, VK_WHOLE_SIZE, 0);
+    submitTempCmdBuffer(cmdBuf);
+
+    if (m_pcRay.cache == eCacheOff)
+        return;
+
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantCache)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges    = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_cachePipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_cachePipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/radianceCache.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_cachePipeline);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+
+    printf("Radiance cache: %u slots, %.1f MB, cells from %g\n", cacheCapacity,
+           slots * (sizeof(uint32_t) + sizeof(uvec4) + sizeof(CacheCell)) / 1048576.0,
+           m_pcRay.cacheCellSize);
+    // To destroy: destroyRadianceCache();
+}
+
+void VkApp::destroyRadianceCache()
+{
+    m_cacheKeyBW.destroy(m_device);
+    m_cacheAccumBW.destroy(m_device);
+    m_cacheCellBW.destroy(m_device);
+    vkDestroyPipelineLayout(m_device, m_cachePipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_cachePipeline, nullptr);
+}
+
+// The "radiance cache" pass, after raytrace.
+void VkApp::resolveRadianceCache(VkCommandBuffer cmdBuf)
+{
+    PushConstantCache pc{};
+    pc.keyAddress   = getBufferDeviceAddress(m_device, m_cacheKeyBW.buffer);
+    pc.accumAddress = getBufferDeviceAddress(m_device, m_cacheAccumBW.buffer);
+    pc.cellAddress  = getBufferDeviceAddress(m_device, m_cacheCellBW.buffer);
+    pc.capacity     = m_pcRay.cacheCapacity;
+    pc.maxAge       = m_cacheMaxAge;
+    pc.maxSamples   = m_cacheMaxSamples;
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_cachePipeline);
+    vkCmdPushConstants(cmdBuf, m_cachePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantCache), &pc);
+    // Must match radianceCache.comp's local_size_x.
+    vkCmdDispatch(cmdBuf, (pc.capacity + 127) / 128, 1, 1);
+}
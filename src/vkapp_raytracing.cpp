@@ -33,25 +33,31 @@ void VkApp::createRtBuffers()
         1);
 
     m_rtNdCurrBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtColPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+    transitionImageLayout(m_rtNdCurrBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL,
         1);
 
     m_rtNdPrevBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtColPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+    transitionImageLayout(m_rtNdPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL,
         1);
 
     m_rtKdCurrBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtColPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+    transitionImageLayout(m_rtKdCurrBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL,
         1);
 
     m_rtKdPrevBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtColPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+    transitionImageLayout(m_rtKdPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_GENERAL,
+        1);
+
+    m_rtSampleBuffer = createBufferImage(windowSize);
+    transitionImageLayout(m_rtSampleBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL,
         1);
@@ -99,6 +105,38 @@ void VkApp::createRtDescriptorSet()
 			{5, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
              VK_SHADER_STAGE_RAYGEN_BIT_KHR},
             {6, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eEnvMap, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eEnvLow, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eEnvAlias, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eLights, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eLightTree, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eDIReservoirs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eDIFinal, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eGIReservoirs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eGIFinal, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eCacheKeys, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eCacheAccum, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eCacheCells, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eGuideGrid, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eGuideAccum, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eGuideTree, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {eSampleImage, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
              VK_SHADER_STAGE_RAYGEN_BIT_KHR}
         });
     
@@ -112,14 +150,37 @@ void VkApp::createRtDescriptorSet()
     m_rtDesc.write(m_device, 4, m_rtNdPrevBuffer.Descriptor());
     m_rtDesc.write(m_device, 5, m_rtKdCurrBuffer.Descriptor());
     m_rtDesc.write(m_device, 6, m_rtKdPrevBuffer.Descriptor());
+    m_rtDesc.write(m_device, eEnvMap, m_envImage.Descriptor());
+    m_rtDesc.write(m_device, eEnvLow, m_envLowImage.Descriptor());
+    m_rtDesc.write(m_device, eEnvAlias, m_envAliasBW.buffer);
+    m_rtDesc.write(m_device, eLights, m_lightBuff.buffer);
+    m_rtDesc.write(m_device, eLightTree, m_lightTreeBW.buffer);
+    m_rtDesc.write(m_device, eDIReservoirs, m_diReservoirBW.buffer);
+    m_rtDesc.write(m_device, eDIFinal, m_diFinalBW.buffer);
+    m_rtDesc.write(m_device, eGIReservoirs, m_giReservoirBW.buffer);
+    m_rtDesc.write(m_device, eGIFinal, m_giFinalBW.buffer);
+    m_rtDesc.write(m_device, eCacheKeys, m_cacheKeyBW.buffer);
+    m_rtDesc.write(m_device, eCacheAccum, m_cacheAccumBW.buffer);
+    m_rtDesc.write(m_device, eCacheCells, m_cacheCellBW.buffer);
+    m_rtDesc.write(m_device, eGuideGrid, m_guideGridBW.buffer);
+    m_rtDesc.write(m_device, eGuideAccum, m_guideAccumBW.buffer);
+    m_rtDesc.write(m_device, eGuideTree, m_guideTreeBW.buffer);
+    m_rtDesc.write(m_device, eSampleImage, m_rtSampleBuffer.Descriptor());
 }
 
+// The ReSTIR raygen shaders, in RestirRaygen order
+static const char* restirRaygenFiles[eRestirRaygenCount] = {
+    "spv/restirDI.rgen.spv",
+    "spv/restirDISpatial.rgen.spv",
+    "spv/restirGI.rgen.spv",
+    "spv/restirGISpatial.rgen.spv"};
+
 // Pipeline for the ray tracer: all shaders, raygen, chit, miss
 //
 void VkApp::createRtPipeline()
 {
     ////////////////////////////////////////////////////////////////////////////////////////////
-    // stages: Array of shaders: 1 raygen, 1 miss, 1 hit (later: an additional hit/miss pair.)
+    // stages: Array of shaders: 1 raygen, 2 miss (path and shadow rays), 1 hit
 
     ////////////////////////////////////////////////////////////////////////////////////////////
     // Group the shaders.  Raygen and miss shaders get their own
@@ -158,6 +219,18 @@ void VkApp::createRtPipeline()
     group.generalShader = stages.size()-1;    // Index of miss shader
     groups.push_back(group);
     group.generalShader    = VK_SHADER_UNUSED_KHR;
+
+    // Shadow miss shader (miss index 1): for visibility rays, which
+    // skip closest hit shaders and stop at the first hit.
+    stage.module = createShaderModule(loadFile("spv/raytraceShadow.rmiss.spv"));
+    stage.stage = VK_SHADER_STAGE_MISS_BIT_KHR;
+    stages.push_back(stage);
+
+    group.type          = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+    group.generalShader = stages.size()-1;    // Index of shadow miss shader
+    groups.push_back(group);
+    group.generalShader    = VK_SHADER_UNUSED_KHR;
+
     // Closest hit shader stage and group appended to stages and groups lists
     stage.module = createShaderModule(loadFile("spv/raytrace.rchit.spv"));
     stage.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
@@ -166,6 +239,19 @@ void VkApp::createRtPipeline()
     group.type             = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
     group.closestHitShader = stages.size()-1;   // Index of hit shader
     groups.push_back(group);
+    group.closestHitShader = VK_SHADER_UNUSED_KHR;
+
+    // The ReSTIR passes' raygen shaders (vkapp_restir.cpp), after the
+    // hit group; each gets an SBT region of its own.
+    for (const char* file : restirRaygenFiles) {
+        stage.module = createShaderModule(loadFile(file));
+        stage.stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
+        stages.push_back(stage);
+
+        group.type          = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+        group.generalShader = stages.size()-1;
+        groups.push_back(group);
+        group.generalShader = VK_SHADER_UNUSED_KHR; }
 
     ////////////////////////////////////////////////////////////////////////////////////////////
     // Create the ray tracing pipeline layout.
@@ -222,10 +308,12 @@ constexpr integral align_up(integral x, size_t a) noexcept
 
 void VkApp::createRtShaderBindingTable()
 {
-    uint32_t missCount{1};
+    uint32_t missCount{2};  // Path rays, shadow rays
     uint32_t hitCount{1};
 
-    uint32_t handleCount = 1 + missCount + hitCount;
+    uint32_t restirCount = eRestirRaygenCount;  // Raygens after the hit group
+
+    uint32_t handleCount = 1 + missCount + hitCount + restirCount;
 
     // The SBT (buffer) needs to have starting group to be aligned
     // and handles in the group to be aligned.
@@ -262,13 +350,11 @@ void VkApp::createRtShaderBindingTable()
                                                        0, handleCount, dataSize, handles.data());
     assert(result == VK_SUCCESS);
 
-    // Allocate a buffer for storing the SBT, and a staging buffer for transferring data to it.
+    // Allocate a buffer for storing the SBT, and staging ring space for transferring data to it.
     VkDeviceSize sbtSize = m_rgenRegion.size + m_missRegion.size
-        + m_hitRegion.size + m_callRegion.size;
+        + m_hitRegion.size + m_callRegion.size + restirCount * m_rgenRegion.size;
     
-    BufferWrap staging = createBufferWrap(sbtSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    StagingRegion staging = m_staging.alloc(sbtSize);
     m_shaderBindingTableBW = createBufferWrap(sbtSize,
                                   VK_BUFFER_USAGE_TRANSFER_DST_BIT
                                   | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
@@ -283,14 +369,17 @@ void VkApp::createRtShaderBindingTable()
     m_rgenRegion.deviceAddress = sbtAddress;
     m_missRegion.deviceAddress = sbtAddress + m_rgenRegion.size;
     m_hitRegion.deviceAddress  = sbtAddress + m_rgenRegion.size + m_missRegion.size;
+    VkDeviceSize restirOffset = m_rgenRegion.size + m_missRegion.size + m_hitRegion.size;
+    for (uint32_t r = 0; r < restirCount; r++) {
+        m_restirRegion[r] = m_rgenRegion;
+        m_restirRegion[r].deviceAddress = sbtAddress + restirOffset + r * m_rgenRegion.size; }
 
     // Helper to retrieve the handle data
     auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
 
-    // Map the SBT buffer and write in the handles.
-    uint8_t* mappedMemAddress;
-    vkMapMemory(m_device, staging.memory, 0, sbtSize, 0, (void**)&mappedMemAddress);
-    uint8_t offset = 0;
+    // Write the handles into the staging ring.
+    uint8_t* mappedMemAddress = static_cast<uint8_t*>(staging.mapped);
+    VkDeviceSize offset = 0;
 
     // Raygen
     uint32_t handleIdx{0};
@@ -308,11 +397,14 @@ void VkApp::createRtShaderBindingTable()
         memcpy(mappedMemAddress+offset, getHandle(handleIdx++), handleSize);
         offset += m_hitRegion.stride; }
 
-    vkUnmapMemory(m_device, staging.memory);
+    // ReSTIR raygens
+    for(uint32_t c = 0; c < restirCount; c++)
+        memcpy(mappedMemAddress + restirOffset + c * m_rgenRegion.size, getHandle(handleIdx++), handleSize);
     
-    copyBuffer(staging.buffer, m_shaderBindingTableBW.buffer, sbtSize);
-
-    staging.destroy(m_device);
+    VkBufferCopy copyRegion{staging.offset, 0, sbtSize};
+    vkCmdCopyBuffer(m_staging.cmd(), staging.buffer, m_shaderBindingTableBW.buffer,
+                    1, &copyRegion);
+    m_staging.releaseBuffer(m_shaderBindingTableBW.buffer);
 
     // @@[DONE] destroy acceleration structure with m_shaderBindingTableBW.destroy(m_device);
 }
@@ -328,37 +420,21 @@ void VkApp::CmdCopyImage(ImageWrap& src, ImageWrap& dst)
     imageCopyRegion.extent.height             = windowSize.height;
     imageCopyRegion.extent.depth              = 1;
 
-    imageLayoutBarrier(m_commandBuffer, src.image,
-                       VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-    imageLayoutBarrier(m_commandBuffer, dst.image,
-                       VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    
+    // Both images stay in GENERAL, which copies may use; the render
+    // graph has put any barriers needed in front of the pass.
     vkCmdCopyImage(m_commandBuffer,
-                   src.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                   dst.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   src.image, VK_IMAGE_LAYOUT_GENERAL,
+                   dst.image, VK_IMAGE_LAYOUT_GENERAL,
                    1, &imageCopyRegion);
-    
-    imageLayoutBarrier(m_commandBuffer, src.image,
-                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-    imageLayoutBarrier(m_commandBuffer, dst.image,
-                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-
 }
 
-void VkApp::raytrace()
+// Once per frame, before the ray tracing passes (the ReSTIR passes,
+// then raytrace), which all push the same constants.
+void VkApp::updateRtConstants()
 {
-    float rr = 0.7;
-    int depth = 1;
-    while (float(rand())/RAND_MAX < rr)
-        depth++;
-    depth = std::min(depth, 4);
-    
     // The push constants for the ray tracing pipeline.
     // These are temporary -- used only for ray casting step.
     m_pcRay.alignmentTest = 1234;
-    m_pcRay.tempLightPos = vec4(0.5f, 2.5f, 3.0f, 0.0);
-    m_pcRay.tempLightInt = vec4(2.5, 2.5, 2.5, 0.0);
-    m_pcRay.tempAmbient = vec4(0.2f);
 
     m_pcRay.frameSeed = rand() % 32768;
     m_pcRay.rr = 0.7f;
@@ -366,19 +442,51 @@ void VkApp::raytrace()
     while (float(rand()) / RAND_MAX < m_pcRay.rr)
         m_pcRay.depth++;
 
+    m_pcRay.tracePhase = frameCount & 3;
+
+    // This frame's part of the images (dynamic resolution); the
+    // history holds the last one's.
+    m_priorRenderSize = m_renderSize;
+    m_renderSize.width  = std::max(1u, uint32_t(windowSize.width * m_renderScale + 0.5f));
+    m_renderSize.height = std::max(1u, uint32_t(windowSize.height * m_renderScale + 0.5f));
+    m_frames[m_frameIndex].renderScale = m_renderScale;
+    m_pcRay.renderWidth  = m_renderSize.width;
+    m_pcRay.renderHeight = m_renderSize.height;
+    m_pcRay.priorWidth   = m_priorRenderSize.width;
+    m_pcRay.priorHeight  = m_priorRenderSize.height;
+
+    // The G-buffer capture's second frame (see vkapp_capture.cpp).
+    m_pcRay.captureSample = m_captureStage == 1;
+
     m_pcRay.clear = app->myCamera.modified;
     app->myCamera.modified = false;
+}
+
+void VkApp::raytrace()
+{
+    // This dispatches the ray generation shader for each pixel on screen.
+    writePassTimestamp(eTimeRaytrace, false);
+    traceRays(m_rgenRegion, traceExtent());
+    writePassTimestamp(eTimeRaytrace, true);
+    frameCount++;
+}
 
+// Binds the ray tracing pipeline, its descriptor sets and push
+// constants, and traces with rgenRegion's raygen shader, launch's
+// width x height invocations (one per pixel, but see traceExtent).
+void VkApp::traceRays(const VkStridedDeviceAddressRegionKHR& rgenRegion, VkExtent2D launch)
+{
     // Bind the ray tracing pipeline
     vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipeline);
 
     // Bind the descriptor sets (the ray tracing specific one, and the
     // full model descriptor)
     std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet};
+    uint32_t matrixOffset = m_frameIndex * m_matrixSlice;  // m_scDesc's dynamic UBO
     vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
                             m_rtPipelineLayout, 0,
                             descSets.size(), descSets.data(),
-                            0, nullptr);
+                            1, &matrixOffset);
 
     // Push the push constants
     vkCmdPushConstants(m_commandBuffer, m_rtPipelineLayout,
@@ -387,12 +495,13 @@ void VkApp::raytrace()
                        | VK_SHADER_STAGE_MISS_BIT_KHR,
                        0, sizeof(PushConstantRay), &m_pcRay);
 
-    // This dispatches the ray generation shader for each pixel on screen.
-    vkCmdTraceRaysKHR(m_commandBuffer, &m_rgenRegion, &m_missRegion, &m_hitRegion,
-                      &m_callRegion, windowSize.width, windowSize.height, 1);
-    frameCount++;
+    vkCmdTraceRaysKHR(m_commandBuffer, &rgenRegion, &m_missRegion, &m_hitRegion,
+                      &m_callRegion, launch.width, launch.height, 1);
+}
 
-    
+// A render graph pass of its own, after raytrace().
+void VkApp::copyRtHistory()
+{
     // Copy the ray tracer output image to the scanline output image
     // -- because we already have the operations needed to display
     // that image on the screen.
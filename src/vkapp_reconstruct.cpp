@@ -0,0 +1,87 @@
+
+#include "vkapp.h"
+#include "app.h"
+
+// Reduced tracing (-R half, -R checker; see LaunchPixel in
+// raytrace.glsl).  raytrace traces the paths of a quarter or half of
+// the pixels each frame, in turn, and only the primary hits of the
+// rest, which keep their reprojected history in the usual history
+// images.  The "reconstruct" pass (reconstruct.comp) then fills those
+// without any history from their traced neighbors, guided by the
+// G-buffer (kdCurr, ndCurr), before the history copy and denoising.
+
+#define GROUP_SIZE 128
+
+void VkApp::createReconstruct()
+{
+    m_pcRay.traceMode = app->m_traceMode;
+    if (m_pcRay.traceMode == eTraceFull)
+        return;
+
+    m_reconstructDesc.setBindings(m_device, {
+            {0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            {2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
+        });
+    m_reconstructDesc.write(m_device, 0, m_rtColCurrBuffer.Descriptor());
+    m_reconstructDesc.write(m_device, 1, m_rtKdCurrBuffer.Descriptor());
+    m_reconstructDesc.write(m_device, 2, m_rtNdCurrBuffer.Descriptor());
+
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantReconstruct)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.setLayoutCount         = 1;
+    plCreateInfo.pSetLayouts            = &m_reconstructDesc.descSetLayout;
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges    = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_reconstructPipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_reconstructPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/reconstruct.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_reconstructPipeline);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+
+    printf("Reduced tracing: %s\n", m_pcRay.traceMode == eTraceHalf
+           ? "one pixel of each 2x2 block per frame" : "a checkerboard per frame");
+    // To destroy: destroyReconstruct();
+}
+
+void VkApp::destroyReconstruct()
+{
+    if (m_pcRay.traceMode == eTraceFull)
+        return;
+    m_reconstructDesc.destroy(m_device);
+    vkDestroyPipelineLayout(m_device, m_reconstructPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_reconstructPipeline, nullptr);
+}
+
+// raytrace's launch: the render size, rounded up to even sizes when
+// reduced, as LaunchPixel packs it.
+VkExtent2D VkApp::traceExtent()
+{
+    VkExtent2D launch = m_renderSize;
+    if (m_pcRay.traceMode != eTraceFull) {
+        launch.width  = (launch.width + 1) & ~1u;
+        launch.height = (launch.height + 1) & ~1u; }
+    return launch;
+}
+
+// The "reconstruct" pass, after raytrace.
+void VkApp::reconstruct()
+{
+    PushConstantReconstruct pc{};
+    pc.traceMode  = m_pcRay.traceMode;
+    pc.tracePhase = m_pcRay.tracePhase;
+    pc.width      = m_renderSize.width;
+    pc.height     = m_renderSize.height;
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_reconstructPipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_reconstructPipelineLayout, 0, 1,
+                            &m_reconstructDesc.descSet, 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_reconstructPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantReconstruct), &pc);
+    // Must match reconstruct.comp's local_size_x.
+    vkCmdDispatch(m_commandBuffer, (m_renderSize.width + GROUP_SIZE-1) / GROUP_SIZE,
+                  m_renderSize.height, 1);
+}
@@ -0,0 +1,44 @@
+
+#include "vkapp.h"
+#include "app.h"
+
+// ReSTIR (-r di, -r gi): reservoir resampling of samples across
+// candidates, frames and neighbouring pixels; see restir.glsl.
+//
+// DI, each frame, before raytrace (the render graph orders them):
+//   restirDI.rgen         primary hits' candidates, visibility, and
+//                         temporal reuse of diFinal -> diReservoirs
+//   restirDISpatial.rgen  spatial reuse of diReservoirs -> diFinal
+// then raytrace.rgen shades the primary hit with diFinal's sample
+// instead of sampling the light tree there.  Needs emitters.
+//
+// GI likewise, with restirGI.rgen and restirGISpatial.rgen: a sample
+// is the point a bounce from the primary hit reached, and the radiance
+// path traced from there.  raytrace.rgen then ends its paths at the
+// primary hit, with giFinal's sample standing for the rest.
+
+void VkApp::createRestir()
+{
+    m_pcRay.restir = app->m_restir;
+    if (m_pcRay.lightCount == 0)
+        m_pcRay.restir &= ~eRestirDI;
+
+    // Sized for the window either way: the descriptors need buffers.
+    VkDeviceSize pixels = VkDeviceSize(windowSize.width) * windowSize.height;
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    m_diReservoirBW = createBufferWrap(pixels * sizeof(DIReservoir), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_diFinalBW     = createBufferWrap(pixels * sizeof(DIReservoir), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_giReservoirBW = createBufferWrap(pixels * sizeof(GIReservoir), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_giFinalBW     = createBufferWrap(pixels * sizeof(GIReservoir), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // M = 0: no history for the first frame.
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    for (BufferWrap* bw : {&m_diReservoirBW, &m_diFinalBW, &m_giReservoirBW, &m_giFinalBW})
+        vkCmdFillBuffer(cmdBuf, bw->buffer, 0, VK_WHOLE_SIZE, 0);
+    submitTempCmdBuffer(cmdBuf);
+}
+
+void VkApp::restir(RestirRaygen pass)
+{
+    traceRays(m_restirRegion[pass], m_renderSize);
+}
@@ -36,6 +36,8 @@ VkAccessFlags accessFlagsForImageLayout(VkImageLayout layout)
             return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
         case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
             return VK_ACCESS_SHADER_READ_BIT;
+        case VK_IMAGE_LAYOUT_GENERAL:
+            return VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
         default:
             return VkAccessFlags();
         }
@@ -51,11 +53,15 @@ VkPipelineStageFlags pipelineStageForLayout(VkImageLayout layout)
         case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
             return VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
         case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-            return VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;  // Allow queue other than graphic
-            // return VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+            return VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+                | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
         case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-            return VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;  // Allow queue other than graphic
-            // return VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            // Textures are read by the rasterizer, the ray tracer, and compute.
+            return VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+                | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+        case VK_IMAGE_LAYOUT_GENERAL:
+            return VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;  // Could be any use
         case VK_IMAGE_LAYOUT_PREINITIALIZED:
             return VK_PIPELINE_STAGE_HOST_BIT;
         case VK_IMAGE_LAYOUT_UNDEFINED:
@@ -109,14 +115,8 @@ ImageWrap VkApp::createTextureImage(std::string fileName)
         throw std::runtime_error("failed to load texture image!");
     }
 
-    BufferWrap staging = createBufferWrap(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    void* data;
-    vkMapMemory(m_device, staging.memory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(m_device, staging.memory);
+    StagingRegion staging = m_staging.alloc(imageSize);
+    memcpy(staging.mapped, pixels, static_cast<size_t>(imageSize));
 
     stbi_image_free(pixels);
 
@@ -129,15 +129,21 @@ ImageWrap VkApp::createTextureImage(std::string fileName)
                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                                   mipLevels);
 
-    transitionImageLayout(myImage.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-
-    copyBufferToImage(staging.buffer, myImage.image, static_cast<uint32_t>(texWidth),
-                      static_cast<uint32_t>(texHeight));
-
-    staging.destroy(m_device);
-
-    generateMipmaps(myImage.image, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
+    // The copy is recorded for the transfer queue; no submit or wait here.
+    VkCommandBuffer cmdBuf = m_staging.cmd();
+    transitionImageLayout(cmdBuf, myImage.image, VK_FORMAT_R8G8B8A8_UNORM,
+                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          mipLevels);
+
+    copyBufferToImage(cmdBuf, staging.buffer, staging.offset, myImage.image,
+                      static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+    m_staging.releaseImage(myImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+
+    // Blits need a graphics queue, so the mip chain is built after the
+    // graphics queue has acquired the image.
+    VkImage image = myImage.image;
+    m_staging.afterAcquire([this, image, texWidth, texHeight, mipLevels](VkCommandBuffer gfxCmd) {
+        generateMipmaps(gfxCmd, image, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels); });
     
     myImage.imageView = createImageView(myImage.image, VK_FORMAT_R8G8B8A8_UNORM);
     myImage.sampler = createTextureSampler();
@@ -147,6 +153,14 @@ ImageWrap VkApp::createTextureImage(std::string fileName)
 
 void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
                             int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+{
+    VkCommandBuffer commandBuffer = createTempCmdBuffer();
+    generateMipmaps(commandBuffer, image, imageFormat, texWidth, texHeight, mipLevels);
+    submitTempCmdBuffer(commandBuffer);
+}
+
+void VkApp::generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat,
+                            int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
 {
     // Check if image format supports linear blitting
     VkFormatProperties formatProperties;
@@ -156,8 +170,6 @@ void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
         throw std::runtime_error("texture image format does not support linear blitting!");
     }
 
-    VkCommandBuffer commandBuffer = createTempCmdBuffer();
-
     VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
     barrier.image = image;
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -229,36 +241,21 @@ void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
                          0, nullptr,
                          0, nullptr,
                          1, &barrier);
-
-    submitTempCmdBuffer(commandBuffer);
 }
 
-BufferWrap VkApp::createStagedBufferWrap(const VkCommandBuffer& cmdBuf,
-                                         const VkDeviceSize&    size,
+BufferWrap VkApp::createStagedBufferWrap(const VkDeviceSize&    size,
                                          const void*            data,
                                          VkBufferUsageFlags     usage)
 {
-    BufferWrap staging = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    void* dest;
-    vkMapMemory(m_device, staging.memory, 0, size, 0, &dest);
-    memcpy(dest, data, size);
-    vkUnmapMemory(m_device, staging.memory);
-
-    
     BufferWrap bw = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    copyBuffer(staging.buffer, bw.buffer, size);
-
-    staging.destroy(m_device);
+    m_staging.uploadBuffer(bw.buffer, 0, size, data);
     
     return bw;
 }
 
 BufferWrap VkApp::createBufferWrap(VkDeviceSize size, VkBufferUsageFlags usage,
-                                      VkMemoryPropertyFlags properties)
+                                   VkMemoryPropertyFlags properties, bool transient)
 {
     BufferWrap result;
     
@@ -272,19 +269,19 @@ BufferWrap VkApp::createBufferWrap(VkDeviceSize size, VkBufferUsageFlags usage,
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(m_device, result.buffer, &memRequirements);
 
-    VkMemoryAllocateFlagsInfo memFlags = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, nullptr,
-        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
-
-    VkMemoryAllocateInfo allocInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-    allocInfo.pNext = &memFlags;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &result.memory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate buffer memory!");
-    }
+    // The allocator's buffer pools allocate with
+    // VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, and map host visible memory.
+    uint32_t memoryType = findMemoryType(memRequirements.memoryTypeBits, properties);
+    result.allocation = m_allocator.allocate(memRequirements, memoryType,
+                                             MemoryAllocator::eBuffer,
+                                             transient ? MemoryAllocator::eLinear
+                                                       : MemoryAllocator::eBuddy);
+    result.allocator = &m_allocator;
+    result.memory = result.allocation.memory;
+    result.offset = result.allocation.offset;
+    result.mapped = result.allocation.mapped;
         
-    vkBindBufferMemory(m_device, result.buffer, result.memory, 0);
+    vkBindBufferMemory(m_device, result.buffer, result.memory, result.offset);
 
     return result;
 }
@@ -304,9 +301,16 @@ void VkApp::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size
 void VkApp::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
 {
     VkCommandBuffer commandBuffer = createTempCmdBuffer();
+    copyBufferToImage(commandBuffer, buffer, 0, image, width, height);
+    submitTempCmdBuffer(commandBuffer);
+}
 
+void VkApp::copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer,
+                              VkDeviceSize bufferOffset, VkImage image,
+                              uint32_t width, uint32_t height)
+{
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = bufferOffset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -317,8 +321,6 @@ void VkApp::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, ui
     region.imageExtent = {width, height, 1};
 
     vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-    
-    submitTempCmdBuffer(commandBuffer);
 }
 
 void VkApp::transitionImageLayout(VkImage image,
@@ -328,7 +330,17 @@ void VkApp::transitionImageLayout(VkImage image,
                                         uint32_t mipLevels)
 {
     VkCommandBuffer commandBuffer = createTempCmdBuffer();
+    transitionImageLayout(commandBuffer, image, format, oldLayout, newLayout, mipLevels);
+    submitTempCmdBuffer(commandBuffer);
+}
 
+void VkApp::transitionImageLayout(VkCommandBuffer commandBuffer,
+                                  VkImage image,
+                                  VkFormat format,
+                                  VkImageLayout oldLayout,
+                                  VkImageLayout newLayout,
+                                  uint32_t mipLevels)
+{
     VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
     barrier.oldLayout = oldLayout;
     barrier.newLayout = newLayout;
@@ -348,8 +360,6 @@ void VkApp::transitionImageLayout(VkImage image,
 
     vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0,
                          0, nullptr,    0, nullptr,    1, &barrier);
-    
-    submitTempCmdBuffer(commandBuffer);
 }
 
 VkSampler VkApp::createTextureSampler()
@@ -400,7 +410,7 @@ void VkApp::createScBuffer()
     // @@ Destroy with m_scImageBuffer.destroy(m_device);
 }
 
-ImageWrap VkApp::createBufferImage(VkExtent2D& size)
+ImageWrap VkApp::createBufferImage(VkExtent2D& size, uint32_t sharedFamily)
 {
     //uint mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
     uint mipLevels = 1;
@@ -412,7 +422,7 @@ ImageWrap VkApp::createBufferImage(VkExtent2D& size)
                                   | VK_IMAGE_USAGE_STORAGE_BIT
                                   | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                  mipLevels);
+                                  mipLevels, sharedFamily);
 
     myImage.imageView = createImageView(myImage.image, VK_FORMAT_R32G32B32A32_SFLOAT);
     myImage.sampler = createTextureSampler();
@@ -502,7 +512,7 @@ void VkApp::createScDescriptorSet()
     auto nbTxt = static_cast<uint32_t>(m_objText.size());
 
     m_scDesc.setBindings(m_device, {
-            {ScBindings::eMatrices, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
+            {ScBindings::eMatrices, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1,
                 VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
             {ScBindings::eObjDescs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
                 VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
@@ -511,7 +521,8 @@ void VkApp::createScDescriptorSet()
                 VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR}
         });
               
-    m_scDesc.write(m_device, ScBindings::eMatrices, m_matrixBW.buffer);
+    // One slice, selected per frame by a dynamic offset.
+    m_scDesc.write(m_device, ScBindings::eMatrices, m_matrixBW.buffer, sizeof(MatrixUniforms));
     m_scDesc.write(m_device, ScBindings::eObjDescs, m_objDescriptionBW.buffer);
     m_scDesc.write(m_device, ScBindings::eTextures, m_objText);    
 
@@ -660,10 +671,17 @@ void VkApp::createScPipeline()
 // Will be included in a descriptor set for use in shaders.
 void VkApp::createMatrixBuffer()
 {
-    m_matrixBW = createBufferWrap(sizeof(MatrixUniforms),
-                               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-                               | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    // One slice per frame in flight, written by the host while the
+    // other frames' slices may still be read by the GPU.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    VkDeviceSize align = properties.limits.minUniformBufferOffsetAlignment;
+    m_matrixSlice = (sizeof(MatrixUniforms) + align - 1) / align * align;
+
+    m_matrixBW = createBufferWrap(m_matrixSlice * m_frames.size(),
+                               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                               | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
     // @@ Destroy with m_matrixBW.destroy(m_device);
 }
@@ -673,17 +691,13 @@ void VkApp::createMatrixBuffer()
 // included in a descriptor set for use in shaders.
 void VkApp::createObjDescriptionBuffer()
 {
-    VkCommandBuffer cmdBuf = createTempCmdBuffer();
-    m_objDescriptionBW  = createStagedBufferWrap(cmdBuf, m_objDesc,
+    m_objDescriptionBW  = createStagedBufferWrap(m_objDesc,
                                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-    submitTempCmdBuffer(cmdBuf);
     // @@ Destroy with m_objDescriptionBW.destroy(m_device);
 }
 
 void VkApp::rasterize()
 {
-    VkDeviceSize offset{0};
-    
     std::array<VkClearValue, 2> clearValues{};
     clearValues[0].color        = {{0,0,0,1}};
     clearValues[1].depthStencil = {1.0f, 0};
@@ -694,14 +708,65 @@ void VkApp::rasterize()
     _i.renderPass      = m_scanlineRenderPass;
     _i.framebuffer     = m_scanlineFramebuffer;
     _i.renderArea      = {{0, 0}, windowSize};
-    vkCmdBeginRenderPass(m_commandBuffer, &_i, VK_SUBPASS_CONTENTS_INLINE);
 
-    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_scanlinePipeline);
-    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            m_scanlinePipelineLayout, 0, 1, &m_scDesc.descSet, 0, nullptr);
+    if (!m_recordPool) {
+        vkCmdBeginRenderPass(m_commandBuffer, &_i, VK_SUBPASS_CONTENTS_INLINE);
+        recordRasterDraws(m_commandBuffer, 0, m_objInst.size());
+        vkCmdEndRenderPass(m_commandBuffer);
+        return; }
+
+    // Each worker records a contiguous range of the instances into its
+    // own secondary command buffer.  The frame's fence has signaled
+    // (prepareFrame), so the frame's pools can be reset.
+    FrameData& frame = m_frames[m_frameIndex];
+    size_t threads = frame.recordCmds.size();
+    size_t perThread = (m_objInst.size() + threads - 1) / threads;
+    ThreadPool::TaskGroup group;
+    for (size_t t = 0;  t < threads;  t++) {
+        m_recordPool->run(group, [this, &frame, t, perThread]() {
+            vkResetCommandPool(m_device, frame.recordPools[t], 0);
+
+            VkCommandBufferInheritanceInfo inheritance{VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+            inheritance.renderPass  = m_scanlineRenderPass;
+            inheritance.subpass     = 0;
+            inheritance.framebuffer = m_scanlineFramebuffer;
+            VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+                | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo = &inheritance;
+
+            VkCommandBuffer cmdBuf = frame.recordCmds[t];
+            vkBeginCommandBuffer(cmdBuf, &beginInfo);
+            size_t first = std::min(m_objInst.size(), t * perThread);
+            size_t last  = std::min(m_objInst.size(), first + perThread);
+            recordRasterDraws(cmdBuf, first, last);
+            vkEndCommandBuffer(cmdBuf); }); }
+    m_recordPool->wait(group);
+
+    vkCmdBeginRenderPass(m_commandBuffer, &_i, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    vkCmdExecuteCommands(m_commandBuffer, frame.recordCmds.size(), frame.recordCmds.data());
+    vkCmdEndRenderPass(m_commandBuffer);
+}
 
-    for(const ObjInst& inst : m_objInst) {
+// Draw m_objInst[first..last) into cmdBuf, inside the scanline render
+// pass.  Binds its own pipeline and descriptors, as a secondary
+// command buffer inherits no state.  Called from worker threads, so it
+// only reads VkApp.
+void VkApp::recordRasterDraws(VkCommandBuffer cmdBuf, size_t first, size_t last)
+{
+    VkDeviceSize offset{0};
+
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, m_scanlinePipeline);
+    uint32_t matrixOffset = m_frameIndex * m_matrixSlice;
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_scanlinePipelineLayout, 0, 1, &m_scDesc.descSet, 1, &matrixOffset);
+
+    for (size_t i = first;  i < last;  i++) {
+        const ObjInst& inst = m_objInst[i];
         auto& object            = m_objData[inst.objIndex];
+        if (m_instanceLods[i] == culledLod)
+            continue;
+        const ObjLod& lod = object.lods[m_instanceLods[i]];  // Chosen by selectInstances
         
         // Information pushed at each draw call
         PushConstantRaster pcRaster{
@@ -711,18 +776,16 @@ void VkApp::rasterize()
             1.0f                 // light intensity;  Should not be hard-coded here!
         };
         
-        pcRaster.objIndex    = inst.objIndex;  // Telling which object is drawn
+        pcRaster.objIndex    = lod.descIndex;  // Telling which object (and level) is drawn
         pcRaster.modelMatrix = inst.transform;
 
-        vkCmdPushConstants(m_commandBuffer, m_scanlinePipelineLayout,
+        vkCmdPushConstants(cmdBuf, m_scanlinePipelineLayout,
                            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
                            sizeof(PushConstantRaster), &pcRaster);
-        vkCmdBindVertexBuffers(m_commandBuffer, 0, 1, &object.vertexBuffer.buffer, &offset);
-        vkCmdBindIndexBuffer(m_commandBuffer, object.indexBuffer.buffer, 0,
-                             VK_INDEX_TYPE_UINT32);
-        vkCmdDrawIndexed(m_commandBuffer, object.nbIndices, 1, 0, 0, 0); }
-    
-    vkCmdEndRenderPass(m_commandBuffer);
+        vkCmdBindVertexBuffers(cmdBuf, 0, 1, &object.vertexBuffer.buffer, &offset);
+        vkCmdBindIndexBuffer(cmdBuf, m_instanceLods[i] == 0 ? object.indexBuffer.buffer
+                             : object.lodIndexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexed(cmdBuf, lod.indexCount, 1, lod.firstIndex, 0, 0); }
 }
 
 
@@ -740,36 +803,11 @@ void VkApp::updateCameraBuffer()
     m_priorViewProj       = hostUBO.viewProj;
     hostUBO.viewInverse = glm::inverse(view);
     hostUBO.projInverse = glm::inverse(proj);
+    m_frameMatrices     = hostUBO;
 
-    // UBO on the device, and what stages access it.
-    VkBuffer deviceUBO      = m_matrixBW.buffer;
-    auto     uboUsageStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
-                            | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
-
-    // Ensure that the modified UBO is not visible to previous frames.
-    VkBufferMemoryBarrier beforeBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    beforeBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    beforeBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    beforeBarrier.buffer        = deviceUBO;
-    beforeBarrier.offset        = 0;
-    beforeBarrier.size          = sizeof(hostUBO);
-    vkCmdPipelineBarrier(m_commandBuffer, uboUsageStages, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0,
-                         nullptr, 1, &beforeBarrier, 0, nullptr);
-
-
-    // Schedule the host-to-device upload. (hostUBO is copied into the cmd
-    // buffer so it is okay to deallocate when the function returns).
-    vkCmdUpdateBuffer(m_commandBuffer, m_matrixBW.buffer, 0, sizeof(MatrixUniforms), &hostUBO);
-
-    // Making sure the updated UBO will be visible.
-    VkBufferMemoryBarrier afterBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    afterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    afterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    afterBarrier.buffer        = deviceUBO;
-    afterBarrier.offset        = 0;
-    afterBarrier.size          = sizeof(hostUBO);
-    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, uboUsageStages,
-                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0,
-                         nullptr, 1, &afterBarrier, 0, nullptr);
+    // Write this frame's slice.  Its previous reader, the frame that
+    // last used this slot, has finished (prepareFrame waited for it),
+    // and host writes before vkQueueSubmit are visible to the GPU.
+    memcpy(static_cast<char*>(m_matrixBW.mapped) + m_frameIndex * m_matrixSlice,
+           &hostUBO, sizeof(MatrixUniforms));
 }
@@ -0,0 +1,114 @@
+
+#include <cstring>
+
+#include "vkapp.h"
+#include "app.h"
+
+// Skinned models: the CPU poses each skeleton (updateSkinning), a
+// compute pass writes the posed vertices into the object's vertex
+// buffer (skin), and its BLAS is refit in-frame (updateSkinnedBlas),
+// all recorded into the frame's command buffer.
+//
+// Refitting keeps the BLAS's topology from its last full build, so
+// its quality drops as the pose moves away from that one.  How far
+// the bones have moved each bone's box since then, relative to the
+// model's size, decides when to rebuild instead.
+
+static_assert(sizeof(SkinVertex) == sizeof(SkinWeights), "skinning.comp reads SkinVertex as SkinWeights");
+
+void VkApp::createSkinning()
+{
+    if (m_skinned.empty())
+        return;
+
+    VkPushConstantRange pc_info = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantSkinning)};
+    VkPipelineLayoutCreateInfo plCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plCreateInfo.pushConstantRangeCount = 1;
+    plCreateInfo.pPushConstantRanges    = &pc_info;
+    vkCreatePipelineLayout(m_device, &plCreateInfo, nullptr, &m_skinningPipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_skinningPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/skinning.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_skinningPipeline);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+
+    // Bone matrices: one host visible slice per frame in flight.
+    for (SkinnedObject& skinned : m_skinned) {
+        VkDeviceSize slice = skinned.skeleton.bones.size() * sizeof(glm::mat4);
+        skinned.boneBuffer = createBufferWrap(slice * m_frames.size(),
+                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                                              | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        NAME(skinned.boneBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "Bone matrices");
+        // The BLAS was built from the unposed vertices.
+        skinned.builtBones.assign(skinned.skeleton.bones.size(), glm::mat4(1.0f)); }
+
+    printf("Skinned objects: %zd\n", m_skinned.size());
+    // To destroy: destroySkinning();
+}
+
+void VkApp::destroySkinning()
+{
+    for (SkinnedObject& skinned : m_skinned) {
+        skinned.restBuffer.destroy(m_device);
+        skinned.skinBuffer.destroy(m_device);
+        if (skinned.boneBuffer.buffer)
+            skinned.boneBuffer.destroy(m_device); }
+    m_skinned.clear();
+    vkDestroyPipelineLayout(m_device, m_skinningPipelineLayout, nullptr);
+    vkDestroyPipeline(m_device, m_skinningPipeline, nullptr);
+}
+
+// Pose every skeleton at the current time, write its matrices into
+// this frame's slice (free, since prepareFrame waited for the slot's
+// fence), and decide between refit and rebuild.
+void VkApp::updateSkinning()
+{
+    double seconds = glfwGetTime();
+    for (SkinnedObject& skinned : m_skinned) {
+        skinned.skeleton.pose(0, seconds, skinned.bones);
+        VkDeviceSize slice = skinned.bones.size() * sizeof(glm::mat4);
+        memcpy((char*)skinned.boneBuffer.mapped + m_frameIndex * slice, skinned.bones.data(), slice);
+
+        if (!useRaytracer)
+            continue;
+        float deformation = skinDeformation(skinned.skeleton, skinned.bones, skinned.builtBones,
+                                            skinned.radius);
+        skinned.rebuild = deformation > m_skinRebuildThreshold || skinned.refits >= m_skinMaxRefits;
+        if (skinned.rebuild) {
+            skinned.builtBones = skinned.bones;
+            skinned.refits = 0; }
+        else
+            skinned.refits++; }
+}
+
+// The "skinning" pass: one dispatch per skinned object.
+void VkApp::skin(VkCommandBuffer cmdBuf)
+{
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, m_skinningPipeline);
+    for (SkinnedObject& skinned : m_skinned) {
+        const ObjData& object = m_objData[skinned.objIndex];
+        PushConstantSkinning pc{};
+        pc.restAddress = getBufferDeviceAddress(m_device, skinned.restBuffer.buffer);
+        pc.skinAddress = getBufferDeviceAddress(m_device, skinned.skinBuffer.buffer);
+        pc.boneAddress = getBufferDeviceAddress(m_device, skinned.boneBuffer.buffer)
+            + m_frameIndex * skinned.bones.size() * sizeof(glm::mat4);
+        pc.outAddress  = m_objDesc[skinned.objIndex].vertexAddress;
+        pc.vertexCount = object.nbVertices;
+        vkCmdPushConstants(cmdBuf, m_skinningPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(PushConstantSkinning), &pc);
+        // Must match skinning.comp's local_size_x.
+        vkCmdDispatch(cmdBuf, (object.nbVertices + 127) / 128, 1, 1); }
+}
+
+// The "blas update" pass: every skinned BLAS in one build command.
+void VkApp::updateSkinnedBlas(VkCommandBuffer cmdBuf)
+{
+    std::vector<bool> rebuild;
+    for (const SkinnedObject& skinned : m_skinned)
+        rebuild.push_back(skinned.rebuild);
+    m_rtBuilder.cmdUpdateBlas(cmdBuf, rebuild);
+}